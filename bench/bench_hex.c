@@ -0,0 +1,201 @@
+/*********************************************************************************************************************
+ * The MIT License (MIT)                                                                                             *
+ * Copyright (c) 2026 rl78flash contributors                                                                         *
+ *                                                                                                                   *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated      *
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation   *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and  *
+ * to permit persons to whom the Software is furnished to do so, subject to the following conditions:                *
+ *                                                                                                                   *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions     *
+ * of the Software.                                                                                                  *
+ *                                                                                                                   *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO  *
+ * THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF         *
+ * CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+ * IN THE SOFTWARE.                                                                                                  *
+ *********************************************************************************************************************/
+
+/* Throughput of hex digit decoding and of S-record parsing, run by "make bench" */
+
+#include "hex.h"
+#include "srec.h"
+#include "serial.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CODE_SIZE   (1024U * 1024U)
+#define RECORD      32U
+#define RUNS        10
+
+/* Plain decoder the kernel is compared with */
+static int hex_decode_plain(const char *in, unsigned char *out, unsigned int count, unsigned int *sum)
+{
+    unsigned int i;
+    for (i = 0; i < count * 2U; ++i)
+    {
+        const char c = in[i];
+        unsigned int nibble;
+        if ('0' <= c && '9' >= c)
+        {
+            nibble = c - '0';
+        }
+        else if ('A' <= c && 'F' >= c)
+        {
+            nibble = c - 'A' + 10;
+        }
+        else if ('a' <= c && 'f' >= c)
+        {
+            nibble = c - 'a' + 10;
+        }
+        else
+        {
+            return -1;
+        }
+        if (i % 2U)
+        {
+            out[i / 2U] |= nibble;
+            *sum += out[i / 2U];
+        }
+        else
+        {
+            out[i / 2U] = nibble << 4;
+        }
+    }
+    return 0;
+}
+
+/* S3 records of RECORD bytes filling the code flash */
+static char *make_srec(size_t *size)
+{
+    const unsigned int count = CODE_SIZE / RECORD;
+    char *text = malloc((size_t)count * (14 + RECORD * 2 + 3) + 16);
+    char *p = text;
+    unsigned int address;
+    if (NULL == text)
+    {
+        return NULL;
+    }
+    for (address = 0; address < CODE_SIZE; address += RECORD)
+    {
+        unsigned int sum = RECORD + 5;
+        unsigned int i;
+        p += sprintf(p, "S3%02X%08X", RECORD + 5, address);
+        for (i = 0; i < 4; ++i)
+        {
+            sum += (address >> (i * 8)) & 0xFF;
+        }
+        for (i = 0; i < RECORD; ++i)
+        {
+            const unsigned int byte = (address + i * 7) & 0xFF;
+            p += sprintf(p, "%02X", byte);
+            sum += byte;
+        }
+        p += sprintf(p, "%02X\n", ~sum & 0xFF);
+    }
+    p += sprintf(p, "S70500000000FA\n");
+    *size = p - text;
+    return text;
+}
+
+static void report(const char *name, serial_time_t best, size_t bytes)
+{
+    printf("%-24s %8.2f ms %8.1f MB/s\n", name, best / 1000.0, bytes / (double)best);
+}
+
+static serial_time_t bench_decode(int (*decode)(const char *, unsigned char *, unsigned int, unsigned int *),
+                                  const char *digits, unsigned int len, unsigned char *out, unsigned int *sum)
+{
+    serial_time_t best = ~0ULL;
+    int run;
+    for (run = 0; run < RUNS; ++run)
+    {
+        const serial_time_t start = serial_time();
+        unsigned int i;
+        *sum = 0;
+        // Record by record, as the parser calls it
+        for (i = 0; i < len; i += RECORD)
+        {
+            if (0 != decode(digits + i * 2U, out + i, RECORD, sum))
+            {
+                return 0;
+            }
+        }
+        const serial_time_t time = serial_time() - start;
+        best = time < best ? time : best;
+    }
+    return best;
+}
+
+int main(void)
+{
+    const log_t log = { 0, NULL, NULL };
+    size_t size;
+    char *text = make_srec(&size);
+    char *digits = malloc(CODE_SIZE * 2U);
+    unsigned char *code = malloc(CODE_SIZE);
+    unsigned char *ref = malloc(CODE_SIZE);
+    unsigned int i;
+    int run;
+    if (NULL == text || NULL == digits || NULL == code || NULL == ref)
+    {
+        fprintf(stderr, "Memory allocation failed\n");
+        return 1;
+    }
+    for (i = 0; i < CODE_SIZE * 2U; ++i)
+    {
+        digits[i] = "0123456789ABCDEFabcdef"[(i * 11U + (i >> 9)) % 22U];
+    }
+
+    unsigned int sum;
+    unsigned int ref_sum;
+    const serial_time_t plain = bench_decode(hex_decode_plain, digits, CODE_SIZE, ref, &ref_sum);
+    const serial_time_t kernel = bench_decode(hex_decode, digits, CODE_SIZE, code, &sum);
+    if (0 == plain || 0 == kernel || ref_sum != sum || 0 != memcmp(ref, code, CODE_SIZE))
+    {
+        fprintf(stderr, "hex_decode() differs from the plain decoder\n");
+        return 1;
+    }
+    report("hex digits, plain", plain, CODE_SIZE * 2U);
+    report("hex digits, hex_decode", kernel, CODE_SIZE * 2U);
+
+    serial_time_t best = ~0ULL;
+    for (run = 0; run < RUNS; ++run)
+    {
+        const serial_time_t start = serial_time();
+        if (SREC_NO_ERROR != srec_parse(&log, text, size, code, CODE_SIZE, NULL, 0))
+        {
+            fprintf(stderr, "srec_parse() failed\n");
+            return 1;
+        }
+        const serial_time_t time = serial_time() - start;
+        best = time < best ? time : best;
+    }
+    report("srec_parse", best, size);
+
+    best = ~0ULL;
+    for (run = 0; run < RUNS; ++run)
+    {
+        image_t img;
+        image_init(&img);
+        const serial_time_t start = serial_time();
+        const int rc = srec_parse_image(&log, text, size, CODE_SIZE, 0, &img);
+        const serial_time_t time = serial_time() - start;
+        image_free(&img);
+        if (SREC_NO_ERROR != rc)
+        {
+            fprintf(stderr, "srec_parse_image() failed\n");
+            return 1;
+        }
+        best = time < best ? time : best;
+    }
+    report("srec_parse_image", best, size);
+
+    free(text);
+    free(digits);
+    free(code);
+    free(ref);
+    return 0;
+}
@@ -0,0 +1,213 @@
+/*********************************************************************************************************************
+ * The MIT License (MIT)                                                                                             *
+ * Copyright (c) 2026 rl78flash contributors                                                                         *
+ *                                                                                                                   *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated      *
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation   *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and  *
+ * to permit persons to whom the Software is furnished to do so, subject to the following conditions:                *
+ *                                                                                                                   *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions     *
+ * of the Software.                                                                                                  *
+ *                                                                                                                   *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO  *
+ * THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF         *
+ * CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+ * IN THE SOFTWARE.                                                                                                  *
+ *********************************************************************************************************************/
+
+#include "baud_cache.h"
+#include "thread.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/stat.h>
+#ifdef WIN32
+#include <io.h>
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+
+#define BAUD_CACHE_DIR      "rl78flash"
+#define BAUD_CACHE_FILE     "baudrate"
+#define BAUD_CACHE_ENTRIES  64
+#define BAUD_CACHE_LINE     512
+
+/* Cache directory: $XDG_CACHE_HOME/rl78flash or $HOME/.cache/rl78flash (%LOCALAPPDATA%\rl78flash on Windows) */
+static int baud_cache_dir(char *path, size_t size)
+{
+    const char *base;
+    int len;
+#ifdef WIN32
+    base = getenv("LOCALAPPDATA");
+    if (NULL == base || '\0' == *base)
+    {
+        return -1;
+    }
+    len = snprintf(path, size, "%s\\" BAUD_CACHE_DIR, base);
+#else
+    base = getenv("XDG_CACHE_HOME");
+    if (NULL != base && '\0' != *base)
+    {
+        len = snprintf(path, size, "%s/" BAUD_CACHE_DIR, base);
+    }
+    else
+    {
+        base = getenv("HOME");
+        if (NULL == base || '\0' == *base)
+        {
+            return -1;
+        }
+        len = snprintf(path, size, "%s/.cache/" BAUD_CACHE_DIR, base);
+    }
+#endif
+    return (0 < len && (size_t)len < size) ? 0 : -1;
+}
+
+static int baud_cache_path(char *path, size_t size)
+{
+    char dir[BAUD_CACHE_LINE];
+    if (0 != baud_cache_dir(dir, sizeof dir))
+    {
+        return -1;
+    }
+    const int len = snprintf(path, size, "%s/" BAUD_CACHE_FILE, dir);
+    return (0 < len && (size_t)len < size) ? 0 : -1;
+}
+
+/* Each line of the cache is "<baudrate> <time stored> <port>", returns the baudrate if the line is of the port */
+static int baud_cache_parse(const char *line, const char *port, long long *stored)
+{
+    char *endp;
+    const int baud = strtol(line, &endp, 10);
+    if (line == endp || ' ' != *endp)
+    {
+        return 0;
+    }
+    line = endp + 1;
+    *stored = strtoll(line, &endp, 10);
+    if (line == endp || ' ' != *endp)
+    {
+        return 0;
+    }
+    ++endp;
+    const size_t len = strcspn(endp, "\r\n");
+    if (strlen(port) != len || 0 != strncmp(endp, port, len))
+    {
+        return 0;
+    }
+    return baud;
+}
+
+int baud_cache_load(const log_t *log, const char *port)
+{
+    char path[BAUD_CACHE_LINE];
+    char line[BAUD_CACHE_LINE];
+    if (0 != baud_cache_path(path, sizeof path))
+    {
+        return 0;
+    }
+    FILE *file = fopen(path, "r");
+    if (NULL == file)
+    {
+        return 0;
+    }
+    int baud = 0;
+    long long stored = 0;
+    while (0 == baud && NULL != fgets(line, sizeof line, file))
+    {
+        baud = baud_cache_parse(line, port, &stored);
+    }
+    fclose(file);
+    if (0 == baud)
+    {
+        return 0;
+    }
+    const long long age = (long long)time(NULL) - stored;
+    // Search starts from the cached rate and only goes down, so the fastest one is probed again now and then
+    if (0 > age || BAUD_CACHE_EXPIRY <= age)
+    {
+        log_printf(log, 2, "Cached baudrate for %s has expired: %ubps\n", port, baud);
+        return 0;
+    }
+    log_printf(log, 2, "Cached baudrate for %s: %ubps\n", port, baud);
+    return baud;
+}
+
+int baud_cache_store(const log_t *log, const char *port, int baud)
+{
+    char dir[BAUD_CACHE_LINE];
+    char path[BAUD_CACHE_LINE];
+    char tmp_path[BAUD_CACHE_LINE + 48];
+    if (0 != baud_cache_dir(dir, sizeof dir)
+        || 0 != baud_cache_path(path, sizeof path))
+    {
+        return -1;
+    }
+#ifndef WIN32
+    // Parent of the directory is usually there already
+    char parent[BAUD_CACHE_LINE];
+    strcpy(parent, dir);
+    char *slash = strrchr(parent, '/');
+    if (NULL != slash && slash != parent)
+    {
+        *slash = '\0';
+        (void)mkdir(parent, 0755);
+    }
+    if (0 != mkdir(dir, 0755) && EEXIST != errno)
+#else
+    if (0 != mkdir(dir) && EEXIST != errno)
+#endif
+    {
+        log_printf(log, 2, "Unable to create %s\n", dir);
+        return -1;
+    }
+    // Targets of a gang and other instances store at the same time, each writes a file of its own
+    snprintf(tmp_path, sizeof tmp_path, "%s.%d.%lu.tmp", path, (int)getpid(), thread_self());
+    FILE *out = fopen(tmp_path, "w");
+    if (NULL == out)
+    {
+        log_printf(log, 2, "Unable to create %s\n", tmp_path);
+        return -1;
+    }
+    fprintf(out, "%d %lld %s\n", baud, (long long)time(NULL), port);
+    // Keep entries of other ports
+    FILE *in = fopen(path, "r");
+    if (NULL != in)
+    {
+        char line[BAUD_CACHE_LINE];
+        unsigned int entries = 1;
+        while (entries < BAUD_CACHE_ENTRIES && NULL != fgets(line, sizeof line, in))
+        {
+            long long stored;
+            if (NULL == strchr(line, '\n') || 0 != baud_cache_parse(line, port, &stored))
+            {
+                continue;
+            }
+            fputs(line, out);
+            ++entries;
+        }
+        fclose(in);
+    }
+    if (0 != fclose(out))
+    {
+        remove(tmp_path);
+        return -1;
+    }
+#ifdef WIN32
+    // rename() does not replace existing files on Windows
+    remove(path);
+#endif
+    if (0 != rename(tmp_path, path))
+    {
+        remove(tmp_path);
+        return -1;
+    }
+    log_printf(log, 2, "Baudrate for %s stored: %ubps\n", port, baud);
+    return 0;
+}
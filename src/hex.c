@@ -0,0 +1,106 @@
+/*********************************************************************************************************************
+ * The MIT License (MIT)                                                                                             *
+ * Copyright (c) 2026 rl78flash contributors                                                                         *
+ *                                                                                                                   *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated      *
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation   *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and  *
+ * to permit persons to whom the Software is furnished to do so, subject to the following conditions:                *
+ *                                                                                                                   *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions     *
+ * of the Software.                                                                                                  *
+ *                                                                                                                   *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO  *
+ * THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF         *
+ * CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+ * IN THE SOFTWARE.                                                                                                  *
+ *********************************************************************************************************************/
+
+#include "hex.h"
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/* Value of a hex digit, -1 for other characters */
+static const signed char hex_table[256] =
+{
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+     0,  1,  2,  3,  4,  5,  6,  7,  8,  9, -1, -1, -1, -1, -1, -1,
+    -1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+};
+
+#if defined(__SSE2__)
+/* Nibbles of 16 hex digits, lanes with invalid characters are flagged in *valid */
+static __m128i hex_nibbles(__m128i c, __m128i *valid)
+{
+    // Letters of both cases are folded to lower case, digits have the bit set already
+    const __m128i lc = _mm_or_si128(c, _mm_set1_epi8(0x20));
+    const __m128i is_digit = _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('0' - 1)),
+                                           _mm_cmplt_epi8(c, _mm_set1_epi8('9' + 1)));
+    const __m128i is_alpha = _mm_and_si128(_mm_cmpgt_epi8(lc, _mm_set1_epi8('a' - 1)),
+                                           _mm_cmplt_epi8(lc, _mm_set1_epi8('f' + 1)));
+    *valid = _mm_and_si128(*valid, _mm_or_si128(is_digit, is_alpha));
+    const __m128i digit = _mm_and_si128(is_digit, _mm_sub_epi8(c, _mm_set1_epi8('0')));
+    const __m128i alpha = _mm_and_si128(is_alpha, _mm_sub_epi8(lc, _mm_set1_epi8('a' - 10)));
+    return _mm_or_si128(digit, alpha);
+}
+
+/* Join pairs of nibbles, the first one is the high nibble, into 16-bit lanes */
+static __m128i hex_pairs(__m128i nibbles)
+{
+    const __m128i high = _mm_slli_epi16(_mm_and_si128(nibbles, _mm_set1_epi16(0x00FF)), 4);
+    const __m128i low = _mm_srli_epi16(nibbles, 8);
+    return _mm_or_si128(high, low);
+}
+#endif
+
+int hex_decode(const char *in, unsigned char *out, unsigned int count, unsigned int *sum)
+{
+    const unsigned char *p = (const unsigned char*)in;
+    unsigned int total = 0;
+#if defined(__SSE2__)
+    // 32 digits give 16 bytes per step
+    __m128i valid = _mm_set1_epi8(-1);
+    __m128i sums = _mm_setzero_si128();
+    for (; 16 <= count; count -= 16, p += 32, out += 16)
+    {
+        const __m128i first = hex_pairs(hex_nibbles(_mm_loadu_si128((const __m128i*)p), &valid));
+        const __m128i second = hex_pairs(hex_nibbles(_mm_loadu_si128((const __m128i*)(p + 16)), &valid));
+        const __m128i bytes = _mm_packus_epi16(first, second);
+        _mm_storeu_si128((__m128i*)out, bytes);
+        sums = _mm_add_epi64(sums, _mm_sad_epu8(bytes, _mm_setzero_si128()));
+    }
+    if (0xFFFF != _mm_movemask_epi8(valid))
+    {
+        return -1;
+    }
+    total = _mm_cvtsi128_si32(sums) + _mm_cvtsi128_si32(_mm_unpackhi_epi64(sums, sums));
+#endif
+    for (; count; --count, p += 2)
+    {
+        const int high = hex_table[p[0]];
+        const int low = hex_table[p[1]];
+        if (0 > (high | low))
+        {
+            return -1;
+        }
+        *out = (high << 4) | low;
+        total += *out++;
+    }
+    *sum += total;
+    return 0;
+}
@@ -0,0 +1,1063 @@
+/*********************************************************************************************************************
+ * The MIT License (MIT)                                                                                             *
+ * Copyright (c) 2026 rl78flash contributors                                                                         *
+ *                                                                                                                   *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated      *
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation   *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and  *
+ * to permit persons to whom the Software is furnished to do so, subject to the following conditions:                *
+ *                                                                                                                   *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions     *
+ * of the Software.                                                                                                  *
+ *                                                                                                                   *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO  *
+ * THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF         *
+ * CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+ * IN THE SOFTWARE.                                                                                                  *
+ *********************************************************************************************************************/
+
+#include "image.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define ALIGN_DOWN(x)   ((x) & ~(IMAGE_SEGMENT_ALIGN - 1U))
+#define ALIGN_UP(x)     ALIGN_DOWN((x) + IMAGE_SEGMENT_ALIGN - 1U)
+
+void image_init(image_t *img)
+{
+    memset(img, 0, sizeof *img);
+    img->sorted = 1;
+}
+
+int image_reserve(image_t *img, unsigned int address, unsigned int size)
+{
+    if (!size)
+    {
+        return 0;
+    }
+    const unsigned int start = ALIGN_DOWN(address);
+    const unsigned int end = ALIGN_UP(address + size);
+    if (img->count)
+    {
+        // Files are mostly in address order, runs of records grow the last range
+        image_segment_t *last = &img->segment[img->count - 1];
+        if (start >= last->address && start <= last->address + last->size)
+        {
+            if (end > last->address + last->size)
+            {
+                last->size = end - last->address;
+            }
+            return 0;
+        }
+        if (start < last->address)
+        {
+            img->sorted = 0;
+        }
+    }
+    if (img->count == img->capacity)
+    {
+        const unsigned int capacity = img->capacity ? img->capacity * 2U : 16U;
+        image_segment_t *segment = realloc(img->segment, capacity * sizeof *segment);
+        if (NULL == segment)
+        {
+            return -1;
+        }
+        img->segment = segment;
+        img->capacity = capacity;
+    }
+    image_segment_t *seg = &img->segment[img->count++];
+    seg->address = start;
+    seg->size = end - start;
+    seg->data = NULL;
+    return 0;
+}
+
+static int segment_compare(const void *a, const void *b)
+{
+    const image_segment_t *sa = (const image_segment_t*)a;
+    const image_segment_t *sb = (const image_segment_t*)b;
+    return sa->address < sb->address ? -1 : (sa->address > sb->address);
+}
+
+int image_alloc(image_t *img)
+{
+    unsigned int i;
+    unsigned int n = 0;
+    if (!img->sorted)
+    {
+        qsort(img->segment, img->count, sizeof *img->segment, segment_compare);
+        img->sorted = 1;
+    }
+    // Merge overlapping and adjacent ranges
+    for (i = 0; i < img->count; ++i)
+    {
+        const image_segment_t *seg = &img->segment[i];
+        if (n && seg->address <= img->segment[n - 1].address + img->segment[n - 1].size)
+        {
+            image_segment_t *last = &img->segment[n - 1];
+            if (seg->address + seg->size > last->address + last->size)
+            {
+                last->size = seg->address + seg->size - last->address;
+            }
+            continue;
+        }
+        img->segment[n++] = *seg;
+    }
+    img->count = n;
+    for (i = 0; i < img->count; ++i)
+    {
+        image_segment_t *seg = &img->segment[i];
+        seg->data = malloc(seg->size);
+        if (NULL == seg->data)
+        {
+            return -1;
+        }
+        memset(seg->data, 0xFF, seg->size);
+    }
+    return 0;
+}
+
+/* Segment with the address, or the first one after it */
+static unsigned int image_find(const image_t *img, unsigned int address)
+{
+    unsigned int lo = 0;
+    unsigned int hi = img->count;
+    while (lo < hi)
+    {
+        const unsigned int mid = (lo + hi) / 2;
+        if (img->segment[mid].address + img->segment[mid].size <= address)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+unsigned char *image_ptr(const image_t *img, unsigned int address, unsigned int size)
+{
+    const unsigned int i = image_find(img, address);
+    if (i == img->count)
+    {
+        return NULL;
+    }
+    const image_segment_t *seg = &img->segment[i];
+    if (address < seg->address || address + size > seg->address + seg->size || NULL == seg->data)
+    {
+        return NULL;
+    }
+    return seg->data + (address - seg->address);
+}
+
+static int all_ff(const unsigned char *mem, unsigned int size)
+{
+    for (; size; --size)
+    {
+        if (0xFF != *mem++)
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int image_written(image_t *img, unsigned int address, unsigned int size)
+{
+    if (!size)
+    {
+        return 0;
+    }
+    if (img->nwritten)
+    {
+        // Records in address order extend the last range
+        image_range_t *last = &img->written[img->nwritten - 1];
+        if (address >= last->address && address <= last->address + last->size)
+        {
+            if (address + size > last->address + last->size)
+            {
+                last->size = address + size - last->address;
+            }
+            return 0;
+        }
+    }
+    if (img->nwritten == img->written_capacity)
+    {
+        const unsigned int capacity = img->written_capacity ? img->written_capacity * 2U : 16U;
+        image_range_t *written = realloc(img->written, capacity * sizeof *written);
+        if (NULL == written)
+        {
+            return -1;
+        }
+        img->written = written;
+        img->written_capacity = capacity;
+    }
+    image_range_t *range = &img->written[img->nwritten++];
+    range->address = address;
+    range->size = size;
+    return 0;
+}
+
+static int range_compare(const void *a, const void *b)
+{
+    const image_range_t *ra = (const image_range_t*)a;
+    const image_range_t *rb = (const image_range_t*)b;
+    return ra->address < rb->address ? -1 : (ra->address > rb->address);
+}
+
+/* Sort written ranges, merge overlapping and adjacent ones */
+static void image_merge_written(image_t *img)
+{
+    unsigned int i;
+    unsigned int n = 0;
+    if (!img->nwritten)
+    {
+        return;
+    }
+    qsort(img->written, img->nwritten, sizeof *img->written, range_compare);
+    for (i = 0; i < img->nwritten; ++i)
+    {
+        const image_range_t *r = &img->written[i];
+        if (n && r->address <= img->written[n - 1].address + img->written[n - 1].size)
+        {
+            image_range_t *last = &img->written[n - 1];
+            if (r->address + r->size > last->address + last->size)
+            {
+                last->size = r->address + r->size - last->address;
+            }
+            continue;
+        }
+        img->written[n++] = *r;
+    }
+    img->nwritten = n;
+}
+
+int image_seal(image_t *img)
+{
+    image_merge_written(img);
+    free(img->bitmap);
+    img->bitmap = NULL;
+    img->end = img->count ? img->segment[img->count - 1].address + img->segment[img->count - 1].size : 0;
+    img->bitmap = calloc(img->end / IMAGE_BLOCK_SIZE / 8U + 1U, 1);
+    if (NULL == img->bitmap)
+    {
+        return -1;
+    }
+    unsigned int i;
+    for (i = 0; i < img->count; ++i)
+    {
+        const image_segment_t *seg = &img->segment[i];
+        unsigned int offset;
+        for (offset = 0; offset < seg->size; offset += IMAGE_BLOCK_SIZE)
+        {
+            if (!all_ff(seg->data + offset, IMAGE_BLOCK_SIZE))
+            {
+                const unsigned int block = (seg->address + offset) / IMAGE_BLOCK_SIZE;
+                img->bitmap[block / 8U] |= 1U << (block % 8U);
+            }
+        }
+    }
+    return 0;
+}
+
+/* Patched pieces of an overlay with its own bitmap and sums */
+struct image_overlay
+{
+    image_t pieces;
+    unsigned char *bitmap;
+    unsigned char *sums;
+};
+
+void image_free(image_t *img)
+{
+    unsigned int i;
+    if (!img->external)
+    {
+        for (i = 0; i < img->count; ++i)
+        {
+            free(img->segment[i].data);
+        }
+        free(img->bitmap);
+    }
+    if (NULL != img->overlay)
+    {
+        image_free(&img->overlay->pieces);
+        free(img->overlay->bitmap);
+        free(img->overlay->sums);
+        free(img->overlay);
+    }
+    free(img->segment);
+    free(img->written);
+    image_init(img);
+}
+
+unsigned int image_next_used(const image_t *img, unsigned int address)
+{
+    unsigned int block = address / IMAGE_BLOCK_SIZE;
+    const unsigned int nblocks = img->end / IMAGE_BLOCK_SIZE;
+    while (block < nblocks)
+    {
+        const unsigned char bits = img->bitmap[block / 8U] >> (block % 8U);
+        if (!bits)
+        {
+            // Nothing up to the end of the byte
+            block = (block / 8U + 1U) * 8U;
+            continue;
+        }
+        if (bits & 1U)
+        {
+            return block * IMAGE_BLOCK_SIZE;
+        }
+        ++block;
+    }
+    return img->end;
+}
+
+int image_used(const image_t *img, unsigned int address, unsigned int size)
+{
+    if (!size)
+    {
+        return 0;
+    }
+    const unsigned int next = image_next_used(img, address);
+    return next < img->end && next < address + size;
+}
+
+const unsigned char *image_data(const image_t *img, unsigned int address, unsigned int size, unsigned char *buf)
+{
+    const unsigned char *p = image_ptr(img, address, size);
+    if (NULL != p || NULL == buf)
+    {
+        return p;
+    }
+    memset(buf, 0xFF, size);
+    unsigned int i;
+    for (i = image_find(img, address); i < img->count && img->segment[i].address < address + size; ++i)
+    {
+        const image_segment_t *seg = &img->segment[i];
+        const unsigned int start = seg->address > address ? seg->address : address;
+        const unsigned int end = seg->address + seg->size < address + size ? seg->address + seg->size : address + size;
+        memcpy(buf + (start - address), seg->data + (start - seg->address), end - start);
+    }
+    return buf;
+}
+
+unsigned int image_payload(const image_t *img)
+{
+    unsigned int size = 0;
+    unsigned int i;
+    for (i = 0; i < img->count; ++i)
+    {
+        size += img->segment[i].size;
+    }
+    return size;
+}
+
+int image_sum(const image_t *img, unsigned int address, unsigned int size, unsigned int *sum)
+{
+    if (NULL == img->sums || address % IMAGE_BLOCK_SIZE || size % IMAGE_BLOCK_SIZE)
+    {
+        return -1;
+    }
+    unsigned int total = 0;
+    unsigned int block;
+    for (block = address / IMAGE_BLOCK_SIZE; block < (address + size) / IMAGE_BLOCK_SIZE; ++block)
+    {
+        if (block < img->end / IMAGE_BLOCK_SIZE)
+        {
+            total += img->sums[block * 2U] | (img->sums[block * 2U + 1U] << 8);
+        }
+        else
+        {
+            total += 0xFFU * IMAGE_BLOCK_SIZE;
+        }
+    }
+    *sum = total & 0x0000FFFFU;
+    return 0;
+}
+
+/* Ranges an image writes: the recorded ones, or runs of blocks with data */
+static int image_ranges(const image_t *img, image_range_t **ranges, unsigned int *count)
+{
+    *ranges = NULL;
+    *count = 0;
+    if (img->nwritten)
+    {
+        *ranges = malloc(img->nwritten * sizeof **ranges);
+        if (NULL == *ranges)
+        {
+            return -1;
+        }
+        memcpy(*ranges, img->written, img->nwritten * sizeof **ranges);
+        *count = img->nwritten;
+        return 0;
+    }
+    image_t runs;
+    image_init(&runs);
+    unsigned int address = image_next_used(img, 0);
+    while (address < img->end)
+    {
+        if (0 != image_written(&runs, address, IMAGE_BLOCK_SIZE))
+        {
+            image_free(&runs);
+            return -1;
+        }
+        address = image_next_used(img, address + IMAGE_BLOCK_SIZE);
+    }
+    *ranges = runs.written;
+    *count = runs.nwritten;
+    return 0;
+}
+
+/* Compare a range of two images, the first differing address is described by conflict */
+static int compare_range(const image_t *a, const image_t *b, unsigned int address, unsigned int size,
+                         image_conflict_t *conflict)
+{
+    unsigned char buf_a[IMAGE_BLOCK_SIZE];
+    unsigned char buf_b[IMAGE_BLOCK_SIZE];
+    while (size)
+    {
+        const unsigned int len = size < IMAGE_BLOCK_SIZE ? size : IMAGE_BLOCK_SIZE;
+        const unsigned char *pa = image_data(a, address, len, buf_a);
+        const unsigned char *pb = image_data(b, address, len, buf_b);
+        unsigned int i;
+        for (i = 0; i < len; ++i)
+        {
+            if (pa[i] != pb[i])
+            {
+                conflict->address = address + i;
+                conflict->first_value = pa[i];
+                conflict->second_value = pb[i];
+                return IMAGE_MERGE_CONFLICT;
+            }
+        }
+        address += len;
+        size -= len;
+    }
+    return 0;
+}
+
+/* Copy a range of src to dst, moved by offset */
+static void copy_range(image_t *dst, const image_t *src, unsigned int address, unsigned int size, int offset)
+{
+    unsigned char *to = image_ptr(dst, address + offset, size);
+    const unsigned char *from = image_data(src, address, size, to);
+    if (from != to)
+    {
+        memcpy(to, from, size);
+    }
+}
+
+int image_merge(image_t *img, const image_t *const *src, unsigned int count, image_conflict_t *conflict)
+{
+    image_range_t **ranges = calloc(count ? count : 1, sizeof *ranges);
+    unsigned int *nranges = calloc(count ? count : 1, sizeof *nranges);
+    unsigned int i;
+    unsigned int j;
+    unsigned int k;
+    int rc = (NULL == ranges || NULL == nranges) ? -1 : 0;
+    for (i = 0; i < count && 0 == rc; ++i)
+    {
+        rc = image_ranges(src[i], &ranges[i], &nranges[i]);
+        for (k = 0; k < nranges[i] && 0 == rc; ++k)
+        {
+            rc = image_reserve(img, ranges[i][k].address, ranges[i][k].size);
+            if (0 == rc)
+            {
+                rc = image_written(img, ranges[i][k].address, ranges[i][k].size);
+            }
+        }
+    }
+    if (0 == rc)
+    {
+        rc = image_alloc(img);
+    }
+    // Every range written by two images has to hold the same data in both
+    for (i = 1; i < count && 0 == rc; ++i)
+    {
+        for (j = 0; j < i && 0 == rc; ++j)
+        {
+            unsigned int a = 0;
+            unsigned int b = 0;
+            while (a < nranges[j] && b < nranges[i] && 0 == rc)
+            {
+                const image_range_t *ra = &ranges[j][a];
+                const image_range_t *rb = &ranges[i][b];
+                const unsigned int start = ra->address > rb->address ? ra->address : rb->address;
+                const unsigned int end_a = ra->address + ra->size;
+                const unsigned int end_b = rb->address + rb->size;
+                const unsigned int end = end_a < end_b ? end_a : end_b;
+                if (start < end)
+                {
+                    rc = compare_range(src[j], src[i], start, end - start, conflict);
+                    if (IMAGE_MERGE_CONFLICT == rc)
+                    {
+                        conflict->first = j;
+                        conflict->second = i;
+                    }
+                }
+                if (end_a <= end_b)
+                {
+                    ++a;
+                }
+                else
+                {
+                    ++b;
+                }
+            }
+        }
+    }
+    for (i = 0; i < count && 0 == rc; ++i)
+    {
+        for (k = 0; k < nranges[i]; ++k)
+        {
+            copy_range(img, src[i], ranges[i][k].address, ranges[i][k].size, 0);
+        }
+    }
+    if (0 == rc)
+    {
+        rc = image_seal(img);
+    }
+    if (0 != rc)
+    {
+        image_free(img);
+    }
+    for (i = 0; i < count && NULL != ranges; ++i)
+    {
+        free(ranges[i]);
+    }
+    free(ranges);
+    free(nranges);
+    return rc;
+}
+
+int image_move(image_t *img, const image_t *src, int offset)
+{
+    image_range_t *ranges;
+    unsigned int count;
+    unsigned int i;
+    int rc = image_ranges(src, &ranges, &count);
+    for (i = 0; i < count && 0 == rc; ++i)
+    {
+        const long long address = (long long)ranges[i].address + offset;
+        if (0 > address || IMAGE_STREAM_SIZE < address + ranges[i].size)
+        {
+            rc = -1;
+            break;
+        }
+        rc = image_reserve(img, (unsigned int)address, ranges[i].size);
+        if (0 == rc)
+        {
+            rc = image_written(img, (unsigned int)address, ranges[i].size);
+        }
+    }
+    if (0 == rc)
+    {
+        rc = image_alloc(img);
+    }
+    for (i = 0; i < count && 0 == rc; ++i)
+    {
+        copy_range(img, src, ranges[i].address, ranges[i].size, offset);
+    }
+    if (0 == rc)
+    {
+        rc = image_seal(img);
+    }
+    if (0 != rc)
+    {
+        image_free(img);
+    }
+    free(ranges);
+    return rc;
+}
+
+static int overlay_add(image_t *img, unsigned int address, unsigned int size, unsigned char *data)
+{
+    if (!size)
+    {
+        return 0;
+    }
+    if (img->count == img->capacity)
+    {
+        const unsigned int capacity = img->capacity ? img->capacity * 2U : 16U;
+        image_segment_t *segment = realloc(img->segment, capacity * sizeof *segment);
+        if (NULL == segment)
+        {
+            return -1;
+        }
+        img->segment = segment;
+        img->capacity = capacity;
+    }
+    image_segment_t *seg = &img->segment[img->count++];
+    seg->address = address;
+    seg->size = size;
+    seg->data = data;
+    return 0;
+}
+
+/* Recompute the bit and the sum of every block of the patched pieces */
+static void overlay_blocks(image_t *img, const image_t *pieces, unsigned char *sums)
+{
+    unsigned int i;
+    for (i = 0; i < pieces->count; ++i)
+    {
+        const image_segment_t *seg = &pieces->segment[i];
+        unsigned int offset;
+        for (offset = 0; offset < seg->size; offset += IMAGE_BLOCK_SIZE)
+        {
+            const unsigned int block = (seg->address + offset) / IMAGE_BLOCK_SIZE;
+            if (all_ff(seg->data + offset, IMAGE_BLOCK_SIZE))
+            {
+                img->bitmap[block / 8U] &= ~(1U << (block % 8U));
+            }
+            else
+            {
+                img->bitmap[block / 8U] |= 1U << (block % 8U);
+            }
+            if (NULL != sums)
+            {
+                unsigned int sum = 0;
+                unsigned int j;
+                for (j = 0; j < IMAGE_BLOCK_SIZE; ++j)
+                {
+                    sum += seg->data[offset + j];
+                }
+                sums[block * 2U] = sum & 0xFF;
+                sums[block * 2U + 1U] = (sum >> 8) & 0xFF;
+            }
+        }
+    }
+}
+
+int image_overlay(image_t *img, const image_t *base, const image_patch_t *patch, unsigned int count)
+{
+    image_init(img);
+    img->external = 1;
+    struct image_overlay *ov = calloc(1, sizeof *ov);
+    if (NULL == ov)
+    {
+        return -1;
+    }
+    img->overlay = ov;
+    // Pieces are made the same way as segments of a file, the patches are their records
+    image_init(&ov->pieces);
+    unsigned int i;
+    int rc = 0;
+    for (i = 0; i < count && 0 == rc; ++i)
+    {
+        rc = image_reserve(&ov->pieces, patch[i].address, patch[i].size);
+    }
+    if (0 == rc)
+    {
+        rc = image_alloc(&ov->pieces);
+    }
+    for (i = 0; i < ov->pieces.count && 0 == rc; ++i)
+    {
+        image_segment_t *piece = &ov->pieces.segment[i];
+        const unsigned char *p = image_data(base, piece->address, piece->size, piece->data);
+        if (p != piece->data)
+        {
+            memcpy(piece->data, p, piece->size);
+        }
+    }
+    for (i = 0; i < count && 0 == rc; ++i)
+    {
+        memcpy(image_ptr(&ov->pieces, patch[i].address, patch[i].size), patch[i].data, patch[i].size);
+    }
+    // Segments of base around the pieces point into base
+    for (i = 0; i < base->count && 0 == rc; ++i)
+    {
+        const image_segment_t *seg = &base->segment[i];
+        unsigned int address = seg->address;
+        const unsigned int end = seg->address + seg->size;
+        unsigned int j;
+        for (j = image_find(&ov->pieces, address); j < ov->pieces.count && 0 == rc; ++j)
+        {
+            const image_segment_t *piece = &ov->pieces.segment[j];
+            if (piece->address >= end)
+            {
+                break;
+            }
+            if (piece->address > address)
+            {
+                rc = overlay_add(img, address, piece->address - address, seg->data + (address - seg->address));
+            }
+            address = piece->address + piece->size;
+        }
+        if (0 == rc && address < end)
+        {
+            rc = overlay_add(img, address, end - address, seg->data + (address - seg->address));
+        }
+    }
+    for (i = 0; i < ov->pieces.count && 0 == rc; ++i)
+    {
+        rc = overlay_add(img, ov->pieces.segment[i].address, ov->pieces.segment[i].size, ov->pieces.segment[i].data);
+    }
+    if (0 != rc)
+    {
+        image_free(img);
+        return -1;
+    }
+    qsort(img->segment, img->count, sizeof *img->segment, segment_compare);
+    img->end = img->count ? img->segment[img->count - 1].address + img->segment[img->count - 1].size : 0;
+    const unsigned int nblocks = img->end / IMAGE_BLOCK_SIZE;
+    const unsigned int base_blocks = base->end / IMAGE_BLOCK_SIZE;
+    ov->bitmap = calloc(nblocks / 8U + 1U, 1);
+    if (NULL != base->sums)
+    {
+        ov->sums = malloc(nblocks * 2U + 1U);
+    }
+    if (NULL == ov->bitmap || (NULL != base->sums && NULL == ov->sums))
+    {
+        image_free(img);
+        return -1;
+    }
+    if (NULL != base->bitmap)
+    {
+        memcpy(ov->bitmap, base->bitmap, base_blocks / 8U + 1U);
+    }
+    if (NULL != ov->sums)
+    {
+        memcpy(ov->sums, base->sums, base_blocks * 2U);
+        for (i = base_blocks; i < nblocks; ++i)
+        {
+            ov->sums[i * 2U] = (0xFFU * IMAGE_BLOCK_SIZE) & 0xFF;
+            ov->sums[i * 2U + 1U] = ((0xFFU * IMAGE_BLOCK_SIZE) >> 8) & 0xFF;
+        }
+    }
+    img->bitmap = ov->bitmap;
+    overlay_blocks(img, &ov->pieces, ov->sums);
+    img->sums = ov->sums;
+    return 0;
+}
+
+void image_stream_init(image_stream_t *st)
+{
+    memset(st, 0, sizeof *st);
+    mutex_init(&st->lock);
+    cond_init(&st->changed);
+    image_init(&st->image);
+}
+
+void image_stream_destroy(image_stream_t *st)
+{
+    unsigned int i;
+    for (i = 0; i < IMAGE_STREAM_CHUNKS; ++i)
+    {
+        free(st->chunk[i]);
+    }
+    image_free(&st->image);
+    cond_destroy(&st->changed);
+    mutex_destroy(&st->lock);
+}
+
+/* Called with the lock held */
+static void stream_set_final(image_stream_t *st, unsigned int block)
+{
+    if (!st->final[block])
+    {
+        st->final[block] = 1;
+        cond_broadcast(&st->changed);
+    }
+}
+
+/* Called with the lock held */
+static int stream_allowed(const image_stream_t *st, unsigned int address, unsigned int size)
+{
+    unsigned int i;
+    if (!st->limited)
+    {
+        return 1;
+    }
+    for (i = 0; i < st->nranges; ++i)
+    {
+        if (st->range[i][0] <= address && st->range[i][1] >= address + size)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int image_stream_limit(image_stream_t *st, const unsigned int range[][2], unsigned int count)
+{
+    unsigned int i;
+    int rc = 0;
+    if (IMAGE_STREAM_RANGES < count)
+    {
+        return -1;
+    }
+    mutex_lock(&st->lock);
+    for (i = 0; i < count; ++i)
+    {
+        st->range[i][0] = range[i][0];
+        st->range[i][1] = range[i][1];
+    }
+    st->nranges = count;
+    st->limited = 1;
+    // Blocks are either inside or outside of the ranges
+    for (i = 0; i < IMAGE_STREAM_BLOCKS && 0 == rc; ++i)
+    {
+        if (st->coverage[i] && !stream_allowed(st, i * IMAGE_BLOCK_SIZE, IMAGE_BLOCK_SIZE))
+        {
+            rc = -1;
+        }
+    }
+    mutex_unlock(&st->lock);
+    return rc;
+}
+
+int image_stream_write(image_stream_t *st, unsigned int address, const unsigned char *data, unsigned int size)
+{
+    if (IMAGE_STREAM_SIZE < address || IMAGE_STREAM_SIZE - address < size)
+    {
+        return IMAGE_STREAM_RANGE_ERROR;
+    }
+    // Ranges are set by the reader once the device is known
+    mutex_lock(&st->lock);
+    const int allowed = stream_allowed(st, address, size);
+    mutex_unlock(&st->lock);
+    if (!allowed)
+    {
+        return IMAGE_STREAM_RANGE_ERROR;
+    }
+    if (address < st->watermark && !st->unordered)
+    {
+        // Blocks below the watermark were published too early, they wait for
+        // all their bytes or the end of the file from now on
+        unsigned int i;
+        mutex_lock(&st->lock);
+        for (i = 0; i < st->published; ++i)
+        {
+            if (IMAGE_BLOCK_SIZE > st->coverage[i])
+            {
+                st->final[i] = 0;
+            }
+        }
+        mutex_unlock(&st->lock);
+        st->unordered = 1;
+    }
+    else if (!st->unordered)
+    {
+        // Records in address order so far, nothing will be written below this one
+        st->watermark = address;
+        const unsigned int below = address / IMAGE_BLOCK_SIZE;
+        if (below > st->published)
+        {
+            mutex_lock(&st->lock);
+            for (; st->published < below; ++st->published)
+            {
+                stream_set_final(st, st->published);
+            }
+            mutex_unlock(&st->lock);
+        }
+    }
+    while (size)
+    {
+        const unsigned int block = address / IMAGE_BLOCK_SIZE;
+        const unsigned int offset = address % IMAGE_BLOCK_SIZE;
+        const unsigned int len = (IMAGE_BLOCK_SIZE - offset < size) ? IMAGE_BLOCK_SIZE - offset : size;
+        unsigned char **chunk = &st->chunk[address / IMAGE_SEGMENT_ALIGN];
+        // Blocks the reader may look at are only touched under the lock
+        const int locked = st->final[block] || NULL == *chunk;
+        if (locked)
+        {
+            mutex_lock(&st->lock);
+        }
+        if (NULL == *chunk)
+        {
+            unsigned char *p = malloc(IMAGE_SEGMENT_ALIGN);
+            if (NULL == p)
+            {
+                mutex_unlock(&st->lock);
+                return IMAGE_STREAM_ALLOC_ERROR;
+            }
+            memset(p, 0xFF, IMAGE_SEGMENT_ALIGN);
+            *chunk = p;
+        }
+        memcpy(*chunk + address % IMAGE_SEGMENT_ALIGN, data, len);
+        st->dirty[block] = 1;
+        st->coverage[block] += len;
+        if (IMAGE_BLOCK_SIZE <= st->coverage[block] && !st->final[block])
+        {
+            if (!locked)
+            {
+                mutex_lock(&st->lock);
+            }
+            stream_set_final(st, block);
+            if (!locked)
+            {
+                mutex_unlock(&st->lock);
+            }
+        }
+        else if (st->final[block])
+        {
+            // Taken already, the reader has to take it again
+            cond_broadcast(&st->changed);
+        }
+        if (locked)
+        {
+            mutex_unlock(&st->lock);
+        }
+        address += len;
+        data += len;
+        size -= len;
+    }
+    return 0;
+}
+
+int image_stream_finish(image_stream_t *st, int result)
+{
+    unsigned int i;
+    mutex_lock(&st->lock);
+    for (i = 0; i < IMAGE_STREAM_BLOCKS; ++i)
+    {
+        st->final[i] = 1;
+    }
+    st->done = 1;
+    st->result = result;
+    cond_broadcast(&st->changed);
+    mutex_unlock(&st->lock);
+
+    // Chunks do not change any more, the reader only copies them
+    for (i = 0; i < IMAGE_STREAM_CHUNKS && 0 == result; ++i)
+    {
+        if (NULL != st->chunk[i] && 0 != image_reserve(&st->image, i * IMAGE_SEGMENT_ALIGN, IMAGE_SEGMENT_ALIGN))
+        {
+            result = -1;
+        }
+    }
+    if (0 == result && 0 != image_alloc(&st->image))
+    {
+        result = -1;
+    }
+    for (i = 0; i < IMAGE_STREAM_CHUNKS && 0 == result; ++i)
+    {
+        if (NULL != st->chunk[i])
+        {
+            memcpy(image_ptr(&st->image, i * IMAGE_SEGMENT_ALIGN, IMAGE_SEGMENT_ALIGN), st->chunk[i], IMAGE_SEGMENT_ALIGN);
+        }
+    }
+    if (0 == result && 0 != image_seal(&st->image))
+    {
+        result = -1;
+    }
+    mutex_lock(&st->lock);
+    st->result = result;
+    st->complete = 1;
+    cond_broadcast(&st->changed);
+    mutex_unlock(&st->lock);
+    return result;
+}
+
+/* Called with the lock held */
+static int stream_ready(const image_stream_t *st, unsigned int address, unsigned int blksz)
+{
+    const unsigned int first = address / IMAGE_BLOCK_SIZE;
+    const unsigned int last = (address + blksz) / IMAGE_BLOCK_SIZE;
+    unsigned int dirty = 0;
+    unsigned int i;
+    for (i = first; i < last; ++i)
+    {
+        if (!st->final[i])
+        {
+            return 0;
+        }
+        dirty |= st->dirty[i];
+    }
+    return dirty;
+}
+
+/* Copy a block and mark it taken, called with the lock held. Returns 0 if it has no data. */
+static int stream_copy(image_stream_t *st, unsigned int address, unsigned int blksz, unsigned char *buf)
+{
+    unsigned int offset;
+    for (offset = 0; offset < blksz; offset += IMAGE_BLOCK_SIZE)
+    {
+        const unsigned int a = address + offset;
+        const unsigned char *chunk = st->chunk[a / IMAGE_SEGMENT_ALIGN];
+        if (NULL != chunk)
+        {
+            memcpy(buf + offset, chunk + a % IMAGE_SEGMENT_ALIGN, IMAGE_BLOCK_SIZE);
+        }
+        else
+        {
+            memset(buf + offset, 0xFF, IMAGE_BLOCK_SIZE);
+        }
+        st->dirty[a / IMAGE_BLOCK_SIZE] = 0;
+    }
+    return !all_ff(buf, blksz);
+}
+
+int image_stream_take(image_stream_t *st, unsigned int start, unsigned int end, unsigned int blksz,
+                      unsigned int max_count, unsigned int *address, unsigned int *count, unsigned char *buf)
+{
+    int rc = 1;
+    end = (IMAGE_STREAM_SIZE < end) ? IMAGE_STREAM_SIZE : end;
+    mutex_lock(&st->lock);
+    for (;;)
+    {
+        if (st->done && 0 != st->result)
+        {
+            rc = -1;
+            break;
+        }
+        unsigned int a;
+        *count = 0;
+        for (a = start; a + blksz <= end; a += blksz)
+        {
+            if (!stream_ready(st, a, blksz))
+            {
+                if (*count)
+                {
+                    break;
+                }
+                continue;
+            }
+            if (!stream_copy(st, a, blksz, buf + *count * blksz))
+            {
+                // Only 0xFF, there is nothing to write
+                if (*count)
+                {
+                    break;
+                }
+                continue;
+            }
+            if (!*count)
+            {
+                *address = a;
+            }
+            if (max_count == ++*count)
+            {
+                break;
+            }
+        }
+        if (*count)
+        {
+            rc = 0;
+            break;
+        }
+        if (st->done)
+        {
+            break;
+        }
+        cond_wait(&st->changed, &st->lock);
+    }
+    mutex_unlock(&st->lock);
+    return rc;
+}
+
+const image_t *image_stream_wait(image_stream_t *st)
+{
+    mutex_lock(&st->lock);
+    while (!st->complete)
+    {
+        cond_wait(&st->changed, &st->lock);
+    }
+    const int result = st->result;
+    mutex_unlock(&st->lock);
+    return (0 == result) ? &st->image : NULL;
+}
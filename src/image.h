@@ -0,0 +1,190 @@
+/*********************************************************************************************************************
+ * The MIT License (MIT)                                                                                             *
+ * Copyright (c) 2026 rl78flash contributors                                                                         *
+ *                                                                                                                   *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated      *
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation   *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and  *
+ * to permit persons to whom the Software is furnished to do so, subject to the following conditions:                *
+ *                                                                                                                   *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions     *
+ * of the Software.                                                                                                  *
+ *                                                                                                                   *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO  *
+ * THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF         *
+ * CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+ * IN THE SOFTWARE.                                                                                                  *
+ *********************************************************************************************************************/
+
+#ifndef IMAGE_H__
+#define IMAGE_H__
+
+#include "thread.h"
+
+/* Blocks the image tracks, the smallest flash block of RL78 devices */
+#define IMAGE_BLOCK_SIZE        256U
+/* Segments start and end on this boundary, so flash blocks up to this size
+ * never span two segments */
+#define IMAGE_SEGMENT_ALIGN     1024U
+
+typedef struct
+{
+    unsigned int address;
+    unsigned int size;
+    unsigned char *data;
+} image_segment_t;
+
+/* Range of addresses */
+typedef struct
+{
+    unsigned int address;
+    unsigned int size;
+} image_range_t;
+
+struct image_overlay;
+
+/* Sparse memory image. Segments hold the ranges the file writes, everything
+ * else reads as 0xFF. The bitmap has a bit per IMAGE_BLOCK_SIZE block holding
+ * anything but 0xFF, so users look at populated blocks only.
+ *
+ * An image is built by image_reserve() of every range to be written, then
+ * image_alloc(), writes through image_ptr() and finally image_seal(). */
+typedef struct
+{
+    image_segment_t *segment;   /* Sorted by address, never adjacent but in overlays */
+    unsigned int count;
+    unsigned int capacity;
+    int sorted;                 /* Reserved ranges came in order */
+    unsigned char *bitmap;
+    unsigned int end;           /* End of the last segment, the bitmap covers up to it */
+    /* Byte sums of the blocks up to end, 16-bit little-endian, NULL if they
+     * are not known. Precompiled images carry them. */
+    const unsigned char *sums;
+    /* Ranges the file writes, sorted and merged by image_seal(). Bytes of
+     * segments outside of them are padding. None: blocks with data count. */
+    image_range_t *written;
+    unsigned int nwritten;
+    unsigned int written_capacity;
+    int external;               /* Data, bitmap and sums belong to someone else */
+    struct image_overlay *overlay;  /* Memory of image_overlay(), NULL otherwise */
+} image_t;
+
+void image_init(image_t *img);
+int image_reserve(image_t *img, unsigned int address, unsigned int size);
+/* Allocate reserved ranges, filled with 0xFF */
+int image_alloc(image_t *img);
+/* Memory of the range, NULL if it was not reserved */
+unsigned char *image_ptr(const image_t *img, unsigned int address, unsigned int size);
+/* Record a range the file writes, ranges may come in any order and overlap */
+int image_written(image_t *img, unsigned int address, unsigned int size);
+/* Mark blocks with data, must be called after the last write */
+int image_seal(image_t *img);
+void image_free(image_t *img);
+
+/* Non-zero if any block of the range holds data */
+int image_used(const image_t *img, unsigned int address, unsigned int size);
+/* Start of the first block with data at or after address, image end if there is none */
+unsigned int image_next_used(const image_t *img, unsigned int address);
+/* Contiguous data of a range. It points into a segment if one covers the
+ * range, otherwise the range is assembled in buf. NULL if buf is needed, but
+ * not given. */
+const unsigned char *image_data(const image_t *img, unsigned int address, unsigned int size, unsigned char *buf);
+/* Bytes allocated for segments */
+unsigned int image_payload(const image_t *img);
+/* Byte sum of a range of whole blocks modulo 0x10000 from the precomputed
+ * sums, -1 if they are not known */
+int image_sum(const image_t *img, unsigned int address, unsigned int size, unsigned int *sum);
+
+/* Bytes two images put at the same address */
+typedef struct
+{
+    unsigned int first;         /* Indices of the images */
+    unsigned int second;
+    unsigned int address;
+    unsigned char first_value;
+    unsigned char second_value;
+} image_conflict_t;
+
+#define IMAGE_MERGE_CONFLICT    1
+
+/* Build an empty image of sealed ones. Returns IMAGE_MERGE_CONFLICT if the
+ * written ranges of two images overlap with different data, 0xFF included,
+ * the first such address is described by conflict, and -1 if memory runs out. */
+int image_merge(image_t *img, const image_t *const *src, unsigned int count, image_conflict_t *conflict);
+/* Build an empty image of a sealed one with the written ranges moved by offset.
+ * Returns -1 if memory runs out or data would leave the address space of the
+ * stream, up to IMAGE_STREAM_SIZE. */
+int image_move(image_t *img, const image_t *src, int offset);
+
+/* Bytes to put into an image in place of its own */
+typedef struct
+{
+    unsigned int address;
+    unsigned int size;
+    const unsigned char *data;
+} image_patch_t;
+
+/* Image of base with the ranges of patches replaced. Only the segment-aligned
+ * pieces the patches touch get memory of their own, the rest is shared with
+ * base and so are data frames cached for it. Bitmap and sums are copied and
+ * updated for the touched blocks. base must outlive the image. */
+int image_overlay(image_t *img, const image_t *base, const image_patch_t *patch, unsigned int count);
+
+/* Address space of an image stream, code and data flash of RL78 */
+#define IMAGE_STREAM_SIZE       0x00100000U
+#define IMAGE_STREAM_BLOCKS     (IMAGE_STREAM_SIZE / IMAGE_BLOCK_SIZE)
+#define IMAGE_STREAM_CHUNKS     (IMAGE_STREAM_SIZE / IMAGE_SEGMENT_ALIGN)
+#define IMAGE_STREAM_RANGES     2
+
+/* Results of image_stream_write() */
+#define IMAGE_STREAM_ALLOC_ERROR    (-1)
+#define IMAGE_STREAM_RANGE_ERROR    (-2)
+
+/* Image written by one thread while another one takes blocks whose content
+ * is final, so programming starts before the file is read to the end.
+ * A block is final when a record starts past it while records come in
+ * address order, when all its bytes are written or at the end of the file.
+ * A record which goes back to a final block makes it dirty again, it is
+ * taken once more and programmed again. */
+typedef struct
+{
+    mutex_t lock;
+    cond_t changed;
+    unsigned char *chunk[IMAGE_STREAM_CHUNKS];      /* Allocated on the first write */
+    unsigned short coverage[IMAGE_STREAM_BLOCKS];   /* Bytes written to a block */
+    unsigned char final[IMAGE_STREAM_BLOCKS];
+    unsigned char dirty[IMAGE_STREAM_BLOCKS];       /* Written since it was taken last */
+    unsigned int watermark;     /* Start of the last record */
+    unsigned int published;     /* Blocks up to this one were made final by the watermark */
+    int unordered;              /* A record went back, the watermark is not used any more */
+    int done;                   /* Writer has finished */
+    int result;                 /* Result of the writer, non-zero if it failed */
+    int complete;               /* image is ready, or the writer failed */
+    unsigned int range[IMAGE_STREAM_RANGES][2];     /* [start, end) data may go to, once limited */
+    unsigned int nranges;
+    int limited;
+    image_t image;              /* Whole image, built at the end */
+} image_stream_t;
+
+void image_stream_init(image_stream_t *st);
+void image_stream_destroy(image_stream_t *st);
+/* Writer side, returns 0 or one of IMAGE_STREAM_*_ERROR */
+int image_stream_write(image_stream_t *st, unsigned int address, const unsigned char *data, unsigned int size);
+/* Data may go only to count ranges of [start, end) pairs from now on, data
+ * written elsewhere fails the writer. Bounds are multiples of IMAGE_BLOCK_SIZE.
+ * Returns -1 if data lies outside of them already. */
+int image_stream_limit(image_stream_t *st, const unsigned int range[][2], unsigned int count);
+/* Make all blocks final and build the whole image, result is non-zero if the file is not valid */
+int image_stream_finish(image_stream_t *st, int result);
+/* Wait for the first run of up to max_count adjacent blocks of blksz bytes
+ * between start and end which are final, dirty and hold data. Their data is
+ * copied to buf. Returns 0 if blocks are taken, 1 if nothing is left after
+ * the end of the stream, -1 if the writer failed. blksz and start must be
+ * multiples of IMAGE_BLOCK_SIZE. */
+int image_stream_take(image_stream_t *st, unsigned int start, unsigned int end, unsigned int blksz,
+                      unsigned int max_count, unsigned int *address, unsigned int *count, unsigned char *buf);
+/* Wait for the end of the stream, NULL if the writer failed */
+const image_t *image_stream_wait(image_stream_t *st);
+
+#endif  // IMAGE_H__
@@ -0,0 +1,124 @@
+/*********************************************************************************************************************
+ * The MIT License (MIT)                                                                                             *
+ * Copyright (c) 2026 rl78flash contributors                                                                         *
+ *                                                                                                                   *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated      *
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation   *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and  *
+ * to permit persons to whom the Software is furnished to do so, subject to the following conditions:                *
+ *                                                                                                                   *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions     *
+ * of the Software.                                                                                                  *
+ *                                                                                                                   *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO  *
+ * THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF         *
+ * CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+ * IN THE SOFTWARE.                                                                                                  *
+ *********************************************************************************************************************/
+
+#include "image_cache.h"
+#include "srec.h"
+#include "hash.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#ifdef WIN32
+#include <io.h>
+#endif
+
+#define IMAGE_CACHE_PATH    1024
+
+static int image_cache_path(char *path, size_t size, const char *dir, uint64_t key, const char *suffix)
+{
+    const int len = snprintf(path, size, "%s/%08X%08X.rl78img%s", dir,
+                             (unsigned int)(key >> 32), (unsigned int)(key & 0xFFFFFFFFU), suffix);
+    return (0 < len && (size_t)len < size) ? 0 : -1;
+}
+
+/* Readers see either no entry or a complete one, whoever renames last wins
+ * with the same content */
+static void image_cache_store(const log_t *log, const char *dir, uint64_t key, const image_t *img)
+{
+    char path[IMAGE_CACHE_PATH];
+    char tmp_path[IMAGE_CACHE_PATH];
+    char suffix[32];
+    snprintf(suffix, sizeof suffix, ".%d.tmp", (int)getpid());
+    if (0 != image_cache_path(path, sizeof path, dir, key, "")
+        || 0 != image_cache_path(tmp_path, sizeof tmp_path, dir, key, suffix))
+    {
+        return;
+    }
+#ifndef WIN32
+    if (0 != mkdir(dir, 0755) && EEXIST != errno)
+#else
+    if (0 != mkdir(dir) && EEXIST != errno)
+#endif
+    {
+        log_printf(log, 1, "Unable to create cache directory \"%s\"\n", dir);
+        return;
+    }
+    // Failures only cost parsing next time
+    const log_t quiet = { -1, NULL, NULL };
+    uint64_t hash;
+    if (0 != rl78img_write(&quiet, tmp_path, img, &hash))
+    {
+        log_printf(log, 1, "Unable to write cache entry \"%s\"\n", tmp_path);
+        remove(tmp_path);
+        return;
+    }
+    if (0 != rename(tmp_path, path))
+    {
+        // Windows does not replace files, the entry is there already
+        remove(tmp_path);
+        return;
+    }
+    log_printf(log, 2, "Stored in cache as \"%s\"\n", path);
+}
+
+int image_cache_load(const log_t *log, const char *dir, const char *text, size_t size,
+                     unsigned int code_len, unsigned int data_len, image_cache_t *c)
+{
+    memset(c, 0, sizeof *c);
+    image_init(&c->parsed);
+    // Limits change the result of parsing, they are a part of the key
+    const uint64_t key = hash64(text, size, ((uint64_t)code_len << 32) | data_len);
+    char path[IMAGE_CACHE_PATH];
+    if (0 == image_cache_path(path, sizeof path, dir, key, "")
+        && MAPFILE_NO_ERROR == mapfile_open(&c->file, path))
+    {
+        // A damaged or outdated entry is parsed again
+        const log_t quiet = { -1, NULL, NULL };
+        if (RL78IMG_NO_ERROR == rl78img_parse(&quiet, c->file.data, c->file.size, &c->entry))
+        {
+            log_printf(log, 2, "Image from cache \"%s\"\n", path);
+            c->precompiled = &c->entry;
+            c->image = &c->entry.image;
+            return SREC_NO_ERROR;
+        }
+        log_printf(log, 1, "Cache entry \"%s\" is not valid\n", path);
+        mapfile_close(&c->file);
+    }
+    const int rc = srec_parse_image(log, text, size, code_len, data_len, &c->parsed);
+    if (SREC_NO_ERROR != rc)
+    {
+        return rc;
+    }
+    c->image = &c->parsed;
+    image_cache_store(log, dir, key, &c->parsed);
+    return SREC_NO_ERROR;
+}
+
+void image_cache_free(image_cache_t *c)
+{
+    if (NULL != c->precompiled)
+    {
+        rl78img_free(&c->entry);
+        mapfile_close(&c->file);
+    }
+    image_free(&c->parsed);
+    c->image = NULL;
+    c->precompiled = NULL;
+}
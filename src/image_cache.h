@@ -0,0 +1,46 @@
+/*********************************************************************************************************************
+ * The MIT License (MIT)                                                                                             *
+ * Copyright (c) 2026 rl78flash contributors                                                                         *
+ *                                                                                                                   *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated      *
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation   *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and  *
+ * to permit persons to whom the Software is furnished to do so, subject to the following conditions:                *
+ *                                                                                                                   *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions     *
+ * of the Software.                                                                                                  *
+ *                                                                                                                   *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO  *
+ * THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF         *
+ * CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+ * IN THE SOFTWARE.                                                                                                  *
+ *********************************************************************************************************************/
+
+#ifndef IMAGE_CACHE_H__
+#define IMAGE_CACHE_H__
+
+#include "log.h"
+#include "image.h"
+#include "rl78img.h"
+#include "mapfile.h"
+#include <stddef.h>
+
+/* Images of S-record files kept as precompiled images in a directory, named
+ * after a hash of the file and the memory limits. An entry which is missing
+ * or damaged is a miss, the file is parsed and the entry is written again. */
+typedef struct
+{
+    const image_t *image;       /* Result, points to one of the images below */
+    const rl78img_t *precompiled;   /* Entry of the cache, NULL on a miss */
+    rl78img_t entry;
+    mapfile_t file;
+    image_t parsed;
+} image_cache_t;
+
+/* Image of the S-record file in text, same limits and errors as srec_parse_image() */
+int image_cache_load(const log_t *log, const char *dir, const char *text, size_t size,
+                     unsigned int code_len, unsigned int data_len, image_cache_t *c);
+void image_cache_free(image_cache_t *c);
+
+#endif  // IMAGE_CACHE_H__
@@ -0,0 +1,367 @@
+/*********************************************************************************************************************
+ * The MIT License (MIT)                                                                                             *
+ * Copyright (c) 2026 rl78flash contributors                                                                         *
+ *                                                                                                                   *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated      *
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation   *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and  *
+ * to permit persons to whom the Software is furnished to do so, subject to the following conditions:                *
+ *                                                                                                                   *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions     *
+ * of the Software.                                                                                                  *
+ *                                                                                                                   *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO  *
+ * THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF         *
+ * CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+ * IN THE SOFTWARE.                                                                                                  *
+ *********************************************************************************************************************/
+
+#include "input.h"
+#include "srec.h"
+#include "rl78.h"
+#include "rl78img.h"
+#include "mapfile.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define ELF_HEADER_SIZE     52U
+#define ELF_PHDR_SIZE       32U
+#define ELF_CLASS32         1
+#define ELF_DATA_LSB        1
+#define ELF_MACHINE_RL78    197U
+#define ELF_PT_LOAD         1U
+
+/* Bytes of a file to be written at an address */
+typedef struct
+{
+    unsigned int address;
+    unsigned int size;
+    const unsigned char *data;
+} input_segment_t;
+
+static unsigned int get16(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+static unsigned int get32(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24);
+}
+
+int input_detect(const char *data, size_t size)
+{
+    if (0 == size || srec_detect(data, size))
+    {
+        return INPUT_RECORDS;
+    }
+    if (4 <= size && 0 == memcmp(data, "\x7F" "ELF", 4))
+    {
+        return INPUT_ELF;
+    }
+    if (rl78img_detect(data, size))
+    {
+        return INPUT_PRECOMPILED;
+    }
+    return INPUT_UNKNOWN;
+}
+
+int input_split_address(char *name, unsigned int *address)
+{
+    char *at = strrchr(name, '@');
+    if (NULL == at || name == at || '\0' == at[1])
+    {
+        return 0;
+    }
+    char *endp;
+    // A sign is an offset, see input_split_offset()
+    const unsigned long value = strtoul(at + 1, &endp, 0);
+    if ('+' == at[1] || '-' == at[1] || '\0' != *endp || 0xFFFFFFFFUL < value)
+    {
+        return 0;
+    }
+    *at = '\0';
+    *address = (unsigned int)value;
+    return 1;
+}
+
+int input_split_offset(char *name, int *offset)
+{
+    char *at = strrchr(name, '@');
+    if (NULL == at || name == at || ('+' != at[1] && '-' != at[1]) || '\0' == at[2])
+    {
+        return 0;
+    }
+    char *endp;
+    const unsigned long value = strtoul(at + 2, &endp, 0);
+    if ('\0' != *endp || '+' == at[2] || '-' == at[2] || 0x00100000UL < value)
+    {
+        return 0;
+    }
+    *at = '\0';
+    *offset = '-' == at[1] ? -(int)value : (int)value;
+    return 1;
+}
+
+/* Segments of an ELF file which have data, they point into the file */
+static int elf_segments(const log_t *log, const char *file, size_t size, input_segment_t **segments, unsigned int *count)
+{
+    const unsigned char *p = (const unsigned char*)file;
+    *segments = NULL;
+    *count = 0;
+    if (ELF_HEADER_SIZE > size
+        || ELF_CLASS32 != p[4]
+        || ELF_DATA_LSB != p[5])
+    {
+        log_printf(log, LOG_ERROR, "Not a 32-bit little-endian ELF file\n");
+        return SREC_FORMAT_ERROR;
+    }
+    if (ELF_MACHINE_RL78 != get16(p + 18))
+    {
+        log_printf(log, LOG_ERROR, "ELF file is not built for RL78 (machine %u)\n", get16(p + 18));
+        return SREC_FORMAT_ERROR;
+    }
+    const unsigned int phoff = get32(p + 28);
+    const unsigned int phentsize = get16(p + 42);
+    const unsigned int phnum = get16(p + 44);
+    if (phnum
+        && (ELF_PHDR_SIZE > phentsize || phoff > size || (size - phoff) / phentsize < phnum))
+    {
+        log_printf(log, LOG_ERROR, "ELF file is damaged\n");
+        return SREC_FORMAT_ERROR;
+    }
+    input_segment_t *s = malloc((phnum ? phnum : 1U) * 2U * sizeof *s);
+    if (NULL == s)
+    {
+        log_printf(log, LOG_ERROR, "Memory allocation failed\n");
+        return SREC_ALLOC_ERROR;
+    }
+    unsigned int n = 0;
+    unsigned int i;
+    for (i = 0; i < phnum; ++i)
+    {
+        const unsigned char *ph = p + phoff + i * phentsize;
+        const unsigned int offset = get32(ph + 4);
+        const unsigned int filesz = get32(ph + 16);
+        // Sections without contents in the file, like .bss, are not written
+        if (ELF_PT_LOAD != get32(ph) || 0 == filesz)
+        {
+            continue;
+        }
+        if (offset > size || size - offset < filesz)
+        {
+            log_printf(log, LOG_ERROR, "ELF file is damaged\n");
+            free(s);
+            return SREC_FORMAT_ERROR;
+        }
+        // Initial values are stored at the load address, not where the program sees them
+        s[n].address = get32(ph + 12);
+        s[n].size = filesz;
+        s[n].data = p + offset;
+        log_printf(log, 4, "ELF segment %u: %06X, %u bytes\n", i, s[n].address, s[n].size);
+        ++n;
+    }
+    *segments = s;
+    *count = n;
+    return SREC_NO_ERROR;
+}
+
+static int segment_compare(const void *a, const void *b)
+{
+    const input_segment_t *sa = (const input_segment_t*)a;
+    const input_segment_t *sb = (const input_segment_t*)b;
+    return sa->address < sb->address ? -1 : (sa->address > sb->address);
+}
+
+/* Same checks as for records: memory areas, and overlaps only with the same data.
+ * A segment running from code flash into data flash, like a dump of the whole
+ * memory, is split in two. There is room for twice the segments. */
+static int segments_check(const log_t *log, input_segment_t *segments, unsigned int *count,
+                          unsigned int code_len, unsigned int data_len)
+{
+    unsigned int i;
+    const unsigned int n = *count;
+    for (i = 0; i < n; ++i)
+    {
+        input_segment_t *s = &segments[i];
+        if (s->address < DATA_OFFSET && DATA_OFFSET - s->address < s->size)
+        {
+            input_segment_t *tail = &segments[(*count)++];
+            tail->address = DATA_OFFSET;
+            tail->size = s->size - (DATA_OFFSET - s->address);
+            tail->data = s->data + (DATA_OFFSET - s->address);
+            s->size = DATA_OFFSET - s->address;
+        }
+    }
+    for (i = 0; i < *count; ++i)
+    {
+        const input_segment_t *s = &segments[i];
+        const unsigned int end = s->address + s->size;
+        if (end < s->address
+            || !((CODE_OFFSET + code_len) >= end
+                 || (DATA_OFFSET <= s->address && (DATA_OFFSET + data_len) >= end)))
+        {
+            log_printf(log, LOG_ERROR, "Data at %06X (%u bytes) is out of the memory range\n", s->address, s->size);
+            return SREC_MEMORY_ERROR;
+        }
+    }
+    if (!*count)
+    {
+        return SREC_NO_ERROR;
+    }
+    qsort(segments, *count, sizeof *segments, segment_compare);
+    const input_segment_t *last = &segments[0];
+    for (i = 1; i < *count; ++i)
+    {
+        const input_segment_t *s = &segments[i];
+        const unsigned int last_end = last->address + last->size;
+        if (s->address < last_end)
+        {
+            // The segment reaching furthest covers all bytes of s given so far
+            const unsigned int end = s->address + s->size < last_end ? s->address + s->size : last_end;
+            if (0 != memcmp(last->data + (s->address - last->address), s->data, end - s->address))
+            {
+                log_printf(log, LOG_ERROR, "Segments at %06X and %06X overlap with different data\n",
+                           last->address, s->address);
+                return SREC_OVERLAP_ERROR;
+            }
+        }
+        if (s->address + s->size > last_end)
+        {
+            last = s;
+        }
+    }
+    return SREC_NO_ERROR;
+}
+
+static int segments_of(const log_t *log, int format, unsigned int address, const char *file, size_t size,
+                       input_segment_t **segments, unsigned int *count)
+{
+    switch (format)
+    {
+    case INPUT_ELF:
+        return elf_segments(log, file, size, segments, count);
+    case INPUT_BINARY:
+        if ((unsigned int)size != size)
+        {
+            log_printf(log, LOG_ERROR, "Data at %06X is out of the memory range\n", address);
+            return SREC_MEMORY_ERROR;
+        }
+        *segments = malloc(2U * sizeof **segments);
+        if (NULL == *segments)
+        {
+            log_printf(log, LOG_ERROR, "Memory allocation failed\n");
+            return SREC_ALLOC_ERROR;
+        }
+        (*segments)->address = address;
+        (*segments)->size = (unsigned int)size;
+        (*segments)->data = (const unsigned char*)file;
+        *count = size ? 1U : 0U;
+        return SREC_NO_ERROR;
+    default:
+        log_printf(log, LOG_ERROR, "Unknown file format\n");
+        return SREC_FORMAT_ERROR;
+    }
+}
+
+int input_parse(const log_t *log, int format, unsigned int address, const char *file, size_t size,
+                void *code, unsigned int code_len, void *data, unsigned int data_len)
+{
+    if (INPUT_RECORDS == format)
+    {
+        return srec_parse(log, file, size, code, code_len, data, data_len);
+    }
+    input_segment_t *segments = NULL;
+    unsigned int count = 0;
+    int rc = segments_of(log, format, address, file, size, &segments, &count);
+    if (SREC_NO_ERROR == rc)
+    {
+        rc = segments_check(log, segments, &count, code_len, data_len);
+    }
+    unsigned int i;
+    for (i = 0; i < count && SREC_NO_ERROR == rc; ++i)
+    {
+        const input_segment_t *s = &segments[i];
+        if (DATA_OFFSET <= s->address && DATA_OFFSET + data_len >= s->address + s->size)
+        {
+            if (NULL != data)
+            {
+                memcpy((unsigned char*)data + (s->address - DATA_OFFSET), s->data, s->size);
+            }
+        }
+        else if (NULL != code)
+        {
+            memcpy((unsigned char*)code + (s->address - CODE_OFFSET), s->data, s->size);
+        }
+    }
+    free(segments);
+    return rc;
+}
+
+int input_parse_image(const log_t *log, int format, unsigned int address, const char *file, size_t size,
+                      unsigned int code_len, unsigned int data_len, image_t *img)
+{
+    if (INPUT_RECORDS == format)
+    {
+        return srec_parse_image(log, file, size, code_len, data_len, img);
+    }
+    input_segment_t *segments = NULL;
+    unsigned int count = 0;
+    int rc = segments_of(log, format, address, file, size, &segments, &count);
+    if (SREC_NO_ERROR == rc)
+    {
+        rc = segments_check(log, segments, &count, code_len, data_len);
+    }
+    // Data is copied once, from the mapped file to the image
+    unsigned int i;
+    for (i = 0; i < count && SREC_NO_ERROR == rc; ++i)
+    {
+        if (0 != image_reserve(img, segments[i].address, segments[i].size)
+            || 0 != image_written(img, segments[i].address, segments[i].size))
+        {
+            rc = SREC_ALLOC_ERROR;
+        }
+    }
+    if (SREC_NO_ERROR == rc && 0 != image_alloc(img))
+    {
+        rc = SREC_ALLOC_ERROR;
+    }
+    for (i = 0; i < count && SREC_NO_ERROR == rc; ++i)
+    {
+        memcpy(image_ptr(img, segments[i].address, segments[i].size), segments[i].data, segments[i].size);
+    }
+    if (SREC_NO_ERROR == rc && 0 != image_seal(img))
+    {
+        rc = SREC_ALLOC_ERROR;
+    }
+    if (SREC_ALLOC_ERROR == rc)
+    {
+        log_printf(log, LOG_ERROR, "Memory allocation failed\n");
+    }
+    if (SREC_NO_ERROR != rc)
+    {
+        image_free(img);
+    }
+    free(segments);
+    return rc;
+}
+
+int input_read_image(const log_t *log, const char *filename, int format, unsigned int address,
+                     unsigned int code_len, unsigned int data_len, image_t *img)
+{
+    mapfile_t file;
+    const int rc = mapfile_open(&file, filename);
+    if (MAPFILE_NO_ERROR != rc)
+    {
+        log_printf(log, LOG_ERROR, "Unable to %s file \"%s\"\n", (MAPFILE_OPEN_ERROR == rc) ? "open" : "read", filename);
+        return SREC_IO_ERROR;
+    }
+    if (INPUT_UNKNOWN == format)
+    {
+        format = input_detect(file.data, file.size);
+    }
+    const int parse_rc = input_parse_image(log, format, address, file.data, file.size, code_len, data_len, img);
+    mapfile_close(&file);
+    return parse_rc;
+}
@@ -0,0 +1,54 @@
+/*********************************************************************************************************************
+ * The MIT License (MIT)                                                                                             *
+ * Copyright (c) 2026 rl78flash contributors                                                                         *
+ *                                                                                                                   *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated      *
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation   *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and  *
+ * to permit persons to whom the Software is furnished to do so, subject to the following conditions:                *
+ *                                                                                                                   *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions     *
+ * of the Software.                                                                                                  *
+ *                                                                                                                   *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO  *
+ * THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF         *
+ * CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+ * IN THE SOFTWARE.                                                                                                  *
+ *********************************************************************************************************************/
+
+#ifndef INPUT_H__
+#define INPUT_H__
+
+#include "log.h"
+#include "image.h"
+#include <stddef.h>
+
+/* Formats of input files. Raw binary files have no signature, they are named
+ * as <file>@<address> with the address of their first byte. */
+#define INPUT_UNKNOWN           (-1)
+#define INPUT_RECORDS           0   /* S-records or Intel HEX, see srec.h */
+#define INPUT_ELF               1
+#define INPUT_BINARY            2
+#define INPUT_PRECOMPILED       3   /* See rl78img.h */
+
+/* Format of a file by its first bytes, an empty file has no records */
+int input_detect(const char *data, size_t size);
+/* Cut "@<address>" off the name of a raw binary file, non-zero if it is there */
+int input_split_address(char *name, unsigned int *address);
+/* Cut "@+<offset>" or "@-<offset>" off the name of a file of any format, non-zero if it is there */
+int input_split_offset(char *name, int *offset);
+
+/* Same as srec_parse() for files of the other formats, but precompiled images.
+ * Data of ELF files are the PT_LOAD segments at their physical addresses,
+ * address is the load address of a raw binary file. Errors are SREC_*. */
+int input_parse(const log_t *log, int format, unsigned int address, const char *file, size_t size,
+                void *code, unsigned int code_len, void *data, unsigned int data_len);
+/* Same as srec_parse_image() */
+int input_parse_image(const log_t *log, int format, unsigned int address, const char *file, size_t size,
+                      unsigned int code_len, unsigned int data_len, image_t *img);
+/* Read a file into an image, the format is detected if it is INPUT_UNKNOWN */
+int input_read_image(const log_t *log, const char *filename, int format, unsigned int address,
+                     unsigned int code_len, unsigned int data_len, image_t *img);
+
+#endif  // INPUT_H__
@@ -0,0 +1,105 @@
+/*********************************************************************************************************************
+ * The MIT License (MIT)                                                                                             *
+ * Copyright (c) 2026 rl78flash contributors                                                                         *
+ *                                                                                                                   *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated      *
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation   *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and  *
+ * to permit persons to whom the Software is furnished to do so, subject to the following conditions:                *
+ *                                                                                                                   *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions     *
+ * of the Software.                                                                                                  *
+ *                                                                                                                   *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO  *
+ * THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF         *
+ * CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+ * IN THE SOFTWARE.                                                                                                  *
+ *********************************************************************************************************************/
+
+#include "log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+
+int log_enabled(const log_t *log, int level)
+{
+    const int verbose_level = (NULL != log) ? log->verbose_level : 0;
+    return level <= verbose_level;
+}
+
+static void log_write(const log_t *log, int level, const char *message)
+{
+    if (NULL != log && NULL != log->sink)
+    {
+        log->sink(log->ctx, level, message);
+    }
+    else if (LOG_ERROR == level)
+    {
+        fputs(message, stderr);
+    }
+    else
+    {
+        fputs(message, stdout);
+        fflush(stdout);
+    }
+}
+
+void log_printf(const log_t *log, int level, const char *format, ...)
+{
+    if (!log_enabled(log, level))
+    {
+        return;
+    }
+    char buf[256];
+    va_list args;
+    va_start(args, format);
+    const int len = vsnprintf(buf, sizeof buf, format, args);
+    va_end(args);
+    if (0 > len)
+    {
+        return;
+    }
+    if ((unsigned int)len < sizeof buf)
+    {
+        log_write(log, level, buf);
+        return;
+    }
+    char *message = malloc(len + 1);
+    if (NULL == message)
+    {
+        return;
+    }
+    va_start(args, format);
+    vsnprintf(message, len + 1, format, args);
+    va_end(args);
+    log_write(log, level, message);
+    free(message);
+}
+
+void log_hexdump(const log_t *log, int level, const char *prefix, const void *data, int len)
+{
+    if (!log_enabled(log, level))
+    {
+        return;
+    }
+    static const char digits[] = "0123456789ABCDEF";
+    char *message = malloc(len * 3 + 2);
+    if (NULL == message)
+    {
+        return;
+    }
+    const unsigned char *p = data;
+    char *out = message;
+    int i;
+    for (i = 0; i < len; ++i)
+    {
+        *out++ = digits[p[i] >> 4];
+        *out++ = digits[p[i] & 0x0F];
+        *out++ = ' ';
+    }
+    *out++ = '\n';
+    *out = '\0';
+    log_printf(log, level, "%s(%u): %s", prefix, len, message);
+    free(message);
+}
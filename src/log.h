@@ -0,0 +1,43 @@
+/*********************************************************************************************************************
+ * The MIT License (MIT)                                                                                             *
+ * Copyright (c) 2026 rl78flash contributors                                                                         *
+ *                                                                                                                   *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated      *
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation   *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and  *
+ * to permit persons to whom the Software is furnished to do so, subject to the following conditions:                *
+ *                                                                                                                   *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions     *
+ * of the Software.                                                                                                  *
+ *                                                                                                                   *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO  *
+ * THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF         *
+ * CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+ * IN THE SOFTWARE.                                                                                                  *
+ *********************************************************************************************************************/
+
+#ifndef LOG_H__
+#define LOG_H__
+
+/* Level of error messages, those are never dropped */
+#define LOG_ERROR 0
+/* Output asked for by the user, goes to stdout regardless of the verbose level */
+#define LOG_OUTPUT (-1)
+
+/* Receives every message passing the verbose level, may be called with parts of a line */
+typedef void (*log_sink_t)(void *ctx, int level, const char *message);
+
+typedef struct
+{
+    int verbose_level;          /* Messages of higher levels are dropped */
+    log_sink_t sink;            /* NULL: errors go to stderr, other messages to stdout */
+    void *ctx;
+} log_t;
+
+int log_enabled(const log_t *log, int level);
+void log_printf(const log_t *log, int level, const char *format, ...)
+    __attribute__((format(printf, 3, 4)));
+void log_hexdump(const log_t *log, int level, const char *prefix, const void *data, int len);
+
+#endif  // LOG_H__
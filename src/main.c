@@ -27,7 +27,17 @@
 #include "rl78-devinfo.h"
 #include "serial.h"
 #include "srec.h"
+#include "mapfile.h"
+#include "rl78img.h"
+#include "image_cache.h"
+#include "input.h"
+#include "patch.h"
 #include "terminal.h"
+#include "baud_cache.h"
+#include "thread.h"
+#ifdef __linux__
+#include "rl78-async.h"
+#endif
 
 int verbose_level = 0;
 
@@ -35,7 +45,8 @@ const char *usage =
     "rl78flash " VERSION "\n"
     "\n"
     "Usage:\n"
-    "rl78flash [options] <port> [<file>]\n"
+    "rl78flash [options] <port> [<file>...]\n"
+    "rl78flash [-v] -o <output> <file>...\n"
     "\t-v\tVerbose mode (several times increase verbose level)\n"
     "\t-i\tDisplay info about MCU\n"
     "\t-a\tAuto mode (Erase-Write-Verify-Reset)\n"
@@ -47,6 +58,7 @@ const char *usage =
     "\t-r\tReset MCU (switch to RUN mode)\n"
     "\t-d\tDelay bootloader initialization till keypress\n"
     "\t-b baud\tSet baudrate (supported baudrates: 115200, 250000, 500000, 1000000)\n"
+    "\t\t\tauto: use the fastest working one, remembered per port for a day\n"
     "\t\t\tdefault: 115200\n"
     "\t-m n\tSet communication mode\n"
     "\t\t\tn=1 Single-wire UART, Reset by DTR\n"
@@ -62,11 +74,943 @@ const char *usage =
     "\t\t\tdefault: n=-1\n"
     "\t-C blk\tCode block size in bytes (default: 0 - autodetect)\n"
     "\t-D blk\tData block size in bytes (default: 0 - autodetect)\n"
+    "\t-M\tProgram runs of adjacent blocks by a single command\n"
+    "\t-R\tBlank check whole ranges, split only non-blank ones\n"
+    "\t-k\tVerify by checksums, narrowing mismatching ranges down to a block\n"
+    "\t-K\tSame as -k, but also compare data of a mismatching block\n"
+    "\t-u\tUpdate mode: write only blocks which differ from the file (no erase),\n"
+    "\t\t\tblocks are found by checksums. With -K the blocks with matching\n"
+    "\t\t\tchecksums are compared as well, which sends all their data\n"
     "\t-n\tInvert reset\n"
     "\t-p v\tSpecify power supply voltage\n"
     "\t\t\tdefault: 3.3\n"
     "\t-t baud\tStart terminal with specified baudrate\n"
-    "\t-h\tDisplay help\n";
+    "\t-o file\tConvert <file> into a precompiled image, which is used as it is\n"
+    "\t\t\tin place of the file later\n"
+    "\t-z dir\tCache parsed files in the directory, the same file is not parsed again\n"
+    "\t-S\tWrite a single S-record or Intel HEX file while it is being read, only\n"
+    "\t\t\tblank blocks are written before the whole file is found valid,\n"
+    "\t\t\tthey are erased again if it is not. Reading overlaps writing\n"
+    "\t\t\tonly without -e, with -e erasing waits for the whole file\n"
+    "\t\t\t(not with -u, -I or several ports)\n"
+    "\t-L\tDrive gang targets from a single event loop, see below\n"
+    "\t-I addr:len:source\tWrite data of every unit over the file (several allowed), source is\n"
+    "\t\t\thex:<digits>     same bytes for every unit\n"
+    "\t\t\tcounter:<file>   number kept in the file, little-endian, incremented per unit\n"
+    "\t\t\tcsv:<file>:<n>   hex digits of column n, one row per unit, the next row\n"
+    "\t\t\t                 is kept in <file>.next\n"
+    "\t\t\tstdin            a line of hex digits per unit\n"
+    "\t-h\tDisplay help\n"
+    "\n"
+    "<port> may be a comma-separated list of ports, those targets are programmed\n"
+    "in parallel and a summary is printed at the end (-d and -t are not allowed).\n"
+    "Each target runs in a thread of its own. With -L a single event loop drives\n"
+    "them instead (Linux only). It programs and verifies block by block, so it\n"
+    "needs a fixed baudrate and is not supported with -M, -R, -k, -K or -u.\n"
+    "\n"
+    "<file> is an S-record, Intel HEX, ELF or precompiled image file, the format is\n"
+    "detected. A raw binary file is given as <file>@<address> of its first byte.\n"
+    "<file>@+<offset> or <file>@-<offset> moves the data of a file of any format.\n"
+    "Several files are merged into one image, they must not write different data\n"
+    "to the same address, blank bytes (FF) included.\n";
+
+/* Address space of code and data flash the file may fill */
+#define IMAGE_CODE_SIZE (DATA_OFFSET - CODE_OFFSET)
+#define IMAGE_DATA_SIZE (0x00100000U - DATA_OFFSET)
+
+#define MAX_PORTS 64
+
+/* Settings shared by all targets */
+typedef struct
+{
+    char erase;
+    char write;
+    char verify;
+    char reset_after;
+    char wait;
+    char display_info;
+    char nodata;
+    char nocode;
+    char terminal;
+    char event_loop;            /* Gang targets are driven by rl78_async instead of threads */
+    int mode;
+    int baud;
+    float voltage;
+    int proto_ver;
+    unsigned code_block_size;
+    unsigned data_block_size;
+    int flags;
+    int terminal_baud;
+    const image_t *image;       /* Contents of the file, NULL if not needed */
+    const rl78_frame_cache_t *frames;   /* Data frames of the image */
+    image_stream_t *stream;     /* File still being read, written while it arrives */
+    const image_t *units;       /* Image of every target with its own patches, NULL without patches */
+    const patch_t *patches;     /* Places of the values in the images of the units */
+    unsigned int npatches;
+} job_t;
+
+typedef struct
+{
+    const job_t *job;
+    const char *portname;
+    const image_t *image;       /* Contents for this target, the job's image unless it is patched */
+    rl78_session_t session;
+    log_t log;
+    const char *error;          /* Reason of a failure */
+    serial_time_t time;
+    /* Output is collected into lines to keep targets apart */
+    char line[256];
+    unsigned int line_len;
+#ifdef __linux__
+    rl78_async_t async;
+#endif
+} target_t;
+
+static mutex_t output_lock;
+
+static void target_flush_line(target_t *t)
+{
+    mutex_lock(&output_lock);
+    printf("[%s] %.*s\n", t->portname, (int)t->line_len, t->line);
+    fflush(stdout);
+    mutex_unlock(&output_lock);
+    t->line_len = 0;
+}
+
+/* Log sink of a target in gang mode, messages are prefixed with the port name */
+static void target_log(void *ctx, int level, const char *message)
+{
+    target_t *t = ctx;
+    (void)level;
+    for (; *message; ++message)
+    {
+        if ('\n' == *message)
+        {
+            target_flush_line(t);
+            continue;
+        }
+        if (sizeof t->line == t->line_len)
+        {
+            target_flush_line(t);
+        }
+        t->line[t->line_len++] = *message;
+    }
+}
+
+/* Check that the file has no data beyond the flash of the device */
+static int image_fits(const image_t *img, unsigned int offset, unsigned int size, unsigned int flash_size)
+{
+    return flash_size >= size || !image_used(img, offset + flash_size, size - flash_size);
+}
+
+static int image_fits_device(const image_t *img, unsigned int code_size, unsigned int data_size)
+{
+    return image_fits(img, CODE_OFFSET, IMAGE_CODE_SIZE, code_size)
+        && image_fits(img, DATA_OFFSET, IMAGE_DATA_SIZE, data_size);
+}
+
+#define TARGET_FAIL(t, code, message)                                   \
+    do                                                                  \
+    {                                                                   \
+        (t)->error = (message);                                         \
+        log_printf(&(t)->session.log, LOG_ERROR, "%s\n", (message));    \
+        retcode = (code);                                               \
+    }                                                                   \
+    while (0)
+
+/* Values the target gets from the patches */
+static void target_log_patches(target_t *t)
+{
+    unsigned char buf[PATCH_MAX_SIZE];
+    char prefix[16];
+    unsigned int i;
+    for (i = 0; i < t->job->npatches; ++i)
+    {
+        const patch_t *p = &t->job->patches[i];
+        snprintf(prefix, sizeof prefix, "Patch %06X", p->address);
+        log_hexdump(&t->log, 1, prefix, image_data(t->image, p->address, p->size, buf), p->size);
+    }
+}
+
+/* Select protocol and block sizes of an identified device, check the file fits */
+static int target_identify(target_t *t, const char *device_name, unsigned int code_size, unsigned int data_size)
+{
+    const job_t *job = t->job;
+    rl78_session_t *session = &t->session;
+    int retcode = 0;
+    if (1 == job->display_info)
+    {
+        log_printf(&session->log, LOG_OUTPUT,
+                   "Device: %s\n"
+                   "Code size: %u kB\n"
+                   "Data size: %u kB\n",
+                   device_name, code_size / 1024, data_size / 1024
+            );
+    }
+    if (!code_size || IMAGE_CODE_SIZE < code_size || IMAGE_DATA_SIZE < data_size)
+    {
+        log_printf(&session->log, LOG_ERROR, "Invalid code size: %u\n", code_size);
+        t->error = "Invalid code size";
+        return EINVAL;
+    }
+    /* Find device info */
+    int proto_ver = job->proto_ver;
+    unsigned code_block_size = job->code_block_size;
+    unsigned data_block_size = job->data_block_size;
+    const device_info_t *pinfo = rl78_devices;
+    while (pinfo->id)
+    {
+        if (!strncmp(pinfo->id, device_name, strlen(pinfo->id)))
+            break;
+        pinfo++;
+    }
+    /* Apply autodetected values, if not defined explicitly */
+    if (pinfo->id)
+    {
+        if (proto_ver == -1)
+            proto_ver = pinfo->protocol;
+        if (!code_block_size)
+            code_block_size = pinfo->code_block_size;
+        if (!data_block_size)
+            data_block_size = pinfo->data_block_size;
+    }
+    /* Verify config */
+    if (proto_ver < 0 || !code_block_size || !data_block_size)
+    {
+        log_printf(&session->log, LOG_ERROR, "Invalid protocol: protocol=%d, code_block=%u, data_block=%u\n",
+                   proto_ver, code_block_size, data_block_size);
+        t->error = "Invalid protocol";
+        return EINVAL;
+    }
+    /* The target device is fully defined. */
+    rl78_set_protocol(session, proto_ver);
+    session->code_block_size = code_block_size;
+    session->data_block_size = data_block_size;
+    log_printf(&session->log, 1, "Protocol configuration: protocol=%d, code_block=%u, data_block=%u\n",
+               proto_ver, code_block_size, data_block_size);
+    if (t->image && !image_fits_device(t->image, code_size, data_size))
+    {
+        TARGET_FAIL(t, EIO, "File does not fit into the device");
+    }
+    else if (!t->image && t->job->stream)
+    {
+        // Records of the file still being read are checked as they come
+        const unsigned int range[2][2] =
+        {
+            { CODE_OFFSET, CODE_OFFSET + code_size },
+            { DATA_OFFSET, DATA_OFFSET + data_size },
+        };
+        if (0 != image_stream_limit(t->job->stream, range, 2))
+        {
+            TARGET_FAIL(t, EIO, "File does not fit into the device");
+        }
+    }
+    return retcode;
+}
+
+/* Whole image of the streamed file, NULL if it is not valid */
+static const image_t *target_stream_wait(target_t *t)
+{
+    const image_t *image = image_stream_wait(t->job->stream);
+    if (NULL != image)
+    {
+        log_printf(&t->session.log, 2, "Image: %u segment(s), %u bytes\n", image->count, image_payload(image));
+    }
+    return image;
+}
+
+/* Complete sequence of actions for a single target */
+static int run_target(target_t *t)
+{
+    const job_t *job = t->job;
+    rl78_session_t *session = &t->session;
+    const serial_time_t start = serial_time();
+    const image_t *image = t->image;
+    int retcode = 0;
+    int rc;
+    if (0 != rl78_session_open(session, t->portname, job->mode, &t->log))
+    {
+        t->error = "Unable to open port";
+        t->time = serial_time() - start;
+        return EBADF;
+    }
+    session->flags = job->flags;
+    session->frame_cache = job->frames;
+    do
+    {
+        if (1 == job->write
+            || 1 == job->erase
+            || 1 == job->verify
+            || 1 == job->display_info)
+        {
+            int baud = job->baud;
+            if (BAUD_AUTO == baud)
+            {
+                const int cached_baud = baud_cache_load(&t->log, t->portname);
+                baud = cached_baud;
+                rc = rl78_reset_init_auto(session, job->wait, &baud, job->voltage);
+                if (0 == rc && cached_baud != baud)
+                {
+                    (void)baud_cache_store(&t->log, t->portname, baud);
+                }
+            }
+            else
+            {
+                rc = rl78_reset_init(session, job->wait, baud, job->voltage);
+            }
+            if (0 > rc)
+            {
+                TARGET_FAIL(t, EIO, "Initialization failed");
+                break;
+            }
+            rc = rl78_cmd_reset(session);
+            if (0 > rc)
+            {
+                TARGET_FAIL(t, EIO, "Synchronization failed");
+                break;
+            }
+            char device_name[11];
+            unsigned int code_size, data_size;
+            rc = rl78_cmd_silicon_signature(session, device_name, &code_size, &data_size);
+            if (0 > rc)
+            {
+                TARGET_FAIL(t, EIO, "Silicon signature read failed");
+                break;
+            }
+            retcode = target_identify(t, device_name, code_size, data_size);
+            if (0 != retcode)
+            {
+                break;
+            }
+            target_log_patches(t);
+            if (NULL == image && NULL != job->stream && 1 == job->erase)
+            {
+                // Nothing is erased before the whole file is read and found valid
+                image = target_stream_wait(t);
+                if (NULL == image)
+                {
+                    TARGET_FAIL(t, EIO, "Read failed");
+                    break;
+                }
+            }
+            if (!job->nocode && (1 == job->erase))
+            {
+                log_printf(&session->log, 1, "Erase code flash\n");
+                rc = rl78_erase(session, CODE_OFFSET, code_size);
+                if (0 != rc)
+                {
+                    TARGET_FAIL(t, EIO, "Code flash erase failed");
+                    break;
+                }
+            }
+            if (!job->nodata && (1 == job->erase && data_size))
+            {
+                log_printf(&session->log, 1, "Erase data flash\n");
+                rc = rl78_erase(session, DATA_OFFSET, data_size);
+                if (0 != rc)
+                {
+                    TARGET_FAIL(t, EIO, "Data flash erase failed");
+                    break;
+                }
+            }
+            if (!job->nocode && (1 == job->write))
+            {
+                log_printf(&session->log, 1, "Write code flash\n");
+                rc = NULL == image ? rl78_program_stream(session, job->stream, CODE_OFFSET, code_size)
+                    : rl78_program(session, image, CODE_OFFSET, code_size);
+                if (0 != rc)
+                {
+                    TARGET_FAIL(t, EIO, "Code flash write failed");
+                    break;
+                }
+            }
+            if (!job->nodata && (1 == job->write && data_size))
+            {
+                log_printf(&session->log, 1, "Write data flash\n");
+                rc = NULL == image ? rl78_program_stream(session, job->stream, DATA_OFFSET, data_size)
+                    : rl78_program(session, image, DATA_OFFSET, data_size);
+                if (0 != rc)
+                {
+                    TARGET_FAIL(t, EIO, "Data flash write failed");
+                    break;
+                }
+            }
+            if (NULL == image && NULL != job->stream)
+            {
+                // The file is complete now, its records were checked against the device
+                image = target_stream_wait(t);
+                if (NULL == image)
+                {
+                    TARGET_FAIL(t, EIO, "Read failed");
+                    break;
+                }
+            }
+            if (!job->nocode && (1 == job->verify))
+            {
+                log_printf(&session->log, 1, "Verify Code flash\n");
+                rc = rl78_verify(session, image, CODE_OFFSET, code_size);
+                if (0 != rc)
+                {
+                    TARGET_FAIL(t, EIO, "Code flash verification failed");
+                    break;
+                }
+            }
+            if (!job->nodata && (1 == job->verify && data_size))
+            {
+                log_printf(&session->log, 1, "Verify Data flash\n");
+                rc = rl78_verify(session, image, DATA_OFFSET, data_size);
+                if (0 != rc)
+                {
+                    TARGET_FAIL(t, EIO, "Data flash verification failed");
+                    break;
+                }
+            }
+        }
+        if (1 == job->terminal)
+        {
+            log_printf(&session->log, 1, "Start terminal\n");
+            int reset_before_terminal = job->write || job->verify || job->erase
+                || job->reset_after || job->display_info;
+            terminal_start(session, job->terminal_baud, reset_before_terminal);
+        }
+        else if (1 == job->reset_after)
+        {
+            log_printf(&session->log, 1, "Reset MCU\n");
+            rl78_reset(session);
+        }
+    }
+    while (0);
+    rl78_session_close(session);
+    t->time = serial_time() - start;
+    return retcode;
+}
+
+/* Reads the file while a single target is being programmed */
+typedef struct
+{
+    log_t log;
+    const char *filename;
+    mapfile_t file;
+    image_stream_t stream;
+    thread_t thread;
+    int started;
+    int rc;
+} reader_t;
+
+static THREAD_FUNC(reader_thread, arg)
+{
+    reader_t *r = arg;
+    r->rc = srec_stream(&r->log, r->filename, &r->file, IMAGE_CODE_SIZE, IMAGE_DATA_SIZE, &r->stream);
+    return 0;
+}
+
+static THREAD_FUNC(target_thread, arg)
+{
+    target_t *t = arg;
+    (void)run_target(t);
+    if (t->line_len)
+    {
+        target_flush_line(t);
+    }
+    return 0;
+}
+
+static void run_gang_threads(target_t *targets, unsigned int nports)
+{
+    thread_t *threads = calloc(nports, sizeof *threads);
+    char *started = calloc(nports, 1);
+    unsigned int i;
+    if (NULL == threads || NULL == started)
+    {
+        for (i = 0; i < nports; ++i)
+        {
+            targets[i].error = "Memory allocation failed";
+        }
+        free(threads);
+        free(started);
+        return;
+    }
+    for (i = 0; i < nports; ++i)
+    {
+        if (0 != thread_create(&threads[i], target_thread, &targets[i]))
+        {
+            targets[i].error = "Unable to start a thread";
+            continue;
+        }
+        started[i] = 1;
+    }
+    for (i = 0; i < nports; ++i)
+    {
+        if (started[i])
+        {
+            thread_join(&threads[i]);
+        }
+    }
+    free(threads);
+    free(started);
+}
+
+#ifdef __linux__
+/* The options are checked by main(), only a plain reset does not need the bootloader */
+static int gang_async_capable(const job_t *job)
+{
+    return job->event_loop
+        && (job->erase || job->write || job->verify || job->display_info);
+}
+
+/* Same actions as of run_target(), queued once the device is known */
+static int target_async_identified(rl78_async_t *a, const char *device_name,
+                                   unsigned int code_size, unsigned int data_size)
+{
+    target_t *t = a->ctx;
+    const job_t *job = t->job;
+    if (0 != target_identify(t, device_name, code_size, data_size))
+    {
+        a->error = t->error;
+        return -1;
+    }
+    target_log_patches(t);
+    if (!job->nocode && job->erase)
+    {
+        rl78_async_add_op(a, RL78_ASYNC_ERASE, "Erase code flash", CODE_OFFSET, NULL, code_size);
+    }
+    if (!job->nodata && job->erase && data_size)
+    {
+        rl78_async_add_op(a, RL78_ASYNC_ERASE, "Erase data flash", DATA_OFFSET, NULL, data_size);
+    }
+    if (!job->nocode && job->write)
+    {
+        rl78_async_add_image_op(a, RL78_ASYNC_PROGRAM, "Write code flash", CODE_OFFSET, t->image, code_size);
+    }
+    if (!job->nodata && job->write && data_size)
+    {
+        rl78_async_add_image_op(a, RL78_ASYNC_PROGRAM, "Write data flash", DATA_OFFSET, t->image, data_size);
+    }
+    if (!job->nocode && job->verify)
+    {
+        rl78_async_add_image_op(a, RL78_ASYNC_VERIFY, "Verify Code flash", CODE_OFFSET, t->image, code_size);
+    }
+    if (!job->nodata && job->verify && data_size)
+    {
+        rl78_async_add_image_op(a, RL78_ASYNC_VERIFY, "Verify Data flash", DATA_OFFSET, t->image, data_size);
+    }
+    if (job->reset_after)
+    {
+        rl78_async_add_op(a, RL78_ASYNC_RESET, "Reset MCU", 0, NULL, 0);
+    }
+    return 0;
+}
+
+/* All targets are driven by a single thread */
+static void run_gang_async(target_t *targets, unsigned int nports, serial_time_t start)
+{
+    rl78_async_loop_t loop;
+    unsigned int i;
+    if (0 != rl78_async_loop_init(&loop))
+    {
+        for (i = 0; i < nports; ++i)
+        {
+            targets[i].error = "Unable to create an event loop";
+        }
+        return;
+    }
+    for (i = 0; i < nports; ++i)
+    {
+        target_t *t = &targets[i];
+        if (0 != rl78_session_open(&t->session, t->portname, t->job->mode, &t->log))
+        {
+            t->error = "Unable to open port";
+            continue;
+        }
+        t->session.frame_cache = t->job->frames;
+        t->async.session = &t->session;
+        t->async.family = RL78_ASYNC_RL78;
+        t->async.baud = t->job->baud;
+        t->async.voltage = t->job->voltage;
+        t->async.identified = target_async_identified;
+        t->async.ctx = t;
+        if (0 != rl78_async_start(&loop, &t->async))
+        {
+            t->error = "Unable to start";
+            rl78_session_close(&t->session);
+        }
+    }
+    rl78_async_run(&loop);
+    for (i = 0; i < nports; ++i)
+    {
+        target_t *t = &targets[i];
+        if (NULL == t->session.port)
+        {
+            continue;
+        }
+        t->error = t->async.error;
+        t->time = t->async.finish_time - start;
+        rl78_session_close(&t->session);
+        if (t->line_len)
+        {
+            target_flush_line(t);
+        }
+    }
+    rl78_async_loop_close(&loop);
+}
+#endif
+
+/* Program all targets in parallel, then print a summary */
+static int run_gang(const job_t *job, char *ports[], unsigned int nports)
+{
+    target_t *targets = calloc(nports, sizeof *targets);
+    if (NULL == targets)
+    {
+        fprintf(stderr, "Memory allocation failed\n");
+        return ENOMEM;
+    }
+    mutex_init(&output_lock);
+    const serial_time_t start = serial_time();
+    unsigned int i;
+    for (i = 0; i < nports; ++i)
+    {
+        targets[i].job = job;
+        targets[i].portname = ports[i];
+        targets[i].image = job->units ? &job->units[i] : job->image;
+        targets[i].log.verbose_level = verbose_level;
+        targets[i].log.sink = target_log;
+        targets[i].log.ctx = &targets[i];
+    }
+#ifdef __linux__
+    if (gang_async_capable(job))
+    {
+        run_gang_async(targets, nports, start);
+    }
+    else
+#endif
+    {
+        run_gang_threads(targets, nports);
+    }
+    const serial_time_t total = serial_time() - start;
+    int retcode = 0;
+    unsigned int failed = 0;
+    printf("\n%-24s %-6s %8s\n", "Port", "Result", "Time, s");
+    for (i = 0; i < nports; ++i)
+    {
+        const target_t *t = &targets[i];
+        printf("%-24s %-6s %8.2f%s%s\n",
+               ports[i], t->error ? "FAIL" : "PASS", t->time / 1000000.0,
+               t->error ? "  " : "", t->error ? t->error : "");
+        if (t->error)
+        {
+            ++failed;
+            retcode = EIO;
+        }
+    }
+    printf("%u of %u passed in %.2f s\n", nports - failed, nports, total / 1000000.0);
+    mutex_destroy(&output_lock);
+    free(targets);
+    return retcode;
+}
+
+/* A file read for programming, in one of the ways below */
+typedef struct
+{
+    const image_t *image;       /* Contents, NULL while the file is streamed */
+    image_t parsed;
+    rl78img_t precompiled;
+    mapfile_t file;             /* Mapped as long as the precompiled image is used */
+    int precompiled_used;
+    image_cache_t cache;
+    int cache_used;
+    image_t moved;              /* Contents with the offset of the file name applied */
+} input_file_t;
+
+static void unload_file(input_file_t *f)
+{
+    image_free(&f->parsed);
+    image_free(&f->moved);
+    if (f->precompiled_used)
+    {
+        rl78img_free(&f->precompiled);
+        mapfile_close(&f->file);
+    }
+    if (f->cache_used)
+    {
+        image_cache_free(&f->cache);
+    }
+    f->image = NULL;
+}
+
+/* Move the contents of a loaded file by the offset of its name */
+static int move_file(const char *filename, int offset, input_file_t *f)
+{
+    const int rc = image_move(&f->moved, f->image, offset);
+    if (0 != rc)
+    {
+        fprintf(stderr, "File \"%s\" does not fit into flash with offset %s%X\n",
+                filename, 0 > offset ? "-" : "+", (unsigned int)(0 > offset ? -offset : offset));
+        unload_file(f);
+        return EINVAL;
+    }
+    f->image = &f->moved;
+    return 0;
+}
+
+/* Read a file. It is streamed by a reader if reader is not NULL and the
+ * format allows it. */
+static int load_file(const log_t *log, char *filename, const char *cache_dir, reader_t **reader, input_file_t *f)
+{
+    memset(f, 0, sizeof *f);
+    image_init(&f->parsed);
+    image_init(&f->moved);
+    unsigned int address = 0;
+    int offset = 0;
+    const int moved = input_split_offset(filename, &offset);
+    const int binary = !moved && input_split_address(filename, &address);
+    if (1 <= verbose_level)
+    {
+        printf("Read file \"%s\"\n", filename);
+    }
+    mapfile_t file;
+    if (MAPFILE_NO_ERROR != mapfile_begin(&file, filename))
+    {
+        fprintf(stderr, "Unable to open file \"%s\"\n", filename);
+        return EIO;
+    }
+    /* A file which is not mapped shows its first bytes, enough to tell the format */
+    if (0 > mapfile_more(&file))
+    {
+        fprintf(stderr, "Unable to read file \"%s\"\n", filename);
+        mapfile_close(&file);
+        return EIO;
+    }
+    const int format = binary ? INPUT_BINARY : input_detect(file.data, file.size);
+    if (INPUT_UNKNOWN == format)
+    {
+        fprintf(stderr, "Unknown format of file \"%s\", give a raw binary file as <file>@<address>\n", filename);
+        mapfile_close(&file);
+        return EINVAL;
+    }
+    if (INPUT_PRECOMPILED == format)
+    {
+        /* Used as it is, the file stays open */
+        if (MAPFILE_NO_ERROR != mapfile_rest(&file)
+            || RL78IMG_NO_ERROR != rl78img_parse(log, file.data, file.size, &f->precompiled))
+        {
+            fprintf(stderr, "Read failed\n");
+            mapfile_close(&file);
+            return EIO;
+        }
+        log_printf(log, 2, "Precompiled image, hash %08X%08X\n",
+                   (unsigned int)(f->precompiled.hash >> 32), (unsigned int)(f->precompiled.hash & 0xFFFFFFFFU));
+        f->file = file;
+        f->precompiled_used = 1;
+        f->image = &f->precompiled.image;
+        return moved ? move_file(filename, offset, f) : 0;
+    }
+    /* A moved file is needed as a whole */
+    if (INPUT_RECORDS == format
+        && NULL != reader
+        && NULL == cache_dir
+        && !moved)
+    {
+        reader_t *r = malloc(sizeof *r);
+        if (NULL == r)
+        {
+            fprintf(stderr, "Memory allocation failed\n");
+            mapfile_close(&file);
+            return ENOMEM;
+        }
+        r->log = *log;
+        r->filename = filename;
+        r->file = file;
+        image_stream_init(&r->stream);
+        r->started = 0 == thread_create(&r->thread, reader_thread, r);
+        if (!r->started)
+        {
+            // Read it all before programming
+            reader_thread(r);
+        }
+        *reader = r;
+        return 0;
+    }
+    int rc = mapfile_rest(&file);
+    if (MAPFILE_NO_ERROR != rc)
+    {
+        fprintf(stderr, "Unable to read file \"%s\"\n", filename);
+    }
+    else if (INPUT_RECORDS == format
+             && NULL != cache_dir)
+    {
+        rc = image_cache_load(log, cache_dir, file.data, file.size, IMAGE_CODE_SIZE, IMAGE_DATA_SIZE, &f->cache);
+        f->cache_used = 0 == rc;
+        f->image = f->cache.image;
+    }
+    else
+    {
+        rc = input_parse_image(log, format, address, file.data, file.size,
+                               IMAGE_CODE_SIZE, IMAGE_DATA_SIZE, &f->parsed);
+        f->image = &f->parsed;
+    }
+    mapfile_close(&file);
+    if (0 != rc)
+    {
+        fprintf(stderr, "Read failed\n");
+        return EIO;
+    }
+    return moved ? move_file(filename, offset, f) : 0;
+}
+
+/* All files of the command line, several ones are merged into one image */
+typedef struct
+{
+    input_file_t *file;
+    unsigned int count;
+    image_t merged;
+    const image_t *image;       /* Contents, NULL while a single file is streamed */
+} input_t;
+
+/* Image of every unit, the image with the unit's values of the patches */
+static image_t *patch_units(const log_t *log, const image_t *image, const patch_t *patch, unsigned int count,
+                            unsigned int units)
+{
+    unsigned char *values[PATCH_MAX_COUNT];
+    image_patch_t pieces[PATCH_MAX_COUNT];
+    image_t *img = calloc(units, sizeof *img);
+    unsigned int i;
+    unsigned int k;
+    int rc = NULL == img ? -1 : 0;
+    memset(values, 0, sizeof values);
+    for (i = 0; i < count && 0 == rc; ++i)
+    {
+        values[i] = malloc(units * patch[i].size);
+        rc = NULL == values[i] ? -1 : 0;
+    }
+    if (0 == rc)
+    {
+        rc = patch_values(log, patch, count, units, values);
+    }
+    for (k = 0; k < units && 0 == rc; ++k)
+    {
+        for (i = 0; i < count; ++i)
+        {
+            pieces[i].address = patch[i].address;
+            pieces[i].size = patch[i].size;
+            pieces[i].data = values[i] + k * patch[i].size;
+        }
+        rc = image_overlay(&img[k], image, pieces, count);
+    }
+    for (i = 0; i < count; ++i)
+    {
+        free(values[i]);
+    }
+    if (0 != rc && NULL != img)
+    {
+        for (i = 0; i < units; ++i)
+        {
+            image_free(&img[i]);
+        }
+        free(img);
+        img = NULL;
+    }
+    return img;
+}
+
+static void unload_files(input_t *in)
+{
+    unsigned int i;
+    for (i = 0; i < in->count; ++i)
+    {
+        unload_file(&in->file[i]);
+    }
+    free(in->file);
+    in->file = NULL;
+    in->count = 0;
+    image_free(&in->merged);
+    in->image = NULL;
+}
+
+/* Read the files, reader is passed on for a single file */
+static int load_files(const log_t *log, char **names, unsigned int count, const char *cache_dir,
+                      reader_t **reader, input_t *in)
+{
+    memset(in, 0, sizeof *in);
+    image_init(&in->merged);
+    in->file = calloc(count, sizeof *in->file);
+    const image_t **src = malloc(count * sizeof *src);
+    if (NULL == in->file || NULL == src)
+    {
+        fprintf(stderr, "Memory allocation failed\n");
+        free(in->file);
+        free(src);
+        return ENOMEM;
+    }
+    int rc = 0;
+    unsigned int i;
+    for (i = 0; i < count && 0 == rc; ++i)
+    {
+        rc = load_file(log, names[i], cache_dir, 1 == count ? reader : NULL, &in->file[i]);
+        in->count = 0 == rc ? i + 1 : i;
+        src[i] = in->file[i].image;
+    }
+    if (0 == rc && 1 == count)
+    {
+        in->image = in->file[0].image;
+    }
+    else if (0 == rc)
+    {
+        image_conflict_t conflict;
+        const int merge_rc = image_merge(&in->merged, src, count, &conflict);
+        if (IMAGE_MERGE_CONFLICT == merge_rc)
+        {
+            fprintf(stderr, "Files \"%s\" and \"%s\" overlap with different data at %06X (%02X and %02X)\n",
+                    names[conflict.first], names[conflict.second], conflict.address,
+                    conflict.first_value, conflict.second_value);
+            rc = EINVAL;
+        }
+        else if (0 != merge_rc)
+        {
+            fprintf(stderr, "Memory allocation failed\n");
+            rc = ENOMEM;
+        }
+        /* The merged image has all data, files are not needed any more */
+        for (i = 0; i < in->count; ++i)
+        {
+            unload_file(&in->file[i]);
+        }
+        in->count = 0;
+        in->image = &in->merged;
+        log_printf(log, 2, "Merged %u files\n", count);
+    }
+    free(src);
+    if (0 != rc)
+    {
+        unload_files(in);
+    }
+    return rc;
+}
+
+/* Parse files once and keep the result with its checksums */
+static int convert(char **names, unsigned int count, const char *output)
+{
+    const log_t log = { verbose_level, NULL, NULL };
+    input_t in;
+    const int rc = load_files(&log, names, count, NULL, NULL, &in);
+    if (0 != rc)
+    {
+        return rc;
+    }
+    int retcode = 0;
+    uint64_t hash;
+    if (0 != rl78img_write(&log, output, in.image, &hash))
+    {
+        fprintf(stderr, "Write failed\n");
+        retcode = EIO;
+    }
+    else
+    {
+        log_printf(&log, 1, "Image: %u segment(s), %u bytes, hash %08X%08X\n", in.image->count, image_payload(in.image),
+                   (unsigned int)(hash >> 32), (unsigned int)(hash & 0xFFFFFFFFU));
+    }
+    unload_files(&in);
+    return retcode;
+}
 
 int main(int argc, char *argv[])
 {
@@ -81,16 +1025,23 @@ int main(int argc, char *argv[])
     int baud = 115200;
     float voltage = 3.3f;
     char terminal = 0;
+    char event_loop = 0;
+    char stream = 0;
     int terminal_baud = 0;
     char nodata = 0;
     char nocode = 0;
     int proto_ver = -1;
     unsigned code_block_size = 0;
     unsigned data_block_size = 0;
+    int flags = 0;
+    const char *output = NULL;
+    const char *cache_dir = NULL;
+    patch_t patches[PATCH_MAX_COUNT];
+    unsigned int npatches = 0;
 
     char *endp;
     int opt;
-    while ((opt = getopt(argc, argv, "xyab:cvwrdeim:np:P:C:D:t:h?")) != -1)
+    while ((opt = getopt(argc, argv, "xyab:cvwrdeim:np:P:C:D:MRkKuSLt:o:z:I:h?")) != -1)
     {
         switch (opt)
         {
@@ -107,6 +1058,11 @@ int main(int argc, char *argv[])
             reset_after = 1;
             break;
         case 'b':
+            if (0 == strcmp(optarg, "auto"))
+            {
+                baud = BAUD_AUTO;
+                break;
+            }
             baud = strtoul(optarg, &endp, 10);
             if (optarg == endp)
             {
@@ -114,6 +1070,13 @@ int main(int argc, char *argv[])
                 printf("%s", usage);
                 return EINVAL;
             }
+            // BAUD_AUTO is asked for by name only
+            if (0 >= baud)
+            {
+                fprintf(stderr, "Invalid baudrate: %s\n", optarg);
+                printf("%s", usage);
+                return EINVAL;
+            }
             break;
         case 'm':
             mode = strtol(optarg, &endp, 10) - 1;
@@ -180,6 +1143,21 @@ int main(int argc, char *argv[])
                 return EINVAL;
             }
             break;
+        case 'M':
+            flags |= RL78_FLAG_MERGE_BLOCKS;
+            break;
+        case 'R':
+            flags |= RL78_FLAG_BISECT_BLANK_CHECK;
+            break;
+        case 'k':
+            flags |= RL78_FLAG_VERIFY_CHECKSUM;
+            break;
+        case 'K':
+            flags |= RL78_FLAG_VERIFY_CHECKSUM | RL78_FLAG_VERIFY_DATA;
+            break;
+        case 'u':
+            flags |= RL78_FLAG_DELTA;
+            break;
         case 'v':
             ++verbose_level;
             break;
@@ -204,6 +1182,35 @@ int main(int argc, char *argv[])
         case 'n':
             invert_reset = 1;
             break;
+        case 'o':
+            output = optarg;
+            break;
+        case 'z':
+            cache_dir = optarg;
+            break;
+        case 'L':
+            event_loop = 1;
+            break;
+        case 'S':
+            stream = 1;
+            break;
+        case 'I':
+            if (PATCH_MAX_COUNT == npatches)
+            {
+                fprintf(stderr, "Too many patches, at most %u are supported\n", PATCH_MAX_COUNT);
+                return EINVAL;
+            }
+            /* Values go into code or data flash, not across both */
+            if (0 != patch_parse(optarg, &patches[npatches])
+                || (DATA_OFFSET > patches[npatches].address
+                    ? DATA_OFFSET < patches[npatches].address + patches[npatches].size
+                    : DATA_OFFSET + IMAGE_DATA_SIZE < patches[npatches].address + patches[npatches].size))
+            {
+                fprintf(stderr, "Invalid patch: %s\n", optarg);
+                return EINVAL;
+            }
+            ++npatches;
+            break;
         case 'h':
         case '?':
             printf("%s", usage);
@@ -220,40 +1227,43 @@ int main(int argc, char *argv[])
         printf("rl78flash %s\n", VERSION);
     }
 
+    if (NULL != output)
+    {
+        if (1 > argc - optind)
+        {
+            printf("%s", usage);
+            return EINVAL;
+        }
+        return convert(&argv[optind], argc - optind, output);
+    }
+
     if (invert_reset)
     {
         mode |= MODE_INVERT_RESET;
     }
-    char *portname = NULL;
-    char *filename = NULL;
-    switch (argc - optind)
-    {
-    case 2:
-        filename = argv[optind + 1];
-        /* fall-through */
-    case 1:
-        portname = argv[optind + 0];
-        break;
-    default:
+    /* Blocks that differ from the file are erased while writing */
+    if (flags & RL78_FLAG_DELTA)
+    {
+        erase = 0;
+    }
+    if (1 > argc - optind)
+    {
         printf("%s", usage);
         return EINVAL;
     }
+    char *portname = argv[optind];
+    /* Several files are merged and programmed in one session */
+    char **filenames = &argv[optind + 1];
+    const unsigned int nfiles = argc - optind - 1;
 
     // If file is not specified, but required - show error message
-    if (NULL == filename
+    if (0 == nfiles
         && (1 == write || 1 == verify))
     {
         fprintf(stderr, "File not specified\n");
         return ENOENT;
     }
 
-    port_handle_t fd = serial_open(portname);
-    int rc = 0;
-    if (INVALID_HANDLE_VALUE == fd)
-    {
-        return EBADF;
-    }
-
     // If no actions are specified - do nothing :)
     if (0 == write
         && 0 == verify
@@ -265,227 +1275,174 @@ int main(int argc, char *argv[])
         return 0;
     }
 
-    int retcode = 0;
-    unsigned char *code = NULL;
-    unsigned char *data = NULL;
-
-    do
+    /* Several comma-separated ports are programmed in parallel */
+    char *ports[MAX_PORTS];
+    unsigned int nports = 0;
+    char *port = strtok(portname, ",");
+    while (NULL != port)
     {
-        if (1 == write
-            || 1 == erase
-            || 1 == verify
-            || 1 == display_info)
+        if (MAX_PORTS == nports)
         {
-            rc = rl78_reset_init(fd, wait, baud, mode, voltage);
-            if (0 > rc)
-            {
-                fprintf(stderr, "Initialization failed\n");
-                retcode = EIO;
-                break;
-            }
-            rc = rl78_cmd_reset(fd);
-            if (0 > rc)
-            {
-                fprintf(stderr, "Synchronization failed\n");
-                retcode = EIO;
-                break;
-            }
-            char device_name[11];
-            unsigned int code_size, data_size;
-            rc = rl78_cmd_silicon_signature(fd, device_name, &code_size, &data_size);
-            if (0 > rc)
-            {
-                fprintf(stderr, "Silicon signature read failed\n");
-                retcode = EIO;
-                break;
-            }
-            if (1 == display_info)
-            {
-                printf("Device: %s\n"
-                       "Code size: %u kB\n"
-                       "Data size: %u kB\n",
-                       device_name, code_size / 1024, data_size / 1024
-                    );
-            }
-            if (!code_size)
-            {
-                fprintf(stderr, "Invalid code size: %u\n", code_size);
-                retcode = EINVAL;
-                break;
-            }
-            /* Find device info */
-            const device_info_t *pinfo = rl78_devices;
-            while (pinfo->id)
-            {
-                if (!strncmp(pinfo->id, device_name, strlen(pinfo->id)))
-                    break;
-                pinfo++;
-            }
-            /* Apply autodetected values, if not defined explicitly */
-            if (pinfo->id)
-            {
-                if (proto_ver == -1)
-                    proto_ver = pinfo->protocol;
-                if (!code_block_size)
-                    code_block_size = pinfo->code_block_size;
-                if (!data_block_size)
-                    data_block_size = pinfo->data_block_size;
-            }
-            /* Verify config */
-            if (proto_ver < 0 || !code_block_size || !data_block_size)
-            {
-                fprintf(stderr, "Invalid protocol: protocol=%d, code_block=%u, data_block=%u\n",
-                        proto_ver, code_block_size, data_block_size);
-                retcode = EINVAL;
-                break;
-            }
-            /* The target device is fully defined. */
-            if (1 <= verbose_level)
-            {
-                printf("Protocol configuration: protocol=%d, code_block=%u, data_block=%u\n",
-                        proto_ver, code_block_size, data_block_size);
-            }
-            if (!nocode && (1 == erase))
-            {
-                if (1 <= verbose_level)
-                {
-                    printf("Erase code flash\n");
-                }
-                rc = rl78_erase(fd, CODE_OFFSET, code_size, code_block_size);
-                if (0 != rc)
-                {
-                    fprintf(stderr, "Code flash erase failed\n");
-                    retcode = EIO;
-                    break;
-                }
-            }
-            if (!nodata && (1 == erase && data_size))
-            {
-                if (1 <= verbose_level)
-                {
-                    printf("Erase data flash\n");
-                }
-                rc = rl78_erase(fd, DATA_OFFSET, data_size, data_block_size);
-                if (0 != rc)
-                {
-                    fprintf(stderr, "Data flash erase failed\n");
-                    retcode = EIO;
-                    break;
-                }
-            }
-
-            code = malloc(code_size);
-            if (data_size)
-                data = malloc(data_size);
+            fprintf(stderr, "Too many ports, at most %u are supported\n", MAX_PORTS);
+            return EINVAL;
+        }
+        ports[nports++] = port;
+        port = strtok(NULL, ",");
+    }
+    if (0 == nports)
+    {
+        printf("%s", usage);
+        return EINVAL;
+    }
+    if (1 < nports && (terminal || wait))
+    {
+        fprintf(stderr, "Terminal and delayed initialization need a single port\n");
+        return EINVAL;
+    }
+    /* The event loop covers the usual sequence, block by block. It has no range
+     * operations, checksum verify, update mode or baudrate detection. */
+    if (event_loop)
+    {
+#ifdef __linux__
+        const char *error = NULL;
+        if (1 == nports)
+        {
+            error = "-L needs several ports";
+        }
+        else if (BAUD_AUTO == baud)
+        {
+            error = "-L needs a fixed baudrate";
+        }
+        else if (0 != flags)
+        {
+            error = "-L is not supported with -M, -R, -k, -K or -u";
+        }
+        if (NULL != error)
+        {
+            fprintf(stderr, "%s\n", error);
+            return EINVAL;
+        }
+#else
+        fprintf(stderr, "-L is supported on Linux only\n");
+        return EINVAL;
+#endif
+    }
 
-            if (!code || (!data && data_size))
-            {
-                fprintf(stderr, "Memory allocation failed\n");
-                retcode = ENOMEM;
-                break;
-            }
-            if (1 == write
-                || 1 == verify)
-            {
-                memset(code, 0xFF, code_size);
-                if (data)
-                    memset(data, 0xFF, data_size);
-                if (1 <= verbose_level)
-                {
-                    printf("Read file \"%s\"\n", filename);
-                }
-                rc = srec_read(filename, code, code_size, data, data_size);
-                if (0 != rc)
-                {
-                    fprintf(stderr, "Read failed\n");
-                    retcode = EIO;
-                    break;
-                }
-            }
-            if (!nocode && (1 == write))
-            {
-                if (1 <= verbose_level)
-                {
-                    printf("Write code flash\n");
-                }
-                rc = rl78_program(fd, CODE_OFFSET, code, code_size, code_block_size, proto_ver);
-                if (0 != rc)
-                {
-                    fprintf(stderr, "Code flash write failed\n");
-                    retcode = EIO;
-                    break;
-                }
-            }
-            if (!nodata && (1 == write && data_size))
-            {
-                if (1 <= verbose_level)
-                {
-                    printf("Write data flash\n");
-                }
-                rc = rl78_program(fd, DATA_OFFSET, data, data_size, data_block_size, proto_ver);
-                if (0 != rc)
-                {
-                    fprintf(stderr, "Data flash write failed\n");
-                    retcode = EIO;
-                    break;
-                }
-            }
-            if (!nocode && (1 == verify))
-            {
-                if (1 <= verbose_level)
-                {
-                    printf("Verify Code flash\n");
-                }
-                rc = rl78_verify(fd, CODE_OFFSET, code, code_size, code_block_size);
-                if (0 != rc)
-                {
-                    fprintf(stderr, "Code flash verification failed\n");
-                    retcode = EIO;
-                    break;
-                }
-            }
-            if (!nodata && (1 == verify && data_size))
-            {
-                if (1 <= verbose_level)
-                {
-                    printf("Verify Data flash\n");
-                }
-                rc = rl78_verify(fd, DATA_OFFSET, data, data_size, data_block_size);
-                if (0 != rc)
-                {
-                    fprintf(stderr, "Data flash verification failed\n");
-                    retcode = EIO;
-                    break;
-                }
-            }
+    job_t job =
+    {
+        .erase = erase,
+        .write = write,
+        .verify = verify,
+        .reset_after = reset_after,
+        .wait = wait,
+        .display_info = display_info,
+        .nodata = nodata,
+        .nocode = nocode,
+        .terminal = terminal,
+        .event_loop = event_loop,
+        .mode = mode,
+        .baud = baud,
+        .voltage = voltage,
+        .proto_ver = proto_ver,
+        .code_block_size = code_block_size,
+        .data_block_size = data_block_size,
+        .flags = flags,
+        .terminal_baud = terminal_baud,
+        .image = NULL,
+        .frames = NULL,
+        .stream = NULL,
+        .units = NULL,
+        .patches = NULL,
+        .npatches = 0,
+    };
+    rl78_frame_cache_t frames;
+    memset(&frames, 0, sizeof frames);
+    input_t input;
+    memset(&input, 0, sizeof input);
+    image_init(&input.merged);
+    reader_t *reader = NULL;
+    image_t *units = NULL;
+    if (1 == write
+        || 1 == verify)
+    {
+        /* Files are read once for all targets, sizes of the devices are checked later */
+        const log_t log = { verbose_level, NULL, NULL };
+        /* With -S a single target starts to work while the file is still being read.
+         * Update mode compares checksums of whole blocks, it needs the file first,
+         * and so do patches. */
+        stream = stream && 1 == write && 1 == nports && !(flags & RL78_FLAG_DELTA) && 0 == npatches;
+        const int rc = load_files(&log, filenames, nfiles, cache_dir, stream ? &reader : NULL, &input);
+        if (0 != rc)
+        {
+            return rc;
+        }
+        job.image = input.image;
+        if (NULL != reader)
+        {
+            job.stream = &reader->stream;
         }
-        if (1 == terminal)
+        if (NULL != job.image)
         {
-            if (1 <= verbose_level)
+            log_printf(&log, 2, "Image: %u segment(s), %u bytes\n", job.image->count, image_payload(job.image));
+            /* Frames are the same for every target and pass, they are encoded once */
+            if (0 == rl78_frame_cache_add_image(&frames, job.image))
             {
-                printf("Start terminal\n");
+                job.frames = &frames;
             }
-            int reset_before_terminal = write || verify || erase
-                || reset_after || display_info;
-            terminal_start(fd, terminal_baud, mode, reset_before_terminal);
         }
-        else if (1 == reset_after)
+        /* Every target gets its own values, the rest of the image is shared */
+        if (0 != npatches)
         {
-            if (1 <= verbose_level)
+            units = patch_units(&log, job.image, patches, npatches, nports);
+            if (NULL == units)
             {
-                printf("Reset MCU\n");
+                fprintf(stderr, "Unable to make data of the units\n");
+                rl78_frame_cache_free(&frames);
+                unload_files(&input);
+                return EIO;
             }
-            rl78_reset(fd, mode);
+            job.units = units;
+            job.patches = patches;
+            job.npatches = npatches;
         }
     }
-    while (0);
 
-    if (code)
-        free(code);
-    if (data)
-        free(data);
-
-    serial_close(fd);
-    printf("\n");
+    int retcode = 0;
+    if (1 == nports)
+    {
+        target_t target =
+        {
+            .job = &job,
+            .portname = ports[0],
+            .image = units ? &units[0] : job.image,
+            .log = { verbose_level, NULL, NULL }
+        };
+        retcode = run_target(&target);
+        printf("\n");
+    }
+    else
+    {
+        retcode = run_gang(&job, ports, nports);
+    }
+    if (NULL != reader)
+    {
+        if (reader->started)
+        {
+            thread_join(&reader->thread);
+        }
+        image_stream_destroy(&reader->stream);
+        free(reader);
+    }
+    if (NULL != units)
+    {
+        unsigned int i;
+        for (i = 0; i < nports; ++i)
+        {
+            image_free(&units[i]);
+        }
+        free(units);
+    }
+    rl78_frame_cache_free(&frames);
+    unload_files(&input);
     return retcode;
 }
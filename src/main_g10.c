@@ -24,8 +24,15 @@
 #include <errno.h>
 #include "rl78g10.h"
 #include "serial.h"
-#include "srec.h"
+#include "rl78img.h"
+#include "image_cache.h"
+#include "input.h"
+#include "mapfile.h"
+#include "crc16_ccit.h"
 #include "terminal.h"
+#ifdef __linux__
+#include "rl78-async.h"
+#endif
 
 int verbose_level = 0;
 
@@ -45,8 +52,244 @@ const char *usage =
     "\t\t\tdefault: n=1\n"
     "\t-n\tInvert reset\n"
     "\t-t baud\tStart terminal with specified baudrate\n"
+    "\t-z dir\tCache parsed files in the directory, the same file is not parsed again\n"
     "\t-v\tVerbose mode\n"
-    "\t-h\tDisplay help\n";
+    "\t-h\tDisplay help\n"
+    "\n"
+    "<file> is an S-record, Intel HEX, ELF or precompiled image file, the format is\n"
+    "detected. A raw binary file is given as <file>@<address> of its first byte.\n"
+    "<file>@+<offset> or <file>@-<offset> moves the data of a file of any format.\n"
+#ifdef __linux__
+    "\n"
+    "<port> may be a comma-separated list of ports, those targets are programmed\n"
+    "in parallel and a summary is printed at the end (-d and -t are not allowed).\n"
+#endif
+    ;
+
+/* Copy the code flash part of an image, which must not have data beyond it */
+static int copy_image(const log_t *log, const image_t *img, unsigned char *code, int codesize)
+{
+    if (image_used(img, codesize, IMAGE_STREAM_SIZE - codesize))
+    {
+        log_printf(log, LOG_ERROR, "File does not fit into the device\n");
+        return -1;
+    }
+    const unsigned char *data = image_data(img, CODE_OFFSET, codesize, code);
+    if (data != code)
+    {
+        memcpy(code, data, codesize);
+    }
+    return 0;
+}
+
+/* Same as copy_image() with the data moved by offset first */
+static int copy_moved(const log_t *log, const image_t *img, int offset, unsigned char *code, int codesize)
+{
+    image_t moved;
+    image_init(&moved);
+    if (0 != image_move(&moved, img, offset))
+    {
+        log_printf(log, LOG_ERROR, "File does not fit into the device\n");
+        return -1;
+    }
+    const int rc = copy_image(log, &moved, code, codesize);
+    image_free(&moved);
+    return rc;
+}
+
+/* Flash contents of a file of any format, with its crc16(). The address of a
+ * raw binary file or the offset of any file is cut off its name. */
+static int read_file(const log_t *log, char *filename, const char *cache_dir,
+                     unsigned char *code, int codesize, unsigned int *crc)
+{
+    unsigned int address = 0;
+    int offset = 0;
+    const int moved = input_split_offset(filename, &offset);
+    const int binary = !moved && input_split_address(filename, &address);
+    mapfile_t file;
+    int rc = mapfile_open(&file, filename);
+    if (MAPFILE_NO_ERROR != rc)
+    {
+        log_printf(log, LOG_ERROR, "Unable to %s file \"%s\"\n", (MAPFILE_OPEN_ERROR == rc) ? "open" : "read", filename);
+        return -1;
+    }
+    const int format = binary ? INPUT_BINARY : input_detect(file.data, file.size);
+    if (INPUT_PRECOMPILED == format)
+    {
+        rl78img_t ri;
+        rc = rl78img_parse(log, file.data, file.size, &ri);
+        if (0 == rc)
+        {
+            rc = moved ? copy_moved(log, &ri.image, offset, code, codesize)
+                : copy_image(log, &ri.image, code, codesize);
+            if (0 == rc && (moved || 0 != rl78img_g10_crc(&ri, codesize, crc)))
+            {
+                *crc = crc16(code, codesize);
+            }
+            rl78img_free(&ri);
+        }
+    }
+    else if (INPUT_RECORDS == format
+             && NULL != cache_dir)
+    {
+        image_cache_t cache;
+        rc = image_cache_load(log, cache_dir, file.data, file.size, codesize, 0, &cache);
+        if (0 == rc)
+        {
+            rc = moved ? copy_moved(log, cache.image, offset, code, codesize)
+                : copy_image(log, cache.image, code, codesize);
+            if (0 == rc)
+            {
+                if (moved || NULL == cache.precompiled || 0 != rl78img_g10_crc(cache.precompiled, codesize, crc))
+                {
+                    *crc = crc16(code, codesize);
+                }
+            }
+            image_cache_free(&cache);
+        }
+    }
+    else if (moved)
+    {
+        image_t img;
+        image_init(&img);
+        rc = input_parse_image(log, format, address, file.data, file.size, codesize, 0, &img);
+        if (0 == rc)
+        {
+            rc = copy_moved(log, &img, offset, code, codesize);
+            *crc = crc16(code, codesize);
+        }
+        image_free(&img);
+    }
+    else
+    {
+        rc = input_parse(log, format, address, file.data, file.size, code, codesize, NULL, 0);
+        *crc = crc16(code, codesize);
+    }
+    mapfile_close(&file);
+    return rc;
+}
+
+#ifdef __linux__
+#define MAX_PORTS 64
+
+typedef struct
+{
+    const char *portname;
+    rl78_session_t session;
+    rl78_async_t async;
+    log_t log;
+    /* Output is collected into lines to keep targets apart */
+    char line[256];
+    unsigned int line_len;
+} target_t;
+
+static void target_flush_line(target_t *t)
+{
+    printf("[%s] %.*s\n", t->portname, (int)t->line_len, t->line);
+    fflush(stdout);
+    t->line_len = 0;
+}
+
+/* All targets run in one thread, lines are printed as they are complete */
+static void target_log(void *ctx, int level, const char *message)
+{
+    target_t *t = ctx;
+    (void)level;
+    for (; *message; ++message)
+    {
+        if ('\n' == *message)
+        {
+            target_flush_line(t);
+            continue;
+        }
+        if (sizeof t->line == t->line_len)
+        {
+            target_flush_line(t);
+        }
+        t->line[t->line_len++] = *message;
+    }
+}
+
+/* Program all targets by a single event loop, then print a summary */
+static int run_gang(char *ports[], unsigned int nports, int mode, const unsigned char *code, int codesize,
+                    int write, int verify, int reset_after)
+{
+    target_t *targets = calloc(nports, sizeof *targets);
+    rl78_async_loop_t loop;
+    if (NULL == targets || 0 != rl78_async_loop_init(&loop))
+    {
+        fprintf(stderr, "Unable to start\n");
+        free(targets);
+        return ENOMEM;
+    }
+    const serial_time_t start = serial_time();
+    unsigned int i;
+    for (i = 0; i < nports; ++i)
+    {
+        target_t *t = &targets[i];
+        t->portname = ports[i];
+        t->log.verbose_level = verbose_level;
+        t->log.sink = target_log;
+        t->log.ctx = t;
+        if (0 != rl78_session_open(&t->session, t->portname, mode, &t->log))
+        {
+            t->async.error = "Unable to open port";
+            continue;
+        }
+        t->async.session = &t->session;
+        t->async.family = RL78_ASYNC_G10;
+        if (write)
+        {
+            rl78_async_add_op(&t->async, RL78_ASYNC_PROGRAM, "Write", CODE_OFFSET, code, codesize);
+        }
+        if (verify)
+        {
+            rl78_async_add_op(&t->async, RL78_ASYNC_VERIFY, "Verify", CODE_OFFSET, code, codesize);
+        }
+        if (reset_after)
+        {
+            rl78_async_add_op(&t->async, RL78_ASYNC_RESET, "Reset MCU", 0, NULL, 0);
+        }
+        if (0 > serial_set_parity(t->session.port, ENABLE, ODD)
+            || 0 != rl78_async_start(&loop, &t->async))
+        {
+            t->async.error = "Unable to start";
+            rl78_session_close(&t->session);
+        }
+    }
+    rl78_async_run(&loop);
+    rl78_async_loop_close(&loop);
+    const serial_time_t total = serial_time() - start;
+    int retcode = 0;
+    unsigned int failed = 0;
+    printf("\n%-24s %-6s %8s\n", "Port", "Result", "Time, s");
+    for (i = 0; i < nports; ++i)
+    {
+        target_t *t = &targets[i];
+        if (NULL != t->session.port)
+        {
+            rl78_session_close(&t->session);
+        }
+        if (t->line_len)
+        {
+            target_flush_line(t);
+        }
+        const char *error = t->async.error;
+        const serial_time_t time = t->async.finish_time ? t->async.finish_time - start : 0;
+        printf("%-24s %-6s %8.2f%s%s\n",
+               ports[i], error ? "FAIL" : "PASS", time / 1000000.0,
+               error ? "  " : "", error ? error : "");
+        if (error)
+        {
+            ++failed;
+            retcode = EIO;
+        }
+    }
+    printf("%u of %u passed in %.2f s\n", nports - failed, nports, total / 1000000.0);
+    free(targets);
+    return retcode;
+}
+#endif
 
 int main(int argc, char *argv[])
 {
@@ -54,14 +297,15 @@ int main(int argc, char *argv[])
     char write = 0;
     char reset_after = 0;
     char wait = 0;
-    char mode = 0;
+    int mode = 1;
     char invert_reset = 0;
     char terminal = 0;
     int terminal_baud = 0;
+    const char *cache_dir = NULL;
 
     char *endp;
     int opt;
-    while ((opt = getopt(argc, argv, "acvwrdm:nt:h?")) != -1)
+    while ((opt = getopt(argc, argv, "acvwrdm:nt:z:h?")) != -1)
     {
         switch (opt)
         {
@@ -71,9 +315,9 @@ int main(int argc, char *argv[])
             reset_after = 1;
             break;
         case 'm':
-            mode = strtol(optarg, &endp, 10) - 1;
+            mode = strtol(optarg, &endp, 10);
             if (optarg == endp
-                || MODE_MAX_VALUE < mode)
+                || 1 > mode || 2 < mode)
             {
                 fprintf(stderr, "Invalid mode\n");
                 printf("%s", usage);
@@ -93,6 +337,9 @@ int main(int argc, char *argv[])
         case 'v':
             ++verbose_level;
             break;
+        case 'z':
+            cache_dir = optarg;
+            break;
         case 'c':
             verify = 1;
             break;
@@ -124,6 +371,8 @@ int main(int argc, char *argv[])
         printf("rl78g10flash %s\n", VERSION);
     }
 
+    /* Same mode bits as of rl78flash, the UART is always single-wire */
+    mode = MODE_UART_1 | ((2 == mode) ? MODE_RESET_RTS : MODE_RESET_DTR);
     if (invert_reset)
     {
         mode |= MODE_INVERT_RESET;
@@ -185,17 +434,60 @@ int main(int argc, char *argv[])
         return 0;
     }
 
-    port_handle_t fd = serial_open(portname);
+#ifdef __linux__
+    /* Several comma-separated ports are programmed in parallel */
+    if (NULL != strchr(portname, ','))
+    {
+        char *ports[MAX_PORTS];
+        unsigned int nports = 0;
+        char *port = strtok(portname, ",");
+        while (NULL != port)
+        {
+            if (MAX_PORTS == nports)
+            {
+                fprintf(stderr, "Too many ports, at most %u are supported\n", MAX_PORTS);
+                return EINVAL;
+            }
+            ports[nports++] = port;
+            port = strtok(NULL, ",");
+        }
+        if (terminal || wait)
+        {
+            fprintf(stderr, "Terminal and delayed initialization need a single port\n");
+            return EINVAL;
+        }
+        unsigned char code[codesize ? codesize : 1];
+        memset(code, 0xFF, sizeof code);
+        if (write || verify)
+        {
+            if (1 <= verbose_level)
+            {
+                printf("Read file \"%s\"\n", filename);
+            }
+            const log_t log = { verbose_level, NULL, NULL };
+            unsigned int crc;
+            if (0 != read_file(&log, filename, cache_dir, code, codesize, &crc))
+            {
+                fprintf(stderr, "Read failed\n");
+                return EIO;
+            }
+        }
+        return run_gang(ports, nports, mode, code, codesize, write, verify, reset_after);
+    }
+#endif
+
+    rl78_session_t session;
+    const log_t log = { verbose_level, NULL, NULL };
     int rc = 0;
-    if (INVALID_HANDLE_VALUE == fd)
+    if (0 != rl78_session_open(&session, portname, mode, &log))
     {
         return EBADF;
     }
-    rc = serial_set_parity(fd, ENABLE, ODD);
+    rc = serial_set_parity(session.port, ENABLE, ODD);
     if (rc < 0)
     {
         perror("Failed to set port attributes:");
-        serial_close(fd);
+        rl78_session_close(&session);
         return EIO;
     }
 
@@ -204,7 +496,7 @@ int main(int argc, char *argv[])
     {
         if (1 == write || 1 == verify)
         {
-            rc = rl78g10_reset_init(fd, wait, mode);
+            rc = rl78g10_reset_init(&session, wait);
             if (0 > rc)
             {
                 fprintf(stderr, "Initialization failed\n");
@@ -218,7 +510,8 @@ int main(int argc, char *argv[])
             {
                 printf("Read file \"%s\"\n", filename);
             }
-            rc = srec_read(filename, code, codesize, NULL, 0);
+            unsigned int crc;
+            rc = read_file(&session.log, filename, cache_dir, code, codesize, &crc);
             if (0 != rc)
             {
                 fprintf(stderr, "Read failed\n");
@@ -232,7 +525,7 @@ int main(int argc, char *argv[])
                 {
                     printf("Write\n");
                 }
-                rc = rl78g10_erase_write(fd, code, codesize);
+                rc = rl78g10_erase_write(&session, code, codesize);
                 if (0 != rc)
                 {
                     fprintf(stderr, "Write failed\n");
@@ -246,7 +539,7 @@ int main(int argc, char *argv[])
                 {
                     printf("Verify\n");
                 }
-                rc = rl78g10_crc_check(fd, code, codesize);
+                rc = rl78g10_crc_check_value(&session, crc, codesize);
                 if (0 != rc)
                 {
                     fprintf(stderr, "Verify failed\n");
@@ -262,8 +555,8 @@ int main(int argc, char *argv[])
                 printf("Start terminal\n");
             }
             int reset_before_terminal = write || verify || reset_after;
-            serial_set_parity(fd, DISABLE, 0);
-            terminal_start(fd, terminal_baud, mode, reset_before_terminal);
+            serial_set_parity(session.port, DISABLE, 0);
+            terminal_start(&session, terminal_baud, reset_before_terminal);
         }
         else if (1 == reset_after)
         {
@@ -271,11 +564,11 @@ int main(int argc, char *argv[])
             {
                 printf("Reset MCU\n");
             }
-            rl78_reset(fd, mode);
+            rl78_reset(&session);
         }
     }
     while (0);
-    serial_close(fd);
+    rl78_session_close(&session);
     printf("\n");
     return retcode;
 }
@@ -0,0 +1,144 @@
+/*********************************************************************************************************************
+ * The MIT License (MIT)                                                                                             *
+ * Copyright (c) 2026 rl78flash contributors                                                                         *
+ *                                                                                                                   *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated      *
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation   *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and  *
+ * to permit persons to whom the Software is furnished to do so, subject to the following conditions:                *
+ *                                                                                                                   *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions     *
+ * of the Software.                                                                                                  *
+ *                                                                                                                   *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO  *
+ * THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF         *
+ * CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+ * IN THE SOFTWARE.                                                                                                  *
+ *********************************************************************************************************************/
+
+#include "mapfile.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+int mapfile_begin(mapfile_t *m, const char *filename)
+{
+    memset(m, 0, sizeof *m);
+    m->fd = -1;
+    const int fd = open(filename, O_RDONLY);
+    if (0 > fd)
+    {
+        return MAPFILE_OPEN_ERROR;
+    }
+    struct stat st;
+    if (0 != fstat(fd, &st))
+    {
+        close(fd);
+        return MAPFILE_READ_ERROR;
+    }
+    if (S_ISREG(st.st_mode)
+        && 0 < st.st_size
+        && (size_t)-1 >= (unsigned long long)st.st_size)
+    {
+        void *p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (MAP_FAILED != p)
+        {
+            // Records are parsed front to back, let the kernel read ahead
+            madvise(p, st.st_size, MADV_SEQUENTIAL);
+            close(fd);
+            m->data = p;
+            m->size = st.st_size;
+            m->mapped = 1;
+            return MAPFILE_NO_ERROR;
+        }
+    }
+    // Pipes, character devices and file systems without mmap are read into a buffer
+    m->fd = fd;
+    return MAPFILE_NO_ERROR;
+}
+
+int mapfile_more(mapfile_t *m)
+{
+    if (0 > m->fd)
+    {
+        return 0;
+    }
+    if (m->size == m->capacity)
+    {
+        const size_t capacity = m->capacity ? m->capacity * 2U : 64U * 1024U;
+        char *buf = realloc((void*)m->data, capacity);
+        if (NULL == buf)
+        {
+            return MAPFILE_READ_ERROR;
+        }
+        m->data = buf;
+        m->capacity = capacity;
+    }
+    for (;;)
+    {
+        const ssize_t rc = read(m->fd, (char*)m->data + m->size, m->capacity - m->size);
+        if (0 > rc)
+        {
+            if (EINTR == errno)
+            {
+                continue;
+            }
+            return MAPFILE_READ_ERROR;
+        }
+        if (0 == rc)
+        {
+            close(m->fd);
+            m->fd = -1;
+        }
+        m->size += rc;
+        return (int)rc;
+    }
+}
+
+int mapfile_rest(mapfile_t *m)
+{
+    int more;
+    do
+    {
+        more = mapfile_more(m);
+    }
+    while (0 < more);
+    return (0 > more) ? MAPFILE_READ_ERROR : MAPFILE_NO_ERROR;
+}
+
+int mapfile_open(mapfile_t *m, const char *filename)
+{
+    int rc = mapfile_begin(m, filename);
+    if (MAPFILE_NO_ERROR == rc)
+    {
+        rc = mapfile_rest(m);
+        if (MAPFILE_NO_ERROR != rc)
+        {
+            mapfile_close(m);
+        }
+    }
+    return rc;
+}
+
+void mapfile_close(mapfile_t *m)
+{
+    if (m->mapped)
+    {
+        munmap((void*)m->data, m->size);
+    }
+    else
+    {
+        free((void*)m->data);
+    }
+    if (0 <= m->fd)
+    {
+        close(m->fd);
+    }
+    memset(m, 0, sizeof *m);
+    m->fd = -1;
+}
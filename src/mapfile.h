@@ -0,0 +1,50 @@
+/*********************************************************************************************************************
+ * The MIT License (MIT)                                                                                             *
+ * Copyright (c) 2026 rl78flash contributors                                                                         *
+ *                                                                                                                   *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated      *
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation   *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and  *
+ * to permit persons to whom the Software is furnished to do so, subject to the following conditions:                *
+ *                                                                                                                   *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions     *
+ * of the Software.                                                                                                  *
+ *                                                                                                                   *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO  *
+ * THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF         *
+ * CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+ * IN THE SOFTWARE.                                                                                                  *
+ *********************************************************************************************************************/
+
+#ifndef MAPFILE_H__
+#define MAPFILE_H__
+
+#include <stddef.h>
+
+#define MAPFILE_NO_ERROR        (0)
+#define MAPFILE_OPEN_ERROR      (-1)
+#define MAPFILE_READ_ERROR      (-2)
+
+/* Contents of a whole file, mapped into memory when the file allows it, read otherwise */
+typedef struct
+{
+    const char *data;
+    size_t size;
+    int mapped;
+    /* Private, files which are read */
+    int fd;
+    size_t capacity;
+} mapfile_t;
+
+int mapfile_open(mapfile_t *m, const char *filename);
+/* Same as mapfile_open(), but a file which can not be mapped is not read yet.
+ * mapfile_more() appends what arrives next, the data may move. It returns the
+ * number of bytes added, 0 at the end of the file or MAPFILE_READ_ERROR. */
+int mapfile_begin(mapfile_t *m, const char *filename);
+int mapfile_more(mapfile_t *m);
+/* Read what is left of a file opened by mapfile_begin() */
+int mapfile_rest(mapfile_t *m);
+void mapfile_close(mapfile_t *m);
+
+#endif  // MAPFILE_H__
@@ -0,0 +1,96 @@
+/*********************************************************************************************************************
+ * The MIT License (MIT)                                                                                             *
+ * Copyright (c) 2026 rl78flash contributors                                                                         *
+ *                                                                                                                   *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated      *
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation   *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and  *
+ * to permit persons to whom the Software is furnished to do so, subject to the following conditions:                *
+ *                                                                                                                   *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions     *
+ * of the Software.                                                                                                  *
+ *                                                                                                                   *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO  *
+ * THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF         *
+ * CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+ * IN THE SOFTWARE.                                                                                                  *
+ *********************************************************************************************************************/
+
+#include "mapfile.h"
+#include <windows.h>
+#include <string.h>
+
+int mapfile_open(mapfile_t *m, const char *filename)
+{
+    memset(m, 0, sizeof *m);
+    m->fd = -1;
+    HANDLE file = CreateFile(filename,
+                             GENERIC_READ,
+                             FILE_SHARE_READ,
+                             NULL,
+                             OPEN_EXISTING,
+                             FILE_ATTRIBUTE_NORMAL,
+                             NULL);
+    if (INVALID_HANDLE_VALUE == file)
+    {
+        return MAPFILE_OPEN_ERROR;
+    }
+    LARGE_INTEGER size;
+    if (0 == GetFileSizeEx(file, &size))
+    {
+        CloseHandle(file);
+        return MAPFILE_READ_ERROR;
+    }
+    if (0 == size.QuadPart)
+    {
+        // Empty files can not be mapped, there is nothing to parse anyway
+        CloseHandle(file);
+        return MAPFILE_NO_ERROR;
+    }
+    HANDLE mapping = CreateFileMapping(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(file);
+    if (NULL == mapping)
+    {
+        return MAPFILE_READ_ERROR;
+    }
+    // The view keeps the mapping alive
+    const void *view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping);
+    if (NULL == view)
+    {
+        return MAPFILE_READ_ERROR;
+    }
+    m->data = view;
+    m->size = (size_t)size.QuadPart;
+    m->mapped = 1;
+    return MAPFILE_NO_ERROR;
+}
+
+/* Files are always mapped, there is nothing to read in pieces */
+int mapfile_begin(mapfile_t *m, const char *filename)
+{
+    return mapfile_open(m, filename);
+}
+
+int mapfile_more(mapfile_t *m)
+{
+    (void)m;
+    return 0;
+}
+
+int mapfile_rest(mapfile_t *m)
+{
+    (void)m;
+    return MAPFILE_NO_ERROR;
+}
+
+void mapfile_close(mapfile_t *m)
+{
+    if (m->mapped)
+    {
+        UnmapViewOfFile(m->data);
+    }
+    memset(m, 0, sizeof *m);
+    m->fd = -1;
+}
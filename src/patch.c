@@ -0,0 +1,311 @@
+/*********************************************************************************************************************
+ * The MIT License (MIT)                                                                                             *
+ * Copyright (c) 2026 rl78flash contributors                                                                         *
+ *                                                                                                                   *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated      *
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation   *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and  *
+ * to permit persons to whom the Software is furnished to do so, subject to the following conditions:                *
+ *                                                                                                                   *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions     *
+ * of the Software.                                                                                                  *
+ *                                                                                                                   *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO  *
+ * THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF         *
+ * CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+ * IN THE SOFTWARE.                                                                                                  *
+ *********************************************************************************************************************/
+
+#include "patch.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#define PATCH_LINE          1024
+#define PATCH_PATH          1024
+
+/* Hex digits of a value, separators used in MAC addresses and keys are skipped */
+static int patch_hex(const char *text, size_t len, unsigned char *out, unsigned int size)
+{
+    unsigned int digits = 0;
+    size_t i;
+    for (i = 0; i < len; ++i)
+    {
+        const char c = text[i];
+        if (':' == c || '-' == c || ' ' == c)
+        {
+            continue;
+        }
+        if (!isxdigit((unsigned char)c) || digits >= size * 2U)
+        {
+            return -1;
+        }
+        const unsigned int nibble = isdigit((unsigned char)c) ? c - '0' : (toupper((unsigned char)c) - 'A' + 10);
+        out[digits / 2U] = (digits % 2U) ? (out[digits / 2U] | nibble) : (nibble << 4);
+        ++digits;
+    }
+    return size * 2U == digits ? 0 : -1;
+}
+
+int patch_parse(char *spec, patch_t *p)
+{
+    char *endp;
+    memset(p, 0, sizeof *p);
+    p->address = strtoul(spec, &endp, 0);
+    if (spec == endp || ':' != *endp)
+    {
+        return -1;
+    }
+    char *size = endp + 1;
+    p->size = strtoul(size, &endp, 0);
+    if (size == endp || ':' != *endp || 0 == p->size || PATCH_MAX_SIZE < p->size)
+    {
+        return -1;
+    }
+    char *source = endp + 1;
+    if (0 == strncmp(source, "hex:", 4))
+    {
+        p->source = PATCH_HEX;
+        return patch_hex(source + 4, strlen(source + 4), p->value, p->size);
+    }
+    if (0 == strncmp(source, "counter:", 8) && '\0' != source[8])
+    {
+        p->source = PATCH_COUNTER;
+        p->file = source + 8;
+        return sizeof(unsigned long long) >= p->size ? 0 : -1;
+    }
+    if (0 == strncmp(source, "csv:", 4))
+    {
+        // The column follows the last colon, the name may have colons of its own
+        char *colon = strrchr(source + 4, ':');
+        if (NULL == colon || source + 4 == colon)
+        {
+            return -1;
+        }
+        p->source = PATCH_CSV;
+        p->column = strtoul(colon + 1, &endp, 10);
+        if (colon + 1 == endp || '\0' != *endp || 0 == p->column)
+        {
+            return -1;
+        }
+        // The name ends where the column starts
+        *colon = '\0';
+        p->file = source + 4;
+        return 0;
+    }
+    if (0 == strcmp(source, "stdin"))
+    {
+        p->source = PATCH_STDIN;
+        return 0;
+    }
+    return -1;
+}
+
+/* Number kept in a file, 0 if there is no file yet */
+static int number_load(const log_t *log, const char *path, unsigned long long *value)
+{
+    *value = 0;
+    FILE *f = fopen(path, "r");
+    if (NULL == f)
+    {
+        return 0;
+    }
+    char line[PATCH_LINE];
+    int rc = 0;
+    if (NULL != fgets(line, sizeof line, f))
+    {
+        char *endp;
+        *value = strtoull(line, &endp, 0);
+        if (line == endp || ('\0' != *endp && '\n' != *endp && '\r' != *endp))
+        {
+            log_printf(log, LOG_ERROR, "File \"%s\" does not hold a number\n", path);
+            rc = -1;
+        }
+    }
+    fclose(f);
+    return rc;
+}
+
+static int number_store(const log_t *log, const char *path, unsigned long long value)
+{
+    char tmp_path[PATCH_PATH + 4];
+    snprintf(tmp_path, sizeof tmp_path, "%s.tmp", path);
+    FILE *out = fopen(tmp_path, "w");
+    if (NULL != out)
+    {
+        fprintf(out, "%llu\n", value);
+        if (0 != fclose(out))
+        {
+            remove(tmp_path);
+            out = NULL;
+        }
+    }
+#ifdef WIN32
+    // rename() does not replace existing files on Windows
+    remove(path);
+#endif
+    if (NULL == out || 0 != rename(tmp_path, path))
+    {
+        remove(tmp_path);
+        log_printf(log, LOG_ERROR, "Unable to write file \"%s\"\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+/* Field of a CSV row, rows are the non-empty lines from 1 */
+static int csv_field(const log_t *log, const char *path, unsigned long long row, unsigned int column,
+                     unsigned char *out, unsigned int size)
+{
+    FILE *f = fopen(path, "r");
+    if (NULL == f)
+    {
+        log_printf(log, LOG_ERROR, "Unable to open file \"%s\"\n", path);
+        return -1;
+    }
+    char line[PATCH_LINE];
+    unsigned long long n = 0;
+    int rc = -1;
+    while (NULL != fgets(line, sizeof line, f))
+    {
+        line[strcspn(line, "\r\n")] = '\0';
+        if ('\0' == line[0] || ++n != row)
+        {
+            continue;
+        }
+        const char *field = line;
+        unsigned int i;
+        for (i = 1; i < column && NULL != field; ++i)
+        {
+            field = strchr(field, ',');
+            field = NULL != field ? field + 1 : NULL;
+        }
+        if (NULL == field || 0 != patch_hex(field, strcspn(field, ","), out, size))
+        {
+            log_printf(log, LOG_ERROR, "Column %u of row %llu of \"%s\" is not %u bytes of hex digits\n",
+                       column, row, path, size);
+        }
+        else
+        {
+            rc = 0;
+        }
+        break;
+    }
+    if (n < row)
+    {
+        log_printf(log, LOG_ERROR, "File \"%s\" has no row %llu\n", path, row);
+    }
+    fclose(f);
+    return rc;
+}
+
+/* Counters are moved on once per file, where each file is first named */
+static unsigned int patch_first(const patch_t *patch, unsigned int i)
+{
+    unsigned int j;
+    for (j = 0; j < i; ++j)
+    {
+        if (patch[j].source == patch[i].source && NULL != patch[i].file && 0 == strcmp(patch[j].file, patch[i].file))
+        {
+            break;
+        }
+    }
+    return j;
+}
+
+static int patch_state_path(char *path, const patch_t *p)
+{
+    const int len = snprintf(path, PATCH_PATH, PATCH_CSV == p->source ? "%s.next" : "%s", p->file);
+    return (0 < len && len < PATCH_PATH) ? 0 : -1;
+}
+
+int patch_values(const log_t *log, const patch_t *patch, unsigned int count, unsigned int units, unsigned char **values)
+{
+    unsigned long long start[PATCH_MAX_COUNT];
+    char path[PATCH_PATH];
+    unsigned int i;
+    unsigned int unit;
+    if (PATCH_MAX_COUNT < count)
+    {
+        return -1;
+    }
+    // Numbers and rows are taken first, then values are made of them
+    for (i = 0; i < count; ++i)
+    {
+        const patch_t *p = &patch[i];
+        start[i] = 0;
+        if (PATCH_COUNTER != p->source && PATCH_CSV != p->source)
+        {
+            continue;
+        }
+        if (0 != patch_state_path(path, p))
+        {
+            return -1;
+        }
+        if (0 != number_load(log, path, &start[i]))
+        {
+            return -1;
+        }
+        // Rows of a CSV file count from 1
+        if (PATCH_CSV == p->source && 0 == start[i])
+        {
+            start[i] = 1;
+        }
+    }
+    for (unit = 0; unit < units; ++unit)
+    {
+        for (i = 0; i < count; ++i)
+        {
+            const patch_t *p = &patch[i];
+            unsigned char *value = values[i] + unit * p->size;
+            if (PATCH_HEX == p->source)
+            {
+                memcpy(value, p->value, p->size);
+            }
+            else if (PATCH_COUNTER == p->source)
+            {
+                const unsigned long long number = start[i] + unit;
+                unsigned int j;
+                if (sizeof number > p->size && 0 != (number >> (p->size * 8U)))
+                {
+                    log_printf(log, LOG_ERROR, "Counter %llu of \"%s\" does not fit into %u bytes\n",
+                               number, p->file, p->size);
+                    return -1;
+                }
+                for (j = 0; j < p->size; ++j)
+                {
+                    value[j] = (number >> (j * 8U)) & 0xFF;
+                }
+            }
+            else if (PATCH_CSV == p->source)
+            {
+                if (0 != csv_field(log, p->file, start[i] + unit, p->column, value, p->size))
+                {
+                    return -1;
+                }
+            }
+            else
+            {
+                char line[PATCH_LINE];
+                if (NULL == fgets(line, sizeof line, stdin)
+                    || 0 != patch_hex(line, strcspn(line, "\r\n"), value, p->size))
+                {
+                    log_printf(log, LOG_ERROR, "No value of %u bytes on stdin for %06X\n", p->size, p->address);
+                    return -1;
+                }
+            }
+        }
+    }
+    for (i = 0; i < count; ++i)
+    {
+        if ((PATCH_COUNTER == patch[i].source || PATCH_CSV == patch[i].source)
+            && i == patch_first(patch, i)
+            && (0 != patch_state_path(path, &patch[i]) || 0 != number_store(log, path, start[i] + units)))
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,55 @@
+/*********************************************************************************************************************
+ * The MIT License (MIT)                                                                                             *
+ * Copyright (c) 2026 rl78flash contributors                                                                         *
+ *                                                                                                                   *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated      *
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation   *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and  *
+ * to permit persons to whom the Software is furnished to do so, subject to the following conditions:                *
+ *                                                                                                                   *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions     *
+ * of the Software.                                                                                                  *
+ *                                                                                                                   *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO  *
+ * THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF         *
+ * CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+ * IN THE SOFTWARE.                                                                                                  *
+ *********************************************************************************************************************/
+
+#ifndef PATCH_H__
+#define PATCH_H__
+
+#include "log.h"
+
+#define PATCH_MAX_SIZE      64U     /* Longest value, enough for keys */
+#define PATCH_MAX_COUNT     16U     /* Patches of a run */
+
+#define PATCH_HEX           0       /* Same bytes for every unit */
+#define PATCH_COUNTER       1       /* Number kept in a file, little-endian, one per unit */
+#define PATCH_CSV           2       /* Column of a CSV file, one row per unit */
+#define PATCH_STDIN         3       /* Line of hex digits read from stdin for every unit */
+
+/* Data of a unit written over the image when it is programmed */
+typedef struct
+{
+    unsigned int address;
+    unsigned int size;
+    int source;
+    const char *file;           /* Counter or CSV file */
+    unsigned int column;        /* Column of the CSV file, from 1 */
+    unsigned char value[PATCH_MAX_SIZE];    /* Bytes of PATCH_HEX */
+} patch_t;
+
+/* Parse "<address>:<length>:<source>", the source being hex:<digits>,
+ * counter:<file>, csv:<file>:<column> or stdin. Names of files point into
+ * spec, which is cut there. Returns 0 or -1. */
+int patch_parse(char *spec, patch_t *p);
+/* Values of all patches for a number of units, values[i] gets the values of
+ * patch[i] for every unit one after another. A counter file and the next row
+ * of a CSV file, kept in <file>.next, are moved past the units before anything
+ * is programmed, so no value is given twice even if programming fails.
+ * Patches of the same file get the same number or row of it. */
+int patch_values(const log_t *log, const patch_t *patch, unsigned int count, unsigned int units, unsigned char **values);
+
+#endif  // PATCH_H__
@@ -0,0 +1,822 @@
+/*********************************************************************************************************************
+ * The MIT License (MIT)                                                                                             *
+ * Copyright (c) 2026 rl78flash contributors                                                                         *
+ *                                                                                                                   *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated      *
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation   *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and  *
+ * to permit persons to whom the Software is furnished to do so, subject to the following conditions:                *
+ *                                                                                                                   *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions     *
+ * of the Software.                                                                                                  *
+ *                                                                                                                   *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO  *
+ * THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF         *
+ * CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+ * IN THE SOFTWARE.                                                                                                  *
+ *********************************************************************************************************************/
+
+/* Built on Linux only, other systems drive gang targets from threads */
+#ifdef __linux__
+
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "serial.h"
+#include "rl78.h"
+#include "rl78g10.h"
+#include "crc16_ccit.h"
+#include "rl78-async.h"
+
+/* What a target waits for */
+#define WAIT_NONE   0
+#define WAIT_DELAY  1   /* Timer only, a hold time of the entry sequence */
+#define WAIT_FRAME  2   /* RL78 response frame, the timer is its timeout */
+#define WAIT_BYTES  3   /* G10 response bytes, the timer is their timeout */
+
+/* States, each is resumed when its wait is over */
+#define ST_START                0
+#define ST_RESET_RELEASE        1
+#define ST_TOOL0_HIGH           2
+#define ST_SET_MODE             3
+#define ST_BAUD_RATE_SET        4
+#define ST_BAUD_RATE_SET_STATUS 5
+#define ST_RESET_STATUS         6
+#define ST_SIGNATURE_STATUS     7
+#define ST_SIGNATURE_DATA       8
+#define ST_BLANK_CHECK_STATUS   9
+#define ST_ERASE_STATUS         10
+#define ST_COMMAND_STATUS       11  /* Programming or Verify command accepted */
+#define ST_FRAME_STATUS         12
+#define ST_PROGRAM_COMPLETE     13
+#define ST_RUN                  14
+#define ST_G10_MODE_STATUS      15
+#define ST_G10_SIZE             16
+#define ST_G10_ACCEPTED         17
+#define ST_G10_ERASED           18
+#define ST_G10_WORD_STATUS      19
+#define ST_G10_WRITE_STATUS     20
+#define ST_G10_CRC              21
+#define ST_PROGRAM_SETTLED      22  /* Protocol C sends no completion status, waited for */
+#define ST_DONE                 23
+
+/* Events are tagged with the slot of the target, the low bit marks its timer */
+#define EVENT_TAG(index, timer) (((uint64_t)(index) << 1) | (timer))
+
+#define MAX_EVENTS 32
+
+static void async_advance(rl78_async_t *a);
+
+static void async_arm(rl78_async_t *a, unsigned int timeout_us)
+{
+    struct itimerspec its;
+    memset(&its, 0, sizeof its);
+    its.it_value.tv_sec = timeout_us / 1000000U;
+    its.it_value.tv_nsec = (timeout_us % 1000000U) * 1000U;
+    timerfd_settime(a->timer_fd, 0, &its, NULL);
+}
+
+/* Input is only polled while a response is awaited */
+static void async_watch(rl78_async_t *a, int enable)
+{
+    if (enable == a->watching)
+    {
+        return;
+    }
+    struct epoll_event ev;
+    ev.events = enable ? EPOLLIN : 0;
+    ev.data.u64 = EVENT_TAG(a->index, 0);
+    epoll_ctl(a->loop->epoll_fd, EPOLL_CTL_MOD, serial_fd(a->session->port), &ev);
+    a->watching = enable;
+}
+
+static void async_delay(rl78_async_t *a, int state, unsigned int delay_us)
+{
+    a->state = state;
+    a->wait = WAIT_DELAY;
+    async_watch(a, 0);
+    async_arm(a, delay_us);
+}
+
+static void async_expect(rl78_async_t *a, int state, const char *step, int len, unsigned int timeout)
+{
+    a->state = state;
+    a->wait = (RL78_ASYNC_G10 == a->family) ? WAIT_BYTES : WAIT_FRAME;
+    a->step = step;
+    a->expected = len;
+    a->response_len = 0;
+    async_watch(a, 1);
+    async_arm(a, timeout);
+}
+
+static void async_finish(rl78_async_t *a, const char *error)
+{
+    if (ST_DONE == a->state)
+    {
+        return;
+    }
+    a->state = ST_DONE;
+    a->wait = WAIT_NONE;
+    a->error = error;
+    a->result = (NULL != error) ? -1 : 0;
+    a->finish_time = serial_time();
+    epoll_ctl(a->loop->epoll_fd, EPOLL_CTL_DEL, serial_fd(a->session->port), NULL);
+    epoll_ctl(a->loop->epoll_fd, EPOLL_CTL_DEL, a->timer_fd, NULL);
+    close(a->timer_fd);
+    a->timer_fd = -1;
+    free(a->bounce);
+    a->bounce = NULL;
+    a->bounce_size = 0;
+    --a->loop->active;
+}
+
+static void async_fail(rl78_async_t *a, const char *error)
+{
+    log_printf(&a->session->log, LOG_ERROR, "%s: %s\n", a->step, error);
+    async_finish(a, error);
+}
+
+static int async_ack(rl78_async_t *a, unsigned char status)
+{
+    if (STATUS_ACK == status)
+    {
+        return 1;
+    }
+    log_printf(&a->session->log, LOG_ERROR, "%s: ACK not received (%02X)\n", a->step, status);
+    async_finish(a, "ACK not received");
+    return 0;
+}
+
+/* Data of the current block, put together in a->bounce if it spans segments of the image */
+static const unsigned char *block_data(rl78_async_t *a, unsigned int blksz)
+{
+    const image_t *img = a->ops[a->op].image;
+    const unsigned char *data = image_data(img, a->address, blksz, NULL);
+    if (NULL != data)
+    {
+        return data;
+    }
+    if (a->bounce_size < blksz)
+    {
+        unsigned char *bounce = realloc(a->bounce, blksz);
+        if (NULL == bounce)
+        {
+            return NULL;
+        }
+        a->bounce = bounce;
+        a->bounce_size = blksz;
+    }
+    return image_data(img, a->address, blksz, a->bounce);
+}
+
+static void async_next_op(rl78_async_t *a);
+
+/* Start work on the first block from a->address on that needs it */
+static void rl78_block(rl78_async_t *a)
+{
+    rl78_session_t *s = a->session;
+    const rl78_async_op_t *op = &a->ops[a->op];
+    const unsigned int blksz = rl78_block_size(s, op->address);
+    const unsigned int end = op->address + (op->size & ~(blksz - 1));
+    for (; a->address < end; a->address += blksz)
+    {
+        if (RL78_ASYNC_PROGRAM == op->type)
+        {
+            // Go straight to the next block with data
+            const unsigned int next = image_next_used(op->image, a->address);
+            if (next >= op->image->end)
+            {
+                break;
+            }
+            if (next >= a->address + blksz)
+            {
+                a->address += (next - a->address) / blksz * blksz;
+                if (a->address >= end)
+                {
+                    break;
+                }
+            }
+        }
+        const int has_data = RL78_ASYNC_ERASE != op->type
+            && image_used(op->image, a->address, blksz);
+        if (RL78_ASYNC_VERIFY == op->type && has_data)
+        {
+            log_printf(&s->log, 3, "Verify block %06X\n", a->address);
+            rl78_send_range(s, CMD_VERIFY, a->address, a->address + blksz - 1);
+            async_expect(a, ST_COMMAND_STATUS, "Verify", 1,
+                         rl78_timeout(s, CMD_VERIFY, RL78_RESPONSE_STATUS, a->address, a->address + blksz - 1));
+            return;
+        }
+        // Blocks without data are not written
+        if (RL78_ASYNC_PROGRAM != op->type || has_data)
+        {
+            log_printf(&s->log, 3, "Blank check block %06X\n", a->address);
+            rl78_send_range(s, CMD_BLOCK_BLANK_CHECK, a->address, a->address + blksz - 1);
+            async_expect(a, ST_BLANK_CHECK_STATUS, "Block Blank Check", 1,
+                         rl78_timeout(s, CMD_BLOCK_BLANK_CHECK, RL78_RESPONSE_STATUS, a->address, a->address + blksz - 1));
+            return;
+        }
+    }
+    ++a->op;
+    async_next_op(a);
+}
+
+static void rl78_block_done(rl78_async_t *a)
+{
+    a->address += rl78_block_size(a->session, a->address);
+    rl78_block(a);
+}
+
+static void rl78_send_frame(rl78_async_t *a)
+{
+    rl78_session_t *s = a->session;
+    const rl78_async_op_t *op = &a->ops[a->op];
+    const unsigned int blksz = rl78_block_size(s, a->address);
+    const unsigned int len = (256 < blksz - a->offset) ? 256 : blksz - a->offset;
+    const unsigned char *data = block_data(a, blksz);
+    if (NULL == data)
+    {
+        async_fail(a, "Memory allocation failed");
+        return;
+    }
+    rl78_send_data(s, data + a->offset, len, blksz == a->offset + len);
+    a->offset += len;
+    const int cmd = (RL78_ASYNC_PROGRAM == op->type) ? CMD_PROGRAMMING : CMD_VERIFY;
+    async_expect(a, ST_FRAME_STATUS, (CMD_PROGRAMMING == cmd) ? "Programming" : "Verify", 2,
+                 rl78_timeout(s, cmd, RL78_RESPONSE_FRAME, 0, 0));
+}
+
+static void rl78_advance(rl78_async_t *a)
+{
+    rl78_session_t *s = a->session;
+    const rl78_async_op_t *op = &a->ops[a->op];
+    unsigned char buf[2];
+    switch (a->state)
+    {
+    case ST_SET_MODE:
+        buf[0] = (1 == s->communication_mode) ? SET_MODE_1WIRE_UART : SET_MODE_2WIRE_UART;
+        serial_flush(s->port);
+        s->rx.head = 0;
+        s->rx.tail = 0;
+        s->rx.echo = (1 == s->communication_mode) ? 1 : 0;
+        log_printf(&s->log, 3, "Send 1-byte data for setting mode\n");
+        serial_write(s->port, buf, 1);
+        async_delay(a, ST_BAUD_RATE_SET, 1000);
+        break;
+    case ST_BAUD_RATE_SET:
+        buf[0] = rl78_baud_code(a->baud);
+        buf[1] = (int)(a->voltage * 10);
+        log_printf(&s->log, 3, "Send \"Set Baud Rate\" command (baud=%ubps, voltage=%1.1fV)\n", a->baud, a->voltage);
+        rl78_send_cmd(s, CMD_BAUD_RATE_SET, buf, 2);
+        async_expect(a, ST_BAUD_RATE_SET_STATUS, "Set Baud Rate", 3, s->timing->command);
+        break;
+    case ST_BAUD_RATE_SET_STATUS:
+        if (!async_ack(a, a->response[0]))
+        {
+            break;
+        }
+        log_printf(&s->log, 3, "\tFrequency: %u MHz\n", a->response[1]);
+        if (115200 != a->baud && 0 != serial_set_baud(s->port, a->baud))
+        {
+            async_fail(a, "Unable to set baudrate");
+            break;
+        }
+        log_printf(&s->log, 3, "Send \"Reset\" command\n");
+        rl78_send_cmd(s, CMD_RESET, NULL, 0);
+        async_expect(a, ST_RESET_STATUS, "Reset", 1, s->timing->command);
+        break;
+    case ST_RESET_STATUS:
+        if (!async_ack(a, a->response[0]))
+        {
+            break;
+        }
+        log_printf(&s->log, 3, "Send \"Get Silicon Signature\" command\n");
+        rl78_send_cmd(s, CMD_SILICON_SIGNATURE, NULL, 0);
+        async_expect(a, ST_SIGNATURE_STATUS, "Get Silicon Signature", 1, s->timing->command);
+        break;
+    case ST_SIGNATURE_STATUS:
+        if (async_ack(a, a->response[0]))
+        {
+            async_expect(a, ST_SIGNATURE_DATA, "Get Silicon Signature", 22, s->timing->command);
+        }
+        break;
+    case ST_SIGNATURE_DATA:
+    {
+        char device_name[11];
+        unsigned int code_size, data_size;
+        rl78_decode_signature(a->response, device_name, &code_size, &data_size);
+        log_printf(&s->log, 3, "\tDevice name: %s\n", device_name);
+        if (NULL != a->identified
+            && 0 != a->identified(a, device_name, code_size, data_size))
+        {
+            async_finish(a, (NULL != a->error) ? a->error : "Device is not supported");
+            break;
+        }
+        a->op = 0;
+        async_next_op(a);
+        break;
+    }
+    case ST_BLANK_CHECK_STATUS:
+        if (STATUS_IVERIFY_BLANK_ERROR == a->response[0])
+        {
+            if (RL78_ASYNC_VERIFY == op->type)
+            {
+                log_printf(&s->log, LOG_ERROR, "Block content does not match (%06X)\n", a->address);
+                async_finish(a, "Block content does not match");
+                break;
+            }
+            log_printf(&s->log, 3, "Send \"Block Erase\" command (address=%06X)\n", a->address);
+            rl78_send_cmd(s, CMD_BLOCK_ERASE, &a->address, 3);
+            async_expect(a, ST_ERASE_STATUS, "Block Erase", 1,
+                         rl78_timeout(s, CMD_BLOCK_ERASE, RL78_RESPONSE_STATUS, a->address, a->address));
+            break;
+        }
+        /* fall through */
+    case ST_ERASE_STATUS:
+        if (!async_ack(a, a->response[0]))
+        {
+            break;
+        }
+        if (RL78_ASYNC_PROGRAM != op->type)
+        {
+            rl78_block_done(a);
+            break;
+        }
+        {
+            const unsigned int blksz = rl78_block_size(s, a->address);
+            log_printf(&s->log, 3, "Program block %06X\n", a->address);
+            rl78_send_range(s, CMD_PROGRAMMING, a->address, a->address + blksz - 1);
+            async_expect(a, ST_COMMAND_STATUS, "Programming", 1,
+                         rl78_timeout(s, CMD_PROGRAMMING, RL78_RESPONSE_STATUS, a->address, a->address + blksz - 1));
+        }
+        break;
+    case ST_COMMAND_STATUS:
+        if (async_ack(a, a->response[0]))
+        {
+            a->offset = 0;
+            rl78_send_frame(a);
+        }
+        break;
+    case ST_FRAME_STATUS:
+        if (!async_ack(a, a->response[0]))
+        {
+            break;
+        }
+        if (STATUS_ACK != a->response[1])
+        {
+            if (RL78_ASYNC_VERIFY == op->type)
+            {
+                log_printf(&s->log, LOG_ERROR, "Block content does not match (%06X)\n", a->address);
+                async_finish(a, "Block content does not match");
+            }
+            else
+            {
+                async_fail(a, "Data not written");
+            }
+            break;
+        }
+        if (a->offset < rl78_block_size(s, a->address))
+        {
+            rl78_send_frame(a);
+        }
+        else if (RL78_ASYNC_PROGRAM == op->type && PROTOCOL_VERSION_C != s->proto_ver)
+        {
+            // Protocol A and D report completion of the whole command
+            async_expect(a, ST_PROGRAM_COMPLETE, "Programming", 1,
+                         rl78_timeout(s, CMD_PROGRAMMING, RL78_RESPONSE_DONE, a->address, a->address + a->offset - 1));
+        }
+        else if (RL78_ASYNC_PROGRAM == op->type)
+        {
+            // Protocol C writes and verifies without a word, its worst case is waited for
+            async_delay(a, ST_PROGRAM_SETTLED,
+                        rl78_timeout(s, CMD_PROGRAMMING, RL78_RESPONSE_DONE, a->address, a->address + a->offset - 1));
+        }
+        else
+        {
+            rl78_block_done(a);
+        }
+        break;
+    case ST_PROGRAM_COMPLETE:
+        if (async_ack(a, a->response[0]))
+        {
+            rl78_block_done(a);
+        }
+        break;
+    case ST_PROGRAM_SETTLED:
+        rl78_block_done(a);
+        break;
+    }
+}
+
+static void g10_send_word(rl78_async_t *a)
+{
+    const rl78_async_op_t *op = &a->ops[a->op];
+    serial_write(a->session->port, op->data + a->offset, FLASH_BLOCK_SIZE);
+    a->offset += FLASH_BLOCK_SIZE;
+    // Echo of the word and the status
+    async_expect(a, ST_G10_WORD_STATUS, "Write", FLASH_BLOCK_SIZE + 1, a->session->timing->command);
+}
+
+static void g10_start_op(rl78_async_t *a)
+{
+    const unsigned char cmd = (RL78_ASYNC_PROGRAM == a->ops[a->op].type) ? CMD_ERASE_WRITE : CMD_CRC_CHECK;
+    log_printf(&a->session->log, 3, "Send command byte\n");
+    serial_write(a->session->port, &cmd, 1);
+    async_expect(a, ST_G10_SIZE, (CMD_ERASE_WRITE == cmd) ? "Erase/Write" : "CRC Check", 3,
+                 a->session->timing->command);
+}
+
+static void g10_advance(rl78_async_t *a)
+{
+    rl78_session_t *s = a->session;
+    const rl78_async_op_t *op = &a->ops[a->op];
+    unsigned char buf[1];
+    switch (a->state)
+    {
+    case ST_SET_MODE:
+        serial_flush(s->port);
+        log_printf(&s->log, 3, "Send 1-byte data for setting mode\n");
+        buf[0] = CMD_MODE_SET;
+        serial_write(s->port, buf, 1);
+        async_expect(a, ST_G10_MODE_STATUS, "Set Mode", 2, s->timing->command);
+        break;
+    case ST_G10_MODE_STATUS:
+        if (async_ack(a, a->response[1]))
+        {
+            a->op = 0;
+            async_next_op(a);
+        }
+        break;
+    case ST_G10_SIZE:
+        if (!async_ack(a, a->response[1]))
+        {
+            break;
+        }
+        if (rl78g10_size_from_code(a->response[2]) != (int)op->size)
+        {
+            log_printf(&s->log, LOG_ERROR, "Unexpected flash size %i, expected %u\n",
+                       rl78g10_size_from_code(a->response[2]), op->size);
+            buf[0] = STATUS_NACK;
+            serial_write(s->port, buf, 1);
+            async_finish(a, "Unexpected flash size");
+            break;
+        }
+        buf[0] = STATUS_ACK;
+        serial_write(s->port, buf, 1);
+        async_expect(a, ST_G10_ACCEPTED, a->step, 1, s->timing->command);
+        break;
+    case ST_G10_ACCEPTED:
+        if (RL78_ASYNC_PROGRAM == op->type)
+        {
+            async_expect(a, ST_G10_ERASED, "Erase", 1, s->timing->erase);
+        }
+        else
+        {
+            async_expect(a, ST_G10_CRC, "CRC Check", 3, s->timing->command + (op->size / 1024 + 1) * s->timing->read_kb);
+        }
+        break;
+    case ST_G10_ERASED:
+        if (async_ack(a, a->response[0]))
+        {
+            log_printf(&s->log, 3, "Write data\n");
+            a->offset = 0;
+            g10_send_word(a);
+        }
+        break;
+    case ST_G10_WORD_STATUS:
+        if (!async_ack(a, a->response[FLASH_BLOCK_SIZE]))
+        {
+            break;
+        }
+        if (a->offset < op->size)
+        {
+            g10_send_word(a);
+        }
+        else
+        {
+            async_expect(a, ST_G10_WRITE_STATUS, "Write", 1, s->timing->command);
+        }
+        break;
+    case ST_G10_WRITE_STATUS:
+        if (async_ack(a, a->response[0]))
+        {
+            ++a->op;
+            async_next_op(a);
+        }
+        break;
+    case ST_G10_CRC:
+    {
+        if (!async_ack(a, a->response[0]))
+        {
+            break;
+        }
+        const unsigned int crc_recv = ((unsigned int)a->response[2] << 8) | a->response[1];
+        const unsigned int crc_calc = crc16(op->data, op->size);
+        if (crc_recv != crc_calc)
+        {
+            log_printf(&s->log, LOG_ERROR, "CRC don't match (remote: %04Xh, local: %04Xh)\n", crc_recv, crc_calc);
+            async_finish(a, "CRC mismatch");
+            break;
+        }
+        log_printf(&s->log, 1, "CRC match %04Xh\n", crc_calc);
+        ++a->op;
+        async_next_op(a);
+        break;
+    }
+    }
+}
+
+static void async_next_op(rl78_async_t *a)
+{
+    rl78_session_t *s = a->session;
+    if (a->op >= a->nops)
+    {
+        async_finish(a, NULL);
+        return;
+    }
+    const rl78_async_op_t *op = &a->ops[a->op];
+    if (NULL != op->title)
+    {
+        log_printf(&s->log, 1, "%s\n", op->title);
+    }
+    a->address = op->address;
+    a->offset = 0;
+    if (RL78_ASYNC_RESET == op->type)
+    {
+        serial_set_txd(s->port, 1);                         /* TOOL0 -> 1 */
+        rl78_set_reset(s, 0);                               /* RESET -> 0 */
+        async_delay(a, ST_RUN, 10000);
+        return;
+    }
+    if (RL78_ASYNC_G10 == a->family)
+    {
+        g10_start_op(a);
+        return;
+    }
+    if (!rl78_block_size(s, op->address))
+    {
+        log_printf(&s->log, LOG_ERROR, "Block size is not set\n");
+        async_finish(a, "Block size is not set");
+        return;
+    }
+    rl78_block(a);
+}
+
+static void async_advance(rl78_async_t *a)
+{
+    rl78_session_t *s = a->session;
+    a->wait = WAIT_NONE;
+    switch (a->state)
+    {
+    case ST_START:
+        if (RL78_ASYNC_G10 == a->family)
+        {
+            rl78g10_set_protocol(s);
+        }
+        else if (NULL == s->timing)
+        {
+            rl78_set_protocol(s, s->proto_ver);
+        }
+        s->communication_mode = (MODE_UART_1 == (s->mode & MODE_UART)) ? 1 : 2;
+        rl78_set_reset(s, 0);                               /* RESET -> 0 */
+        serial_set_txd(s->port, 0);                         /* TOOL0 -> 0 */
+        serial_flush(s->port);
+        async_delay(a, ST_RESET_RELEASE, 1000);
+        break;
+    case ST_RESET_RELEASE:
+        rl78_set_reset(s, 1);                               /* RESET -> 1 */
+        async_delay(a, ST_TOOL0_HIGH, (RL78_ASYNC_G10 == a->family) ? 2000 : 3000);
+        break;
+    case ST_TOOL0_HIGH:
+        serial_set_txd(s->port, 1);                         /* TOOL0 -> 1 */
+        async_delay(a, ST_SET_MODE, 1000);
+        break;
+    case ST_RUN:
+        rl78_set_reset(s, 1);                               /* RESET -> 1 */
+        ++a->op;
+        async_next_op(a);
+        break;
+    default:
+        if (RL78_ASYNC_G10 == a->family)
+        {
+            g10_advance(a);
+        }
+        else
+        {
+            rl78_advance(a);
+        }
+        break;
+    }
+}
+
+/* Take the awaited response if it has arrived.
+ * Returns 1 if it is complete, 0 if not yet, -1 if the target has failed. */
+static int async_receive(rl78_async_t *a)
+{
+    rl78_session_t *s = a->session;
+    if (WAIT_FRAME == a->wait)
+    {
+        const int rc = rl78_recv_poll(s, a->response, &a->response_len, a->expected);
+        if (RESPONSE_PENDING == rc)
+        {
+            return 0;
+        }
+        if (RESPONSE_OK != rc)
+        {
+            log_printf(&s->log, LOG_ERROR, "%s: invalid response (%d)\n", a->step, rc);
+            async_finish(a, "Invalid response");
+            return -1;
+        }
+        return 1;
+    }
+    // The deadline has passed already, only data at hand is read
+    const int rc = serial_read_available(s->port, a->response + a->response_len, a->expected - a->response_len, 0);
+    if (SERIAL_ERROR == rc)
+    {
+        async_fail(a, "Unable to read from port");
+        return -1;
+    }
+    if (0 < rc)
+    {
+        a->response_len += rc;
+    }
+    return (a->response_len == a->expected) ? 1 : 0;
+}
+
+/* Handle responses, several of them may have arrived at once */
+static void async_input(rl78_async_t *a)
+{
+    while (WAIT_FRAME == a->wait || WAIT_BYTES == a->wait)
+    {
+        if (1 != async_receive(a))
+        {
+            return;
+        }
+        async_advance(a);
+    }
+}
+
+static void async_timer(rl78_async_t *a)
+{
+    uint64_t expirations;
+    if (sizeof expirations != read(a->timer_fd, &expirations, sizeof expirations))
+    {
+        // Re-armed after the event was queued
+        return;
+    }
+    if (WAIT_DELAY != a->wait)
+    {
+        // The response may be waiting in the buffer
+        const int rc = async_receive(a);
+        if (0 == rc)
+        {
+            async_fail(a, "No response from MCU");
+        }
+        if (1 != rc)
+        {
+            return;
+        }
+    }
+    async_advance(a);
+    async_input(a);
+}
+
+int rl78_async_loop_init(rl78_async_loop_t *loop)
+{
+    memset(loop, 0, sizeof *loop);
+    loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    return (0 <= loop->epoll_fd) ? 0 : -1;
+}
+
+void rl78_async_loop_close(rl78_async_loop_t *loop)
+{
+    if (0 <= loop->epoll_fd)
+    {
+        close(loop->epoll_fd);
+    }
+    free(loop->targets);
+    memset(loop, 0, sizeof *loop);
+    loop->epoll_fd = -1;
+}
+
+int rl78_async_add_op(rl78_async_t *a, int type, const char *title,
+                      unsigned int address, const unsigned char *data, unsigned int size)
+{
+    if (RL78_ASYNC_MAX_OPS == a->nops)
+    {
+        return -1;
+    }
+    rl78_async_op_t *op = &a->ops[a->nops++];
+    op->type = type;
+    op->title = title;
+    op->address = address;
+    op->data = data;
+    op->image = NULL;
+    op->size = size;
+    return 0;
+}
+
+int rl78_async_add_image_op(rl78_async_t *a, int type, const char *title,
+                            unsigned int address, const image_t *image, unsigned int size)
+{
+    if (0 != rl78_async_add_op(a, type, title, address, NULL, size))
+    {
+        return -1;
+    }
+    a->ops[a->nops - 1].image = image;
+    return 0;
+}
+
+int rl78_async_start(rl78_async_loop_t *loop, rl78_async_t *a)
+{
+    if (RL78_ASYNC_RL78 == a->family && 0 > rl78_baud_code(a->baud))
+    {
+        log_printf(&a->session->log, LOG_ERROR, "Unsupported baudrate %ubps\n", a->baud);
+        return -1;
+    }
+    rl78_async_t **targets = realloc(loop->targets, (loop->count + 1) * sizeof *targets);
+    if (NULL == targets)
+    {
+        return -1;
+    }
+    loop->targets = targets;
+    a->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (0 > a->timer_fd)
+    {
+        return -1;
+    }
+    a->loop = loop;
+    a->index = loop->count;
+    a->watching = 0;
+    a->result = -1;
+    a->error = NULL;
+    a->step = "Entry";
+    struct epoll_event port_ev, timer_ev;
+    port_ev.events = 0;
+    port_ev.data.u64 = EVENT_TAG(a->index, 0);
+    timer_ev.events = EPOLLIN;
+    timer_ev.data.u64 = EVENT_TAG(a->index, 1);
+    if (0 != epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, serial_fd(a->session->port), &port_ev))
+    {
+        close(a->timer_fd);
+        return -1;
+    }
+    if (0 != epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, a->timer_fd, &timer_ev))
+    {
+        epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, serial_fd(a->session->port), NULL);
+        close(a->timer_fd);
+        return -1;
+    }
+    loop->targets[loop->count++] = a;
+    ++loop->active;
+    a->state = ST_START;
+    async_advance(a);
+    return 0;
+}
+
+int rl78_async_run(rl78_async_loop_t *loop)
+{
+    struct epoll_event events[MAX_EVENTS];
+    while (loop->active)
+    {
+        const int n = epoll_wait(loop->epoll_fd, events, MAX_EVENTS, -1);
+        if (0 > n)
+        {
+            if (EINTR == errno)
+            {
+                continue;
+            }
+            return -1;
+        }
+        int i;
+        for (i = 0; i < n; ++i)
+        {
+            rl78_async_t *a = loop->targets[events[i].data.u64 >> 1];
+            if (ST_DONE == a->state)
+            {
+                continue;
+            }
+            if (events[i].data.u64 & 1)
+            {
+                async_timer(a);
+            }
+            else if (events[i].events & (EPOLLERR | EPOLLHUP))
+            {
+                async_fail(a, "Port error");
+            }
+            else
+            {
+                async_input(a);
+            }
+        }
+    }
+    return 0;
+}
+
+#endif  // __linux__
@@ -0,0 +1,114 @@
+/*********************************************************************************************************************
+ * The MIT License (MIT)                                                                                             *
+ * Copyright (c) 2026 rl78flash contributors                                                                         *
+ *                                                                                                                   *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated      *
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation   *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and  *
+ * to permit persons to whom the Software is furnished to do so, subject to the following conditions:                *
+ *                                                                                                                   *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions     *
+ * of the Software.                                                                                                  *
+ *                                                                                                                   *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO  *
+ * THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF         *
+ * CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+ * IN THE SOFTWARE.                                                                                                  *
+ *********************************************************************************************************************/
+
+#ifndef RL78_ASYNC_H__
+#define RL78_ASYNC_H__
+
+#include "rl78-session.h"
+#include "image.h"
+
+/* Device families */
+#define RL78_ASYNC_RL78     0
+#define RL78_ASYNC_G10      1
+
+/* Operations run after the target has entered the bootloader */
+#define RL78_ASYNC_ERASE    0   /* Erase blocks which are not blank */
+#define RL78_ASYNC_PROGRAM  1   /* Write blocks with data, G10: erase and write the whole flash */
+#define RL78_ASYNC_VERIFY   2   /* Compare blocks with data, check others are blank, G10: CRC check */
+#define RL78_ASYNC_RESET    3   /* Let the target run its program */
+
+#define RL78_ASYNC_MAX_OPS  8
+
+typedef struct
+{
+    int type;                   /* RL78_ASYNC_* */
+    const char *title;          /* Logged at level 1 when the operation starts, may be NULL */
+    unsigned int address;
+    const unsigned char *data;  /* G10 */
+    const image_t *image;       /* RL78 */
+    unsigned int size;
+} rl78_async_op_t;
+
+typedef struct rl78_async rl78_async_t;
+typedef struct rl78_async_loop rl78_async_loop_t;
+
+/* Called after the silicon signature is read (RL78 only). Sets protocol and
+ * block sizes of the session and adds operations, non-zero fails the target. */
+typedef int (*rl78_async_identified_t)(rl78_async_t *a, const char *device_name,
+                                       unsigned int code_size, unsigned int data_size);
+
+/* Programming sequence of a target, resumed whenever its response arrives or
+ * its timer expires. All state lives here, so one thread drives any number of
+ * targets. Blocks are handled one by one, RL78_FLAG_* of the session are not
+ * taken into account. The structure is zeroed before the fields are set. */
+struct rl78_async
+{
+    /* Set by the caller */
+    rl78_session_t *session;    /* Open session */
+    int family;                 /* RL78_ASYNC_RL78 or RL78_ASYNC_G10 */
+    int baud;                   /* RL78 only, a rate supported by the bootloader */
+    float voltage;
+    rl78_async_identified_t identified;
+    void *ctx;
+    rl78_async_op_t ops[RL78_ASYNC_MAX_OPS];
+    unsigned int nops;
+    /* Outcome */
+    int result;                 /* 0 on success */
+    const char *error;          /* Reason of a failure */
+    serial_time_t finish_time;
+    /* Private */
+    rl78_async_loop_t *loop;
+    int state;
+    int wait;
+    const char *step;           /* Command whose response is awaited */
+    int timer_fd;
+    int watching;               /* Port is polled for input */
+    unsigned int index;         /* Slot in the loop */
+    unsigned int op;
+    unsigned int address;       /* Current block */
+    unsigned int offset;        /* Bytes sent of the current block or G10 flash */
+    int expected;               /* Length of the awaited response */
+    int response_len;
+    unsigned char response[32];
+    unsigned char *bounce;      /* Block which spans segments of the image */
+    unsigned int bounce_size;
+};
+
+/* Event loop over ports and timers of many targets */
+struct rl78_async_loop
+{
+    int epoll_fd;
+    rl78_async_t **targets;
+    unsigned int count;
+    unsigned int active;        /* Targets not finished yet */
+};
+
+int rl78_async_loop_init(rl78_async_loop_t *loop);
+void rl78_async_loop_close(rl78_async_loop_t *loop);
+int rl78_async_add_op(rl78_async_t *a, int type, const char *title,
+                      unsigned int address, const unsigned char *data, unsigned int size);
+/* Same for RL78 operations, which take their data from a sparse image */
+int rl78_async_add_image_op(rl78_async_t *a, int type, const char *title,
+                            unsigned int address, const image_t *image, unsigned int size);
+/* Start the sequence, the target must stay in place until the loop finishes */
+int rl78_async_start(rl78_async_loop_t *loop, rl78_async_t *a);
+/* Run until every started target has finished */
+int rl78_async_run(rl78_async_loop_t *loop);
+
+#endif  // RL78_ASYNC_H__
@@ -0,0 +1,67 @@
+/*********************************************************************************************************************
+ * The MIT License (MIT)                                                                                             *
+ * Copyright (c) 2026 rl78flash contributors                                                                         *
+ *                                                                                                                   *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated      *
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation   *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and  *
+ * to permit persons to whom the Software is furnished to do so, subject to the following conditions:                *
+ *                                                                                                                   *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions     *
+ * of the Software.                                                                                                  *
+ *                                                                                                                   *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO  *
+ * THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF         *
+ * CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+ * IN THE SOFTWARE.                                                                                                  *
+ *********************************************************************************************************************/
+
+#include <unistd.h>
+#include <string.h>
+#include "rl78-session.h"
+
+int rl78_session_open(rl78_session_t *s, const char *path, int mode, const log_t *log)
+{
+    memset(s, 0, sizeof *s);
+    s->mode = mode;
+    s->communication_mode = (MODE_UART_1 == (mode & MODE_UART)) ? 1 : 2;
+    s->proto_ver = -1;
+    s->log = *log;
+    s->port = serial_open(path, &s->log);
+    return (NULL != s->port) ? 0 : -1;
+}
+
+int rl78_session_close(rl78_session_t *s)
+{
+    if (NULL == s->port)
+    {
+        return 0;
+    }
+    const int rc = serial_close(s->port);
+    s->port = NULL;
+    return rc;
+}
+
+void rl78_set_reset(rl78_session_t *s, int value)
+{
+    int level  = (s->mode & MODE_INVERT_RESET) ? !value : value;
+
+    if (MODE_RESET_RTS == (s->mode & MODE_RESET))
+    {
+        serial_set_rts(s->port, level);
+    }
+    else
+    {
+        serial_set_dtr(s->port, level);
+    }
+}
+
+int rl78_reset(rl78_session_t *s)
+{
+    serial_set_txd(s->port, 1);                             /* TOOL0 -> 1 */
+    rl78_set_reset(s, 0);                                   /* RESET -> 0 */
+    usleep(10000);
+    rl78_set_reset(s, 1);                                   /* RESET -> 1 */
+    return 0;
+}
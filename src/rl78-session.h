@@ -0,0 +1,80 @@
+/*********************************************************************************************************************
+ * The MIT License (MIT)                                                                                             *
+ * Copyright (c) 2026 rl78flash contributors                                                                         *
+ *                                                                                                                   *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated      *
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation   *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and  *
+ * to permit persons to whom the Software is furnished to do so, subject to the following conditions:                *
+ *                                                                                                                   *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions     *
+ * of the Software.                                                                                                  *
+ *                                                                                                                   *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO  *
+ * THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF         *
+ * CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+ * IN THE SOFTWARE.                                                                                                  *
+ *********************************************************************************************************************/
+
+#ifndef RL78_SESSION_H__
+#define RL78_SESSION_H__
+
+#include "serial.h"
+#include "log.h"
+
+#define MODE_UART         1
+#define MODE_UART_1       0
+#define MODE_UART_2       MODE_UART
+#define MODE_RESET        2
+#define MODE_RESET_DTR    0
+#define MODE_RESET_RTS    MODE_RESET
+#define MODE_MAX_VALUE    (MODE_UART | MODE_RESET)
+#define MODE_MIN_VALUE    0
+#define MODE_INVERT_RESET 0x80
+
+#define RX_BUFFER_SIZE 1024 /* Must be a power of two */
+
+/* Response timeouts of a protocol in microseconds */
+typedef struct
+{
+    unsigned int command;       /* Any command, added to the ones below */
+    unsigned int erase;         /* Erase of a block (whole flash on RL78/G10) */
+    unsigned int read_kb;       /* Reading of each kB: blank check, checksum, verify, CRC */
+    unsigned int write_frame;   /* Programming of a data frame */
+} rl78_timing_t;
+
+typedef struct rl78_frame_cache rl78_frame_cache_t;
+
+/* State of communication with a single target, sessions are independent of each other */
+typedef struct
+{
+    port_handle_t port;
+    int mode;                   /* MODE_* bits */
+    int communication_mode;     /* 1 or 2 wire UART */
+    int proto_ver;              /* PROTOCOL_VERSION_* */
+    unsigned int code_block_size;
+    unsigned int data_block_size;
+    int flags;                  /* RL78_FLAG_* */
+    log_t log;
+    const rl78_timing_t *timing;
+    const rl78_frame_cache_t *frame_cache;  /* Pre-encoded data frames, may be NULL */
+    /* Received data, both echo and responses, indices run freely and wrap around */
+    struct
+    {
+        unsigned char buf[RX_BUFFER_SIZE];
+        unsigned int head;      /* Total bytes stored */
+        unsigned int tail;      /* Total bytes consumed */
+        unsigned int echo;      /* Bytes of echo to be skipped */
+    } rx;
+} rl78_session_t;
+
+/* Open the port for the session, messages are passed to a copy of the log.
+ * The port refers to the session's log, so the session must not be moved while open. */
+int rl78_session_open(rl78_session_t *s, const char *path, int mode, const log_t *log);
+int rl78_session_close(rl78_session_t *s);
+void rl78_set_reset(rl78_session_t *s, int value);
+/* Let the target run its program */
+int rl78_reset(rl78_session_t *s);
+
+#endif  // RL78_SESSION_H__
@@ -20,97 +20,192 @@
 #include <unistd.h>
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include "wait_kbhit.h"
 
 #include "serial.h"
 #include "rl78.h"
 
-extern int verbose_level;
-static unsigned char communication_mode;
+static const rl78_timing_t timing_a = { TIMEOUT_A_COMMAND, TIMEOUT_A_ERASE_BLOCK, TIMEOUT_A_READ_KB, TIMEOUT_A_WRITE_FRAME };
+static const rl78_timing_t timing_c = { TIMEOUT_C_COMMAND, TIMEOUT_C_ERASE_BLOCK, TIMEOUT_C_READ_KB, TIMEOUT_C_WRITE_FRAME };
+static const rl78_timing_t timing_d = { TIMEOUT_D_COMMAND, TIMEOUT_D_ERASE_BLOCK, TIMEOUT_D_READ_KB, TIMEOUT_D_WRITE_FRAME };
 
-static void rl78_set_reset(port_handle_t fd, int mode, int value)
+void rl78_set_protocol(rl78_session_t *s, int proto_ver)
 {
-    int level  = (mode & MODE_INVERT_RESET) ? !value : value;
+    s->proto_ver = proto_ver;
+    switch (proto_ver)
+    {
+    case PROTOCOL_VERSION_C:
+        s->timing = &timing_c;
+        break;
+    case PROTOCOL_VERSION_D:
+        s->timing = &timing_d;
+        break;
+    default:
+        s->timing = &timing_a;
+        break;
+    }
+}
+
+static void rx_reset(rl78_session_t *s)
+{
+    s->rx.head = 0;
+    s->rx.tail = 0;
+    s->rx.echo = 0;
+}
+
+static unsigned char rx_peek(const rl78_session_t *s, unsigned int offset)
+{
+    return s->rx.buf[(s->rx.tail + offset) & (RX_BUFFER_SIZE - 1)];
+}
 
-    if (MODE_RESET_RTS == (mode & MODE_RESET))
+/* Read as much as fits into free space of the buffer */
+static int rx_fill(rl78_session_t *s, serial_time_t deadline)
+{
+    if (s->rx.head == s->rx.tail)
     {
-        serial_set_rts(fd, level);
+        s->rx.head = 0;
+        s->rx.tail = 0;
     }
-    else
+    const unsigned int offset = s->rx.head & (RX_BUFFER_SIZE - 1);
+    unsigned int space = RX_BUFFER_SIZE - (s->rx.head - s->rx.tail);
+    if (space > RX_BUFFER_SIZE - offset)
+    {
+        space = RX_BUFFER_SIZE - offset;
+    }
+    const int rc = serial_read_available(s->port, s->rx.buf + offset, space, deadline);
+    if (0 < rc)
     {
-        serial_set_dtr(fd, level);
+        s->rx.head += rc;
     }
+    return rc;
 }
 
-int rl78_reset_init(port_handle_t fd, int wait, int baud, int mode, float voltage)
+int rl78_reset_init(rl78_session_t *s, int wait, int baud, float voltage)
 {
     unsigned char r;
-    if (MODE_UART_1 == (mode & MODE_UART))
+    if (NULL == s->timing)
+    {
+        rl78_set_protocol(s, s->proto_ver);
+    }
+    if (MODE_UART_1 == (s->mode & MODE_UART))
     {
         r = SET_MODE_1WIRE_UART;
-        communication_mode = 1;
+        s->communication_mode = 1;
     }
     else
     {
         r = SET_MODE_2WIRE_UART;
-        communication_mode = 2;
+        s->communication_mode = 2;
     }
-    if (4 <= verbose_level)
-    {
-        printf("Using communication mode %u%s\n",
-               (mode & (MODE_UART | MODE_RESET)) + 1,
-               (mode & MODE_INVERT_RESET) ? " with RESET inversion" : "");
-    }
-    rl78_set_reset(fd, mode, 0);                            /* RESET -> 0 */
-    serial_set_txd(fd, 0);                                  /* TOOL0 -> 0 */
+    log_printf(&s->log, 4, "Using communication mode %u%s\n",
+               (s->mode & (MODE_UART | MODE_RESET)) + 1,
+               (s->mode & MODE_INVERT_RESET) ? " with RESET inversion" : "");
+    rl78_set_reset(s, 0);                                   /* RESET -> 0 */
+    serial_set_txd(s->port, 0);                             /* TOOL0 -> 0 */
     if (wait)
     {
-        printf("Turn MCU's power on and press any key...");
+        log_printf(&s->log, LOG_ERROR, "Turn MCU's power on and press any key...");
         wait_kbhit();
-        printf("\n");
+        log_printf(&s->log, LOG_ERROR, "\n");
     }
-    serial_flush(fd);
+    serial_flush(s->port);
+    /* Delays below are minimal hold times of the entry sequence */
     usleep(1000);
-    rl78_set_reset(fd, mode, 1);                            /* RESET -> 1 */
+    rl78_set_reset(s, 1);                                   /* RESET -> 1 */
     usleep(3000);
-    serial_set_txd(fd, 1);                                  /* TOOL0 -> 1 */
+    serial_set_txd(s->port, 1);                             /* TOOL0 -> 1 */
     usleep(1000);
-    serial_flush(fd);
-    if (3 <= verbose_level)
-    {
-        printf("Send 1-byte data for setting mode\n");
-    }
-    serial_write(fd, &r, 1);
-    if (1 == communication_mode)
+    serial_flush(s->port);
+    rx_reset(s);
+    log_printf(&s->log, 3, "Send 1-byte data for setting mode\n");
+    serial_write(s->port, &r, 1);
+    if (1 == s->communication_mode)
     {
-        serial_read(fd, &r, 1);
+        s->rx.echo += 1;
     }
     usleep(1000);
-    return rl78_cmd_baud_rate_set(fd, baud, voltage);
+    return rl78_cmd_baud_rate_set(s, baud, voltage);
 }
 
-int rl78_reset(port_handle_t fd, int mode)
+/* Rates supported by the bootloader, fastest first */
+static const int auto_baudrates[] = { 1000000, 500000, 250000, 115200 };
+
+int rl78_reset_init_auto(rl78_session_t *s, int wait, int *baud, float voltage)
 {
-    serial_set_txd(fd, 1);                                  /* TOOL0 -> 1 */
-    rl78_set_reset(fd, mode, 0);                            /* RESET -> 0 */
-    usleep(10000);
-    rl78_set_reset(fd, mode, 1);                            /* RESET -> 1 */
-    return 0;
+    const unsigned int count = sizeof auto_baudrates / sizeof auto_baudrates[0];
+    unsigned int i = 0;
+    // Start from the given rate, or from the fastest one
+    while (BAUD_AUTO != *baud && i < count - 1 && auto_baudrates[i] > *baud)
+    {
+        ++i;
+    }
+    int rc = -1;
+    for (; i < count; ++i)
+    {
+        log_printf(&s->log, 2, "Trying baudrate %ubps\n", auto_baudrates[i]);
+        // Entry sequence and "Set Baud Rate" command go at the default rate
+        serial_set_baud(s->port, 115200);
+        rc = rl78_reset_init(s, wait, auto_baudrates[i], voltage);
+        wait = 0;
+        if (0 == rc)
+        {
+            rc = rl78_cmd_reset(s);
+        }
+        if (0 == rc)
+        {
+            rc = rl78_cmd_silicon_signature(s, NULL, NULL, NULL);
+        }
+        if (0 == rc)
+        {
+            *baud = auto_baudrates[i];
+            log_printf(&s->log, 1, "Using baudrate %ubps\n", *baud);
+            return 0;
+        }
+        if (i + 1 < count)
+        {
+            log_printf(&s->log, 1, "Baudrate %ubps failed, falling back to %ubps\n", auto_baudrates[i], auto_baudrates[i + 1]);
+        }
+    }
+    return (0 < rc) ? -1 : rc;
 }
 
 static
-int checksum(const void *data, int len)
+unsigned int checksum_add(unsigned int sum, const void *data, int len)
 {
-    unsigned int sum = 0;
     const unsigned char *p = data;
     for (; len; --len)
     {
         sum -= *p++;
     }
-    return sum & 0x00FF;
+    return sum;
+}
+
+/* Send header, payload taken directly from the caller and trailer */
+static
+int rl78_send_frame(rl78_session_t *s, const unsigned char *header, int header_len,
+                    const void *data, int len, unsigned char footer)
+{
+    // Start byte is not part of the checksum
+    unsigned int sum = checksum_add(0, &header[1], header_len - 1);
+    sum = checksum_add(sum, data, len);
+    const unsigned char trailer[2] = { sum & 0x00FFU, footer };
+    serial_iovec_t iov[3] =
+    {
+        { header, header_len },
+        { data, len },
+        { trailer, sizeof trailer },
+    };
+    int ret = serial_writev(s->port, iov, 3);
+    // Echo is skipped on reception of the response
+    if (1 == s->communication_mode)
+    {
+        s->rx.echo += header_len + len + sizeof trailer;
+    }
+    return ret;
 }
 
-int rl78_send_cmd(port_handle_t fd, int cmd, const void *data, int len)
+int rl78_send_cmd(rl78_session_t *s, int cmd, const void *data, int len)
 {
     if (255 < len)
     {
@@ -120,209 +215,403 @@ int rl78_send_cmd(port_handle_t fd, int cmd, const void *data, int len)
     {
         return -2;
     }
+    const unsigned char header[3] = { SOH, (len + 1) & 0xFFU, cmd };
+    return rl78_send_frame(s, header, sizeof header, data, len, ETX);
+}
 
-    unsigned char buf[len + 5];
-    buf[0] = SOH;
-    buf[1] = (len + 1) & 0xFFU;
-    buf[2] = cmd;
-    if (len)
-        memcpy(&buf[3], data, len);
-    buf[len + 3] = checksum(&buf[1], len + 2);
-    buf[len + 4] = ETX;
-    int ret = serial_write(fd, buf, sizeof buf);
-    // Read back echo
-    if (1 == communication_mode)
+int rl78_frame_cache_add(rl78_frame_cache_t *c, unsigned int address, const void *data, unsigned int size)
+{
+    if (c->count == c->capacity)
     {
-        serial_read(fd, buf, sizeof buf);
+        const unsigned int capacity = c->capacity ? c->capacity * 2U : 4U;
+        rl78_frame_segment_t *segment = realloc(c->segment, capacity * sizeof *segment);
+        if (NULL == segment)
+        {
+            return -1;
+        }
+        c->segment = segment;
+        c->capacity = capacity;
     }
-    return ret;
+    const unsigned int nframes = (size + RL78_FRAME_DATA - 1) / RL78_FRAME_DATA;
+    unsigned char *frames = malloc((size_t)nframes * RL78_FRAME_SLOT);
+    if (NULL == frames)
+    {
+        return -1;
+    }
+    const unsigned char *p = data;
+    unsigned int i;
+    for (i = 0; i < nframes; ++i)
+    {
+        const unsigned int offset = i * RL78_FRAME_DATA;
+        const unsigned int len = (RL78_FRAME_DATA < size - offset) ? RL78_FRAME_DATA : size - offset;
+        unsigned char *frame = frames + (size_t)i * RL78_FRAME_SLOT;
+        frame[0] = STX;
+        frame[1] = len & 0xFFU;
+        memcpy(frame + 2, p + offset, len);
+        frame[2 + len] = checksum_add(0, frame + 1, len + 1) & 0x00FFU;
+        frame[3 + len] = ETB;
+    }
+    rl78_frame_segment_t *segment = &c->segment[c->count++];
+    segment->address = address;
+    segment->size = size;
+    segment->data = data;
+    segment->frames = frames;
+    return 0;
+}
+
+int rl78_frame_cache_add_image(rl78_frame_cache_t *c, const image_t *img)
+{
+    unsigned int i;
+    for (i = 0; i < img->count; ++i)
+    {
+        const image_segment_t *seg = &img->segment[i];
+        if (0 != rl78_frame_cache_add(c, seg->address, seg->data, seg->size))
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void rl78_frame_cache_free(rl78_frame_cache_t *c)
+{
+    unsigned int i;
+    for (i = 0; i < c->count; ++i)
+    {
+        free(c->segment[i].frames);
+    }
+    free(c->segment);
+    c->segment = NULL;
+    c->count = 0;
+    c->capacity = 0;
+}
+
+/* Encoded frame of the data, if the session's cache holds exactly this piece of an image */
+static const unsigned char *cached_frame(const rl78_session_t *s, const unsigned char *data, int len)
+{
+    const rl78_frame_cache_t *c = s->frame_cache;
+    if (NULL == c)
+    {
+        return NULL;
+    }
+    unsigned int i;
+    for (i = 0; i < c->count; ++i)
+    {
+        const rl78_frame_segment_t *segment = &c->segment[i];
+        if (data < segment->data || data >= segment->data + segment->size)
+        {
+            continue;
+        }
+        const unsigned int offset = data - segment->data;
+        const unsigned int left = segment->size - offset;
+        if (0 != offset % RL78_FRAME_DATA
+            || (unsigned int)len != ((RL78_FRAME_DATA < left) ? RL78_FRAME_DATA : left))
+        {
+            return NULL;
+        }
+        return segment->frames + (size_t)(offset / RL78_FRAME_DATA) * RL78_FRAME_SLOT;
+    }
+    return NULL;
 }
 
-int rl78_send_data(port_handle_t fd, const void *data, int len, int last)
+int rl78_send_data(rl78_session_t *s, const void *data, int len, int last)
 {
     if (256 < len)
     {
         return -1;
     }
-    unsigned char buf[len + 4];
-    buf[0] = STX;
-    buf[1] = len & 0xFFU;
-    memcpy(&buf[2], data, len);
-    buf[len + 2] = checksum(&buf[1], len + 1);
-    buf[len + 3] = last ? ETX : ETB;
-    int ret = serial_write(fd, buf, sizeof buf);
-    // Read back echo
-    if (1 == communication_mode)
+    const unsigned char *frame = cached_frame(s, data, len);
+    if (NULL != frame)
     {
-        serial_read(fd, buf, sizeof buf);
+        // Everything but the footer is ready, it depends on the position within the command
+        static const unsigned char footer[2] = { ETB, ETX };
+        serial_iovec_t iov[2] =
+        {
+            { frame, len + 3 },
+            { &footer[last ? 1 : 0], 1 },
+        };
+        const int ret = serial_writev(s->port, iov, 2);
+        if (1 == s->communication_mode)
+        {
+            s->rx.echo += len + 4;
+        }
+        return ret;
     }
-    return ret;
+    const unsigned char header[2] = { STX, len & 0xFFU };
+    return rl78_send_frame(s, header, sizeof header, data, len, last ? ETX : ETB);
 }
 
-int rl78_recv(port_handle_t fd, void *data, int *len, int explen)
+/* Take a complete response frame out of the receive buffer, skipping echo of sent frames */
+static int rx_frame(rl78_session_t *s, void *data, int *len, int explen)
 {
-    unsigned char in[MAX_RESPONSE_LENGTH];
-    int data_len;
-    // receive header
-    serial_read(fd, in, 2);
-    data_len = in[1];
+    unsigned int available = s->rx.head - s->rx.tail;
+    if (s->rx.echo && available)
+    {
+        const unsigned int n = (s->rx.echo < available) ? s->rx.echo : available;
+        s->rx.tail += n;
+        s->rx.echo -= n;
+        available -= n;
+    }
+    if (s->rx.echo || 2 > available)
+    {
+        return RESPONSE_PENDING;
+    }
+    if (STX != rx_peek(s, 0))
+    {
+        s->rx.tail = s->rx.head;
+        return RESPONSE_FORMAT_ERROR;
+    }
+    int data_len = rx_peek(s, 1);
     if (0 == data_len)
     {
         data_len = 256;
     }
-    if ((MAX_RESPONSE_LENGTH - 4) < data_len
-        || STX != in[0])
+    // data field, checksum and footer byte
+    if ((unsigned int)data_len + 4 > available)
     {
-        return RESPONSE_FORMAT_ERROR;
+        return RESPONSE_PENDING;
     }
-    if (explen != data_len)
+    unsigned int sum = 0;
+    int i;
+    for (i = 1; i < data_len + 2; ++i)
     {
-        return RESPONSE_EXPECTED_LENGTH_ERROR;
+        sum -= rx_peek(s, i);
     }
-    // receive data field, checksum and footer byte
-    serial_read(fd, in + 2, data_len + 2);
-    switch (in[data_len + 3])
+    const unsigned char footer = rx_peek(s, data_len + 3);
+    const unsigned char frame_sum = rx_peek(s, data_len + 2);
+    if (ETB != footer && ETX != footer)
     {
-    case ETB:
-    case ETX:
-        break;
-    default:
+        s->rx.tail = s->rx.head;
         return RESPONSE_FORMAT_ERROR;
     }
-    if (checksum(in + 1, data_len + 1) != in[data_len + 2])
+    if ((sum & 0x00FFU) != frame_sum)
     {
+        s->rx.tail += data_len + 4;
         return RESPONSE_CHECKSUM_ERROR;
     }
-    memcpy(data, in + 2, data_len);
+    if (explen != data_len)
+    {
+        s->rx.tail += data_len + 4;
+        return RESPONSE_EXPECTED_LENGTH_ERROR;
+    }
+    unsigned char *out = data;
+    for (i = 0; i < data_len; ++i)
+    {
+        out[i] = rx_peek(s, i + 2);
+    }
+    s->rx.tail += data_len + 4;
     *len = data_len;
     return RESPONSE_OK;
 }
 
-int rl78_cmd_reset(port_handle_t fd)
+int rl78_recv(rl78_session_t *s, void *data, int *len, int explen, unsigned int timeout)
+{
+    serial_time_t deadline = serial_deadline(timeout);
+    int extended = 0;
+    for (;;)
+    {
+        const int rc = rx_frame(s, data, len, explen);
+        if (RESPONSE_PENDING != rc)
+        {
+            return rc;
+        }
+        if (!extended && !s->rx.echo && 2 <= s->rx.head - s->rx.tail)
+        {
+            // The rest of the frame follows the header immediately
+            const serial_time_t frame_deadline = serial_deadline(s->timing->command);
+            if (deadline < frame_deadline)
+            {
+                deadline = frame_deadline;
+            }
+            extended = 1;
+        }
+        const int fill_rc = rx_fill(s, deadline);
+        if (SERIAL_TIMEOUT == fill_rc)
+        {
+            return RESPONSE_TIMEOUT;
+        }
+        if (0 >= fill_rc)
+        {
+            return RESPONSE_FORMAT_ERROR;
+        }
+    }
+}
+
+int rl78_recv_poll(rl78_session_t *s, void *data, int *len, int explen)
+{
+    int rc = rx_frame(s, data, len, explen);
+    if (RESPONSE_PENDING != rc)
+    {
+        return rc;
+    }
+    // The deadline has passed already, only data at hand is read
+    if (SERIAL_ERROR == rx_fill(s, 0))
+    {
+        return RESPONSE_FORMAT_ERROR;
+    }
+    return rx_frame(s, data, len, explen);
+}
+
+/* Time for the device to process a range of flash memory */
+static
+unsigned int range_timeout(const rl78_session_t *s, unsigned int address_start, unsigned int address_end)
+{
+    return s->timing->command + ((address_end - address_start) / 1024 + 1) * s->timing->read_kb;
+}
+
+unsigned int rl78_timeout(const rl78_session_t *s, int cmd, int response,
+                          unsigned int address_start, unsigned int address_end)
 {
-    if (3 <= verbose_level)
+    if (RL78_RESPONSE_DONE == response)
+    {
+        return range_timeout(s, address_start, address_end);
+    }
+    if (RL78_RESPONSE_FRAME == response)
+    {
+        return s->timing->command + ((CMD_PROGRAMMING == cmd) ? s->timing->write_frame : s->timing->read_kb);
+    }
+    switch (cmd)
     {
-        printf("Send \"Reset\" command\n");
+    case CMD_BLOCK_ERASE:
+        return s->timing->command + s->timing->erase;
+    case CMD_BLOCK_BLANK_CHECK:
+        return range_timeout(s, address_start, address_end);
+    default:
+        return s->timing->command;
     }
-    rl78_send_cmd(fd, CMD_RESET, NULL, 0);
+}
+
+int rl78_send_range(rl78_session_t *s, int cmd, unsigned int address_start, unsigned int address_end)
+{
+    unsigned char buf[7];
+    memcpy(buf + 0, &address_start, 3);
+    memcpy(buf + 3, &address_end, 3);
+    buf[6] = 0;
+    return rl78_send_cmd(s, cmd, buf, (CMD_BLOCK_BLANK_CHECK == cmd) ? 7 : 6);
+}
+
+int rl78_cmd_reset(rl78_session_t *s)
+{
+    log_printf(&s->log, 3, "Send \"Reset\" command\n");
+    const serial_time_t start = serial_time();
+    rl78_send_cmd(s, CMD_RESET, NULL, 0);
     int len = 0;
     unsigned char data[3];
-    int rc = rl78_recv(fd, &data, &len, 1);
+    int rc = rl78_recv(s, &data, &len, 1, s->timing->command);
     if (RESPONSE_OK != rc)
     {
-        fprintf(stderr, "FAILED\n");
+        log_printf(&s->log, LOG_ERROR, "FAILED\n");
         return rc;
     }
     if (STATUS_ACK != data[0])
     {
-        fprintf(stderr, "ACK not received\n");
+        log_printf(&s->log, LOG_ERROR, "ACK not received\n");
         return data[0];
     }
     else
     {
-        if (3 <= verbose_level)
-        {
-            printf("\tOK\n");
-        }
+        log_printf(&s->log, 3, "\tOK\n");
     }
+    // The shortest exchange of the protocol, dominated by the adapter's latency
+    log_printf(&s->log, 2, "Round-trip time: %u us\n", (unsigned int)(serial_time() - start));
     return 0;
 }
 
-int rl78_cmd_baud_rate_set(port_handle_t fd, int baud, float voltage)
+int rl78_baud_code(int baud)
 {
-    unsigned char buf[2];
-    int baud_code;
     switch (baud)
     {
-    default:
-        fprintf(stderr, "Unsupported baudrate %ubps. Using default baudrate 115200bps.\n", baud);
-        baud = 115200;
-        // fall through
     case 115200:
-        baud_code = RL78_BAUD_115200;
-        break;
+        return RL78_BAUD_115200;
     case 250000:
-        baud_code = RL78_BAUD_250000;
-        break;
+        return RL78_BAUD_250000;
     case 500000:
-        baud_code = RL78_BAUD_500000;
-        break;
+        return RL78_BAUD_500000;
     case 1000000:
-        baud_code = RL78_BAUD_1000000;
-        break;
+        return RL78_BAUD_1000000;
+    default:
+        return -1;
     }
-    buf[0] = baud_code;
-    buf[1] = (int)(voltage * 10);
-    if (3 <= verbose_level)
+}
+
+int rl78_cmd_baud_rate_set(rl78_session_t *s, int baud, float voltage)
+{
+    unsigned char buf[2];
+    int baud_code = rl78_baud_code(baud);
+    if (0 > baud_code)
     {
-        printf("Send \"Set Baud Rate\" command (baud=%ubps, voltage=%1.1fV)\n", baud, voltage);
+        log_printf(&s->log, LOG_ERROR, "Unsupported baudrate %ubps. Using default baudrate 115200bps.\n", baud);
+        baud = 115200;
+        baud_code = RL78_BAUD_115200;
     }
-    rl78_send_cmd(fd, CMD_BAUD_RATE_SET, buf, 2);
+    buf[0] = baud_code;
+    buf[1] = (int)(voltage * 10);
+    log_printf(&s->log, 3, "Send \"Set Baud Rate\" command (baud=%ubps, voltage=%1.1fV)\n", baud, voltage);
+    rl78_send_cmd(s, CMD_BAUD_RATE_SET, buf, 2);
     int len = 0;
     unsigned char data[3];
-    int rc = rl78_recv(fd, &data, &len, 3);
+    int rc = rl78_recv(s, &data, &len, 3, s->timing->command);
     if (RESPONSE_OK != rc)
     {
-        fprintf(stderr, "FAILED baud rate set\n");
+        log_printf(&s->log, LOG_ERROR, "FAILED baud rate set\n");
         return rc;
     }
     if (STATUS_ACK != data[0])
     {
-        fprintf(stderr, "ACK not received\n");
+        log_printf(&s->log, LOG_ERROR, "ACK not received\n");
         return data[0];
     }
-    if (3 <= verbose_level)
-    {
-        printf("\tOK\n");
-        printf("\tFrequency: %u MHz\n", data[1]);
-        printf("\tMode: %s\n", 0 == data[2] ? "full-speed mode" : "wide-voltage mode");
-    }
+    log_printf(&s->log, 3, "\tOK\n");
+    log_printf(&s->log, 3, "\tFrequency: %u MHz\n", data[1]);
+    log_printf(&s->log, 3, "\tMode: %s\n", 0 == data[2] ? "full-speed mode" : "wide-voltage mode");
     /* If no need to change baudrate, just exit */
     if (115200 == baud)
     {
         return 0;
     }
-    return serial_set_baud(fd, baud);
+    return serial_set_baud(s->port, baud);
 }
 
-int rl78_cmd_silicon_signature(port_handle_t fd, char device_name[11], unsigned int *code_size, unsigned int *data_size)
+void rl78_decode_signature(const unsigned char data[22], char device_name[11], unsigned int *code_size, unsigned int *data_size)
 {
-    if (3 <= verbose_level)
+    if (NULL != device_name)
     {
-        printf("Send \"Get Silicon Signature\" command\n");
+        memcpy(device_name, data + 3, 10);
+        device_name[10] = '\0';
     }
-    rl78_send_cmd(fd, CMD_SILICON_SIGNATURE, NULL, 0);
+    unsigned int rom_code_address = 0;
+    unsigned int rom_data_address = 0;
+    memcpy(&rom_code_address, data + 13, 3);
+    memcpy(&rom_data_address, data + 16, 3);
+    *code_size = rom_code_address + 1;
+    *data_size = (rom_data_address != 0) ? (rom_data_address - DATA_OFFSET + 1) : 0;
+}
+
+int rl78_cmd_silicon_signature(rl78_session_t *s, char device_name[11], unsigned int *code_size, unsigned int *data_size)
+{
+    log_printf(&s->log, 3, "Send \"Get Silicon Signature\" command\n");
+    rl78_send_cmd(s, CMD_SILICON_SIGNATURE, NULL, 0);
     int len = 0;
     unsigned char data[22];
-    int rc = rl78_recv(fd, &data, &len, 1);
+    int rc = rl78_recv(s, &data, &len, 1, s->timing->command);
     if (RESPONSE_OK != rc)
     {
-        fprintf(stderr, "FAILED\n");
+        log_printf(&s->log, LOG_ERROR, "FAILED\n");
         return rc;
     }
     if (STATUS_ACK != data[0])
     {
-        fprintf(stderr, "ACK not received\n");
+        log_printf(&s->log, LOG_ERROR, "ACK not received\n");
         return data[0];
     }
-    rc = rl78_recv(fd, &data, &len, 22);
+    rc = rl78_recv(s, &data, &len, 22, s->timing->command);
     if (RESPONSE_OK != rc)
     {
-        fprintf(stderr, "FAILED\n");
+        log_printf(&s->log, LOG_ERROR, "FAILED\n");
         return rc;
     }
-    if (NULL != device_name)
-    {
-        memcpy(device_name, data + 3, 10);
-        device_name[10] = '\0';
-    }
-    unsigned int rom_code_address = 0;
-    unsigned int rom_data_address = 0;
-    memcpy(&rom_code_address, data + 13, 3);
-    memcpy(&rom_data_address, data + 16, 3);
-    const unsigned int rom_code_size = (rom_code_address + 1);
-    const unsigned int rom_data_size = (rom_data_address != 0) ? (rom_data_address - 0x000F1000U + 1) : 0;
-
+    unsigned int rom_code_size, rom_data_size;
+    rl78_decode_signature(data, device_name, &rom_code_size, &rom_data_size);
     if (NULL != code_size)
     {
         *code_size = rom_code_size;
@@ -331,75 +620,60 @@ int rl78_cmd_silicon_signature(port_handle_t fd, char device_name[11], unsigned
     {
         *data_size = rom_data_size;
     }
-    if (3 <= verbose_level)
+    log_printf(&s->log, 3, "\tOK\n");
+    log_printf(&s->log, 3, "\tDevice code: %02X%02X%02X\n", data[0], data[1], data[2]);
+    log_printf(&s->log, 3, "\tDevice name: %.10s\n", (const char*)data + 3);
+    log_printf(&s->log, 3, "\tCode flash size: %ukB\n", rom_code_size / 1024);
+    if (rom_data_size != 0)
     {
-        printf("\tOK\n");
-        printf("\tDevice code: %02X%02X%02X\n", data[0], data[1], data[2]);
-        printf("\tDevice name: %s\n", device_name);
-        printf("\tCode flash size: %ukB\n", rom_code_size / 1024);
-        if (rom_data_size != 0)
-        {
-            printf("\tData flash size: %ukB\n", rom_data_size / 1024);
-        }
-        else
-        {
-            printf("\tData flash not present\n");
-        }
-        printf("\tFirmware version: %X.%X%X\n", data[19], data[20], data[21]);
+        log_printf(&s->log, 3, "\tData flash size: %ukB\n", rom_data_size / 1024);
+    }
+    else
+    {
+        log_printf(&s->log, 3, "\tData flash not present\n");
     }
+    log_printf(&s->log, 3, "\tFirmware version: %X.%X%X\n", data[19], data[20], data[21]);
     return 0;
 }
 
-int rl78_cmd_block_erase(port_handle_t fd, unsigned int address)
+int rl78_cmd_block_erase(rl78_session_t *s, unsigned int address)
 {
-    if (3 <= verbose_level)
-    {
-        printf("Send \"Block Erase\" command (addres=%06X)\n", address);
-    }
-    rl78_send_cmd(fd, CMD_BLOCK_ERASE, &address, 3);
+    log_printf(&s->log, 3, "Send \"Block Erase\" command (addres=%06X)\n", address);
+    rl78_send_cmd(s, CMD_BLOCK_ERASE, &address, 3);
     int len = 0;
     unsigned char data[1];
-    int rc = rl78_recv(fd, &data, &len, 1);
+    int rc = rl78_recv(s, &data, &len, 1, rl78_timeout(s, CMD_BLOCK_ERASE, RL78_RESPONSE_STATUS, address, address));
     if (RESPONSE_OK != rc)
     {
-        fprintf(stderr, "FAILED\n");
+        log_printf(&s->log, LOG_ERROR, "FAILED\n");
         return rc;
     }
     if (STATUS_ACK != data[0])
     {
-        fprintf(stderr, "ACK not received\n");
+        log_printf(&s->log, LOG_ERROR, "ACK not received\n");
         return data[0];
     }
-    if (3 <= verbose_level)
-    {
-        printf("\tOK\n");
-    }
+    log_printf(&s->log, 3, "\tOK\n");
     return 0;
 }
 
-int rl78_cmd_block_blank_check(port_handle_t fd, unsigned int address_start, unsigned int address_end)
+int rl78_cmd_block_blank_check(rl78_session_t *s, unsigned int address_start, unsigned int address_end)
 {
-    if (3 <= verbose_level)
-    {
-        printf("Send \"Block Blank Check\" command (range=%06X..%06X)\n", address_start, address_end);
-    }
-    unsigned char buf[7];
-    memcpy(buf + 0, &address_start, 3);
-    memcpy(buf + 3, &address_end, 3);
-    buf[6] = 0;
-    rl78_send_cmd(fd, CMD_BLOCK_BLANK_CHECK, buf, sizeof buf);
+    log_printf(&s->log, 3, "Send \"Block Blank Check\" command (range=%06X..%06X)\n", address_start, address_end);
+    rl78_send_range(s, CMD_BLOCK_BLANK_CHECK, address_start, address_end);
     int len = 0;
     unsigned char data[1];
-    int rc = rl78_recv(fd, &data, &len, 1);
+    int rc = rl78_recv(s, &data, &len, 1,
+                       rl78_timeout(s, CMD_BLOCK_BLANK_CHECK, RL78_RESPONSE_STATUS, address_start, address_end));
     if (RESPONSE_OK != rc)
     {
-        fprintf(stderr, "FAILED\n");
+        log_printf(&s->log, LOG_ERROR, "FAILED\n");
         return rc;
     }
     if (STATUS_ACK != data[0]
         && STATUS_IVERIFY_BLANK_ERROR != data[0])
     {
-        fprintf(stderr, "ACK not received\n");
+        log_printf(&s->log, LOG_ERROR, "ACK not received\n");
         return data[0];
     }
     if (STATUS_ACK == data[0])
@@ -411,91 +685,71 @@ int rl78_cmd_block_blank_check(port_handle_t fd, unsigned int address_start, uns
         rc = 1;
     }
 
-    if (3 <= verbose_level)
-    {
-        printf("\tOK\n");
-        if (0 == rc)
-        {
-            printf("\tBlock is empty\n");
-        }
-        else
-        {
-            printf("\tBlock is not empty\n");
-        }
-    }
+    log_printf(&s->log, 3, "\tOK\n");
+    log_printf(&s->log, 3, (0 == rc) ? "\tBlock is empty\n" : "\tBlock is not empty\n");
     return rc;
 }
 
-int rl78_cmd_checksum(port_handle_t fd, unsigned int address_start, unsigned int address_end)
+int rl78_cmd_checksum(rl78_session_t *s, unsigned int address_start, unsigned int address_end, unsigned int *value)
 {
-    if (3 <= verbose_level)
-    {
-        printf("Send \"Checksum\" command (range=%06X..%06X)\n", address_start, address_end);
-    }
-    unsigned char buf[6];
-    memcpy(buf + 0, &address_start, 3);
-    memcpy(buf + 3, &address_end, 3);
-    rl78_send_cmd(fd, CMD_CHECKSUM, buf, sizeof buf);
+    log_printf(&s->log, 3, "Send \"Checksum\" command (range=%06X..%06X)\n", address_start, address_end);
+    rl78_send_range(s, CMD_CHECKSUM, address_start, address_end);
     int len = 0;
     unsigned char data[2];
-    int rc = rl78_recv(fd, &data, &len, 1);
+    int rc = rl78_recv(s, &data, &len, 1, rl78_timeout(s, CMD_CHECKSUM, RL78_RESPONSE_STATUS, address_start, address_end));
     if (RESPONSE_OK != rc)
     {
-        fprintf(stderr, "FAILED\n");
+        log_printf(&s->log, LOG_ERROR, "FAILED\n");
         return rc;
     }
     if (STATUS_ACK != data[0])
     {
-        fprintf(stderr, "ACK not received\n");
+        log_printf(&s->log, LOG_ERROR, "ACK not received\n");
         return data[0];
     }
-    rc = rl78_recv(fd, &data, &len, 2);
-    if (3 <= verbose_level)
+    rc = rl78_recv(s, &data, &len, 2, rl78_timeout(s, CMD_CHECKSUM, RL78_RESPONSE_DONE, address_start, address_end));
+    if (RESPONSE_OK != rc)
+    {
+        log_printf(&s->log, LOG_ERROR, "FAILED\n");
+        return rc;
+    }
+    if (NULL != value)
     {
-        printf("\tOK\n");
-        printf("\tValue: %02X%02X\n", data[1], data[0]);
+        *value = ((unsigned int)data[1] << 8) | data[0];
     }
+    log_printf(&s->log, 3, "\tOK\n");
+    log_printf(&s->log, 3, "\tValue: %02X%02X\n", data[1], data[0]);
     return rc;
 }
 
-int rl78_cmd_programming(port_handle_t fd, unsigned int address_start, unsigned int address_end, const void *rom, int proto_ver)
+int rl78_cmd_programming(rl78_session_t *s, unsigned int address_start, unsigned int address_end, const void *rom)
 {
-    if (3 <= verbose_level)
-    {
-        printf("Send \"Programming\" command (range=%06X..%06X)\n", address_start, address_end);
-    }
-    unsigned char buf[6];
-    memcpy(buf + 0, &address_start, 3);
-    memcpy(buf + 3, &address_end, 3);
-    rl78_send_cmd(fd, CMD_PROGRAMMING, buf, sizeof buf);
+    log_printf(&s->log, 3, "Send \"Programming\" command (range=%06X..%06X)\n", address_start, address_end);
+    rl78_send_range(s, CMD_PROGRAMMING, address_start, address_end);
     int len = 0;
     unsigned char data[2];
-    int rc = rl78_recv(fd, &data, &len, 1);
+    int rc = rl78_recv(s, &data, &len, 1, rl78_timeout(s, CMD_PROGRAMMING, RL78_RESPONSE_STATUS, address_start, address_end));
     if (RESPONSE_OK != rc)
     {
-        fprintf(stderr, "FAILED (no response)\n");
+        log_printf(&s->log, LOG_ERROR, "FAILED (no response)\n");
         return rc;
     }
     if (STATUS_ACK != data[0])
     {
-        fprintf(stderr, "ACK not received\n");
+        log_printf(&s->log, LOG_ERROR, "ACK not received\n");
         return data[0];
     }
     unsigned int rom_length = address_end - address_start + 1;
     unsigned char *rom_p = (unsigned char*)rom;
     unsigned int address_current = address_start;
-    unsigned int final_delay = (rom_length / 1024 + 1) * 1500;
     // Send data
     while (rom_length)
     {
-        if (3 <= verbose_level)
-        {
-            printf("\tSend data to address %06X\n", address_current);
-        }
+        log_printf(&s->log, 3, "\tSend data to address %06X\n", address_current);
         if (256 < rom_length)
         {
             // Not last data frame
-            rl78_send_data(fd, rom_p, 256, 0);
+            rl78_send_data(s, rom_p, 256, 0);
             address_current += 256;
             rom_p += 256;
             rom_length -= 256;
@@ -503,48 +757,48 @@ int rl78_cmd_programming(port_handle_t fd, unsigned int address_start, unsigned
         else
         {
             // Last data frame
-            rl78_send_data(fd, rom_p, rom_length, 1);
+            rl78_send_data(s, rom_p, rom_length, 1);
             address_current += rom_length;
             rom_p += rom_length;
             rom_length -= rom_length;
         }
-        rc = rl78_recv(fd, &data, &len, 2);
+        rc = rl78_recv(s, &data, &len, 2, rl78_timeout(s, CMD_PROGRAMMING, RL78_RESPONSE_FRAME, 0, 0));
         if (RESPONSE_OK != rc)
         {
-            fprintf(stderr, "FAILED (bad response for block)\n");
+            log_printf(&s->log, LOG_ERROR, "FAILED (bad response for block)\n");
             return rc;
         }
         if (STATUS_ACK != data[0])
         {
-            fprintf(stderr, "ACK not received\n");
+            log_printf(&s->log, LOG_ERROR, "ACK not received\n");
             return data[0];
         }
         if (STATUS_ACK != data[1])
         {
-            fprintf(stderr, "Data not written\n");
+            log_printf(&s->log, LOG_ERROR, "Data not written\n");
             return data[1];
         }
     }
-    usleep(final_delay);
     // Receive status of completion
-    if (proto_ver != PROTOCOL_VERSION_C)
-    { /* Protocol A and D require this packet, C doesn't send it */
-        rc = rl78_recv(fd, &data, &len, 1);
+    if (s->proto_ver == PROTOCOL_VERSION_C)
+    { /* C doesn't send it, the device writes and verifies until the worst case is over */
+        usleep(rl78_timeout(s, CMD_PROGRAMMING, RL78_RESPONSE_DONE, address_start, address_end));
+    }
+    else
+    { /* Protocol A and D require this packet */
+        rc = rl78_recv(s, &data, &len, 1, rl78_timeout(s, CMD_PROGRAMMING, RL78_RESPONSE_DONE, address_start, address_end));
         if (RESPONSE_OK != rc)
         {
-            fprintf(stderr, "FAILED (response not ok)\n");
+            log_printf(&s->log, LOG_ERROR, "FAILED (response not ok)\n");
             return rc;
         }
         if (STATUS_ACK != data[0])
         {
-            fprintf(stderr, "ACK not received\n");
+            log_printf(&s->log, LOG_ERROR, "ACK not received\n");
             return data[0];
         }
     }
-    if (3 <= verbose_level)
-    {
-        printf("\tOK\n");
-    }
+    log_printf(&s->log, 3, "\tOK\n");
     return rc;
 }
 
@@ -560,27 +814,21 @@ unsigned int rl78_checksum(const void *rom, unsigned int len)
     return sum & 0x0000FFFFU;
 }
 
-int rl78_cmd_verify(port_handle_t fd, unsigned int address_start, unsigned int address_end, const void *rom)
+int rl78_cmd_verify(rl78_session_t *s, unsigned int address_start, unsigned int address_end, const void *rom)
 {
-    if (3 <= verbose_level)
-    {
-        printf("Send \"Verify\" command (range=%06X..%06X)\n", address_start, address_end);
-    }
-    unsigned char buf[6];
-    memcpy(buf + 0, &address_start, 3);
-    memcpy(buf + 3, &address_end, 3);
-    rl78_send_cmd(fd, CMD_VERIFY, buf, sizeof buf);
+    log_printf(&s->log, 3, "Send \"Verify\" command (range=%06X..%06X)\n", address_start, address_end);
+    rl78_send_range(s, CMD_VERIFY, address_start, address_end);
     int len = 0;
     unsigned char data[2];
-    int rc = rl78_recv(fd, &data, &len, 1);
+    int rc = rl78_recv(s, &data, &len, 1, rl78_timeout(s, CMD_VERIFY, RL78_RESPONSE_STATUS, address_start, address_end));
     if (RESPONSE_OK != rc)
     {
-        fprintf(stderr, "FAILED\n");
+        log_printf(&s->log, LOG_ERROR, "FAILED\n");
         return rc;
     }
     if (STATUS_ACK != data[0])
     {
-        fprintf(stderr, "ACK not received\n");
+        log_printf(&s->log, LOG_ERROR, "ACK not received\n");
         return data[0];
     }
     unsigned int rom_length = address_end - address_start + 1;
@@ -589,14 +837,11 @@ int rl78_cmd_verify(port_handle_t fd, unsigned int address_start, unsigned int a
     // Send data
     while (rom_length)
     {
-        if (3 <= verbose_level)
-        {
-            printf("\tSend data to address %06X\n", address_current);
-        }
+        log_printf(&s->log, 3, "\tSend data to address %06X\n", address_current);
         if (256 < rom_length)
         {
             // Not last data frame
-            rl78_send_data(fd, rom_p, 256, 0);
+            rl78_send_data(s, rom_p, 256, 0);
             address_current += 256;
             rom_p += 256;
             rom_length -= 256;
@@ -604,212 +849,755 @@ int rl78_cmd_verify(port_handle_t fd, unsigned int address_start, unsigned int a
         else
         {
             // Last data frame
-            rl78_send_data(fd, rom_p, rom_length, 1);
+            rl78_send_data(s, rom_p, rom_length, 1);
             address_current += rom_length;
             rom_p += rom_length;
             rom_length -= rom_length;
         }
-        usleep(10000);
-        rc = rl78_recv(fd, &data, &len, 2);
+        rc = rl78_recv(s, &data, &len, 2, rl78_timeout(s, CMD_VERIFY, RL78_RESPONSE_FRAME, 0, 0));
         if (RESPONSE_OK != rc)
         {
-            fprintf(stderr, "FAILED\n");
+            log_printf(&s->log, LOG_ERROR, "FAILED\n");
             return rc;
         }
         if (STATUS_ACK != data[0])
         {
-            fprintf(stderr, "ACK not received\n");
+            log_printf(&s->log, LOG_ERROR, "ACK not received\n");
             return data[0];
         }
         if (STATUS_ACK != data[1])
         {
-            fprintf(stderr, "Verify failed\n");
+            log_printf(&s->log, LOG_ERROR, "Verify failed\n");
             return data[1];
         }
     }
-    if (3 <= verbose_level)
+    log_printf(&s->log, 3, "\tOK\n");
+    return rc;
+}
+
+/* Progress marks are shown at verbose level 2 only, higher levels print details instead */
+static
+int show_progress(const rl78_session_t *s)
+{
+    return 2 == s->log.verbose_level;
+}
+
+static
+void print_progress(const rl78_session_t *s, char c, unsigned int count)
+{
+    char marks[64];
+    while (count)
     {
-        printf("\tOK\n");
+        const unsigned int n = (count < sizeof marks - 1) ? count : sizeof marks - 1;
+        memset(marks, c, n);
+        marks[n] = '\0';
+        log_printf(&s->log, 2, "%s", marks);
+        count -= n;
     }
-    return rc;
 }
 
+/* Check blank state of the blocks. Blocks that are not blank are erased if
+ * erase is set, otherwise the first of them is reported and checking stops.
+ * A range that is not blank is split in halves with RL78_FLAG_BISECT_BLANK_CHECK
+ * and into single blocks without it. */
 static
-int allFFs(const void *mem, unsigned int size)
+int rl78_blank_blocks(rl78_session_t *s, unsigned int address, unsigned int count, unsigned blksz,
+                      int erase, int progress)
 {
-    unsigned char *p = (unsigned char*)mem;
-    unsigned int i = size;
-    for (; i; --i)
+    int rc = rl78_cmd_block_blank_check(s, address, address + count * blksz - 1);
+    if (0 > rc)
+    {
+        log_printf(&s->log, LOG_ERROR, "Block Blank Check failed (%06X)\n", address);
+        return rc;
+    }
+    if (0 == rc)
+    {
+        if (progress && show_progress(s))
+        {
+            print_progress(s, '.', count);
+        }
+        return 0;
+    }
+    if (1 == count)
+    {
+        if (!erase)
+        {
+            log_printf(&s->log, LOG_ERROR, "Block content does not match (%06X)\n", address);
+            return rc;
+        }
+        // If block is not empty - erase it
+        rc = rl78_cmd_block_erase(s, address);
+        if (0 > rc)
+        {
+            log_printf(&s->log, LOG_ERROR, "Block Erase failed (%06X)\n", address);
+            return rc;
+        }
+        if (progress && show_progress(s))
+        {
+            print_progress(s, '*', 1);
+        }
+        return 0;
+    }
+    if (s->flags & RL78_FLAG_BISECT_BLANK_CHECK)
+    {
+        const unsigned int half = count / 2;
+        rc = rl78_blank_blocks(s, address, half, blksz, erase, progress);
+        if (0 != rc)
+        {
+            return rc;
+        }
+        return rl78_blank_blocks(s, address + half * blksz, count - half, blksz, erase, progress);
+    }
+    for (; count; --count, address += blksz)
+    {
+        rc = rl78_blank_blocks(s, address, 1, blksz, erase, progress);
+        if (0 != rc)
+        {
+            return rc;
+        }
+    }
+    return 0;
+}
+
+/* Checksums of the blocks in the image, only blocks with data are summed up */
+static
+unsigned int *rl78_block_sums(rl78_session_t *s, const image_t *img, unsigned int address,
+                              unsigned int nblocks, unsigned blksz, unsigned char *buf)
+{
+    unsigned int *sums = malloc(nblocks * sizeof *sums);
+    if (NULL == sums)
+    {
+        log_printf(&s->log, LOG_ERROR, "Memory allocation failed\n");
+        return NULL;
+    }
+    const unsigned int blank_sum = (0U - 0xFFU * blksz) & 0x0000FFFFU;
+    unsigned int i;
+    for (i = 0; i < nblocks; ++i, address += blksz)
     {
-        if (0xFF != *p++)
+        unsigned int sum;
+        if (!image_used(img, address, blksz))
+        {
+            sums[i] = blank_sum;
+        }
+        else if (0 == image_sum(img, address, blksz, &sum))
+        {
+            // Precompiled image, the checksum is the negated byte sum
+            sums[i] = (0U - sum) & 0x0000FFFFU;
+        }
+        else
+        {
+            sums[i] = rl78_checksum(image_data(img, address, blksz, buf), blksz);
+        }
+    }
+    return sums;
+}
+
+/* Mark blocks whose device checksums differ from the image, splitting a
+ * mismatching range in halves. If known_bad is set, the range is known to
+ * mismatch and its checksum is not requested. The checksum is a 16-bit sum,
+ * it does not see bytes swapped or moved within a range, blocks left unmarked
+ * are confirmed by rl78_confirm_blocks() if RL78_FLAG_VERIFY_DATA is set. */
+static
+int rl78_diff_blocks(rl78_session_t *s, unsigned int address, const unsigned int *sums,
+                     unsigned int count, unsigned blksz, unsigned char *dirty, int known_bad)
+{
+    int rc;
+    if (!known_bad)
+    {
+        unsigned int device_sum = 0;
+        unsigned int image_sum = 0;
+        unsigned int i;
+        rc = rl78_cmd_checksum(s, address, address + count * blksz - 1, &device_sum);
+        if (0 != rc)
+        {
+            log_printf(&s->log, LOG_ERROR, "Checksum failed (%06X)\n", address);
+            return rc;
+        }
+        for (i = 0; i < count; ++i)
+        {
+            image_sum += sums[i];
+        }
+        if (device_sum == (image_sum & 0x0000FFFFU))
         {
             return 0;
         }
     }
-    return 1;
+    if (1 == count)
+    {
+        *dirty = 1;
+        return 0;
+    }
+    const unsigned int half = count / 2;
+    rc = rl78_diff_blocks(s, address, sums, half, blksz, dirty, 0);
+    if (0 != rc)
+    {
+        return rc;
+    }
+    // If the first half matches, the second one does not
+    known_bad = (NULL == memchr(dirty, 1, half));
+    return rl78_diff_blocks(s, address + half * blksz, sums + half, count - half, blksz, dirty + half, known_bad);
 }
 
-int rl78_program(port_handle_t fd, unsigned int address, const void *data, unsigned int size, unsigned blksz, int proto_ver)
+/* Let the device compare blocks which are not marked, those the image has data
+ * for are verified, the others are blank checked run by run. Blocks which
+ * differ in spite of their checksums are marked. */
+static
+int rl78_confirm_blocks(rl78_session_t *s, const image_t *img, unsigned int address, unsigned int nblocks,
+                        unsigned blksz, unsigned char *dirty, unsigned char *buf)
 {
-    // Make sure size is aligned to flash block boundary
-    unsigned int i = size & ~(blksz - 1);
-    const unsigned char *mem = (const unsigned char*)data;
-    int rc = 0;;
-    for (; i; i -= blksz)
+    unsigned int i = 0;
+    while (i < nblocks)
     {
-        if (!allFFs(mem, blksz))
+        const unsigned int start = address + i * blksz;
+        unsigned int count = 1;
+        int rc;
+        if (dirty[i])
+        {
+            ++i;
+            continue;
+        }
+        if (image_used(img, start, blksz))
+        {
+            rc = rl78_cmd_verify(s, start, start + blksz - 1, image_data(img, start, blksz, buf));
+        }
+        else
         {
-            if (3 <= verbose_level)
+            while (i + count < nblocks && !dirty[i + count] && !image_used(img, start + count * blksz, blksz))
             {
-                printf("Program block %06X\n", address);
+                ++count;
             }
-            // Check if block is ready to program new content
-            rc = rl78_cmd_block_blank_check(fd, address, address + blksz - 1);
-            if (0 > rc)
+            rc = rl78_cmd_block_blank_check(s, start, start + count * blksz - 1);
+        }
+        if (0 > rc)
+        {
+            log_printf(&s->log, LOG_ERROR, "Comparison failed (%06X)\n", start);
+            return rc;
+        }
+        if (0 != rc)
+        {
+            log_printf(&s->log, 1, "Blocks %06X..%06X differ, although their checksums match\n",
+                       start, start + count * blksz - 1);
+            memset(dirty + i, 1, count);
+        }
+        i += count;
+    }
+    return 0;
+}
+
+unsigned int rl78_block_size(const rl78_session_t *s, unsigned int address)
+{
+    return (DATA_OFFSET <= address) ? s->data_block_size : s->code_block_size;
+}
+
+int rl78_program(rl78_session_t *s, const image_t *img, unsigned int address, unsigned int size)
+{
+    const unsigned int blksz = rl78_block_size(s, address);
+    if (!blksz)
+    {
+        log_printf(&s->log, LOG_ERROR, "Block size is not set\n");
+        return -1;
+    }
+    // Make sure size is aligned to flash block boundary
+    const unsigned int nblocks = (size & ~(blksz - 1)) / blksz;
+    unsigned int max_count = 1;
+    unsigned char *dirty = NULL;
+    unsigned int i = 0;
+    int rc = 0;
+    if (!nblocks)
+    {
+        return 0;
+    }
+    if (s->flags & RL78_FLAG_MERGE_BLOCKS)
+    {
+        max_count = MAX_PROGRAM_RANGE / blksz;
+        if (!max_count)
+        {
+            max_count = 1;
+        }
+    }
+    // Ranges which span segments of the image are put together here
+    unsigned char *buf = malloc(max_count * blksz);
+    if (NULL == buf)
+    {
+        log_printf(&s->log, LOG_ERROR, "Memory allocation failed\n");
+        return -1;
+    }
+    if (s->flags & RL78_FLAG_DELTA)
+    {
+        // Find blocks that differ from the image
+        unsigned int *sums = rl78_block_sums(s, img, address, nblocks, blksz, buf);
+        dirty = calloc(nblocks, 1);
+        if (NULL == sums || NULL == dirty)
+        {
+            free(sums);
+            free(dirty);
+            free(buf);
+            return -1;
+        }
+        rc = rl78_diff_blocks(s, address, sums, nblocks, blksz, dirty, 0);
+        free(sums);
+        // Sending the data of every matching block again costs what update mode saves
+        if (0 == rc && (s->flags & RL78_FLAG_VERIFY_DATA))
+        {
+            rc = rl78_confirm_blocks(s, img, address, nblocks, blksz, dirty, buf);
+        }
+        if (0 != rc)
+        {
+            free(dirty);
+            free(buf);
+            return rc;
+        }
+    }
+    while (i < nblocks)
+    {
+        if (!dirty)
+        {
+            // Blocks without data are passed over at once
+            const unsigned int next = image_next_used(img, address);
+            unsigned int skip = nblocks - i;
+            if (next < img->end)
             {
-                fprintf(stderr, "Block Blank Check failed (%06X)\n", address);
-                break;
+                skip = (next > address) ? (next - address) / blksz : 0;
+                skip = (skip < nblocks - i) ? skip : nblocks - i;
             }
-            if (0 < rc)
+            if (skip)
             {
-                // If block is not empty - erase it
-                rc = rl78_cmd_block_erase(fd, address);
-                if (0 > rc)
-                {
-                    fprintf(stderr, "Block Erase failed (%06X)\n", address);
-                    break;
-                }
+                log_printf(&s->log, 3, "No data at blocks %06X..%06X\n", address, address + skip * blksz - 1);
+                address += skip * blksz;
+                i += skip;
+                continue;
             }
-            // Write new content
-            rc = rl78_cmd_programming(fd, address, address + blksz - 1, mem, proto_ver);
+        }
+        if (dirty && !dirty[i])
+        {
+            log_printf(&s->log, 3, "Block %06X is up to date\n", address);
+            address += blksz;
+            ++i;
+            continue;
+        }
+        if (!image_used(img, address, blksz))
+        {
+            // Device has data, the image does not
+            log_printf(&s->log, 3, "Erase block %06X\n", address);
+            rc = rl78_blank_blocks(s, address, 1, blksz, 1, 0);
             if (0 > rc)
             {
-                fprintf(stderr, "Programming failed (%06X)\n", address);
                 break;
             }
-            if (2 == verbose_level)
+            if (show_progress(s))
             {
-                printf("*");
-                fflush(stdout);
+                print_progress(s, '*', 1);
             }
+            address += blksz;
+            ++i;
+            continue;
         }
-        else
+        // Collect adjacent blocks with data
+        unsigned int count = 1;
+        while (count < max_count
+               && (i + count) < nblocks
+               && (!dirty || dirty[i + count])
+               && image_used(img, address + count * blksz, blksz))
         {
-            if (3 <= verbose_level)
-            {
-                printf("No data at block %06X\n", address);
-            }
+            ++count;
+        }
+        const unsigned int address_end = address + count * blksz - 1;
+        log_printf(&s->log, 3, "Program blocks %06X..%06X\n", address, address_end);
+        rc = rl78_blank_blocks(s, address, count, blksz, 1, 0);
+        if (0 > rc)
+        {
+            break;
+        }
+        // Write new content
+        rc = rl78_cmd_programming(s, address, address_end, image_data(img, address, count * blksz, buf));
+        if (0 > rc)
+        {
+            log_printf(&s->log, LOG_ERROR, "Programming failed (%06X)\n", address);
+            break;
+        }
+        if (show_progress(s))
+        {
+            print_progress(s, '*', count);
         }
-        mem += blksz;
-        address += blksz;
+        address += count * blksz;
+        i += count;
     }
-    if (2 == verbose_level)
+    free(dirty);
+    free(buf);
+    if (show_progress(s))
     {
-        printf("\n");
+        log_printf(&s->log, 2, "\n");
     }
     return rc;
 }
 
-int rl78_erase(port_handle_t fd, unsigned int start_address, unsigned int size, unsigned blksz)
+/* States of blocks while a stream is programmed */
+#define STREAM_BLOCK_PENDING    1   /* Not blank, written once the file is valid */
+#define STREAM_BLOCK_WRITTEN    2   /* Was blank, written from the stream */
+
+/* Erase blocks written from a stream which turned out to be bad, the ones
+ * which could not be erased are reported */
+static void rl78_unwrite_stream(rl78_session_t *s, unsigned int address, unsigned int nblocks,
+                                unsigned int blksz, const unsigned char *state)
 {
-    // Make sure size is aligned to flash block boundary
-    unsigned int i = size & ~(blksz - 1);
-    unsigned int address = start_address;
+    unsigned int i = 0;
+    while (i < nblocks)
+    {
+        unsigned int count = 0;
+        for (; i < nblocks && STREAM_BLOCK_WRITTEN != state[i]; ++i)
+        {
+        }
+        while (i + count < nblocks && STREAM_BLOCK_WRITTEN == state[i + count])
+        {
+            ++count;
+        }
+        if (!count)
+        {
+            break;
+        }
+        const unsigned int start = address + i * blksz;
+        log_printf(&s->log, 1, "Erase blocks %06X..%06X written from the bad file\n",
+                   start, start + count * blksz - 1);
+        unsigned int k;
+        for (k = 0; k < count; ++k)
+        {
+            const unsigned int a = start + k * blksz;
+            if (0 != rl78_cmd_block_erase(s, a))
+            {
+                log_printf(&s->log, LOG_ERROR, "Blocks %06X..%06X are left written from the bad file\n",
+                           a, start + count * blksz - 1);
+                break;
+            }
+        }
+        i += count;
+    }
+}
+
+int rl78_program_stream(rl78_session_t *s, image_stream_t *st, unsigned int address, unsigned int size)
+{
+    const unsigned int blksz = rl78_block_size(s, address);
+    if (!blksz)
+    {
+        log_printf(&s->log, LOG_ERROR, "Block size is not set\n");
+        return -1;
+    }
+    if (blksz % IMAGE_BLOCK_SIZE || address % IMAGE_BLOCK_SIZE)
+    {
+        // Blocks of the stream do not map onto flash blocks, take the whole image
+        const image_t *img = image_stream_wait(st);
+        return NULL != img ? rl78_program(s, img, address, size) : -1;
+    }
+    const unsigned int nblocks = size / blksz;
+    const unsigned int end = address + nblocks * blksz;
+    unsigned int max_count = 1;
     int rc = 0;
-    for (; i; i -= blksz)
+    if (s->flags & RL78_FLAG_MERGE_BLOCKS)
     {
-        rc = rl78_cmd_block_blank_check(fd, address, address + blksz - 1);
+        max_count = MAX_PROGRAM_RANGE / blksz;
+        if (!max_count)
+        {
+            max_count = 1;
+        }
+    }
+    unsigned char *buf = malloc(max_count * blksz);
+    // STREAM_BLOCK_* of every block
+    unsigned char *state = calloc(nblocks ? nblocks : 1, 1);
+    if (NULL == buf || NULL == state)
+    {
+        log_printf(&s->log, LOG_ERROR, "Memory allocation failed\n");
+        free(buf);
+        free(state);
+        return -1;
+    }
+    unsigned int npending = 0;
+    int stream_failed = 0;
+    for (;;)
+    {
+        unsigned int start;
+        unsigned int count;
+        // Blocks come as soon as their data is final, in any order
+        rc = image_stream_take(st, address, end, blksz, max_count, &start, &count, buf);
+        if (0 != rc)
+        {
+            stream_failed = 0 > rc;
+            rc = (0 < rc) ? 0 : -1;
+            break;
+        }
+        const unsigned int address_end = start + count * blksz - 1;
+        rc = rl78_cmd_block_blank_check(s, start, address_end);
         if (0 > rc)
         {
-            fprintf(stderr, "Block Blank Check failed (%06X)\n", address);
+            log_printf(&s->log, LOG_ERROR, "Block Blank Check failed (%06X)\n", start);
             break;
         }
         if (0 < rc)
         {
-            // If block is not empty
-            rc = rl78_cmd_block_erase(fd, address);
+            // Nothing is erased before the file is known to be good.
+            // Blocks are taken again if the file goes back to them, those are not blank either.
+            log_printf(&s->log, 3, "Blocks %06X..%06X are not blank, they are written later\n", start, address_end);
+            unsigned int i;
+            for (i = 0; i < count; ++i)
+            {
+                npending += STREAM_BLOCK_PENDING != state[(start - address) / blksz + i];
+                state[(start - address) / blksz + i] = STREAM_BLOCK_PENDING;
+            }
+            rc = 0;
+            continue;
+        }
+        log_printf(&s->log, 3, "Program blocks %06X..%06X\n", start, address_end);
+        rc = rl78_cmd_programming(s, start, address_end, buf);
+        if (0 > rc)
+        {
+            log_printf(&s->log, LOG_ERROR, "Programming failed (%06X)\n", start);
+            break;
+        }
+        memset(state + (start - address) / blksz, STREAM_BLOCK_WRITTEN, count);
+        if (show_progress(s))
+        {
+            print_progress(s, '*', count);
+        }
+    }
+    const image_t *img = (0 == rc && npending) ? image_stream_wait(st) : NULL;
+    if (0 == rc && npending && NULL == img)
+    {
+        stream_failed = 1;
+        rc = -1;
+    }
+    if (stream_failed)
+    {
+        rl78_unwrite_stream(s, address, nblocks, blksz, state);
+    }
+    if (0 == rc && npending)
+    {
+        // The file is complete and valid, the blocks get their final data
+        log_printf(&s->log, 3, "Write %u block(s) which were not blank\n", npending);
+        unsigned int i;
+        for (i = 0; i < nblocks && 0 == rc; ++i)
+        {
+            const unsigned int a = address + i * blksz;
+            if (STREAM_BLOCK_PENDING != state[i])
+            {
+                continue;
+            }
+            rc = rl78_blank_blocks(s, a, 1, blksz, 1, 0);
             if (0 > rc)
             {
-                fprintf(stderr, "Block Erase failed (%06X)\n", address);
                 break;
             }
-            if (2 == verbose_level)
+            rc = rl78_cmd_programming(s, a, a + blksz - 1, image_data(img, a, blksz, buf));
+            if (0 > rc)
             {
-                printf("*");
-                fflush(stdout);
+                log_printf(&s->log, LOG_ERROR, "Programming failed (%06X)\n", a);
+                break;
             }
-        }
-        else
-        {
-            // if block is already empty
-            if (2 == verbose_level)
+            if (show_progress(s))
             {
-                printf(".");
-                fflush(stdout);
+                print_progress(s, '*', 1);
             }
         }
-        address += blksz;
     }
-    if (2 == verbose_level)
+    free(state);
+    free(buf);
+    if (show_progress(s))
     {
-        printf("\n");
+        log_printf(&s->log, 2, "\n");
     }
     return rc;
 }
 
-int rl78_verify(port_handle_t fd, unsigned int address, const void *data, unsigned int size, int blksz)
+int rl78_erase(rl78_session_t *s, unsigned int start_address, unsigned int size)
 {
+    const unsigned int blksz = rl78_block_size(s, start_address);
+    if (!blksz)
+    {
+        log_printf(&s->log, LOG_ERROR, "Block size is not set\n");
+        return -1;
+    }
     // Make sure size is aligned to flash block boundary
-    unsigned int i = size & ~(blksz - 1);
-    const unsigned char *mem = (const unsigned char*)data;
+    const unsigned int nblocks = (size & ~(blksz - 1)) / blksz;
     int rc = 0;
-    for (; i; i -= blksz)
+    if (s->flags & RL78_FLAG_BISECT_BLANK_CHECK)
     {
-        if (3 <= verbose_level)
+        // Check the whole area at once and look into non-blank parts only
+        if (nblocks)
         {
-            printf("Verify block %06X\n", address);
+            rc = rl78_blank_blocks(s, start_address, nblocks, blksz, 1, 1);
         }
-        if (allFFs(mem, blksz))
+    }
+    else
+    {
+        unsigned int address = start_address;
+        unsigned int i = nblocks;
+        for (; i; --i, address += blksz)
         {
-            // Check if block is blank
-            rc = rl78_cmd_block_blank_check(fd, address, address + blksz - 1);
-            if (0 > rc)
+            rc = rl78_blank_blocks(s, address, 1, blksz, 1, 1);
+            if (0 != rc)
             {
-                fprintf(stderr, "Block Blank Check failed (%06X)\n", address);
                 break;
             }
-            if (0 < rc)
+        }
+    }
+    if (show_progress(s))
+    {
+        log_printf(&s->log, 2, "\n");
+    }
+    return rc;
+}
+
+/* Compare device checksums of the blocks with the image, splitting a range
+ * in halves until the first mismatching block is found. If known_bad is set,
+ * the range is known to mismatch and its checksum is not requested. Blocks
+ * passed by their data in spite of their checksum are counted in forgiven. */
+static
+int rl78_verify_blocks(rl78_session_t *s, const image_t *img, unsigned int address, const unsigned int *sums,
+                       unsigned int count, unsigned blksz, int known_bad, unsigned char *buf, unsigned int *forgiven)
+{
+    int rc;
+    if (!known_bad)
+    {
+        unsigned int device_sum = 0;
+        unsigned int image_sum = 0;
+        unsigned int i;
+        rc = rl78_cmd_checksum(s, address, address + count * blksz - 1, &device_sum);
+        if (0 != rc)
+        {
+            log_printf(&s->log, LOG_ERROR, "Checksum failed (%06X)\n", address);
+            return rc;
+        }
+        for (i = 0; i < count; ++i)
+        {
+            image_sum += sums[i];
+        }
+        if (device_sum == (image_sum & 0x0000FFFFU))
+        {
+            if (show_progress(s))
+            {
+                print_progress(s, '*', count);
+            }
+            return 0;
+        }
+    }
+    if (1 == count)
+    {
+        if (s->flags & RL78_FLAG_VERIFY_DATA)
+        {
+            // Let the device compare the data
+            rc = rl78_cmd_verify(s, address, address + blksz - 1, image_data(img, address, blksz, buf));
+            if (0 == rc)
             {
-                fprintf(stderr, "Block content does not match (%06X)\n", address);
-                break;
+                log_printf(&s->log, LOG_ERROR, "Checksum does not match, but data does (%06X)\n", address);
+                ++*forgiven;
+                return 0;
+            }
+        }
+        log_printf(&s->log, LOG_ERROR, "Block content does not match (%06X)\n", address);
+        return 1;
+    }
+    const unsigned int half = count / 2;
+    const unsigned int forgiven_before = *forgiven;
+    rc = rl78_verify_blocks(s, img, address, sums, half, blksz, 0, buf, forgiven);
+    if (0 != rc)
+    {
+        return rc;
+    }
+    // If the checksums of the first half match, the second one does not
+    known_bad = (forgiven_before == *forgiven);
+    return rl78_verify_blocks(s, img, address + half * blksz, sums + half, count - half, blksz, known_bad, buf,
+                              forgiven);
+}
+
+static
+int rl78_verify_checksum(rl78_session_t *s, const image_t *img, unsigned int address, unsigned int nblocks, int blksz,
+                         unsigned char *buf)
+{
+    if (!nblocks)
+    {
+        return 0;
+    }
+    unsigned int *sums = rl78_block_sums(s, img, address, nblocks, blksz, buf);
+    if (NULL == sums)
+    {
+        return -1;
+    }
+    log_printf(&s->log, 3, "Verify blocks %06X..%06X\n", address, address + nblocks * blksz - 1);
+    unsigned int forgiven = 0;
+    const int rc = rl78_verify_blocks(s, img, address, sums, nblocks, blksz, 0, buf, &forgiven);
+    free(sums);
+    if (show_progress(s))
+    {
+        log_printf(&s->log, 2, "\n");
+    }
+    return rc;
+}
+
+int rl78_verify(rl78_session_t *s, const image_t *img, unsigned int address, unsigned int size)
+{
+    const int blksz = rl78_block_size(s, address);
+    if (!blksz)
+    {
+        log_printf(&s->log, LOG_ERROR, "Block size is not set\n");
+        return -1;
+    }
+    // Make sure size is aligned to flash block boundary
+    const unsigned int nblocks = (size & ~(blksz - 1)) / blksz;
+    unsigned int i = 0;
+    int rc = 0;
+    // A block which spans segments of the image is put together here
+    unsigned char *buf = malloc(blksz);
+    if (NULL == buf)
+    {
+        log_printf(&s->log, LOG_ERROR, "Memory allocation failed\n");
+        return -1;
+    }
+    if (s->flags & RL78_FLAG_VERIFY_CHECKSUM)
+    {
+        rc = rl78_verify_checksum(s, img, address, nblocks, blksz, buf);
+        free(buf);
+        return rc;
+    }
+    while (i < nblocks)
+    {
+        log_printf(&s->log, 3, "Verify block %06X\n", address);
+        unsigned int count = 1;
+        if (!image_used(img, address, blksz))
+        {
+            if (s->flags & RL78_FLAG_BISECT_BLANK_CHECK)
+            {
+                // Collect adjacent blocks without data
+                while ((i + count) < nblocks
+                       && !image_used(img, address + count * blksz, blksz))
+                {
+                    ++count;
+                }
             }
-            if (2 == verbose_level)
+            // Check if blocks are blank
+            rc = rl78_blank_blocks(s, address, count, blksz, 0, 1);
+            if (0 != rc)
             {
-                printf(".");
-                fflush(stdout);
+                break;
             }
         }
         else
         {
             // If block is not blank
-            rc = rl78_cmd_verify(fd, address, address + blksz - 1, mem);
+            rc = rl78_cmd_verify(s, address, address + blksz - 1, image_data(img, address, blksz, buf));
             if (0 != rc)
             {
-                fprintf(stderr, "Block content does not match (%06X)\n", address);
+                log_printf(&s->log, LOG_ERROR, "Block content does not match (%06X)\n", address);
                 break;
             }
-            if (2 == verbose_level)
+            if (show_progress(s))
             {
-                printf("*");
-                fflush(stdout);
+                print_progress(s, '*', 1);
             }
         }
-        mem += blksz;
-        address += blksz;
+        address += count * blksz;
+        i += count;
     }
-    if (2 == verbose_level)
+    free(buf);
+    if (show_progress(s))
     {
-        printf("\n");
+        log_printf(&s->log, 2, "\n");
     }
     return rc;
 }
@@ -53,15 +53,37 @@
 #define RL78_BAUD_500000     0x02
 #define RL78_BAUD_1000000    0x03
 
+/* Pick the fastest baudrate passing a link check */
+#define BAUD_AUTO 0
+
 #define CODE_OFFSET             (0U)
 #define DATA_OFFSET             (0x000F1000U)
 
-#define MAX_RESPONSE_LENGTH 32
+/* Worst-case response times in microseconds of each protocol version, see the
+ * command processing times of the flash memory programming manuals:
+ *   A: RL78 Microcontrollers (RL78 Protocol A) Programmer Edition, R01AN0815
+ *   C: RL78 Microcontrollers (RL78 Protocol C) Programmer Edition
+ *   D: RL78 Microcontrollers (RL78 Protocol D) Programmer Edition
+ * Blocks are 1 kB with protocol A and 2 kB with protocols C and D. */
+#define TIMEOUT_A_COMMAND       100000U /* Command without flash operations, echo */
+#define TIMEOUT_A_ERASE_BLOCK   500000U /* Block Erase */
+#define TIMEOUT_A_READ_KB        10000U /* Blank Check, Checksum, Verify and internal verify, per kB */
+#define TIMEOUT_A_WRITE_FRAME   100000U /* Programming of a data frame */
+#define TIMEOUT_C_COMMAND       100000U
+#define TIMEOUT_C_ERASE_BLOCK  1000000U
+#define TIMEOUT_C_READ_KB        10000U /* Also the end of Programming, which sends no status */
+#define TIMEOUT_C_WRITE_FRAME   100000U
+#define TIMEOUT_D_COMMAND       100000U
+#define TIMEOUT_D_ERASE_BLOCK  1000000U
+#define TIMEOUT_D_READ_KB        10000U
+#define TIMEOUT_D_WRITE_FRAME   100000U
 
 #define RESPONSE_OK                     (0)
 #define RESPONSE_CHECKSUM_ERROR         (-1)
 #define RESPONSE_FORMAT_ERROR           (-2)
 #define RESPONSE_EXPECTED_LENGTH_ERROR  (-3)
+#define RESPONSE_TIMEOUT                (-4)
+#define RESPONSE_PENDING                (-5) /* Frame is not complete yet */
 
 #define SET_MODE_1WIRE_UART 0x3A
 #define SET_MODE_2WIRE_UART 0x00
@@ -69,39 +91,96 @@
 #define RL78_MIN_VOLTAGE    1.8f
 #define RL78_MAX_VOLTAGE    5.5f
 
-#define MODE_UART         1
-#define MODE_UART_1       0
-#define MODE_UART_2       MODE_UART
-#define MODE_RESET        2
-#define MODE_RESET_DTR    0
-#define MODE_RESET_RTS    MODE_RESET
-#define MODE_MAX_VALUE    (MODE_UART | MODE_RESET)
-#define MODE_MIN_VALUE    0
-#define MODE_INVERT_RESET 0x80
-
 #define PROTOCOL_VERSION_A 0 /* most RL78 chips */
 /* Protocol B = ??? Is this the G10 protocol? */
 #define PROTOCOL_VERSION_C 2 /* RL78/G23 */
 #define PROTOCOL_VERSION_D 3 /* RL78/F24 */
 
-#include "serial.h"
-
-int rl78_reset_init(port_handle_t fd, int wait, int baud, int mode, float voltage);
-int rl78_reset(port_handle_t fd, int mode);
-int rl78_send_cmd(port_handle_t fd, int cmd, const void *data, int len);
-int rl78_send_data(port_handle_t fd, const void *data, int len, int last);
-int rl78_recv(port_handle_t fd, void *data, int *len, int explen);
-int rl78_cmd_reset(port_handle_t fd);
-int rl78_cmd_baud_rate_set(port_handle_t fd, int baud, float voltage);
-int rl78_cmd_silicon_signature(port_handle_t fd, char device_name[11], unsigned int *code_size, unsigned int *data_size);
-int rl78_cmd_block_erase(port_handle_t fd, unsigned int address);
-int rl78_cmd_block_blank_check(port_handle_t fd, unsigned int address_start, unsigned int address_end);
-int rl78_cmd_checksum(port_handle_t fd, unsigned int address_start, unsigned int address_end);
-int rl78_cmd_programming(port_handle_t fd, unsigned int address_start, unsigned int address_end, const void *rom, int proto_ver);
+/* Upper bound for the range covered by a single Programming command. The limit
+ * of the bootloaders is not known, this one is a conservative guess for all
+ * protocol versions. */
+#define MAX_PROGRAM_RANGE       (64U * 1024U)
+
+#define RL78_FLAG_MERGE_BLOCKS          0x01 /* Program runs of adjacent blocks by one command */
+#define RL78_FLAG_BISECT_BLANK_CHECK    0x02 /* Blank check whole ranges, split only non-blank ones */
+#define RL78_FLAG_VERIFY_CHECKSUM       0x04 /* Verify by comparing checksums of ranges */
+#define RL78_FLAG_VERIFY_DATA           0x08 /* Verify data of blocks with mismatching checksums,
+                                                  * in update mode compare the matching ones */
+#define RL78_FLAG_DELTA                 0x10 /* Program only blocks with mismatching checksums */
+
+#include "rl78-session.h"
+#include "image.h"
+
+/* Data frames carry up to 256 bytes: STX, length, data, checksum and ETB/ETX */
+#define RL78_FRAME_DATA             256U
+#define RL78_FRAME_SLOT             (RL78_FRAME_DATA + 4U)
+
+typedef struct
+{
+    unsigned int address;
+    unsigned int size;
+    const unsigned char *data;  /* Image the frames are made of, must outlive the cache */
+    unsigned char *frames;      /* One slot per 256 bytes, terminated by ETB */
+} rl78_frame_segment_t;
+
+/* Data frames of images, encoded once and sent as they are by any number of
+ * sessions. rl78_send_data() takes a frame from the cache of the session when
+ * the data is a 256-byte aligned piece of a cached image. */
+struct rl78_frame_cache
+{
+    rl78_frame_segment_t *segment;
+    unsigned int count;
+    unsigned int capacity;
+};
+
+/* Encode data frames of an image, the cache is zeroed before the first call */
+int rl78_frame_cache_add(rl78_frame_cache_t *c, unsigned int address, const void *data, unsigned int size);
+/* Same for every segment of a sparse image */
+int rl78_frame_cache_add_image(rl78_frame_cache_t *c, const image_t *img);
+void rl78_frame_cache_free(rl78_frame_cache_t *c);
+
+void rl78_set_protocol(rl78_session_t *s, int proto_ver);
+int rl78_reset_init(rl78_session_t *s, int wait, int baud, float voltage);
+int rl78_reset_init_auto(rl78_session_t *s, int wait, int *baud, float voltage);
+int rl78_send_cmd(rl78_session_t *s, int cmd, const void *data, int len);
+/* Command with an address range, Block Blank Check gets its extra byte */
+int rl78_send_range(rl78_session_t *s, int cmd, unsigned int address_start, unsigned int address_end);
+int rl78_send_data(rl78_session_t *s, const void *data, int len, int last);
+int rl78_recv(rl78_session_t *s, void *data, int *len, int explen, unsigned int timeout);
+/* Same as rl78_recv(), but only takes data which has arrived already */
+int rl78_recv_poll(rl78_session_t *s, void *data, int *len, int explen);
+
+/* Responses of a command, their deadlines come from the timing of the protocol */
+#define RL78_RESPONSE_STATUS    0   /* Status of the command frame */
+#define RL78_RESPONSE_FRAME     1   /* Status of a data frame of Programming or Verify */
+#define RL78_RESPONSE_DONE      2   /* Completion of Programming, result of Checksum */
+
+/* Time to wait for a response in microseconds, the range is of the command */
+unsigned int rl78_timeout(const rl78_session_t *s, int cmd, int response,
+                          unsigned int address_start, unsigned int address_end);
+/* RL78_BAUD_* code of a baudrate, -1 if the bootloader does not support it */
+int rl78_baud_code(int baud);
+/* Parse the response to "Get Silicon Signature", device_name may be NULL */
+void rl78_decode_signature(const unsigned char data[22], char device_name[11], unsigned int *code_size, unsigned int *data_size);
+int rl78_cmd_reset(rl78_session_t *s);
+int rl78_cmd_baud_rate_set(rl78_session_t *s, int baud, float voltage);
+int rl78_cmd_silicon_signature(rl78_session_t *s, char device_name[11], unsigned int *code_size, unsigned int *data_size);
+int rl78_cmd_block_erase(rl78_session_t *s, unsigned int address);
+int rl78_cmd_block_blank_check(rl78_session_t *s, unsigned int address_start, unsigned int address_end);
+int rl78_cmd_checksum(rl78_session_t *s, unsigned int address_start, unsigned int address_end, unsigned int *value);
+int rl78_cmd_programming(rl78_session_t *s, unsigned int address_start, unsigned int address_end, const void *rom);
 unsigned int rl78_checksum(const void *rom, unsigned int len);
-int rl78_cmd_verify(port_handle_t fd, unsigned int address_start, unsigned int address_end, const void *rom);
-int rl78_program(port_handle_t fd, unsigned int address, const void *data, unsigned int size, unsigned blksz, int proto_ver);
-int rl78_erase(port_handle_t fd, unsigned int start_address, unsigned int size, unsigned blksz);
-int rl78_verify(port_handle_t fd, unsigned int address, const void *data, unsigned int size, int blksz);
+int rl78_cmd_verify(rl78_session_t *s, unsigned int address_start, unsigned int address_end, const void *rom);
+/* Block size of the session's code or data flash, depending on the address */
+unsigned int rl78_block_size(const rl78_session_t *s, unsigned int address);
+/* Program and verify blocks of a flash area with an image, blocks without data in the image are not written */
+int rl78_program(rl78_session_t *s, const image_t *img, unsigned int address, unsigned int size);
+/* Same as rl78_program(), blank blocks are written while the stream is still
+ * being filled. Blocks holding data are erased and written only after the
+ * writer has finished without error. If the writer fails, the blocks written
+ * from the stream are erased again, those left written are reported. */
+int rl78_program_stream(rl78_session_t *s, image_stream_t *st, unsigned int address, unsigned int size);
+int rl78_erase(rl78_session_t *s, unsigned int start_address, unsigned int size);
+int rl78_verify(rl78_session_t *s, const image_t *img, unsigned int address, unsigned int size);
 
 #endif  // RL78_H__
@@ -25,9 +25,9 @@
 #include <stdio.h>
 #include "wait_kbhit.h"
 
-extern int verbose_level;
+static const rl78_timing_t timing_g10 = { G10_TIMEOUT_COMMAND, G10_TIMEOUT_ERASE, G10_TIMEOUT_CRC_KB, G10_TIMEOUT_COMMAND };
 
-static int get_size_from_code (unsigned int code)
+int rl78g10_size_from_code(unsigned int code)
 {
     int size;
     switch (code)
@@ -45,209 +45,193 @@ static int get_size_from_code (unsigned int code)
     return size;
 }
 
-static void rl78g10_set_reset(port_handle_t fd, int mode, int value)
+/* Read a response that must arrive before the timeout expires */
+static int rl78g10_read(rl78_session_t *s, void *buf, int len, unsigned int timeout)
 {
-    int level = (mode & MODE_INVERT_RESET) ? !value : value;
-    if (MODE_RESET_RTS == (mode & MODE_RESET))
+    const int rc = serial_read_deadline(s->port, buf, len, serial_deadline(timeout));
+    if (SERIAL_TIMEOUT == rc)
     {
-        serial_set_rts(fd, level);
+        log_printf(&s->log, LOG_ERROR, "No response from MCU\n");
+        return -1;
     }
-    else
+    if (len != rc)
     {
-        serial_set_dtr(fd, level);
+        log_printf(&s->log, LOG_ERROR, "Unable to read from port\n");
+        return -1;
     }
+    return 0;
+}
+
+void rl78g10_set_protocol(rl78_session_t *s)
+{
+    s->timing = &timing_g10;
 }
 
-int rl78g10_reset_init(port_handle_t fd, int wait, int mode)
+int rl78g10_reset_init(rl78_session_t *s, int wait)
 {
+    rl78g10_set_protocol(s);
     unsigned char buf[2];
-    rl78g10_set_reset(fd, mode, 0);                         /* RESET -> 0 */
-    serial_set_txd(fd, 0);                                  /* TOOL0 -> 0 */
+    rl78_set_reset(s, 0);                                   /* RESET -> 0 */
+    serial_set_txd(s->port, 0);                             /* TOOL0 -> 0 */
     if (wait)
     {
-        printf("Turn MCU's power on and press any key...");
+        log_printf(&s->log, LOG_ERROR, "Turn MCU's power on and press any key...");
         wait_kbhit();
-        printf("\n");
+        log_printf(&s->log, LOG_ERROR, "\n");
     }
-    serial_flush(fd);
+    serial_flush(s->port);
     usleep(1000);
-    rl78g10_set_reset(fd, mode, 1);                         /* RESET -> 1 */
+    rl78_set_reset(s, 1);                                   /* RESET -> 1 */
     usleep(2000);
-    serial_set_txd(fd, 1);                                  /* TOOL0 -> 1 */
+    serial_set_txd(s->port, 1);                             /* TOOL0 -> 1 */
     usleep(1000);
-    serial_flush(fd);
-    if (3 <= verbose_level)
+    serial_flush(s->port);
+    log_printf(&s->log, 3, "Send 1-byte data for setting mode\n");
+    buf[0] = CMD_MODE_SET;
+    serial_write(s->port, buf, 1);
+    if (0 > rl78g10_read(s, buf, 2, s->timing->command))
     {
-        printf("Send 1-byte data for setting mode\n");
+        return -1;
     }
-    buf[0] = CMD_MODE_SET;
-    serial_write(fd, buf, 1);
-    serial_read(fd, buf, 2);
     if (buf[1] != STATUS_ACK)
     {
-        fprintf(stderr, "Unexpected response %02X\n", buf[1]);
+        log_printf(&s->log, LOG_ERROR, "Unexpected response %02X\n", buf[1]);
         return -1;
     }
     return 0;
 }
 
-int rl78_reset(port_handle_t fd, int mode)
-{
-    serial_set_txd(fd, 1);                                  /* TOOL0 -> 1 */
-    rl78g10_set_reset(fd, mode, 0);                         /* RESET -> 0 */
-    usleep(10000);
-    rl78g10_set_reset(fd, mode, 1);                         /* RESET -> 1 */
-    return 0;
-}
-
-int rl78g10_erase_write(port_handle_t fd, const void *data, int size)
+int rl78g10_erase_write(rl78_session_t *s, const void *data, int size)
 {
     unsigned char buf[5];
-    if (3 <= verbose_level)
+    log_printf(&s->log, 3, "Send command byte\n");
+    buf[0] = CMD_ERASE_WRITE;
+    serial_write(s->port, buf, 1);
+    if (0 > rl78g10_read(s, buf, 3, s->timing->command))
     {
-        printf("Send command byte\n");
+        return -1;
     }
-    buf[0] = CMD_ERASE_WRITE;
-    serial_write(fd, buf, 1);
-    serial_read(fd, buf, 3);
     if (buf[1] != STATUS_ACK)
     {
-        fprintf(stderr, "Unexpected response %02X\n", buf[1]);
+        log_printf(&s->log, LOG_ERROR, "Unexpected response %02X\n", buf[1]);
         return -1;
     }
-    if (get_size_from_code(buf[2]) != size)
+    if (rl78g10_size_from_code(buf[2]) != size)
     {
-        fprintf(stderr, "Unexpected flash size %i, expected %i\n",
-                get_size_from_code(buf[2]), size);
+        log_printf(&s->log, LOG_ERROR, "Unexpected flash size %i, expected %i\n",
+                rl78g10_size_from_code(buf[2]), size);
         buf[0] = STATUS_NACK;
-        serial_write(fd, buf, 1);
-        serial_read(fd, buf, 1);
+        serial_write(s->port, buf, 1);
+        rl78g10_read(s, buf, 1, s->timing->command);
         return -1;
     }
-    if (3 <= verbose_level)
-    {
-        printf("Acknowledge erasing\n");
-    }
+    log_printf(&s->log, 3, "Acknowledge erasing\n");
     buf[0] = STATUS_ACK;
-    serial_write(fd, buf, 1);
-    serial_read(fd, buf, 1);
-    /* Wait till end of erase cycle */
-    int i = 100;
-    int n;
-    do
+    serial_write(s->port, buf, 1);
+    if (0 > rl78g10_read(s, buf, 1, s->timing->command))
     {
-        n = serial_read(fd, buf, 1);
-        --i;
+        return -1;
     }
-    while (n == 0 && i != 0);
-
-    if (n < 0)
+    /* Wait till end of erase cycle */
+    if (0 > rl78g10_read(s, buf, 1, s->timing->erase))
     {
-        perror("Unable to read from port:");
         return -1;
     }
     if (buf[0] != STATUS_ACK)
     {
-        fprintf(stderr, "Unexpected response %02X\n", buf[1]);
+        log_printf(&s->log, LOG_ERROR, "Unexpected response %02X\n", buf[1]);
         return -1;
     }
-    if (3 <= verbose_level)
-    {
-        printf("Write data\n");
-    }
+    log_printf(&s->log, 3, "Write data\n");
+    const serial_time_t start = serial_time();
     const unsigned char *pdata = (const unsigned char*)data;
+    int i;
     for (i = size; i; pdata += 4, i -= 4)
     {
         memcpy(buf, pdata, 4);
-        serial_write(fd, buf, 4);
-        serial_read(fd, buf, 5);
+        serial_write(s->port, buf, 4);
+        if (0 > rl78g10_read(s, buf, 5, s->timing->command))
+        {
+            return -2;
+        }
         if (buf[4] != STATUS_ACK)
         {
-            fprintf(stderr, "Unexpected response %02X\n", buf[4]);
+            log_printf(&s->log, LOG_ERROR, "Unexpected response %02X\n", buf[4]);
             return -2;
         }
     }
-    if (3 <= verbose_level)
+    // Every word is a round trip, the adapter's latency adds to each of them
+    if (size)
     {
-        printf("Read verification status\n");
+        log_printf(&s->log, 2, "Average round-trip time: %u us\n", (unsigned int)((serial_time() - start) / (size / 4)));
+    }
+    log_printf(&s->log, 3, "Read verification status\n");
+    if (0 > rl78g10_read(s, buf, 1, s->timing->command))
+    {
+        return -1;
     }
-    serial_read(fd, buf, 1);
     if (buf[0] != STATUS_ACK)
     {
-        fprintf(stderr, "Unexpected response %02X\n", buf[1]);
+        log_printf(&s->log, LOG_ERROR, "Unexpected response %02X\n", buf[1]);
         return -1;
     }
     return 0;
 }
 
-int rl78g10_crc_check(port_handle_t fd, const void *data, int size)
+int rl78g10_crc_check(rl78_session_t *s, const void *data, int size)
+{
+    return rl78g10_crc_check_value(s, crc16(data, size), size);
+}
+
+int rl78g10_crc_check_value(rl78_session_t *s, unsigned int crc_calc, int size)
 {
     unsigned char buf[5];
-    if (3 <= verbose_level)
+    log_printf(&s->log, 3, "Send command byte\n");
+    buf[0] = CMD_CRC_CHECK;
+    serial_write(s->port, buf, 1);
+    if (0 > rl78g10_read(s, buf, 3, s->timing->command))
     {
-        printf("Send command byte\n");
+        return -1;
     }
-    buf[0] = CMD_CRC_CHECK;
-    serial_write(fd, buf, 1);
-    serial_read(fd, buf, 3);
     if (buf[1] != STATUS_ACK)
     {
-        fprintf(stderr, "Unexpected response %02X\n", buf[1]);
+        log_printf(&s->log, LOG_ERROR, "Unexpected response %02X\n", buf[1]);
         return -1;
     }
-    if (get_size_from_code(buf[2]) != size)
+    if (rl78g10_size_from_code(buf[2]) != size)
     {
-        fprintf(stderr, "Unexpected flash size %i, expected %i\n",
-                get_size_from_code(buf[2]), size);
+        log_printf(&s->log, LOG_ERROR, "Unexpected flash size %i, expected %i\n",
+                rl78g10_size_from_code(buf[2]), size);
         buf[0] = STATUS_NACK;
-        serial_write(fd, buf, 1);
-        serial_read(fd, buf, 1);
+        serial_write(s->port, buf, 1);
+        rl78g10_read(s, buf, 1, s->timing->command);
         return -1;
     }
-    if (3 <= verbose_level)
+    log_printf(&s->log, 3, "Acknowledge checking\n");
+    buf[0] = STATUS_ACK;
+    serial_write(s->port, buf, 1);
+    if (0 > rl78g10_read(s, buf, 1, s->timing->command))
     {
-        printf("Acknowledge checking\n");
+        return -1;
     }
-    buf[0] = STATUS_ACK;
-    serial_write(fd, buf, 1);
-    serial_read(fd, buf, 1);
-
     /* Wait till end of CRC calculation */
-    int i = 100;
-    int n;
-    int recieved = 0;
-    unsigned char *pbuf = buf;
-    do
-    {
-        n = serial_read(fd, pbuf, 3);
-        pbuf += n;
-        recieved += n;
-        --i;
-    }
-    while (n >= 0 && recieved < 3 && i != 0);
-
-    if (n < 0 || recieved < 3)
+    if (0 > rl78g10_read(s, buf, 3, s->timing->command + (size / 1024 + 1) * s->timing->read_kb))
     {
-        perror("Unable to read from port:");
         return -1;
     }
 
     if (buf[0] != STATUS_ACK)
     {
-        fprintf(stderr, "Unexpected response %02X\n", buf[1]);
+        log_printf(&s->log, LOG_ERROR, "Unexpected response %02X\n", buf[1]);
         return -1;
     }
     unsigned int crc_recv = ((unsigned int)buf[2] << 8) | buf[1];
-    unsigned int crc_calc = crc16(data, size);
 
     if (crc_recv != crc_calc)
     {
-        fprintf(stderr, "CRC don't match (remote: %04Xh, local: %04Xh)\n", crc_recv, crc_calc);
+        log_printf(&s->log, LOG_ERROR, "CRC don't match (remote: %04Xh, local: %04Xh)\n", crc_recv, crc_calc);
         return -2;
     }
-    if (1 <= verbose_level)
-    {
-        printf("CRC match %04Xh\n", crc_calc);
-    }
+    log_printf(&s->log, 1, "CRC match %04Xh\n", crc_calc);
     return 0;
 }
@@ -37,22 +37,27 @@
 
 #define MAX_RESPONSE_LENGTH 32
 
+/* Response timeouts in microseconds */
+#define G10_TIMEOUT_COMMAND     100000U     /* Command byte, data word */
+#define G10_TIMEOUT_ERASE       10000000U   /* Erase of the whole flash */
+#define G10_TIMEOUT_CRC_KB      600000U     /* CRC calculation, per kB of flash */
+
 #define RESPONSE_OK                     (0)
 #define RESPONSE_CHECKSUM_ERROR         (-1)
 #define RESPONSE_FORMAT_ERROR           (-2)
 #define RESPONSE_EXPECTED_LENGTH_ERROR  (-3)
 
-#define MODE_RESET        1
-#define MODE_RESET_DTR    0
-#define MODE_RESET_RTS    MODE_RESET
-#define MODE_MAX_VALUE    MODE_RESET
-#define MODE_INVERT_RESET 0x80
-
-#include "serial.h"
-
-int rl78_reset(port_handle_t fd, int mode);
-int rl78g10_reset_init(port_handle_t fd, int wait, int mode);
-int rl78g10_erase_write(port_handle_t fd, const void *data, int size);
-int rl78g10_crc_check(port_handle_t fd, const void *data, int size);
+#include "rl78-session.h"
+
+/* Select timeouts of the G10 bootloader */
+void rl78g10_set_protocol(rl78_session_t *s);
+/* Flash size in bytes reported by a size code, -1 for unknown codes */
+int rl78g10_size_from_code(unsigned int code);
+/* Single-wire UART only, the session's mode selects the reset line */
+int rl78g10_reset_init(rl78_session_t *s, int wait);
+int rl78g10_erase_write(rl78_session_t *s, const void *data, int size);
+int rl78g10_crc_check(rl78_session_t *s, const void *data, int size);
+/* Same, with crc16() of the data known already */
+int rl78g10_crc_check_value(rl78_session_t *s, unsigned int crc, int size);
 
 #endif  // RL78G10_H__
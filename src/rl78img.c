@@ -0,0 +1,320 @@
+/*********************************************************************************************************************
+ * The MIT License (MIT)                                                                                             *
+ * Copyright (c) 2026 rl78flash contributors                                                                         *
+ *                                                                                                                   *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated      *
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation   *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and  *
+ * to permit persons to whom the Software is furnished to do so, subject to the following conditions:                *
+ *                                                                                                                   *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions     *
+ * of the Software.                                                                                                  *
+ *                                                                                                                   *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO  *
+ * THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF         *
+ * CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+ * IN THE SOFTWARE.                                                                                                  *
+ *********************************************************************************************************************/
+
+#include "rl78img.h"
+#include "hash.h"
+#include "crc16_ccit.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SEGMENT_ENTRY_SIZE  12U
+#define RANGE_ENTRY_SIZE    8U
+#define G10_MAX_SIZE        (512U << (RL78IMG_G10_SIZES - 1U))
+/* Data of the segments starts on this boundary in the file */
+#define DATA_ALIGN          64U
+
+static unsigned int get32(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24);
+}
+
+static void put32(unsigned char *p, unsigned int v)
+{
+    p[0] = v & 0xFF;
+    p[1] = (v >> 8) & 0xFF;
+    p[2] = (v >> 16) & 0xFF;
+    p[3] = (v >> 24) & 0xFF;
+}
+
+static unsigned int bitmap_size(unsigned int end)
+{
+    return end / IMAGE_BLOCK_SIZE / 8U + 1U;
+}
+
+static unsigned int sums_size(unsigned int end)
+{
+    return end / IMAGE_BLOCK_SIZE * 2U;
+}
+
+int rl78img_detect(const char *data, size_t size)
+{
+    return sizeof RL78IMG_MAGIC <= size && 0 == memcmp(data, RL78IMG_MAGIC, sizeof RL78IMG_MAGIC);
+}
+
+uint64_t rl78img_hash(const image_t *img)
+{
+    uint64_t hash = 0;
+    unsigned int i;
+    for (i = 0; i < img->count; ++i)
+    {
+        unsigned char range[8];
+        put32(range, img->segment[i].address);
+        put32(range + 4, img->segment[i].size);
+        hash = hash64(range, sizeof range, hash);
+        hash = hash64(img->segment[i].data, img->segment[i].size, hash);
+    }
+    return hash;
+}
+
+/* Tables computed of the data, a damaged sum would make a block look programmed */
+static uint64_t tables_hash(const unsigned char *header, const unsigned char *ranges, unsigned int nranges,
+                            const unsigned char *bitmap, const unsigned char *sums, unsigned int end)
+{
+    uint64_t hash = hash64(header + 32, RL78IMG_G10_SIZES * 2U, 0);
+    hash = hash64(ranges, nranges * RANGE_ENTRY_SIZE, hash);
+    hash = hash64(bitmap, bitmap_size(end), hash);
+    return hash64(sums, sums_size(end), hash);
+}
+
+int rl78img_parse(const log_t *log, const char *data, size_t size, rl78img_t *ri)
+{
+    const unsigned char *p = (const unsigned char*)data;
+    memset(ri, 0, sizeof *ri);
+    image_init(&ri->image);
+    ri->image.external = 1;
+    if (RL78IMG_HEADER_SIZE > size || !rl78img_detect(data, size))
+    {
+        log_printf(log, LOG_ERROR, "Not a precompiled image\n");
+        return RL78IMG_FORMAT_ERROR;
+    }
+    if (RL78IMG_VERSION != get32(p + 8))
+    {
+        log_printf(log, LOG_ERROR, "Unsupported version %u of precompiled image\n", get32(p + 8));
+        return RL78IMG_FORMAT_ERROR;
+    }
+    const unsigned int count = get32(p + 12);
+    const unsigned int end = get32(p + 16);
+    const unsigned int nranges = get32(p + 20);
+    // Every part has to lie in the file, segments in order and aligned as image_alloc() makes them
+    size_t offset = RL78IMG_HEADER_SIZE;
+    int valid = IMAGE_STREAM_SIZE >= end && 0 == end % IMAGE_SEGMENT_ALIGN
+        && count <= end / IMAGE_SEGMENT_ALIGN
+        && size - offset >= (size_t)count * SEGMENT_ENTRY_SIZE;
+    const unsigned char *table = p + offset;
+    if (valid)
+    {
+        offset += count * SEGMENT_ENTRY_SIZE;
+        valid = nranges <= end / IMAGE_BLOCK_SIZE && size - offset >= (size_t)nranges * RANGE_ENTRY_SIZE;
+    }
+    const unsigned char *ranges = p + offset;
+    if (valid)
+    {
+        offset += nranges * RANGE_ENTRY_SIZE;
+        valid = size - offset >= bitmap_size(end) + sums_size(end);
+    }
+    if (valid && count)
+    {
+        ri->image.segment = malloc(count * sizeof *ri->image.segment);
+        if (NULL == ri->image.segment)
+        {
+            log_printf(log, LOG_ERROR, "Memory allocation failed\n");
+            return RL78IMG_ALLOC_ERROR;
+        }
+    }
+    unsigned int i;
+    unsigned int last_end = 0;
+    for (i = 0; i < count && valid; ++i)
+    {
+        image_segment_t *seg = &ri->image.segment[i];
+        seg->address = get32(table + i * SEGMENT_ENTRY_SIZE);
+        seg->size = get32(table + i * SEGMENT_ENTRY_SIZE + 4);
+        const unsigned int data_offset = get32(table + i * SEGMENT_ENTRY_SIZE + 8);
+        valid = (!i || seg->address > last_end)
+            && seg->size && 0 == seg->address % IMAGE_SEGMENT_ALIGN && 0 == seg->size % IMAGE_SEGMENT_ALIGN
+            && end >= seg->address && end - seg->address >= seg->size
+            && size >= data_offset && size - data_offset >= seg->size;
+        seg->data = (unsigned char*)p + data_offset;
+        last_end = seg->address + seg->size;
+        ri->image.count = i + 1;
+    }
+    if (valid && nranges)
+    {
+        ri->image.written = malloc(nranges * sizeof *ri->image.written);
+        if (NULL == ri->image.written)
+        {
+            log_printf(log, LOG_ERROR, "Memory allocation failed\n");
+            rl78img_free(ri);
+            return RL78IMG_ALLOC_ERROR;
+        }
+        ri->image.written_capacity = nranges;
+    }
+    // Written ranges are sorted, apart and inside of the segments
+    unsigned int range_end = 0;
+    for (i = 0; i < nranges && valid; ++i)
+    {
+        image_range_t *range = &ri->image.written[i];
+        range->address = get32(ranges + i * RANGE_ENTRY_SIZE);
+        range->size = get32(ranges + i * RANGE_ENTRY_SIZE + 4);
+        valid = (!i || range->address > range_end) && range->size
+            && end >= range->address && end - range->address >= range->size;
+        range_end = range->address + range->size;
+        ri->image.nwritten = i + 1;
+    }
+    if (!valid || last_end != end)
+    {
+        log_printf(log, LOG_ERROR, "Precompiled image is damaged\n");
+        rl78img_free(ri);
+        return RL78IMG_FORMAT_ERROR;
+    }
+    ri->image.capacity = count;
+    ri->image.end = end;
+    ri->image.bitmap = (unsigned char*)p + offset;
+    ri->image.sums = p + offset + bitmap_size(end);
+    ri->hash = (uint64_t)get32(p + 24) | ((uint64_t)get32(p + 28) << 32);
+    for (i = 0; i < RL78IMG_G10_SIZES; ++i)
+    {
+        ri->g10_crc[i] = p[32 + i * 2] | (p[33 + i * 2] << 8);
+    }
+    // A damaged file would be programmed as it is, the data is checked once
+    const uint64_t tables = (uint64_t)get32(p + 48) | ((uint64_t)get32(p + 52) << 32);
+    if (tables_hash(p, ranges, nranges, ri->image.bitmap, ri->image.sums, end) != tables
+        || rl78img_hash(&ri->image) != ri->hash)
+    {
+        log_printf(log, LOG_ERROR, "Precompiled image is damaged (hash mismatch)\n");
+        rl78img_free(ri);
+        return RL78IMG_HASH_ERROR;
+    }
+    return RL78IMG_NO_ERROR;
+}
+
+void rl78img_free(rl78img_t *ri)
+{
+    image_free(&ri->image);
+}
+
+int rl78img_g10_crc(const rl78img_t *ri, unsigned int size, unsigned int *crc)
+{
+    unsigned int i;
+    for (i = 0; i < RL78IMG_G10_SIZES; ++i)
+    {
+        if ((512U << i) == size)
+        {
+            *crc = ri->g10_crc[i];
+            return 0;
+        }
+    }
+    return -1;
+}
+
+int rl78img_write(const log_t *log, const char *filename, const image_t *img, uint64_t *hash)
+{
+    const unsigned int nblocks = img->end / IMAGE_BLOCK_SIZE;
+    unsigned char header[RL78IMG_HEADER_SIZE];
+    const size_t tables_size = img->count * SEGMENT_ENTRY_SIZE + img->nwritten * RANGE_ENTRY_SIZE;
+    unsigned char *table = malloc(tables_size + 1U);
+    unsigned char *sums = malloc(sums_size(img->end) + 1U);
+    unsigned char *flash = malloc(G10_MAX_SIZE);
+    int rc = RL78IMG_NO_ERROR;
+    if (NULL == table || NULL == sums || NULL == flash)
+    {
+        log_printf(log, LOG_ERROR, "Memory allocation failed\n");
+        free(table);
+        free(sums);
+        free(flash);
+        return RL78IMG_ALLOC_ERROR;
+    }
+    memset(header, 0, sizeof header);
+    memcpy(header, RL78IMG_MAGIC, sizeof RL78IMG_MAGIC);
+    put32(header + 8, RL78IMG_VERSION);
+    put32(header + 12, img->count);
+    put32(header + 16, img->end);
+    put32(header + 20, img->nwritten);
+    *hash = rl78img_hash(img);
+    put32(header + 24, (unsigned int)(*hash & 0xFFFFFFFFU));
+    put32(header + 28, (unsigned int)(*hash >> 32));
+    unsigned int i;
+    // G10 flash starts at 0 and is checked as a whole
+    for (i = 0; i < RL78IMG_G10_SIZES; ++i)
+    {
+        const unsigned int crc = crc16(image_data(img, 0, 512U << i, flash), 512U << i);
+        header[32 + i * 2] = crc & 0xFF;
+        header[33 + i * 2] = (crc >> 8) & 0xFF;
+    }
+    // Blocks between segments are blank
+    for (i = 0; i < nblocks; ++i)
+    {
+        sums[i * 2] = (0xFFU * IMAGE_BLOCK_SIZE) & 0xFF;
+        sums[i * 2 + 1] = ((0xFFU * IMAGE_BLOCK_SIZE) >> 8) & 0xFF;
+    }
+    unsigned char *ranges = table + img->count * SEGMENT_ENTRY_SIZE;
+    for (i = 0; i < img->nwritten; ++i)
+    {
+        put32(ranges + i * RANGE_ENTRY_SIZE, img->written[i].address);
+        put32(ranges + i * RANGE_ENTRY_SIZE + 4, img->written[i].size);
+    }
+    size_t offset = RL78IMG_HEADER_SIZE + tables_size + bitmap_size(img->end) + sums_size(img->end);
+    offset = (offset + DATA_ALIGN - 1U) & ~(size_t)(DATA_ALIGN - 1U);
+    const size_t data_start = offset;
+    for (i = 0; i < img->count; ++i)
+    {
+        const image_segment_t *seg = &img->segment[i];
+        put32(table + i * SEGMENT_ENTRY_SIZE, seg->address);
+        put32(table + i * SEGMENT_ENTRY_SIZE + 4, seg->size);
+        put32(table + i * SEGMENT_ENTRY_SIZE + 8, (unsigned int)offset);
+        offset += seg->size;
+        unsigned int block_offset;
+        for (block_offset = 0; block_offset < seg->size; block_offset += IMAGE_BLOCK_SIZE)
+        {
+            const unsigned char *b = seg->data + block_offset;
+            const unsigned int block = (seg->address + block_offset) / IMAGE_BLOCK_SIZE;
+            unsigned int sum = 0;
+            unsigned int j;
+            for (j = 0; j < IMAGE_BLOCK_SIZE; ++j)
+            {
+                sum += b[j];
+            }
+            sums[block * 2] = sum & 0xFF;
+            sums[block * 2 + 1] = (sum >> 8) & 0xFF;
+        }
+    }
+    const uint64_t tables = tables_hash(header, ranges, img->nwritten, img->bitmap, sums, img->end);
+    put32(header + 48, (unsigned int)(tables & 0xFFFFFFFFU));
+    put32(header + 52, (unsigned int)(tables >> 32));
+
+    FILE *f = fopen(filename, "wb");
+    if (NULL == f)
+    {
+        log_printf(log, LOG_ERROR, "Unable to create file \"%s\"\n", filename);
+        rc = RL78IMG_IO_ERROR;
+    }
+    else
+    {
+        static const unsigned char padding[DATA_ALIGN];
+        const size_t used = RL78IMG_HEADER_SIZE + tables_size + bitmap_size(img->end) + sums_size(img->end);
+        int ok = 1 == fwrite(header, sizeof header, 1, f)
+            && (!tables_size || 1 == fwrite(table, tables_size, 1, f))
+            && 1 == fwrite(img->bitmap, bitmap_size(img->end), 1, f)
+            && (!nblocks || 1 == fwrite(sums, sums_size(img->end), 1, f))
+            && (data_start == used || 1 == fwrite(padding, data_start - used, 1, f));
+        for (i = 0; i < img->count && ok; ++i)
+        {
+            ok = 1 == fwrite(img->segment[i].data, img->segment[i].size, 1, f);
+        }
+        if (0 != fclose(f) || !ok)
+        {
+            log_printf(log, LOG_ERROR, "Unable to write file \"%s\"\n", filename);
+            rc = RL78IMG_IO_ERROR;
+        }
+    }
+    free(table);
+    free(sums);
+    free(flash);
+    return rc;
+}
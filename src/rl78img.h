@@ -0,0 +1,77 @@
+/*********************************************************************************************************************
+ * The MIT License (MIT)                                                                                             *
+ * Copyright (c) 2026 rl78flash contributors                                                                         *
+ *                                                                                                                   *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated      *
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation   *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and  *
+ * to permit persons to whom the Software is furnished to do so, subject to the following conditions:                *
+ *                                                                                                                   *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions     *
+ * of the Software.                                                                                                  *
+ *                                                                                                                   *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO  *
+ * THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF         *
+ * CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+ * IN THE SOFTWARE.                                                                                                  *
+ *********************************************************************************************************************/
+
+#ifndef RL78IMG_H__
+#define RL78IMG_H__
+
+#include "log.h"
+#include "image.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/* Precompiled image: a sparse image with what users compute of it, so a
+ * mapped file is ready to program without parsing. All values are
+ * little-endian.
+ *
+ *   0  magic "RL78IMG\0"
+ *   8  version
+ *  12  number of segments
+ *  16  image end
+ *  20  number of written ranges
+ *  24  hash64() of the content, see rl78img_hash()
+ *  32  crc16() of the first 512 << i bytes, for every G10 flash size
+ *  48  hash64() of the CRCs above, the written ranges, the bitmap and the sums
+ *  56  reserved up to RL78IMG_HEADER_SIZE, 0
+ *  64  segments: address, size and file offset of the data
+ *      written ranges: address and size, as of image_seal()
+ *      bitmap of blocks with data, as of image_seal()
+ *      16-bit byte sums of all blocks up to the image end
+ *      data of the segments */
+#define RL78IMG_MAGIC           "RL78IMG"
+#define RL78IMG_VERSION         3U
+#define RL78IMG_HEADER_SIZE     64U
+#define RL78IMG_G10_SIZES       8U      /* 512 bytes to 64 kB */
+
+#define RL78IMG_NO_ERROR        (0)
+#define RL78IMG_IO_ERROR        (-1)
+#define RL78IMG_FORMAT_ERROR    (-2)
+#define RL78IMG_HASH_ERROR      (-3)
+#define RL78IMG_ALLOC_ERROR     (-4)
+
+typedef struct
+{
+    image_t image;              /* Data, bitmap and sums point into the file */
+    uint64_t hash;
+    unsigned int g10_crc[RL78IMG_G10_SIZES];
+} rl78img_t;
+
+/* Non-zero if the data starts like a precompiled image */
+int rl78img_detect(const char *data, size_t size);
+/* Check the file and make an image of it, the data must outlive the image */
+int rl78img_parse(const log_t *log, const char *data, size_t size, rl78img_t *ri);
+void rl78img_free(rl78img_t *ri);
+/* crc16() of the first size bytes of flash, -1 if size is not a G10 flash size */
+int rl78img_g10_crc(const rl78img_t *ri, unsigned int size, unsigned int *crc);
+
+/* Hash of addresses, sizes and data of all segments */
+uint64_t rl78img_hash(const image_t *img);
+/* Write a sealed image to a file, the hash of its content is returned */
+int rl78img_write(const log_t *log, const char *filename, const image_t *img, uint64_t *hash);
+
+#endif  // RL78IMG_H__
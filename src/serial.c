@@ -17,47 +17,168 @@
  * IN THE SOFTWARE.                                                                                                  *
  *********************************************************************************************************************/
 
+#if defined(__linux__)
+#define _GNU_SOURCE /* ppoll() */
+#endif
+
 #include "serial.h"
-#include "rl78.h"
+#include "serial_termios2.h"
 #include <termios.h>
 #include <fcntl.h>
 #include <sys/ioctl.h>
+#include <sys/uio.h>
 #include <unistd.h>
 #include <stdio.h>
+#include <time.h>
+#include <poll.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#if defined(__linux__)
+#include <linux/serial.h>
+#endif
 
-extern int verbose_level;
-
-int serial_open(const char *port)
+struct serial_port
 {
     int fd;
-    if (4 <= verbose_level)
+    const log_t *log;
+#if defined(__linux__)
+    /* Original settings of the port, restored on close */
+    char latency_timer_path[256];
+    int latency_timer;          /* -1 if not changed */
+    int serial_flags_changed;
+    int serial_flags;
+#endif
+};
+
+#if defined(__linux__)
+
+static int serial_read_number(const char *path)
+{
+    FILE *file = fopen(path, "r");
+    if (NULL == file)
+    {
+        return -1;
+    }
+    int value = -1;
+    if (1 != fscanf(file, "%d", &value))
+    {
+        value = -1;
+    }
+    fclose(file);
+    return value;
+}
+
+static int serial_write_number(const char *path, int value)
+{
+    FILE *file = fopen(path, "w");
+    if (NULL == file)
+    {
+        return -1;
+    }
+    fprintf(file, "%d\n", value);
+    return 0 == fclose(file) ? 0 : -1;
+}
+
+/* Lower the latency of USB-serial adapters, which hold received data for up to 16 ms by default */
+static void serial_tune_latency(port_handle_t port, const char *path)
+{
+    struct serial_struct serinfo;
+    if (0 == ioctl(port->fd, TIOCGSERIAL, &serinfo)
+        && !(serinfo.flags & ASYNC_LOW_LATENCY))
+    {
+        port->serial_flags = serinfo.flags;
+        serinfo.flags |= ASYNC_LOW_LATENCY;
+        if (0 == ioctl(port->fd, TIOCSSERIAL, &serinfo))
+        {
+            port->serial_flags_changed = 1;
+        }
+    }
+    // FTDI adapters expose the latency timer in sysfs
+    char *device = realpath(path, NULL);
+    if (NULL == device)
+    {
+        return;
+    }
+    const char *name = strrchr(device, '/');
+    name = (NULL != name) ? name + 1 : device;
+    snprintf(port->latency_timer_path, sizeof port->latency_timer_path,
+             "/sys/class/tty/%s/device/latency_timer", name);
+    const int latency_timer = serial_read_number(port->latency_timer_path);
+    if (1 < latency_timer
+        && 0 == serial_write_number(port->latency_timer_path, 1))
+    {
+        port->latency_timer = latency_timer;
+        log_printf(port->log, 2, "Latency timer of %s: %d ms -> 1 ms\n", name, latency_timer);
+    }
+    else if (1 < latency_timer)
+    {
+        log_printf(port->log, 1, "Unable to lower latency timer of %s (%d ms)\n", name, latency_timer);
+    }
+    free(device);
+}
+
+static void serial_restore_latency(port_handle_t port)
+{
+    if (port->serial_flags_changed)
+    {
+        struct serial_struct serinfo;
+        if (0 == ioctl(port->fd, TIOCGSERIAL, &serinfo))
+        {
+            serinfo.flags = port->serial_flags;
+            (void)ioctl(port->fd, TIOCSSERIAL, &serinfo);
+        }
+        port->serial_flags_changed = 0;
+    }
+    if (0 <= port->latency_timer)
     {
-        printf("\t\tOpen port: %s\n", port);
+        (void)serial_write_number(port->latency_timer_path, port->latency_timer);
+        port->latency_timer = -1;
     }
-    fd = open(port, O_RDWR | O_NOCTTY | O_NDELAY);
+}
+
+#endif  /* defined(__linux__) */
+
+port_handle_t serial_open(const char *path, const log_t *log)
+{
+    log_printf(log, 4, "\t\tOpen port: %s\n", path);
+    const int fd = open(path, O_RDWR | O_NOCTTY | O_NDELAY);
     if (-1 == fd)
     {
-        perror("Unable to open port ");
+        log_printf(log, LOG_ERROR, "Unable to open port %s: %s\n", path, strerror(errno));
+        return NULL;
     }
-    else
+    port_handle_t port = calloc(1, sizeof *port);
+    if (NULL == port)
     {
-        struct termios options;
-        (void)fcntl(fd, F_SETFL, 0);
-        tcgetattr(fd, &options);
-        cfsetispeed(&options, B115200);
-        cfsetospeed(&options, B115200);
-        options.c_cflag &= ~(HUPCL | CSIZE | PARENB | CRTSCTS);
-        options.c_cflag |= CLOCAL | CREAD | CS8 | CSTOPB;
-        options.c_lflag &= ~(ICANON | ECHO | ECHOE | ISIG);
-        options.c_iflag &= ~(IXON | IXOFF | IXANY);
-        options.c_oflag &= ~OPOST;
-        options.c_cc[VMIN] = 0;
-        options.c_cc[VTIME] = 1;
-        tcsetattr(fd, TCSANOW, &options);
-        usleep(1000);
-        tcflush(fd, TCIOFLUSH);
+        close(fd);
+        return NULL;
     }
-    return fd;
+    port->fd = fd;
+    port->log = log;
+#if defined(__linux__)
+    port->latency_timer = -1;
+#endif
+    struct termios options;
+    /* Port stays non-blocking, reads and writes wait in poll() */
+    (void)fcntl(fd, F_SETFL, O_NONBLOCK);
+    tcgetattr(fd, &options);
+    cfsetispeed(&options, B115200);
+    cfsetospeed(&options, B115200);
+    options.c_cflag &= ~(HUPCL | CSIZE | PARENB | CRTSCTS);
+    options.c_cflag |= CLOCAL | CREAD | CS8 | CSTOPB;
+    options.c_lflag &= ~(ICANON | ECHO | ECHOE | ISIG);
+    options.c_iflag &= ~(IXON | IXOFF | IXANY);
+    options.c_oflag &= ~OPOST;
+    options.c_cc[VMIN] = 0;
+    options.c_cc[VTIME] = 0;
+    tcsetattr(fd, TCSANOW, &options);
+    usleep(1000);
+    tcflush(fd, TCIOFLUSH);
+#if defined(__linux__)
+    serial_tune_latency(port, path);
+#endif
+    return port;
 }
 
 #if !defined(__APPLE__)
@@ -69,12 +190,16 @@ typedef struct {
 
 const baudrate_code_t baudrates[] =
 {
+    { 1200,    B1200 },
+    { 2400,    B2400 },
+    { 4800,    B4800 },
     { 9600,    B9600 },
     { 19200,   B19200 },
     { 38400,   B38400 },
     { 57600,   B57600 },
     { 115200,  B115200 },
     { 230400,  B230400 },
+    { 460800,  B460800 },
     { 500000,  B500000 },
     { 921600,  B921600 },
     { 1000000, B1000000 },
@@ -83,10 +208,15 @@ const baudrate_code_t baudrates[] =
 
 #endif  /* !defined(__APPLE__) */
 
-int serial_set_baud(port_handle_t fd, int baud)
+int serial_set_baud(port_handle_t port, int baud)
 {
     speed_t speed;
 
+    if (0 == serial_set_baud_termios2(port->fd, baud))
+    {
+        return 0;
+    }
+
 #if !defined(__APPLE__)
     const baudrate_code_t *pbaud = baudrates;
     while (0 != pbaud->baudrate)
@@ -99,7 +229,7 @@ int serial_set_baud(port_handle_t fd, int baud)
     }
     if (0 == pbaud->code)
     {
-        fprintf(stderr, "Failed to set baudrate %u\n", baud);
+        log_printf(port->log, LOG_ERROR, "Failed to set baudrate %u\n", baud);
         return -1;
     }
     speed = pbaud->code;
@@ -108,16 +238,16 @@ int serial_set_baud(port_handle_t fd, int baud)
 #endif /* !defined(__APPLE__) */
 
     struct termios options;
-    tcgetattr(fd, &options);
+    tcgetattr(port->fd, &options);
     cfsetispeed(&options, speed);
     cfsetospeed(&options, speed);
-    return tcsetattr(fd, TCSANOW, &options);
+    return tcsetattr(port->fd, TCSANOW, &options);
 }
 
-int serial_set_parity(port_handle_t fd, int enable, int odd_parity)
+int serial_set_parity(port_handle_t port, int enable, int odd_parity)
 {
     struct termios options;
-    tcgetattr(fd, &options);
+    tcgetattr(port->fd, &options);
     options.c_cflag &= ~(PARENB | PARODD);
     if (enable)
     {
@@ -127,10 +257,10 @@ int serial_set_parity(port_handle_t fd, int enable, int odd_parity)
             options.c_cflag |= PARODD;
         }
     }
-    return tcsetattr(fd, TCSANOW, &options);
+    return tcsetattr(port->fd, TCSANOW, &options);
 }
 
-int serial_set_dtr(port_handle_t fd, int level)
+int serial_set_dtr(port_handle_t port, int level)
 {
     unsigned long command;
     const int dtr = TIOCM_DTR;
@@ -142,10 +272,10 @@ int serial_set_dtr(port_handle_t fd, int level)
     {
         command = TIOCMBIS;
     }
-    return ioctl(fd, command, &dtr);
+    return ioctl(port->fd, command, &dtr);
 }
 
-int serial_set_rts(port_handle_t fd, int level)
+int serial_set_rts(port_handle_t port, int level)
 {
     unsigned long command;
     const int rts = TIOCM_RTS;
@@ -157,10 +287,10 @@ int serial_set_rts(port_handle_t fd, int level)
     {
         command = TIOCMBIS;
     }
-    return ioctl(fd, command, &rts);
+    return ioctl(port->fd, command, &rts);
 }
 
-int serial_set_txd(port_handle_t fd, int level)
+int serial_set_txd(port_handle_t port, int level)
 {
     unsigned long command;
     if (level)
@@ -171,36 +301,32 @@ int serial_set_txd(port_handle_t fd, int level)
     {
         command = TIOCSBRK;
     }
-    return ioctl(fd, command);
+    return ioctl(port->fd, command);
 }
 
-int serial_flush(port_handle_t fd)
+int serial_flush(port_handle_t port)
 {
-    return tcflush(fd, TCIOFLUSH);
+    return tcflush(port->fd, TCIOFLUSH);
 }
 
-int serial_write(port_handle_t fd, const void *buf, int len)
+int serial_write(port_handle_t port, const void *buf, int len)
 {
-    if (4 <= verbose_level)
-    {
-        unsigned char *p = (unsigned char*)buf;
-        unsigned int i;
-        printf("\t\tsend(%u): ", len);
-        for (i = len; 0 < i; --i)
-        {
-            printf("%02X ", *p++);
-        }
-        printf("\n");
-    }
+    log_hexdump(port->log, 4, "\t\tsend", buf, len);
     int bytes_left = len;
     int rc = 0;
     unsigned char *pbuf = (unsigned char*)buf;
     do
     {
-        rc = write(fd, pbuf, bytes_left);
+        rc = write(port->fd, pbuf, bytes_left);
+        if (0 > rc && (EAGAIN == errno || EINTR == errno))
+        {
+            struct pollfd pfd = { .fd = port->fd, .events = POLLOUT };
+            (void)poll(&pfd, 1, -1);
+            continue;
+        }
         if (0 > rc)
         {
-            fprintf(stderr, "Failed to write to port.\n");
+            log_printf(port->log, LOG_ERROR, "Failed to write to port.\n");
             return rc;
         }
         pbuf += rc;
@@ -210,47 +336,211 @@ int serial_write(port_handle_t fd, const void *buf, int len)
     return len - bytes_left;
 }
 
-int serial_read(port_handle_t fd, void *buf, int len)
+int serial_writev(port_handle_t port, const serial_iovec_t *iov, int count)
+{
+    if (SERIAL_IOV_MAX < count)
+    {
+        return SERIAL_ERROR;
+    }
+    struct iovec vec[SERIAL_IOV_MAX];
+    int len = 0;
+    int i;
+    for (i = 0; i < count; ++i)
+    {
+        vec[i].iov_base = (void*)iov[i].base;
+        vec[i].iov_len = iov[i].len;
+        len += iov[i].len;
+    }
+    if (log_enabled(port->log, 4))
+    {
+        unsigned char frame[SERIAL_IOV_MAX * 256 + 16];
+        int frame_len = 0;
+        for (i = 0; i < count && frame_len + iov[i].len <= (int)sizeof frame; ++i)
+        {
+            memcpy(frame + frame_len, iov[i].base, iov[i].len);
+            frame_len += iov[i].len;
+        }
+        log_hexdump(port->log, 4, "\t\tsend", frame, frame_len);
+    }
+    struct iovec *pvec = vec;
+    int bytes_left = len;
+    while (0 < bytes_left)
+    {
+        ssize_t rc = writev(port->fd, pvec, count);
+        if (0 > rc && (EAGAIN == errno || EINTR == errno))
+        {
+            struct pollfd pfd = { .fd = port->fd, .events = POLLOUT };
+            (void)poll(&pfd, 1, -1);
+            continue;
+        }
+        if (0 > rc)
+        {
+            log_printf(port->log, LOG_ERROR, "Failed to write to port.\n");
+            return SERIAL_ERROR;
+        }
+        bytes_left -= rc;
+        // Skip pieces written completely, then advance into a partial one
+        while (count && (size_t)rc >= pvec->iov_len)
+        {
+            rc -= pvec->iov_len;
+            ++pvec;
+            --count;
+        }
+        if (count)
+        {
+            pvec->iov_base = (unsigned char*)pvec->iov_base + rc;
+            pvec->iov_len -= rc;
+        }
+    }
+    return len;
+}
+
+serial_time_t serial_time(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (serial_time_t)ts.tv_sec * 1000000U + ts.tv_nsec / 1000U;
+}
+
+serial_time_t serial_deadline(unsigned int timeout_us)
+{
+    return serial_time() + timeout_us;
+}
+
+/* Wait till the port has data to read or the deadline passes */
+static int serial_wait(int fd, serial_time_t deadline)
+{
+    struct pollfd pfd = { .fd = fd, .events = POLLIN };
+    int rc;
+    do
+    {
+        const serial_time_t now = serial_time();
+        if (now >= deadline)
+        {
+            return SERIAL_TIMEOUT;
+        }
+        const serial_time_t left = deadline - now;
+#if defined(__linux__)
+        const struct timespec timeout = { .tv_sec = left / 1000000U, .tv_nsec = (left % 1000000U) * 1000U };
+        rc = ppoll(&pfd, 1, &timeout, NULL);
+#else
+        rc = poll(&pfd, 1, (int)((left + 999U) / 1000U));
+#endif
+    }
+    while (0 == rc || (0 > rc && EINTR == errno));
+    if (0 > rc || !(pfd.revents & POLLIN))
+    {
+        return SERIAL_ERROR;
+    }
+    return 0;
+}
+
+int serial_read_deadline(port_handle_t port, void *buf, int len, serial_time_t deadline)
 {
     int bytes_left = len;
     int rc = 0;
     unsigned char *pbuf = (unsigned char*)buf;
-    do
+    while (0 < bytes_left)
     {
-        rc = read(fd, pbuf, bytes_left);
-        if (0 > rc)
+        rc = read(port->fd, pbuf, bytes_left);
+        if (0 < rc)
         {
-            fprintf(stderr, "Failed to read from port.\n");
-            return rc;
+            pbuf += rc;
+            bytes_left -= rc;
+            continue;
         }
-        if (0 == rc)
+        if (0 > rc && EAGAIN != errno && EINTR != errno)
         {
+            log_printf(port->log, LOG_ERROR, "Failed to read from port.\n");
+            return SERIAL_ERROR;
+        }
+        rc = serial_wait(port->fd, deadline);
+        if (SERIAL_ERROR == rc)
+        {
+            /* Port is gone, report what was received */
             break;
         }
-        pbuf += rc;
-        bytes_left -= rc;
+        if (SERIAL_TIMEOUT == rc)
+        {
+            log_hexdump(port->log, 4, "\t\trecv", buf, len - bytes_left);
+            log_printf(port->log, 4, "\t\ttimeout\n");
+            return SERIAL_TIMEOUT;
+        }
     }
-    while (0 < bytes_left);
     const int nbytes = len - bytes_left;
-    if (4 <= verbose_level)
+    log_hexdump(port->log, 4, "\t\trecv", buf, nbytes);
+    return nbytes;
+}
+
+int serial_read_available(port_handle_t port, void *buf, int len, serial_time_t deadline)
+{
+    for (;;)
     {
-        pbuf = buf;
-        unsigned int i;
-        printf("\t\trecv(%u): ", nbytes);
-        for (i = nbytes; 0 < i; --i)
+        const int rc = read(port->fd, buf, len);
+        if (0 < rc)
         {
-            printf("%02X ", *pbuf++);
+            log_hexdump(port->log, 4, "\t\trecv", buf, rc);
+            return rc;
+        }
+        if (0 > rc && EAGAIN != errno && EINTR != errno)
+        {
+            log_printf(port->log, LOG_ERROR, "Failed to read from port.\n");
+            return SERIAL_ERROR;
+        }
+        const int wait_rc = serial_wait(port->fd, deadline);
+        if (SERIAL_TIMEOUT == wait_rc)
+        {
+            return SERIAL_TIMEOUT;
+        }
+        if (0 != wait_rc)
+        {
+            return 0;
         }
-        printf("\n");
     }
-    return nbytes;
 }
 
-int serial_close(port_handle_t fd)
+int serial_read(port_handle_t port, void *buf, int len)
 {
-    if (4 <= verbose_level)
+    int bytes_left = len;
+    int rc = 0;
+    unsigned char *pbuf = (unsigned char*)buf;
+    while (0 < bytes_left)
     {
-        printf("\t\tClose port\n");
+        rc = read(port->fd, pbuf, bytes_left);
+        if (0 < rc)
+        {
+            pbuf += rc;
+            bytes_left -= rc;
+            continue;
+        }
+        if (0 > rc && EAGAIN != errno && EINTR != errno)
+        {
+            log_printf(port->log, LOG_ERROR, "Failed to read from port.\n");
+            return rc;
+        }
+        /* Stop when no more data arrives within the read timeout */
+        if (0 != serial_wait(port->fd, serial_deadline(SERIAL_READ_TIMEOUT)))
+        {
+            break;
+        }
     }
-    return close(fd);
+    const int nbytes = len - bytes_left;
+    log_hexdump(port->log, 4, "\t\trecv", buf, nbytes);
+    return nbytes;
+}
+
+int serial_close(port_handle_t port)
+{
+    log_printf(port->log, 4, "\t\tClose port\n");
+#if defined(__linux__)
+    serial_restore_latency(port);
+#endif
+    const int rc = close(port->fd);
+    free(port);
+    return rc;
+}
+
+int serial_fd(port_handle_t port)
+{
+    return port->fd;
 }
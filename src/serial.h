@@ -20,32 +20,57 @@
 #ifndef SERIAL_H__
 #define SERIAL_H__
 
-#if WIN32 != 1
+#include "log.h"
 
-typedef int port_handle_t;
-#define INVALID_HANDLE_VALUE (-1)
+#if WIN32 == 1
+#include <windows.h>
+#endif
 
-#else
+/* Open port, its state is private to the backend */
+typedef struct serial_port *port_handle_t;
 
-#include <windows.h>
-typedef HANDLE port_handle_t;
+/* Monotonic time in microseconds */
+typedef unsigned long long serial_time_t;
 
-#endif
+/* Pause after which serial_read() stops waiting for more data */
+#define SERIAL_READ_TIMEOUT 100000U
+
+/* Piece of data sent by serial_writev() */
+typedef struct
+{
+    const void *base;
+    int len;
+} serial_iovec_t;
+
+/* Maximum number of pieces accepted by serial_writev() */
+#define SERIAL_IOV_MAX  4
+
+#define SERIAL_ERROR    (-1)
+#define SERIAL_TIMEOUT  (-2)
 
 #define DISABLE 0
 #define ENABLE  1
 #define EVEN    0
 #define ODD     1
 
-port_handle_t serial_open(const char *port);
-int serial_set_baud(port_handle_t fd, int baud);
-int serial_set_parity(port_handle_t fd, int enable, int odd_parity);
-int serial_set_dtr(port_handle_t fd, int level);
-int serial_set_rts(port_handle_t fd, int level);
-int serial_set_txd(port_handle_t fd, int level);
-int serial_flush(port_handle_t fd);
-int serial_write(port_handle_t fd, const void *buf, int len);
-int serial_read(port_handle_t fd, void *buf, int len);
-int serial_close(port_handle_t fd);
+port_handle_t serial_open(const char *port, const log_t *log);
+int serial_set_baud(port_handle_t port, int baud);
+int serial_set_parity(port_handle_t port, int enable, int odd_parity);
+int serial_set_dtr(port_handle_t port, int level);
+int serial_set_rts(port_handle_t port, int level);
+int serial_set_txd(port_handle_t port, int level);
+int serial_flush(port_handle_t port);
+int serial_write(port_handle_t port, const void *buf, int len);
+int serial_writev(port_handle_t port, const serial_iovec_t *iov, int count);
+int serial_read(port_handle_t port, void *buf, int len);
+int serial_read_deadline(port_handle_t port, void *buf, int len, serial_time_t deadline);
+int serial_read_available(port_handle_t port, void *buf, int len, serial_time_t deadline);
+serial_time_t serial_time(void);
+serial_time_t serial_deadline(unsigned int timeout_us);
+int serial_close(port_handle_t port);
+#if WIN32 != 1
+/* Descriptor of the port for event loops, it is in non-blocking mode */
+int serial_fd(port_handle_t port);
+#endif
 
 #endif  // SERIAL_H__
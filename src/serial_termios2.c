@@ -0,0 +1,55 @@
+/*********************************************************************************************************************
+ * The MIT License (MIT)                                                                                             *
+ * Copyright (c) 2026 rl78flash contributors                                                                         *
+ *                                                                                                                   *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated      *
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation   *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and  *
+ * to permit persons to whom the Software is furnished to do so, subject to the following conditions:                *
+ *                                                                                                                   *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions     *
+ * of the Software.                                                                                                  *
+ *                                                                                                                   *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO  *
+ * THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF         *
+ * CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+ * IN THE SOFTWARE.                                                                                                  *
+ *********************************************************************************************************************/
+
+#include "serial_termios2.h"
+
+#if defined(__linux__)
+
+/* termios2 definitions clash with <termios.h>, so they are kept in this file */
+#include <asm/termbits.h>
+#include <sys/ioctl.h>
+
+int serial_set_baud_termios2(int fd, int baud)
+{
+    struct termios2 options;
+    if (0 >= baud || 0 != ioctl(fd, TCGETS2, &options))
+    {
+        return -1;
+    }
+    options.c_cflag &= ~(CBAUD | (CBAUD << IBSHIFT));
+    options.c_cflag |= BOTHER | (BOTHER << IBSHIFT);
+    options.c_ispeed = baud;
+    options.c_ospeed = baud;
+    if (0 != ioctl(fd, TCSETS2, &options))
+    {
+        return -1;
+    }
+    return 0;
+}
+
+#else  /* defined(__linux__) */
+
+int serial_set_baud_termios2(int fd, int baud)
+{
+    (void)fd;
+    (void)baud;
+    return -1;
+}
+
+#endif /* defined(__linux__) */
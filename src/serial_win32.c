@@ -18,32 +18,45 @@
  *********************************************************************************************************************/
 
 #include "serial.h"
-#include "rl78.h"
 #include <unistd.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
-extern int verbose_level;
-static int last_dtr_setting;
-static int last_rts_setting;
+struct serial_port
+{
+    HANDLE handle;
+    const log_t *log;
+    /* SetCommState() resets DTR and RTS, the last levels are restored after it */
+    int last_dtr_setting;
+    int last_rts_setting;
+};
+
+static int serial_set_read_timeouts(port_handle_t port, DWORD interval, DWORD multiplier, DWORD constant)
+{
+    COMMTIMEOUTS timeouts;
+    timeouts.ReadIntervalTimeout = interval;
+    timeouts.ReadTotalTimeoutMultiplier = multiplier;
+    timeouts.ReadTotalTimeoutConstant = constant;
+    timeouts.WriteTotalTimeoutConstant = 0;
+    timeouts.WriteTotalTimeoutMultiplier = 0;
+    return SetCommTimeouts(port->handle, &timeouts) != 0 ? 0 : -1;
+}
 
-port_handle_t serial_open(const char *port)
+port_handle_t serial_open(const char *path, const log_t *log)
 {
-    port_handle_t fd;
     char port_full_name[20];
     snprintf(port_full_name, sizeof port_full_name - 2u,
-             "\\\\.\\%s", port);
-    if (4 <= verbose_level)
-    {
-        printf("\t\tOpen port: %s\n", port_full_name);
-    }
-    fd = CreateFile(port_full_name,
-                    GENERIC_READ | GENERIC_WRITE,
-                    0,
-                    NULL,
-                    OPEN_EXISTING,
-                    FILE_ATTRIBUTE_NORMAL,
-                    0);
-    if (INVALID_HANDLE_VALUE == fd)
+             "\\\\.\\%s", path);
+    log_printf(log, 4, "\t\tOpen port: %s\n", port_full_name);
+    HANDLE handle = CreateFile(port_full_name,
+                               GENERIC_READ | GENERIC_WRITE,
+                               0,
+                               NULL,
+                               OPEN_EXISTING,
+                               FILE_ATTRIBUTE_NORMAL,
+                               0);
+    if (INVALID_HANDLE_VALUE == handle)
     {
         int error_num = GetLastError();
         char error_string[1024];
@@ -54,48 +67,48 @@ port_handle_t serial_open(const char *port)
                       error_string,
                       sizeof error_string,
                       NULL);
-        fprintf(stderr, "Unable to open port: (%i) %s\n", error_num, error_string);
+        log_printf(log, LOG_ERROR, "Unable to open port: (%i) %s\n", error_num, error_string);
+        return NULL;
     }
-    else
+    port_handle_t port = calloc(1, sizeof *port);
+    if (NULL == port)
     {
-        DCB dcbSerialParams;
-        GetCommState(fd, &dcbSerialParams);
-        dcbSerialParams.BaudRate = CBR_115200;
-        dcbSerialParams.ByteSize = 8;
-        dcbSerialParams.StopBits = TWOSTOPBITS;
-        dcbSerialParams.Parity = NOPARITY;
-        last_dtr_setting = (DTR_CONTROL_ENABLE == dcbSerialParams.fDtrControl) ? SETDTR : CLRDTR;
-        last_rts_setting = (RTS_CONTROL_ENABLE == dcbSerialParams.fRtsControl) ? SETRTS : CLRRTS;
-        dcbSerialParams.fInX = FALSE;
-        dcbSerialParams.fOutX = FALSE;
-        SetCommState(fd, &dcbSerialParams);
-
-        COMMTIMEOUTS timeouts;
-        timeouts.ReadIntervalTimeout=50;
-        timeouts.ReadTotalTimeoutConstant=50;
-        timeouts.ReadTotalTimeoutMultiplier=10;
-        timeouts.WriteTotalTimeoutConstant=0;
-        timeouts.WriteTotalTimeoutMultiplier=0;
-        SetCommTimeouts(fd, &timeouts);
-        FlushFileBuffers(fd);
+        CloseHandle(handle);
+        return NULL;
     }
-    return fd;
+    port->handle = handle;
+    port->log = log;
+    DCB dcbSerialParams;
+    GetCommState(handle, &dcbSerialParams);
+    dcbSerialParams.BaudRate = CBR_115200;
+    dcbSerialParams.ByteSize = 8;
+    dcbSerialParams.StopBits = TWOSTOPBITS;
+    dcbSerialParams.Parity = NOPARITY;
+    port->last_dtr_setting = (DTR_CONTROL_ENABLE == dcbSerialParams.fDtrControl) ? SETDTR : CLRDTR;
+    port->last_rts_setting = (RTS_CONTROL_ENABLE == dcbSerialParams.fRtsControl) ? SETRTS : CLRRTS;
+    dcbSerialParams.fInX = FALSE;
+    dcbSerialParams.fOutX = FALSE;
+    SetCommState(handle, &dcbSerialParams);
+
+    serial_set_read_timeouts(port, 50, 10, 50);
+    FlushFileBuffers(handle);
+    return port;
 }
 
-int serial_set_baud(port_handle_t fd, int baud)
+int serial_set_baud(port_handle_t port, int baud)
 {
     DCB dcbSerialParams;
-    GetCommState(fd, &dcbSerialParams);
+    GetCommState(port->handle, &dcbSerialParams);
     dcbSerialParams.BaudRate = baud;
-    dcbSerialParams.fDtrControl = (SETDTR == last_dtr_setting) ? DTR_CONTROL_ENABLE : DTR_CONTROL_DISABLE;
-    dcbSerialParams.fRtsControl = (SETRTS == last_rts_setting) ? RTS_CONTROL_ENABLE : RTS_CONTROL_DISABLE;
-    return SetCommState(fd, &dcbSerialParams) != 0 ? 0 : -1;
+    dcbSerialParams.fDtrControl = (SETDTR == port->last_dtr_setting) ? DTR_CONTROL_ENABLE : DTR_CONTROL_DISABLE;
+    dcbSerialParams.fRtsControl = (SETRTS == port->last_rts_setting) ? RTS_CONTROL_ENABLE : RTS_CONTROL_DISABLE;
+    return SetCommState(port->handle, &dcbSerialParams) != 0 ? 0 : -1;
 }
 
-int serial_set_parity(port_handle_t fd, int enable, int odd_parity)
+int serial_set_parity(port_handle_t port, int enable, int odd_parity)
 {
     DCB dcbSerialParams;
-    GetCommState(fd, &dcbSerialParams);
+    GetCommState(port->handle, &dcbSerialParams);
     dcbSerialParams.Parity = NOPARITY;
     if (enable)
     {
@@ -108,10 +121,10 @@ int serial_set_parity(port_handle_t fd, int enable, int odd_parity)
             dcbSerialParams.Parity = EVENPARITY;
         }
     }
-    return SetCommState(fd, &dcbSerialParams) != 0 ? 0 : -1;
+    return SetCommState(port->handle, &dcbSerialParams) != 0 ? 0 : -1;
 }
 
-int serial_set_dtr(port_handle_t fd, int level)
+int serial_set_dtr(port_handle_t port, int level)
 {
     int command;
     if (level)
@@ -122,11 +135,11 @@ int serial_set_dtr(port_handle_t fd, int level)
     {
         command = SETDTR;
     }
-    last_dtr_setting = command;
-    return EscapeCommFunction(fd, command) != 0 ? 0 : -1;
+    port->last_dtr_setting = command;
+    return EscapeCommFunction(port->handle, command) != 0 ? 0 : -1;
 }
 
-int serial_set_rts(port_handle_t fd, int level)
+int serial_set_rts(port_handle_t port, int level)
 {
     int command;
     if (level)
@@ -137,11 +150,11 @@ int serial_set_rts(port_handle_t fd, int level)
     {
         command = SETRTS;
     }
-    last_rts_setting = command;
-    return EscapeCommFunction(fd, command) != 0 ? 0 : -1;
+    port->last_rts_setting = command;
+    return EscapeCommFunction(port->handle, command) != 0 ? 0 : -1;
 }
 
-int serial_set_txd(port_handle_t fd, int level)
+int serial_set_txd(port_handle_t port, int level)
 {
     int command;
     if (level)
@@ -152,39 +165,26 @@ int serial_set_txd(port_handle_t fd, int level)
     {
         command = SETBREAK;
     }
-    return EscapeCommFunction(fd, command) != 0 ? 0 : -1;
+    return EscapeCommFunction(port->handle, command) != 0 ? 0 : -1;
 }
 
-int serial_flush(port_handle_t fd)
+int serial_flush(port_handle_t port)
 {
-    if (4 <= verbose_level)
-    {
-        printf("\t\tFlush IO buffers\n");
-    }
-    return PurgeComm(fd, PURGE_RXCLEAR | PURGE_TXCLEAR) != 0 ? 0 : -1;
+    log_printf(port->log, 4, "\t\tFlush IO buffers\n");
+    return PurgeComm(port->handle, PURGE_RXCLEAR | PURGE_TXCLEAR) != 0 ? 0 : -1;
 }
 
-int serial_write(port_handle_t fd, const void *buf, int len)
+int serial_write(port_handle_t port, const void *buf, int len)
 {
-    if (4 <= verbose_level)
-    {
-        unsigned char *p = (unsigned char*)buf;
-        unsigned int i;
-        printf("\t\tsend(%u): ", len);
-        for (i = len; 0 < i; --i)
-        {
-            printf("%02X ", *p++);
-        }
-        printf("\n");
-    }
+    log_hexdump(port->log, 4, "\t\tsend", buf, len);
     int bytes_left = len;
     DWORD bytes_written;
     unsigned char *pbuf = (unsigned char*)buf;
     do
     {
-        if (0 == WriteFile(fd, pbuf, bytes_left, &bytes_written, NULL))
+        if (0 == WriteFile(port->handle, pbuf, bytes_left, &bytes_written, NULL))
         {
-            fprintf(stderr, "Failed to write to port.\n");
+            log_printf(port->log, LOG_ERROR, "Failed to write to port.\n");
             return -1;
         }
         pbuf += bytes_written;
@@ -194,16 +194,39 @@ int serial_write(port_handle_t fd, const void *buf, int len)
     return len - bytes_left;
 }
 
-int serial_read(port_handle_t fd, void *buf, int len)
+int serial_writev(port_handle_t port, const serial_iovec_t *iov, int count)
+{
+    // Frames are short, gather them into one buffer for a single WriteFile()
+    unsigned char buf[SERIAL_IOV_MAX * 256 + 16];
+    int len = 0;
+    int i;
+    if (SERIAL_IOV_MAX < count)
+    {
+        return SERIAL_ERROR;
+    }
+    for (i = 0; i < count; ++i)
+    {
+        if (sizeof buf < (unsigned int)(len + iov[i].len))
+        {
+            return SERIAL_ERROR;
+        }
+        memcpy(buf + len, iov[i].base, iov[i].len);
+        len += iov[i].len;
+    }
+    return serial_write(port, buf, len);
+}
+
+int serial_read(port_handle_t port, void *buf, int len)
 {
     int bytes_left = len;
     DWORD bytes_read;
     unsigned char *pbuf = (unsigned char*)buf;
+    serial_set_read_timeouts(port, 50, 10, 50);
     do
     {
-        if (0 == ReadFile(fd, pbuf, bytes_left, &bytes_read, NULL))
+        if (0 == ReadFile(port->handle, pbuf, bytes_left, &bytes_read, NULL))
         {
-            fprintf(stderr, "Failed to read from port.\n");
+            log_printf(port->log, LOG_ERROR, "Failed to read from port.\n");
             return -1;
         }
         if (0 == bytes_read)
@@ -215,25 +238,80 @@ int serial_read(port_handle_t fd, void *buf, int len)
     }
     while (0 < bytes_left);
     const int nbytes = len - bytes_left;
-    if (4 <= verbose_level)
+    log_hexdump(port->log, 4, "\t\trecv", buf, nbytes);
+    return nbytes;
+}
+
+serial_time_t serial_time(void)
+{
+    LARGE_INTEGER counter, frequency;
+    QueryPerformanceCounter(&counter);
+    QueryPerformanceFrequency(&frequency);
+    const serial_time_t ticks = counter.QuadPart;
+    const serial_time_t freq = frequency.QuadPart;
+    return (ticks / freq) * 1000000U + (ticks % freq) * 1000000U / freq;
+}
+
+serial_time_t serial_deadline(unsigned int timeout_us)
+{
+    return serial_time() + timeout_us;
+}
+
+int serial_read_deadline(port_handle_t port, void *buf, int len, serial_time_t deadline)
+{
+    int bytes_left = len;
+    DWORD bytes_read;
+    unsigned char *pbuf = (unsigned char*)buf;
+    while (0 < bytes_left)
     {
-        pbuf = buf;
-        unsigned int i;
-        printf("\t\trecv(%u): ", nbytes);
-        for (i = nbytes; 0 < i; --i)
+        const serial_time_t now = serial_time();
+        if (now >= deadline)
         {
-            printf("%02X ", *pbuf++);
+            log_hexdump(port->log, 4, "\t\trecv", buf, len - bytes_left);
+            log_printf(port->log, 4, "\t\ttimeout\n");
+            return SERIAL_TIMEOUT;
         }
-        printf("\n");
+        /* Return as soon as any data is available or the deadline passes */
+        serial_set_read_timeouts(port, MAXDWORD, MAXDWORD, (DWORD)((deadline - now + 999U) / 1000U));
+        if (0 == ReadFile(port->handle, pbuf, bytes_left, &bytes_read, NULL))
+        {
+            log_printf(port->log, LOG_ERROR, "Failed to read from port.\n");
+            return SERIAL_ERROR;
+        }
+        pbuf += bytes_read;
+        bytes_left -= bytes_read;
     }
-    return nbytes;
+    log_hexdump(port->log, 4, "\t\trecv", buf, len);
+    return len;
 }
 
-int serial_close(port_handle_t fd)
+int serial_read_available(port_handle_t port, void *buf, int len, serial_time_t deadline)
 {
-    if (4 <= verbose_level)
+    DWORD bytes_read;
+    const serial_time_t now = serial_time();
+    if (now >= deadline)
     {
-        printf("\t\tClose port\n");
+        return SERIAL_TIMEOUT;
     }
-    return CloseHandle(fd) != 0 ? 0 : -1;
+    /* Return as soon as any data is available or the deadline passes */
+    serial_set_read_timeouts(port, MAXDWORD, MAXDWORD, (DWORD)((deadline - now + 999U) / 1000U));
+    if (0 == ReadFile(port->handle, buf, len, &bytes_read, NULL))
+    {
+        log_printf(port->log, LOG_ERROR, "Failed to read from port.\n");
+        return SERIAL_ERROR;
+    }
+    if (0 == bytes_read)
+    {
+        return SERIAL_TIMEOUT;
+    }
+    log_hexdump(port->log, 4, "\t\trecv", buf, bytes_read);
+    return bytes_read;
+}
+
+int serial_close(port_handle_t port)
+{
+    log_printf(port->log, 4, "\t\tClose port\n");
+    const int rc = CloseHandle(port->handle) != 0 ? 0 : -1;
+    free(port);
+    return rc;
 }
@@ -19,148 +19,750 @@
 
 #include "srec.h"
 #include "rl78.h"
+#include "hex.h"
+#include "mapfile.h"
+#include "thread.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
-extern unsigned int verbose_level;
+/* Intel HEX record types */
+#define IHEX_DATA               0x00
+#define IHEX_END_OF_FILE        0x01
+#define IHEX_EXTENDED_SEGMENT   0x02
+#define IHEX_START_SEGMENT      0x03
+#define IHEX_EXTENDED_LINEAR    0x04
+#define IHEX_START_LINEAR       0x05
 
-static
-int ascii2hex(const char *str, unsigned int len)
+/* Files are split into chunks of at least this size for parallel parsing */
+#define SREC_CHUNK_MIN      (256U * 1024U)
+#define SREC_MAX_WORKERS    16
+
+/* Range of the image written by a data record */
+typedef struct
+{
+    unsigned int address;
+    unsigned int length;
+    unsigned int line;
+    size_t digits;              /* Offset of the hex digits of the data in the file */
+} srec_extent_t;
+
+typedef struct
+{
+    const log_t *log;
+    const char *text;           /* Start of the file, extents refer to it */
+    const char *begin;
+    const char *end;
+    void *code;
+    unsigned int code_len;
+    void *data;
+    unsigned int data_len;
+    int sparse;                 /* Records are only checked, data is written to an image later */
+    int deferred;               /* Records are only checked, data is written to the buffers later */
+    int ihex;                   /* Intel HEX records instead of S-records */
+    unsigned int base;          /* Address of Intel HEX extended address records */
+    image_stream_t *stream;     /* Data of sparse records goes to it right away */
+    thread_t thread;
+    int started;
+    /* Results, errors are logged by the caller to keep the first one of the file */
+    int rc;
+    unsigned int lines;         /* Lines parsed, the failing one included */
+    const char *error_line;
+    unsigned int error_len;
+    srec_extent_t *extents;
+    unsigned int count;
+    unsigned int capacity;
+} srec_chunk_t;
+
+static int srec_add_extent(srec_chunk_t *c, unsigned int address, unsigned int length, size_t digits)
 {
-    int res = 0;
-    unsigned int i = len;
-    const char *pstr = str;
-    for (; i; --i)
+    if (c->count == c->capacity)
     {
-        res <<= 4;
-        if ('0' <= *pstr && '9' >= *pstr)
+        const unsigned int capacity = c->capacity ? c->capacity * 2U : 1024U;
+        srec_extent_t *extents = realloc(c->extents, capacity * sizeof *extents);
+        if (NULL == extents)
         {
-            res += *pstr - '0';
+            return -1;
         }
-        else if ('A' <= *pstr && 'F' >= *pstr)
+        c->extents = extents;
+        c->capacity = capacity;
+    }
+    srec_extent_t *e = &c->extents[c->count++];
+    e->address = address;
+    e->length = length;
+    e->line = c->lines;
+    e->digits = digits;
+    return 0;
+}
+
+/* Check the data of a record and write it, sum covers the bytes of the record
+ * before the data. The record is intact if all its bytes sum up to residue. */
+static int srec_data(srec_chunk_t *c, unsigned int address, const char *data_p, unsigned int data_length,
+                     unsigned int sum, unsigned int residue)
+{
+    const unsigned int record_address = address;
+    unsigned char *memory;
+    const char *area;
+
+    if (address + data_length < address)
+    {
+        return SREC_MEMORY_ERROR;
+    }
+    if ((CODE_OFFSET + c->code_len) >= (address + data_length))
+    {
+        if (NULL == c->code && !c->sparse)
         {
-            res += *pstr + 10 - 'A';
+            return SREC_NO_ERROR;
         }
-        else if ('a' <= *pstr && 'f' >= *pstr)
+        memory = (unsigned char*)c->code;
+        address -= CODE_OFFSET;
+        area = "srec_code";
+    }
+    else if (DATA_OFFSET <= address
+        && (DATA_OFFSET + c->data_len) >= (address + data_length))
+    {
+        if (NULL == c->data && !c->sparse)
         {
-            res += *pstr + 10 - 'a';
+            return SREC_NO_ERROR;
         }
-        else
+        memory = (unsigned char*)c->data;
+        address -= DATA_OFFSET;
+        area = "srec_data";
+    }
+    else
+    {
+        return SREC_MEMORY_ERROR;
+    }
+    // Data goes straight to the buffers, the checksum covers all bytes of the record
+    unsigned char record[255];
+    unsigned char *dest = (c->sparse || c->deferred) ? record : memory + address;
+    unsigned char checksum;
+    if (0 != hex_decode(data_p, dest, data_length, &sum)
+        || 0 != hex_decode(data_p + data_length * 2, &checksum, 1, &sum))
+    {
+        return SREC_FORMAT_ERROR;
+    }
+    if (residue != (sum & 0xFF))
+    {
+        return SREC_CHECKSUM_ERROR;
+    }
+    if (data_length
+        && 0 != srec_add_extent(c, record_address, data_length, data_p - c->text))
+    {
+        return SREC_ALLOC_ERROR;
+    }
+    if (NULL != c->stream)
+    {
+        const int rc = image_stream_write(c->stream, record_address, dest, data_length);
+        if (IMAGE_STREAM_RANGE_ERROR == rc)
         {
-            return -1;
+            // Data beyond the flash of the device
+            return SREC_MEMORY_ERROR;
         }
-        ++pstr;
+        if (0 != rc)
+        {
+            return SREC_ALLOC_ERROR;
+        }
+    }
+    if (log_enabled(c->log, 4))
+    {
+        char prefix[32];
+        snprintf(prefix, sizeof prefix, "%s (%06X) ", area, address);
+        log_hexdump(c->log, 4, prefix, dest, data_length);
     }
-    return res;
+    return SREC_NO_ERROR;
 }
 
-int srec_read(const char *filename,
-              void *code, unsigned int code_len,
-              void *data, unsigned int data_len)
+/* Parse one record, line points to its first character and len excludes the line break */
+static int srec_record(srec_chunk_t *c, const char *line, unsigned int len)
 {
-    FILE *pfile;
-    char line[512];
-    int rc = SREC_NO_ERROR;
-    pfile = fopen(filename, "r");
-    if (NULL == pfile)
+    log_printf(c->log, 4, "srec: %.*s\n", (int)len, line);
+    unsigned char count = 0;
+    unsigned int sum = 0;
+    if (4 > len
+        || 'S' != line[0]
+        || '0' > line[1] || '9' < line[1]
+        || 0 != hex_decode(&line[2], &count, 1, &sum)
+        || len < 4 + 2 * (unsigned int)count)
     {
-        fprintf(stderr, "Unable to open file \"%s\"\n", filename);
-        return SREC_IO_ERROR;
+        return SREC_FORMAT_ERROR;
     }
-    rewind(pfile);
-    while (!feof(pfile))
+    const unsigned int record_type = line[1] - '0';
+    // Ignore non-data frames, but make sure they are intact
+    if (1 != record_type
+        && 2 != record_type
+        && 3 != record_type)
     {
-        if (NULL == fgets(line, sizeof line, pfile))
+        unsigned char record[255];
+        if (0 != hex_decode(&line[4], record, count, &sum))
         {
-            if (ferror(pfile))
-            {
-                fprintf(stderr, "Unable to read file \"%s\"\n", filename);
-                rc = SREC_IO_ERROR;
-            }
-            break;
+            return SREC_FORMAT_ERROR;
         }
-        const size_t len = strlen(line);
-        if (0 == len || '\n' != line[len - 1])
+        if (0xFF != (sum & 0xFF))
         {
-            fprintf(stderr, "Unable to parse file: line is too long\n");
-            rc = SREC_IO_ERROR;
+            return SREC_CHECKSUM_ERROR;
         }
-        if (4 <= verbose_level)
+        log_printf(c->log, 4, "Record with no data (S%u)\n", record_type);
+        return SREC_NO_ERROR;
+    }
+    const int address_length = record_type + 1; // in bytes
+    unsigned char header[4];
+    if (count < address_length + 1
+        || 0 != hex_decode(&line[4], header, address_length, &sum))
+    {
+        return SREC_FORMAT_ERROR;
+    }
+    unsigned int address = 0;
+    int i;
+    for (i = 0; i < address_length; ++i)
+    {
+        address = (address << 8) | header[i];
+    }
+    return srec_data(c, address, line + 4 + address_length * 2, count - address_length - 1, sum, 0xFF);
+}
+
+/* Parse one Intel HEX record, same as srec_record() */
+static int ihex_record(srec_chunk_t *c, const char *line, unsigned int len)
+{
+    log_printf(c->log, 4, "ihex: %.*s\n", (int)len, line);
+    unsigned char header[4];
+    unsigned int sum = 0;
+    if (11 > len
+        || ':' != line[0]
+        || 0 != hex_decode(&line[1], header, sizeof header, &sum)
+        || len < 11 + 2 * (unsigned int)header[0])
+    {
+        return SREC_FORMAT_ERROR;
+    }
+    const unsigned int count = header[0];
+    const unsigned int record_type = header[3];
+    if (IHEX_DATA == record_type)
+    {
+        return srec_data(c, c->base + ((header[1] << 8) | header[2]), &line[9], count, sum, 0x00);
+    }
+    unsigned char record[256];
+    if (0 != hex_decode(&line[9], record, count + 1, &sum))
+    {
+        return SREC_FORMAT_ERROR;
+    }
+    if (0 != (sum & 0xFF))
+    {
+        return SREC_CHECKSUM_ERROR;
+    }
+    switch (record_type)
+    {
+    case IHEX_EXTENDED_SEGMENT:
+    case IHEX_EXTENDED_LINEAR:
+        if (2 != count)
         {
-            printf("srec: %s\n", line);
+            return SREC_FORMAT_ERROR;
         }
-        if ('S' != line[0])
+        c->base = ((record[0] << 8) | record[1]) << (IHEX_EXTENDED_LINEAR == record_type ? 16 : 4);
+        break;
+    case IHEX_END_OF_FILE:
+    case IHEX_START_SEGMENT:
+    case IHEX_START_LINEAR:
+        break;
+    default:
+        return SREC_FORMAT_ERROR;
+    }
+    log_printf(c->log, 4, "Record with no data (type %02X)\n", record_type);
+    return SREC_NO_ERROR;
+}
+
+/* Base address in effect at the start of a chunk, set by the last extended
+ * address record before it. That record is checked by the chunk it is in. */
+static unsigned int ihex_base_at(const char *text, const char *p)
+{
+    while (p > text)
+    {
+        const char *line = p - 1;
+        while (line > text && '\n' != line[-1])
+        {
+            --line;
+        }
+        unsigned char value[2];
+        unsigned int sum = 0;
+        if (p - line >= 13
+            && 0 == memcmp(line, ":0200000", 8)
+            && ('2' == line[8] || '4' == line[8])
+            && 0 == hex_decode(&line[9], value, sizeof value, &sum))
+        {
+            return ((value[0] << 8) | value[1]) << ('4' == line[8] ? 16 : 4);
+        }
+        p = line;
+    }
+    return 0;
+}
+
+/* Records of a file are of the kind of its first one */
+static int srec_is_ihex(const char *text, size_t size)
+{
+    return 0 < size && ':' == text[0];
+}
+
+int srec_detect(const char *text, size_t size)
+{
+    return 0 < size && ('S' == text[0] || ':' == text[0]);
+}
+
+static void srec_parse_chunk(srec_chunk_t *c)
+{
+    const char *p = c->begin;
+    while (p < c->end)
+    {
+        // The last record may lack a line break
+        const char *eol = memchr(p, '\n', c->end - p);
+        const char *next = NULL != eol ? eol + 1 : c->end;
+        if (NULL == eol)
+        {
+            eol = c->end;
+        }
+        if (eol > p && '\r' == eol[-1])
+        {
+            --eol;
+        }
+        ++c->lines;
+        c->rc = c->ihex ? ihex_record(c, p, eol - p) : srec_record(c, p, eol - p);
+        if (SREC_NO_ERROR != c->rc)
+        {
+            c->error_line = p;
+            c->error_len = eol - p;
+            return;
+        }
+        p = next;
+    }
+}
+
+static THREAD_FUNC(srec_worker, arg)
+{
+    srec_parse_chunk((srec_chunk_t*)arg);
+    return 0;
+}
+
+static void srec_report(const log_t *log, int rc, unsigned int line_number, const char *line, unsigned int len)
+{
+    switch (rc)
+    {
+    case SREC_FORMAT_ERROR:
+        log_printf(log, LOG_ERROR, "File format error in line %u (\"%.*s\")\n", line_number, (int)len, line);
+        break;
+    case SREC_CHECKSUM_ERROR:
+        log_printf(log, LOG_ERROR, "Checksum error in line %u\n", line_number);
+        break;
+    case SREC_MEMORY_ERROR:
+        log_printf(log, LOG_ERROR, "Data in line %u is out of the memory range\n", line_number);
+        break;
+    case SREC_ALLOC_ERROR:
+        log_printf(log, LOG_ERROR, "Memory allocation failed\n");
+        break;
+    }
+}
+
+static int extent_compare(const void *a, const void *b)
+{
+    const srec_extent_t *ea = (const srec_extent_t*)a;
+    const srec_extent_t *eb = (const srec_extent_t*)b;
+    if (ea->address != eb->address)
+    {
+        return ea->address < eb->address ? -1 : 1;
+    }
+    return ea->line < eb->line ? -1 : (ea->line > eb->line);
+}
+
+/* Records may overlap only if they agree on the data. Workers only check their
+ * records, so the check runs over the extents afterwards and does not depend
+ * on the timing of workers. *overlaps is set if any records overlap. */
+static int srec_check_overlaps(const log_t *log, const char *text, srec_extent_t *extents, unsigned int count,
+                               int *overlaps)
+{
+    unsigned int i;
+    *overlaps = 0;
+    for (i = 1; i < count; ++i)
+    {
+        if (extents[i].address < extents[i - 1].address + extents[i - 1].length)
         {
-            fprintf(stderr, "File format error (\"%s\")\n", line);
-            rc = SREC_FORMAT_ERROR;
             break;
         }
-        // Ignore non-data frames
-        const unsigned int record_type = ascii2hex(&line[1], 1);
-        if (1 != record_type
-            && 2 != record_type
-            && 3 != record_type)
+    }
+    if (i >= count)
+    {
+        // Common case, the file is sorted and no record overlaps another one
+        return SREC_NO_ERROR;
+    }
+    *overlaps = 1;
+    qsort(extents, count, sizeof *extents, extent_compare);
+    const srec_extent_t *last = &extents[0];
+    for (i = 1; i < count; ++i)
+    {
+        const srec_extent_t *e = &extents[i];
+        const unsigned int last_end = last->address + last->length;
+        if (e->address < last_end)
         {
-            if (4 <= verbose_level)
+            // The extent reaching furthest covers all bytes of e written so far
+            const unsigned int end = e->address + e->length < last_end ? e->address + e->length : last_end;
+            const unsigned int length = end - e->address;
+            unsigned char a[255];
+            unsigned char b[255];
+            unsigned int sum = 0;
+            hex_decode(text + last->digits + (e->address - last->address) * 2, a, length, &sum);
+            hex_decode(text + e->digits, b, length, &sum);
+            if (0 != memcmp(a, b, length))
             {
-                printf("Record with no data (S%u)\n", record_type);
+                const unsigned int first = last->line < e->line ? last->line : e->line;
+                const unsigned int second = last->line < e->line ? e->line : last->line;
+                log_printf(log, LOG_ERROR, "Records in lines %u and %u overlap with different data at %06X\n",
+                           first, second, e->address);
+                return SREC_OVERLAP_ERROR;
             }
-            continue;
         }
-        const int address_length = (record_type + 1) * 2; // in symbols
-        unsigned int address = ascii2hex(&line[4], address_length);
-        const int data_length = ascii2hex(&line[2], 2) - address_length / 2 - 1; // in bytes
-        const char *data_p = line + 4 + address_length;
-        unsigned char *memory;
+        if (e->address + e->length > last_end)
+        {
+            last = e;
+        }
+    }
+    return SREC_NO_ERROR;
+}
 
-        if ((CODE_OFFSET + code_len) >= (address + data_length))
+/* Write data of checked records to the buffers of the chunk */
+static void srec_write_extents(const srec_chunk_t *c, const srec_extent_t *extents, unsigned int count)
+{
+    unsigned int i;
+    for (i = 0; i < count; ++i)
+    {
+        const srec_extent_t *e = &extents[i];
+        unsigned char *dest;
+        if ((CODE_OFFSET + c->code_len) >= (e->address + e->length))
         {
-            if (NULL == code)
-            {
-                continue;
-            }
-            memory = (unsigned char*)code;
-            address -= CODE_OFFSET;
-            if (4 <= verbose_level)
+            dest = (unsigned char*)c->code + (e->address - CODE_OFFSET);
+        }
+        else
+        {
+            dest = (unsigned char*)c->data + (e->address - DATA_OFFSET);
+        }
+        unsigned int sum = 0;
+        hex_decode(c->text + e->digits, dest, e->length, &sum);
+    }
+}
+
+static THREAD_FUNC(srec_writer, arg)
+{
+    srec_chunk_t *c = (srec_chunk_t*)arg;
+    srec_write_extents(c, c->extents, c->count);
+    return 0;
+}
+
+/* Parse all records into the buffers of target, or only check them if it is
+ * sparse. Extents of the data records are returned if extents is not NULL.
+ * Several workers only check records and keep their extents, data goes to the
+ * buffers once no records overlap with different data. */
+static int srec_parse_records(const log_t *log, const char *text, size_t size, const srec_chunk_t *target,
+                              srec_extent_t **extents_out, unsigned int *count_out)
+{
+    srec_chunk_t chunk[SREC_MAX_WORKERS];
+    unsigned int workers = 1;
+    // Per-record logs must come in file order, they are printed by one thread
+    if (!log_enabled(log, 4))
+    {
+        const unsigned int cpus = thread_cpu_count();
+        workers = size / SREC_CHUNK_MIN;
+        workers = workers < cpus ? workers : cpus;
+        workers = workers < SREC_MAX_WORKERS ? workers : SREC_MAX_WORKERS;
+        workers = workers ? workers : 1;
+    }
+    memset(chunk, 0, sizeof chunk);
+    const char *p = text;
+    const char *const end = text + size;
+    unsigned int i;
+    for (i = 0; i < workers; ++i)
+    {
+        // Chunks end after a line break, so every record is parsed by one worker
+        const char *split = i + 1 < workers ? text + size / workers * (i + 1) : end;
+        if (split < p)
+        {
+            split = p;
+        }
+        if (split < end)
+        {
+            const char *eol = memchr(split, '\n', end - split);
+            split = NULL != eol ? eol + 1 : end;
+        }
+        chunk[i] = *target;
+        chunk[i].deferred = 1 < workers && !target->sparse;
+        chunk[i].log = log;
+        chunk[i].text = text;
+        chunk[i].ihex = srec_is_ihex(text, size);
+        chunk[i].base = chunk[i].ihex ? ihex_base_at(text, p) : 0;
+        chunk[i].begin = p;
+        chunk[i].end = split;
+        p = split;
+    }
+    for (i = 1; i < workers; ++i)
+    {
+        chunk[i].started = 0 == thread_create(&chunk[i].thread, srec_worker, &chunk[i]);
+    }
+    srec_parse_chunk(&chunk[0]);
+    for (i = 1; i < workers; ++i)
+    {
+        if (chunk[i].started)
+        {
+            thread_join(&chunk[i].thread);
+        }
+        else
+        {
+            srec_parse_chunk(&chunk[i]);
+        }
+    }
+
+    // The first error of the file is reported, as the serial parser would do
+    int rc = SREC_NO_ERROR;
+    unsigned int lines = 0;
+    unsigned int count = 0;
+    for (i = 0; i < workers; ++i)
+    {
+        if (SREC_NO_ERROR != chunk[i].rc)
+        {
+            rc = chunk[i].rc;
+            srec_report(log, rc, lines + chunk[i].lines, chunk[i].error_line, chunk[i].error_len);
+            break;
+        }
+        unsigned int j;
+        for (j = 0; j < chunk[i].count; ++j)
+        {
+            chunk[i].extents[j].line += lines;
+        }
+        lines += chunk[i].lines;
+        count += chunk[i].count;
+    }
+    srec_extent_t *extents = NULL;
+    int overlaps = 0;
+    if (SREC_NO_ERROR == rc && (1 < count || (NULL != extents_out && count)))
+    {
+        if (1 == workers)
+        {
+            extents = chunk[0].extents;
+            chunk[0].extents = NULL;
+        }
+        else if (NULL != (extents = malloc(count * sizeof *extents)))
+        {
+            count = 0;
+            for (i = 0; i < workers; ++i)
             {
-                printf("srec_code (%06X) : ", address);
+                memcpy(extents + count, chunk[i].extents, chunk[i].count * sizeof *extents);
+                count += chunk[i].count;
             }
         }
-        else if (DATA_OFFSET <= address
-            && (DATA_OFFSET + data_len) >= (address + data_length))
+        if (NULL == extents)
+        {
+            rc = SREC_ALLOC_ERROR;
+            srec_report(log, rc, 0, NULL, 0);
+        }
+        else
+        {
+            rc = srec_check_overlaps(log, text, extents, count, &overlaps);
+        }
+    }
+    if (SREC_NO_ERROR == rc && chunk[0].deferred)
+    {
+        if (overlaps)
+        {
+            // Equal data of overlapping records is written by one thread only
+            srec_write_extents(&chunk[0], extents, count);
+        }
+        else
         {
-            if (NULL == data)
+            // Chunks write ranges of their own
+            for (i = 1; i < workers; ++i)
             {
-                continue;
+                chunk[i].started = 0 == thread_create(&chunk[i].thread, srec_writer, &chunk[i]);
             }
-            memory = (unsigned char*)data;
-            address -= DATA_OFFSET;
-            if (4 <= verbose_level)
+            srec_write_extents(&chunk[0], chunk[0].extents, chunk[0].count);
+            for (i = 1; i < workers; ++i)
             {
-                printf("srec_data (%06X) : ", address);
+                if (chunk[i].started)
+                {
+                    thread_join(&chunk[i].thread);
+                }
+                else
+                {
+                    srec_write_extents(&chunk[i], chunk[i].extents, chunk[i].count);
+                }
             }
         }
-        else
+    }
+    if (SREC_NO_ERROR == rc && NULL != extents_out)
+    {
+        *extents_out = extents;
+        *count_out = count;
+        extents = NULL;
+    }
+    free(extents);
+    for (i = 0; i < workers; ++i)
+    {
+        free(chunk[i].extents);
+    }
+    return rc;
+}
+
+int srec_parse(const log_t *log, const char *text, size_t size,
+               void *code, unsigned int code_len,
+               void *data, unsigned int data_len)
+{
+    srec_chunk_t target;
+    memset(&target, 0, sizeof target);
+    target.code = code;
+    target.code_len = code_len;
+    target.data = data;
+    target.data_len = data_len;
+    return srec_parse_records(log, text, size, &target, NULL, NULL);
+}
+
+int srec_parse_image(const log_t *log, const char *text, size_t size,
+                     unsigned int code_len, unsigned int data_len, image_t *img)
+{
+    srec_chunk_t target;
+    memset(&target, 0, sizeof target);
+    target.code_len = code_len;
+    target.data_len = data_len;
+    target.sparse = 1;
+    srec_extent_t *extents = NULL;
+    unsigned int count = 0;
+    int rc = srec_parse_records(log, text, size, &target, &extents, &count);
+    if (SREC_NO_ERROR != rc)
+    {
+        return rc;
+    }
+    // All records are valid, only the ranges they write get memory
+    unsigned int i;
+    for (i = 0; i < count && SREC_NO_ERROR == rc; ++i)
+    {
+        if (0 != image_reserve(img, extents[i].address, extents[i].length)
+            || 0 != image_written(img, extents[i].address, extents[i].length))
+        {
+            rc = SREC_ALLOC_ERROR;
+        }
+    }
+    if (SREC_NO_ERROR == rc && 0 != image_alloc(img))
+    {
+        rc = SREC_ALLOC_ERROR;
+    }
+    for (i = 0; i < count && SREC_NO_ERROR == rc; ++i)
+    {
+        unsigned int sum = 0;
+        hex_decode(text + extents[i].digits, image_ptr(img, extents[i].address, extents[i].length), extents[i].length, &sum);
+    }
+    if (SREC_NO_ERROR == rc && 0 != image_seal(img))
+    {
+        rc = SREC_ALLOC_ERROR;
+    }
+    if (SREC_NO_ERROR != rc)
+    {
+        srec_report(log, rc, 0, NULL, 0);
+        image_free(img);
+    }
+    free(extents);
+    return rc;
+}
+
+int srec_read(const log_t *log, const char *filename,
+              void *code, unsigned int code_len,
+              void *data, unsigned int data_len)
+{
+    mapfile_t file;
+    const int rc = mapfile_open(&file, filename);
+    if (MAPFILE_OPEN_ERROR == rc)
+    {
+        log_printf(log, LOG_ERROR, "Unable to open file \"%s\"\n", filename);
+        return SREC_IO_ERROR;
+    }
+    if (MAPFILE_NO_ERROR != rc)
+    {
+        log_printf(log, LOG_ERROR, "Unable to read file \"%s\"\n", filename);
+        return SREC_IO_ERROR;
+    }
+    const int parse_rc = srec_parse(log, file.data, file.size, code, code_len, data, data_len);
+    mapfile_close(&file);
+    return parse_rc;
+}
+
+int srec_read_image(const log_t *log, const char *filename,
+                    unsigned int code_len, unsigned int data_len, image_t *img)
+{
+    mapfile_t file;
+    const int rc = mapfile_open(&file, filename);
+    if (MAPFILE_OPEN_ERROR == rc)
+    {
+        log_printf(log, LOG_ERROR, "Unable to open file \"%s\"\n", filename);
+        return SREC_IO_ERROR;
+    }
+    if (MAPFILE_NO_ERROR != rc)
+    {
+        log_printf(log, LOG_ERROR, "Unable to read file \"%s\"\n", filename);
+        return SREC_IO_ERROR;
+    }
+    const int parse_rc = srec_parse_image(log, file.data, file.size, code_len, data_len, img);
+    mapfile_close(&file);
+    return parse_rc;
+}
+
+int srec_stream(const log_t *log, const char *filename, mapfile_t *file,
+                unsigned int code_len, unsigned int data_len, image_stream_t *st)
+{
+    int rc = SREC_NO_ERROR;
+    srec_chunk_t c;
+    memset(&c, 0, sizeof c);
+    c.log = log;
+    c.code_len = code_len;
+    c.data_len = data_len;
+    c.sparse = 1;
+    c.stream = st;
+    // Complete lines are parsed as soon as they arrive, the buffer may move while it grows
+    size_t parsed = 0;
+    for (;;)
+    {
+        const int more = mapfile_more(file);
+        if (0 > more)
         {
-            rc = SREC_MEMORY_ERROR;
+            log_printf(log, LOG_ERROR, "Unable to read file \"%s\"\n", filename);
+            rc = SREC_IO_ERROR;
             break;
         }
-        unsigned int i = data_length;
-        for(; 0 < i; --i)
+        size_t end = file->size;
+        if (more)
         {
-            memory[address] = ascii2hex(data_p, 2);
-            if (4 <= verbose_level)
+            while (end > parsed && '\n' != file->data[end - 1])
             {
-                printf("%02X ", memory[address]);
+                --end;
             }
-            ++address;
-            data_p += 2;
         }
-        if (4 <= verbose_level)
+        c.text = file->data;
+        c.ihex = srec_is_ihex(file->data, file->size);
+        c.begin = file->data + parsed;
+        c.end = file->data + end;
+        srec_parse_chunk(&c);
+        rc = c.rc;
+        if (SREC_NO_ERROR != rc)
+        {
+            srec_report(log, rc, c.lines, c.error_line, c.error_len);
+            break;
+        }
+        parsed = end;
+        if (!more)
         {
-            printf("\n");
+            break;
         }
     }
-    fclose(pfile);
+    if (SREC_NO_ERROR == rc && 1 < c.count)
+    {
+        int overlaps;
+        rc = srec_check_overlaps(log, file->data, c.extents, c.count, &overlaps);
+    }
+    free(c.extents);
+    mapfile_close(file);
+    if (0 != image_stream_finish(st, rc) && SREC_NO_ERROR == rc)
+    {
+        rc = SREC_ALLOC_ERROR;
+        srec_report(log, rc, 0, NULL, 0);
+    }
     return rc;
 }
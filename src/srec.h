@@ -20,11 +20,37 @@
 #ifndef SREC_H__
 #define SREC_H__
 
-int srec_read(const char *filename, void *code, unsigned int code_len, void *data, unsigned int data_len);
+#include "log.h"
+#include "image.h"
+#include "mapfile.h"
+#include <stddef.h>
+
+/* Files of S-records or Intel HEX records (types 00 to 05) are read alike,
+ * the first character of a file tells which. */
+int srec_read(const log_t *log, const char *filename, void *code, unsigned int code_len, void *data, unsigned int data_len);
+/* Same as srec_read(), for records already in memory, lines end with LF or CR LF.
+ * Large files are parsed by several threads with the same result. Overlapping
+ * records are accepted only if they carry the same data. */
+int srec_parse(const log_t *log, const char *text, size_t size, void *code, unsigned int code_len, void *data, unsigned int data_len);
+
+/* Read the file into a sparse image, img is initialized by the caller. Data
+ * must lie in code_len bytes of code flash or data_len bytes of data flash. */
+int srec_read_image(const log_t *log, const char *filename, unsigned int code_len, unsigned int data_len, image_t *img);
+int srec_parse_image(const log_t *log, const char *text, size_t size, unsigned int code_len, unsigned int data_len, image_t *img);
+/* Same as srec_read_image(), but data goes to the stream record by record while
+ * the file is read, so a pipe can feed it. The file is opened by mapfile_begin(),
+ * it is closed and the stream is finished in any case. */
+int srec_stream(const log_t *log, const char *filename, mapfile_t *file, unsigned int code_len, unsigned int data_len, image_stream_t *st);
+
+/* Non-zero if the data starts like an S-record or Intel HEX file */
+int srec_detect(const char *text, size_t size);
 
 #define SREC_NO_ERROR           (0)
 #define SREC_IO_ERROR           (-1)
 #define SREC_FORMAT_ERROR       (-2)
 #define SREC_MEMORY_ERROR       (-3)
+#define SREC_CHECKSUM_ERROR     (-4)
+#define SREC_OVERLAP_ERROR      (-5)
+#define SREC_ALLOC_ERROR        (-6)
 
 #endif // SREC_H__
@@ -18,7 +18,7 @@
  *********************************************************************************************************************/
 
 #include "terminal.h"
-#include "rl78.h"
+#include "rl78-session.h"
 #include "serial.h"
 #include <pthread.h>
 #include <stdio.h>
@@ -53,7 +53,7 @@ static void * receiver_func(void * pfd)
     return NULL;
 }
 
-void terminal_start(port_handle_t fd, int baud, int mode, int reset)
+void terminal_start(rl78_session_t *s, int baud, int reset)
 {
     pthread_t receiver;
     char c = 0;
@@ -73,11 +73,11 @@ void terminal_start(port_handle_t fd, int baud, int mode, int reset)
     tattr.c_lflag &= ~(ISIG | ICANON);
     tcsetattr(STDIN_FILENO, TCSAFLUSH, &tattr);
 
-    serial_set_baud(fd, baud);
-    pthread_create(&receiver, NULL, receiver_func, &fd);
+    serial_set_baud(s->port, baud);
+    pthread_create(&receiver, NULL, receiver_func, &s->port);
     if (reset)
     {
-        rl78_reset(fd, mode);
+        rl78_reset(s);
     }
     for (;;)
     {
@@ -87,7 +87,7 @@ void terminal_start(port_handle_t fd, int baud, int mode, int reset)
             {
                 break;
             }
-            serial_write(fd, &c, 1);
+            serial_write(s->port, &c, 1);
         }
     }
     pthread_cancel(receiver);
@@ -20,7 +20,7 @@
 #ifndef TERMINAL_H__
 #define TERMINAL_H__
 
-#include "serial.h"
-void terminal_start(port_handle_t fd, int baud, int mode, int reset);
+#include "rl78-session.h"
+void terminal_start(rl78_session_t *s, int baud, int reset);
 
 #endif  /* TERMINAL_H__ */
@@ -18,7 +18,7 @@
  *********************************************************************************************************************/
 
 #include "terminal.h"
-#include "rl78.h"
+#include "rl78-session.h"
 #include "serial.h"
 #include <stdio.h>
 #include <unistd.h>
@@ -57,7 +57,7 @@ static DWORD WINAPI receiver_func(LPVOID pfd)
     return 0;
 }
 
-void terminal_start(port_handle_t fd, int baud, int mode, int reset)
+void terminal_start(rl78_session_t *s, int baud, int reset)
 {
     HANDLE    receiver;
     char c = 0;
@@ -77,7 +77,7 @@ void terminal_start(port_handle_t fd, int baud, int mode, int reset)
     new_mode = old_mode & ~(ENABLE_PROCESSED_INPUT | ENABLE_LINE_INPUT);
     SetConsoleMode(hStdin, new_mode);
 
-    serial_set_baud(fd, baud);
+    serial_set_baud(s->port, baud);
     receiver_stop = CreateEvent(NULL,
                                 TRUE,
                                 FALSE,
@@ -85,13 +85,13 @@ void terminal_start(port_handle_t fd, int baud, int mode, int reset)
     receiver = CreateThread(NULL,
                             0,
                             receiver_func,
-                            &fd,
+                            &s->port,
                             0,
                             NULL);
 
     if (reset)
     {
-        rl78_reset(fd, mode);
+        rl78_reset(s);
     }
     for (;;)
     {
@@ -101,7 +101,7 @@ void terminal_start(port_handle_t fd, int baud, int mode, int reset)
             {
                 break;
             }
-            serial_write(fd, &c, 1);
+            serial_write(s->port, &c, 1);
         }
     }
     SetEvent(receiver_stop);
@@ -0,0 +1,83 @@
+/*********************************************************************************************************************
+ * The MIT License (MIT)                                                                                             *
+ * Copyright (c) 2026 rl78flash contributors                                                                         *
+ *                                                                                                                   *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated      *
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation   *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and  *
+ * to permit persons to whom the Software is furnished to do so, subject to the following conditions:                *
+ *                                                                                                                   *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions     *
+ * of the Software.                                                                                                  *
+ *                                                                                                                   *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO  *
+ * THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF         *
+ * CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+ * IN THE SOFTWARE.                                                                                                  *
+ *********************************************************************************************************************/
+
+#include "thread.h"
+#include <stdint.h>
+#include <unistd.h>
+
+int thread_create(thread_t *thread, thread_func_t func, void *arg)
+{
+    return 0 == pthread_create(thread, NULL, func, arg) ? 0 : -1;
+}
+
+int thread_join(thread_t *thread)
+{
+    return 0 == pthread_join(*thread, NULL) ? 0 : -1;
+}
+
+void mutex_init(mutex_t *mutex)
+{
+    pthread_mutex_init(mutex, NULL);
+}
+
+void mutex_lock(mutex_t *mutex)
+{
+    pthread_mutex_lock(mutex);
+}
+
+void mutex_unlock(mutex_t *mutex)
+{
+    pthread_mutex_unlock(mutex);
+}
+
+void mutex_destroy(mutex_t *mutex)
+{
+    pthread_mutex_destroy(mutex);
+}
+
+void cond_init(cond_t *cond)
+{
+    pthread_cond_init(cond, NULL);
+}
+
+void cond_wait(cond_t *cond, mutex_t *mutex)
+{
+    pthread_cond_wait(cond, mutex);
+}
+
+void cond_broadcast(cond_t *cond)
+{
+    pthread_cond_broadcast(cond);
+}
+
+void cond_destroy(cond_t *cond)
+{
+    pthread_cond_destroy(cond);
+}
+
+int thread_cpu_count(void)
+{
+    const long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return 1 < count ? (int)count : 1;
+}
+
+unsigned long thread_self(void)
+{
+    return (unsigned long)(uintptr_t)pthread_self();
+}
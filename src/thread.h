@@ -0,0 +1,56 @@
+/*********************************************************************************************************************
+ * The MIT License (MIT)                                                                                             *
+ * Copyright (c) 2026 rl78flash contributors                                                                         *
+ *                                                                                                                   *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated      *
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation   *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and  *
+ * to permit persons to whom the Software is furnished to do so, subject to the following conditions:                *
+ *                                                                                                                   *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions     *
+ * of the Software.                                                                                                  *
+ *                                                                                                                   *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO  *
+ * THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF         *
+ * CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+ * IN THE SOFTWARE.                                                                                                  *
+ *********************************************************************************************************************/
+
+#ifndef THREAD_H__
+#define THREAD_H__
+
+#ifdef WIN32
+#include <windows.h>
+typedef HANDLE thread_t;
+typedef CRITICAL_SECTION mutex_t;
+typedef CONDITION_VARIABLE cond_t;
+#define THREAD_FUNC(name, arg) DWORD WINAPI name(LPVOID arg)
+typedef LPTHREAD_START_ROUTINE thread_func_t;
+#else
+#include <pthread.h>
+typedef pthread_t thread_t;
+typedef pthread_mutex_t mutex_t;
+typedef pthread_cond_t cond_t;
+#define THREAD_FUNC(name, arg) void *name(void *arg)
+typedef void *(*thread_func_t)(void *);
+#endif
+
+/* Minimal portable threads, used to work with several targets at once */
+int thread_create(thread_t *thread, thread_func_t func, void *arg);
+int thread_join(thread_t *thread);
+void mutex_init(mutex_t *mutex);
+void mutex_lock(mutex_t *mutex);
+void mutex_unlock(mutex_t *mutex);
+void mutex_destroy(mutex_t *mutex);
+void cond_init(cond_t *cond);
+/* Wait for a broadcast, the mutex is held when called and on return */
+void cond_wait(cond_t *cond, mutex_t *mutex);
+void cond_broadcast(cond_t *cond);
+void cond_destroy(cond_t *cond);
+/* Number of online processors, at least 1 */
+int thread_cpu_count(void);
+/* Identifier of the calling thread, unique among running threads of the process */
+unsigned long thread_self(void);
+
+#endif  // THREAD_H__
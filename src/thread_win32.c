@@ -0,0 +1,86 @@
+/*********************************************************************************************************************
+ * The MIT License (MIT)                                                                                             *
+ * Copyright (c) 2026 rl78flash contributors                                                                         *
+ *                                                                                                                   *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated      *
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation   *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and  *
+ * to permit persons to whom the Software is furnished to do so, subject to the following conditions:                *
+ *                                                                                                                   *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions     *
+ * of the Software.                                                                                                  *
+ *                                                                                                                   *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO  *
+ * THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF         *
+ * CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+ * IN THE SOFTWARE.                                                                                                  *
+ *********************************************************************************************************************/
+
+#include "thread.h"
+
+int thread_create(thread_t *thread, thread_func_t func, void *arg)
+{
+    *thread = CreateThread(NULL, 0, func, arg, 0, NULL);
+    return NULL != *thread ? 0 : -1;
+}
+
+int thread_join(thread_t *thread)
+{
+    const int rc = WAIT_OBJECT_0 == WaitForSingleObject(*thread, INFINITE) ? 0 : -1;
+    CloseHandle(*thread);
+    return rc;
+}
+
+void mutex_init(mutex_t *mutex)
+{
+    InitializeCriticalSection(mutex);
+}
+
+void mutex_lock(mutex_t *mutex)
+{
+    EnterCriticalSection(mutex);
+}
+
+void mutex_unlock(mutex_t *mutex)
+{
+    LeaveCriticalSection(mutex);
+}
+
+void mutex_destroy(mutex_t *mutex)
+{
+    DeleteCriticalSection(mutex);
+}
+
+void cond_init(cond_t *cond)
+{
+    InitializeConditionVariable(cond);
+}
+
+void cond_wait(cond_t *cond, mutex_t *mutex)
+{
+    SleepConditionVariableCS(cond, mutex, INFINITE);
+}
+
+void cond_broadcast(cond_t *cond)
+{
+    WakeAllConditionVariable(cond);
+}
+
+void cond_destroy(cond_t *cond)
+{
+    // Condition variables of Windows hold no resources
+    (void)cond;
+}
+
+int thread_cpu_count(void)
+{
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return 1 < info.dwNumberOfProcessors ? (int)info.dwNumberOfProcessors : 1;
+}
+
+unsigned long thread_self(void)
+{
+    return (unsigned long)GetCurrentThreadId();
+}
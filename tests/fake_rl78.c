@@ -0,0 +1,248 @@
+/*********************************************************************************************************************
+ * The MIT License (MIT)                                                                                             *
+ * Copyright (c) 2026 rl78flash contributors                                                                         *
+ *                                                                                                                   *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated      *
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation   *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and  *
+ * to permit persons to whom the Software is furnished to do so, subject to the following conditions:                *
+ *                                                                                                                   *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions     *
+ * of the Software.                                                                                                  *
+ *                                                                                                                   *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO  *
+ * THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF         *
+ * CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+ * IN THE SOFTWARE.                                                                                                  *
+ *********************************************************************************************************************/
+
+#define _DEFAULT_SOURCE
+#define _XOPEN_SOURCE 600
+#include "fake_rl78.h"
+#include "rl78.h"
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+
+static int fake_read(fake_rl78_t *f, unsigned char *buf, unsigned int len)
+{
+    while (len)
+    {
+        const ssize_t n = read(f->master, buf, len);
+        if (0 >= n)
+        {
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static void fake_frame(fake_rl78_t *f, const unsigned char *data, unsigned int len)
+{
+    unsigned char frame[260];
+    unsigned int sum = len & 0xFF;
+    unsigned int i;
+    frame[0] = STX;
+    frame[1] = len & 0xFF;
+    for (i = 0; i < len; ++i)
+    {
+        frame[2 + i] = data[i];
+        sum += data[i];
+    }
+    frame[2 + len] = (0x100 - (sum & 0xFF)) & 0xFF;
+    frame[3 + len] = ETX;
+    if (write(f->master, frame, len + 4) != (ssize_t)(len + 4))
+    {
+        return;
+    }
+}
+
+static void fake_status(fake_rl78_t *f, unsigned char status1, unsigned char status2, unsigned int len)
+{
+    const unsigned char status[2] = { status1, status2 };
+    fake_frame(f, status, len);
+}
+
+/* Data frames of Programming and Verify, the flash is compared or written */
+static int fake_data(fake_rl78_t *f, unsigned int start, unsigned int end, int program)
+{
+    unsigned int address = start;
+    for (;;)
+    {
+        unsigned char frame[260];
+        if (0 != fake_read(f, frame, 2))
+        {
+            return -1;
+        }
+        const unsigned int len = frame[1] ? frame[1] : 256U;
+        if (0 != fake_read(f, frame + 2, len + 2))
+        {
+            return -1;
+        }
+        unsigned char status = STATUS_ACK;
+        if (address + len > end + 1)
+        {
+            status = STATUS_PARAMETER_ERROR;
+        }
+        else if (program)
+        {
+            memcpy(f->code + address, frame + 2, len);
+        }
+        else if (0 != memcmp(f->code + address, frame + 2, len))
+        {
+            status = STATUS_VERIFY_ERROR;
+        }
+        fake_status(f, STATUS_ACK, status, 2);
+        address += len;
+        // The command ends with the last frame or the first error
+        if (ETX == frame[len + 3] || STATUS_ACK != status)
+        {
+            return 0;
+        }
+    }
+}
+
+static THREAD_FUNC(fake_thread, arg)
+{
+    fake_rl78_t *f = arg;
+    unsigned char cmd[260];
+    // Commands come as SOH, length, command code, parameters, checksum and ETX
+    while (0 == fake_read(f, cmd, 2))
+    {
+        const unsigned int len = cmd[1] ? cmd[1] : 256U;
+        if (SOH != cmd[0] || 0 != fake_read(f, cmd + 2, len + 2))
+        {
+            break;
+        }
+        const unsigned int start = cmd[3] | (cmd[4] << 8) | (cmd[5] << 16);
+        const unsigned int end = cmd[6] | (cmd[7] << 8) | (cmd[8] << 16);
+        if (f->count < FAKE_MAX_COMMANDS)
+        {
+            f->commands[f->count].command = cmd[2];
+            f->commands[f->count].start = start;
+            f->commands[f->count].end = end;
+            ++f->count;
+        }
+        const int range = 7 <= len && start <= end && end < FAKE_CODE_SIZE;
+        unsigned int i;
+        switch (cmd[2])
+        {
+        case CMD_RESET:
+            fake_status(f, STATUS_ACK, 0, 1);
+            break;
+        case CMD_BLOCK_BLANK_CHECK:
+            for (i = start; range && i <= end && 0xFF == f->code[i]; ++i)
+            {
+            }
+            fake_status(f, !range ? STATUS_PARAMETER_ERROR : i > end ? STATUS_ACK : STATUS_IVERIFY_BLANK_ERROR, 0, 1);
+            break;
+        case CMD_BLOCK_ERASE:
+            if (start % FAKE_BLOCK_SIZE || start >= FAKE_CODE_SIZE)
+            {
+                fake_status(f, STATUS_PARAMETER_ERROR, 0, 1);
+                break;
+            }
+            memset(f->code + start, 0xFF, FAKE_BLOCK_SIZE);
+            fake_status(f, STATUS_ACK, 0, 1);
+            break;
+        case CMD_CHECKSUM:
+            if (!range)
+            {
+                fake_status(f, STATUS_PARAMETER_ERROR, 0, 1);
+                break;
+            }
+            {
+                unsigned int sum = 0;
+                for (i = start; i <= end; ++i)
+                {
+                    sum -= f->code[i];
+                }
+                if (f->checksum_fault && start <= f->checksum_fault && f->checksum_fault <= end)
+                {
+                    ++sum;
+                }
+                fake_status(f, STATUS_ACK, 0, 1);
+                fake_status(f, sum & 0xFF, (sum >> 8) & 0xFF, 2);
+            }
+            break;
+        case CMD_PROGRAMMING:
+        case CMD_VERIFY:
+            if (!range)
+            {
+                fake_status(f, STATUS_PARAMETER_ERROR, 0, 1);
+                break;
+            }
+            fake_status(f, STATUS_ACK, 0, 1);
+            if (0 != fake_data(f, start, end, CMD_PROGRAMMING == cmd[2]))
+            {
+                return 0;
+            }
+            if (CMD_PROGRAMMING == cmd[2])
+            {
+                fake_status(f, STATUS_ACK, 0, 1);
+            }
+            break;
+        default:
+            fake_status(f, STATUS_COMMAND_NUMBER_ERROR, 0, 1);
+            break;
+        }
+    }
+    return 0;
+}
+
+void fake_rl78_init(fake_rl78_t *f)
+{
+    memset(f, 0, sizeof *f);
+    memset(f->code, 0xFF, sizeof f->code);
+    f->master = -1;
+    f->slave = -1;
+}
+
+int fake_rl78_start(fake_rl78_t *f)
+{
+    f->master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (0 > f->master
+        || 0 != grantpt(f->master)
+        || 0 != unlockpt(f->master)
+        || NULL == ptsname(f->master))
+    {
+        return -1;
+    }
+    strncpy(f->path, ptsname(f->master), sizeof f->path - 1);
+    f->slave = open(f->path, O_RDWR | O_NOCTTY);
+    if (0 > f->slave)
+    {
+        return -1;
+    }
+    struct termios options;
+    tcgetattr(f->slave, &options);
+    cfmakeraw(&options);
+    tcsetattr(f->slave, TCSANOW, &options);
+    return thread_create(&f->thread, fake_thread, f);
+}
+
+void fake_rl78_stop(fake_rl78_t *f)
+{
+    close(f->slave);
+    thread_join(&f->thread);
+    close(f->master);
+}
+
+unsigned int fake_rl78_count(const fake_rl78_t *f, unsigned char command, int start)
+{
+    unsigned int n = 0;
+    unsigned int i;
+    for (i = 0; i < f->count; ++i)
+    {
+        if (command == f->commands[i].command && (0 > start || (unsigned int)start == f->commands[i].start))
+        {
+            ++n;
+        }
+    }
+    return n;
+}
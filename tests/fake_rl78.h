@@ -0,0 +1,62 @@
+/*********************************************************************************************************************
+ * The MIT License (MIT)                                                                                             *
+ * Copyright (c) 2026 rl78flash contributors                                                                         *
+ *                                                                                                                   *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated      *
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation   *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and  *
+ * to permit persons to whom the Software is furnished to do so, subject to the following conditions:                *
+ *                                                                                                                   *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions     *
+ * of the Software.                                                                                                  *
+ *                                                                                                                   *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO  *
+ * THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF         *
+ * CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+ * IN THE SOFTWARE.                                                                                                  *
+ *********************************************************************************************************************/
+
+#ifndef FAKE_RL78_H__
+#define FAKE_RL78_H__
+
+#include "thread.h"
+
+#define FAKE_CODE_SIZE      (64U * 1024U)
+#define FAKE_BLOCK_SIZE     1024U
+#define FAKE_MAX_COMMANDS   4096U
+
+/* Command as the device has seen it */
+typedef struct
+{
+    unsigned char command;
+    unsigned int start;
+    unsigned int end;
+} fake_command_t;
+
+/* Bootloader of protocol A behind a pseudo terminal, with code flash only.
+ * Sessions open path in 2-wire mode and talk to it as to a device which has
+ * been initialized already. */
+typedef struct
+{
+    int master;
+    int slave;                  /* Kept open, so the master never sees a hang-up before the end */
+    char path[64];
+    thread_t thread;
+    unsigned char code[FAKE_CODE_SIZE];
+    /* Checksums of ranges holding this address are off by one, 0 for none */
+    unsigned int checksum_fault;
+    fake_command_t commands[FAKE_MAX_COMMANDS];
+    unsigned int count;
+} fake_rl78_t;
+
+/* Blank flash and no faults, the contents may be changed until the start */
+void fake_rl78_init(fake_rl78_t *f);
+/* Start answering commands, returns 0 or -1 */
+int fake_rl78_start(fake_rl78_t *f);
+/* Stop the device once the session is closed */
+void fake_rl78_stop(fake_rl78_t *f);
+/* Number of commands seen with a start address, any address if start is -1 */
+unsigned int fake_rl78_count(const fake_rl78_t *f, unsigned char command, int start);
+
+#endif  // FAKE_RL78_H__
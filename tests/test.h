@@ -0,0 +1,73 @@
+/*********************************************************************************************************************
+ * The MIT License (MIT)                                                                                             *
+ * Copyright (c) 2026 rl78flash contributors                                                                         *
+ *                                                                                                                   *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated      *
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation   *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and  *
+ * to permit persons to whom the Software is furnished to do so, subject to the following conditions:                *
+ *                                                                                                                   *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions     *
+ * of the Software.                                                                                                  *
+ *                                                                                                                   *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO  *
+ * THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF         *
+ * CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+ * IN THE SOFTWARE.                                                                                                  *
+ *********************************************************************************************************************/
+
+#ifndef TEST_H__
+#define TEST_H__
+
+#include <stdio.h>
+#include <string.h>
+#include "log.h"
+
+/* Checks of the unit tests, a failing one is reported and the test goes on */
+static int test_failures;
+
+#define CHECK(cond) \
+    do \
+    { \
+        if (!(cond)) \
+        { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            ++test_failures; \
+        } \
+    } \
+    while (0)
+
+/* Messages of the code under test are collected instead of being printed */
+static char test_messages[16384];
+
+static inline void test_sink(void *ctx, int level, const char *message)
+{
+    (void)ctx;
+    (void)level;
+    const size_t len = strlen(test_messages);
+    snprintf(test_messages + len, sizeof test_messages - len, "%s", message);
+}
+
+static const log_t test_log = { 0, test_sink, NULL };
+
+/* Forget the collected messages */
+static inline void test_clear(void)
+{
+    test_messages[0] = '\0';
+}
+
+/* Non-zero if a message since the last test_clear() contains text */
+static inline int test_logged(const char *text)
+{
+    return NULL != strstr(test_messages, text);
+}
+
+/* Exit code of a test program */
+static inline int test_result(const char *name)
+{
+    printf("%s: %s\n", name, test_failures ? "FAILED" : "passed");
+    return test_failures ? 1 : 0;
+}
+
+#endif  // TEST_H__
@@ -0,0 +1,141 @@
+/*********************************************************************************************************************
+ * The MIT License (MIT)                                                                                             *
+ * Copyright (c) 2026 rl78flash contributors                                                                         *
+ *                                                                                                                   *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated      *
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation   *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and  *
+ * to permit persons to whom the Software is furnished to do so, subject to the following conditions:                *
+ *                                                                                                                   *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions     *
+ * of the Software.                                                                                                  *
+ *                                                                                                                   *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO  *
+ * THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF         *
+ * CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+ * IN THE SOFTWARE.                                                                                                  *
+ *********************************************************************************************************************/
+
+#include "test.h"
+#include "baud_cache.h"
+#include "thread.h"
+#include <stdlib.h>
+#include <time.h>
+
+#define THREADS 8
+
+static char cache_dir[64];
+static char cache_file[128];
+
+static void write_cache(const char *text)
+{
+    FILE *file = fopen(cache_file, "w");
+    CHECK(NULL != file);
+    if (NULL != file)
+    {
+        fputs(text, file);
+        fclose(file);
+    }
+}
+
+static void test_store(void)
+{
+    const log_t log = { 2, test_sink, NULL };
+    CHECK(0 == baud_cache_load(&test_log, "/dev/ttyUSB0"));
+    test_clear();
+    CHECK(0 == baud_cache_store(&log, "/dev/ttyUSB0", 500000));
+    CHECK(test_logged("Baudrate for /dev/ttyUSB0 stored: 500000bps"));
+    CHECK(0 == baud_cache_store(&test_log, "/dev/ttyUSB1", 115200));
+    CHECK(500000 == baud_cache_load(&test_log, "/dev/ttyUSB0"));
+    CHECK(115200 == baud_cache_load(&test_log, "/dev/ttyUSB1"));
+    CHECK(0 == baud_cache_load(&test_log, "/dev/ttyUSB"));
+    // Storing again replaces the entry of the port
+    CHECK(0 == baud_cache_store(&test_log, "/dev/ttyUSB0", 250000));
+    CHECK(250000 == baud_cache_load(&test_log, "/dev/ttyUSB0"));
+    CHECK(115200 == baud_cache_load(&test_log, "/dev/ttyUSB1"));
+}
+
+static void test_expiry(void)
+{
+    const log_t log = { 2, test_sink, NULL };
+    char text[256];
+    const long long now = (long long)time(NULL);
+    snprintf(text, sizeof text, "1000000 %lld /dev/ttyS0\n250000 %lld /dev/ttyS1\n500000 %lld /dev/ttyS2\n"
+             "115200 /dev/ttyS3\n",
+             now - BAUD_CACHE_EXPIRY - 1, now - 60, now + 3600);
+    write_cache(text);
+    test_clear();
+    CHECK(0 == baud_cache_load(&log, "/dev/ttyS0"));
+    CHECK(test_logged("Cached baudrate for /dev/ttyS0 has expired: 1000000bps"));
+    CHECK(250000 == baud_cache_load(&test_log, "/dev/ttyS1"));
+    // Clock went back
+    CHECK(0 == baud_cache_load(&test_log, "/dev/ttyS2"));
+    // Entries without a time are of older versions
+    CHECK(0 == baud_cache_load(&test_log, "/dev/ttyS3"));
+    CHECK(0 == baud_cache_store(&test_log, "/dev/ttyS0", 500000));
+    CHECK(500000 == baud_cache_load(&test_log, "/dev/ttyS0"));
+    CHECK(250000 == baud_cache_load(&test_log, "/dev/ttyS1"));
+}
+
+static int results[THREADS];
+
+static void *store_thread(void *arg)
+{
+    const int n = (int)(size_t)arg;
+    char port[32];
+    snprintf(port, sizeof port, "/dev/ttyACM%d", n);
+    results[n] = baud_cache_store(&test_log, port, 115200);
+    return NULL;
+}
+
+static void test_concurrent(void)
+{
+    thread_t threads[THREADS];
+    int i;
+    for (i = 0; i < THREADS; ++i)
+    {
+        CHECK(0 == thread_create(&threads[i], store_thread, (void *)(size_t)i));
+    }
+    for (i = 0; i < THREADS; ++i)
+    {
+        thread_join(&threads[i]);
+        CHECK(0 == results[i]);
+    }
+    // Whichever store was the last, the cache is complete and no temporary file is left
+    FILE *file = fopen(cache_file, "r");
+    CHECK(NULL != file);
+    if (NULL != file)
+    {
+        char line[128];
+        while (NULL != fgets(line, sizeof line, file))
+        {
+            CHECK(0 == strncmp(line, "115200 ", 7) || 0 == strncmp(line, "500000 ", 7)
+                  || 0 == strncmp(line, "250000 ", 7));
+            CHECK(NULL != strchr(line, '\n'));
+        }
+        fclose(file);
+    }
+    char command[128];
+    snprintf(command, sizeof command, "test 1 = \"$(ls %s/rl78flash | wc -l)\"", cache_dir);
+    CHECK(0 == system(command));
+}
+
+int main(void)
+{
+    strcpy(cache_dir, "/tmp/test_baud_cache.XXXXXX");
+    if (NULL == mkdtemp(cache_dir))
+    {
+        perror("mkdtemp");
+        return 1;
+    }
+    snprintf(cache_file, sizeof cache_file, "%s/rl78flash/baudrate", cache_dir);
+    setenv("XDG_CACHE_HOME", cache_dir, 1);
+    test_store();
+    test_expiry();
+    test_concurrent();
+    char command[128];
+    snprintf(command, sizeof command, "rm -rf %s", cache_dir);
+    (void)system(command);
+    return test_result("test_baud_cache");
+}
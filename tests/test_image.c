@@ -0,0 +1,200 @@
+/*********************************************************************************************************************
+ * The MIT License (MIT)                                                                                             *
+ * Copyright (c) 2026 rl78flash contributors                                                                         *
+ *                                                                                                                   *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated      *
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation   *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and  *
+ * to permit persons to whom the Software is furnished to do so, subject to the following conditions:                *
+ *                                                                                                                   *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions     *
+ * of the Software.                                                                                                  *
+ *                                                                                                                   *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO  *
+ * THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF         *
+ * CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+ * IN THE SOFTWARE.                                                                                                  *
+ *********************************************************************************************************************/
+
+#include "test.h"
+#include "image.h"
+#include "input.h"
+#include "rl78img.h"
+#include "srec.h"
+#include <stdlib.h>
+#include <unistd.h>
+
+/* Image of a raw binary file at an address, it writes exactly its bytes */
+static void binary_image(image_t *img, unsigned int address, const char *bytes, unsigned int size)
+{
+    image_init(img);
+    CHECK(SREC_NO_ERROR == input_parse_image(&test_log, INPUT_BINARY, address, bytes, size,
+                                             0x100000, 0, img));
+}
+
+static int merge(image_t *img, const image_t *a, const image_t *b, image_conflict_t *conflict)
+{
+    const image_t *src[2] = { a, b };
+    image_init(img);
+    return image_merge(img, src, 2, conflict);
+}
+
+static void test_disjoint(void)
+{
+    // Both files write into the same block, each one leaves the bytes of the other alone
+    image_t a, b, img;
+    image_conflict_t conflict;
+    binary_image(&a, 0x100, "\x01\x02\xFF", 3);
+    binary_image(&b, 0x103, "\x04\x05", 2);
+    CHECK(1 == a.nwritten && 0x100 == a.written[0].address && 3 == a.written[0].size);
+    CHECK(0 == merge(&img, &a, &b, &conflict));
+    unsigned char buf[8];
+    CHECK(0 == memcmp(image_data(&img, 0xFF, 7, buf), "\xFF\x01\x02\xFF\x04\x05\xFF", 7));
+    CHECK(1 == img.nwritten && 0x100 == img.written[0].address && 5 == img.written[0].size);
+    image_free(&img);
+    image_free(&a);
+    image_free(&b);
+}
+
+static void test_same_data(void)
+{
+    image_t a, b, img;
+    image_conflict_t conflict;
+    binary_image(&a, 0x200, "\x11\x22\x33\x44", 4);
+    binary_image(&b, 0x202, "\x33\x44\x55", 3);
+    CHECK(0 == merge(&img, &a, &b, &conflict));
+    unsigned char buf[8];
+    CHECK(0 == memcmp(image_data(&img, 0x200, 5, buf), "\x11\x22\x33\x44\x55", 5));
+    image_free(&img);
+    image_free(&a);
+    image_free(&b);
+}
+
+static void test_blank_conflict(void)
+{
+    // A blank byte a file writes is data as well
+    image_t a, b, c, img;
+    image_conflict_t conflict;
+    binary_image(&a, 0x300, "\x00", 1);
+    binary_image(&b, 0x2FE, "\x00\x00\xFF\xFF", 4);
+    binary_image(&c, 0x300, "\x00\x01", 2);
+    const image_t *src[3] = { &a, &c, &b };
+    image_init(&img);
+    CHECK(IMAGE_MERGE_CONFLICT == image_merge(&img, src, 3, &conflict));
+    CHECK(0 == conflict.first && 2 == conflict.second);
+    CHECK(0x300 == conflict.address && 0x00 == conflict.first_value && 0xFF == conflict.second_value);
+    CHECK(0 == img.count && NULL == img.written);
+    // The other way round the first file has the blank byte
+    CHECK(IMAGE_MERGE_CONFLICT == merge(&img, &b, &c, &conflict));
+    CHECK(0 == conflict.first && 1 == conflict.second);
+    CHECK(0x300 == conflict.address && 0xFF == conflict.first_value && 0x00 == conflict.second_value);
+    image_free(&a);
+    image_free(&b);
+    image_free(&c);
+}
+
+static void test_different_data(void)
+{
+    image_t a, b, img;
+    image_conflict_t conflict;
+    binary_image(&a, 0x0FF0, "0123456789", 10);
+    binary_image(&b, 0x0FF8, "8X", 2);
+    CHECK(IMAGE_MERGE_CONFLICT == merge(&img, &a, &b, &conflict));
+    CHECK(0x0FF9 == conflict.address && '9' == conflict.first_value && 'X' == conflict.second_value);
+    image_free(&a);
+    image_free(&b);
+}
+
+static void test_used_blocks(void)
+{
+    // Images without written ranges compare all blocks with data
+    image_t a, b, img;
+    image_conflict_t conflict;
+    image_init(&a);
+    CHECK(0 == image_reserve(&a, 0x400, 1) && 0 == image_alloc(&a));
+    *image_ptr(&a, 0x400, 1) = 0x12;
+    CHECK(0 == image_seal(&a));
+    binary_image(&b, 0x4FF, "\x34", 1);
+    CHECK(IMAGE_MERGE_CONFLICT == merge(&img, &a, &b, &conflict));
+    CHECK(0x4FF == conflict.address && 0xFF == conflict.first_value && 0x34 == conflict.second_value);
+    image_free(&b);
+    binary_image(&b, 0x500, "\x34", 1);
+    CHECK(0 == merge(&img, &a, &b, &conflict));
+    CHECK(0x12 == *image_ptr(&img, 0x400, 1) && 0x34 == *image_ptr(&img, 0x500, 1));
+    image_free(&img);
+    image_free(&a);
+    image_free(&b);
+}
+
+static void test_move(void)
+{
+    image_t a, img;
+    binary_image(&a, 0x1000, "\xFF\x01", 2);
+    image_init(&img);
+    CHECK(0 == image_move(&img, &a, 0xF0000 - 0x1000));
+    CHECK(1 == img.nwritten && 0xF0000 == img.written[0].address && 2 == img.written[0].size);
+    CHECK(0 == memcmp(image_ptr(&img, 0xF0000, 2), "\xFF\x01", 2));
+    CHECK(!image_used(&img, 0, 0xF0000));
+    image_free(&img);
+    CHECK(0 == image_move(&img, &a, -0x1000));
+    CHECK(0 == img.written[0].address && 0x01 == *image_ptr(&img, 1, 1));
+    image_free(&img);
+    CHECK(0 != image_move(&img, &a, -0x1001));
+    CHECK(0 != image_move(&img, &a, IMAGE_STREAM_SIZE - 0x1001));
+    CHECK(0 == img.count);
+    image_free(&a);
+}
+
+static void test_precompiled(void)
+{
+    // Written ranges survive a precompiled image, so do conflicts of blank bytes
+    image_t a, b, img;
+    image_conflict_t conflict;
+    binary_image(&a, 0x600, "\xFF\xFF", 2);
+    CHECK(0 == image_written(&a, 0x700, 1));
+    CHECK(0 == image_seal(&a));
+    char path[] = "/tmp/test_image.XXXXXX";
+    const int fd = mkstemp(path);
+    CHECK(0 <= fd);
+    close(fd);
+    uint64_t hash;
+    CHECK(RL78IMG_NO_ERROR == rl78img_write(&test_log, path, &a, &hash));
+    static char file[4096];
+    FILE *f = fopen(path, "rb");
+    const size_t size = NULL == f ? 0 : fread(file, 1, sizeof file, f);
+    if (NULL != f)
+    {
+        fclose(f);
+    }
+    unlink(path);
+    rl78img_t ri;
+    CHECK(RL78IMG_NO_ERROR == rl78img_parse(&test_log, file, size, &ri));
+    CHECK(2 == ri.image.nwritten);
+    CHECK(0x600 == ri.image.written[0].address && 2 == ri.image.written[0].size);
+    CHECK(0x700 == ri.image.written[1].address && 1 == ri.image.written[1].size);
+    binary_image(&b, 0x601, "\x00", 1);
+    CHECK(IMAGE_MERGE_CONFLICT == merge(&img, &ri.image, &b, &conflict));
+    CHECK(0x601 == conflict.address);
+    rl78img_free(&ri);
+
+    // The ranges are covered by the hash of the tables
+    file[RL78IMG_HEADER_SIZE + 12 + 4] ^= 1;
+    test_clear();
+    CHECK(RL78IMG_HASH_ERROR == rl78img_parse(&test_log, file, size, &ri));
+    CHECK(test_logged("damaged"));
+    image_free(&a);
+    image_free(&b);
+}
+
+int main(void)
+{
+    test_disjoint();
+    test_same_data();
+    test_blank_conflict();
+    test_different_data();
+    test_used_blocks();
+    test_move();
+    test_precompiled();
+    return test_result("test_image");
+}
@@ -0,0 +1,439 @@
+/*********************************************************************************************************************
+ * The MIT License (MIT)                                                                                             *
+ * Copyright (c) 2026 rl78flash contributors                                                                         *
+ *                                                                                                                   *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated      *
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation   *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and  *
+ * to permit persons to whom the Software is furnished to do so, subject to the following conditions:                *
+ *                                                                                                                   *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions     *
+ * of the Software.                                                                                                  *
+ *                                                                                                                   *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO  *
+ * THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF         *
+ * CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+ * IN THE SOFTWARE.                                                                                                  *
+ *********************************************************************************************************************/
+
+#include "test.h"
+#include "srec.h"
+#include "input.h"
+#include "image.h"
+#include "rl78.h"
+#include <stdlib.h>
+
+#define CODE_LEN    (64U * 1024U)
+#define DATA_LEN    (4U * 1024U)
+
+static unsigned char code[CODE_LEN];
+static unsigned char data[DATA_LEN];
+
+/* Append an S1 or S2 record of bytes at an address */
+static void srec_add(char *text, unsigned int address, const unsigned char *bytes, unsigned int len)
+{
+    const unsigned int address_len = 0xFFFFU < address ? 3 : 2;
+    unsigned int sum = len + address_len + 1;
+    char *out = text + strlen(text);
+    int i;
+    out += sprintf(out, "S%c%02X", 3 == address_len ? '2' : '1', len + address_len + 1);
+    for (i = address_len - 1; i >= 0; --i)
+    {
+        sum += (address >> (i * 8)) & 0xFF;
+        out += sprintf(out, "%02X", (address >> (i * 8)) & 0xFF);
+    }
+    for (i = 0; i < (int)len; ++i)
+    {
+        sum += bytes[i];
+        out += sprintf(out, "%02X", bytes[i]);
+    }
+    sprintf(out, "%02X\n", ~sum & 0xFF);
+}
+
+/* Append an Intel HEX record */
+static void ihex_add(char *text, unsigned int type, unsigned int address, const unsigned char *bytes, unsigned int len)
+{
+    unsigned int sum = len + (address >> 8) + (address & 0xFF) + type;
+    char *out = text + strlen(text);
+    unsigned int i;
+    out += sprintf(out, ":%02X%04X%02X", len, address & 0xFFFF, type);
+    for (i = 0; i < len; ++i)
+    {
+        sum += bytes[i];
+        out += sprintf(out, "%02X", bytes[i]);
+    }
+    sprintf(out, "%02X\n", (0x100 - (sum & 0xFF)) & 0xFF);
+}
+
+static const unsigned char bytes[16] =
+{
+    0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99, 0xAA, 0xBB, 0xCC, 0xDD, 0xEE, 0xF0
+};
+
+static int parse(const char *text)
+{
+    memset(code, 0xFF, sizeof code);
+    memset(data, 0xFF, sizeof data);
+    test_clear();
+    return srec_parse(&test_log, text, strlen(text), code, CODE_LEN, data, DATA_LEN);
+}
+
+/* A sample file: code at 0x0100, data flash at its start */
+static void sample(char *text)
+{
+    strcpy(text, "S00600004844521B\n");
+    srec_add(text, 0x0100, bytes, 16);
+    srec_add(text, DATA_OFFSET, bytes, 8);
+    strcat(text, "S9030000FC\n");
+}
+
+static void test_srec_good(void)
+{
+    char text[1024];
+    sample(text);
+    CHECK(SREC_NO_ERROR == parse(text));
+    CHECK(0 == memcmp(code + 0x0100, bytes, 16));
+    CHECK(0xFF == code[0x00FF] && 0xFF == code[0x0110]);
+    CHECK(0 == memcmp(data, bytes, 8));
+    CHECK(0xFF == data[8]);
+
+    // The same file into a sparse image
+    image_t img;
+    image_init(&img);
+    CHECK(SREC_NO_ERROR == srec_parse_image(&test_log, text, strlen(text), CODE_LEN, DATA_LEN, &img));
+    unsigned char buf[16];
+    CHECK(0 == memcmp(image_data(&img, 0x0100, 16, buf), bytes, 16));
+    CHECK(0 == memcmp(image_data(&img, DATA_OFFSET, 8, buf), bytes, 8));
+    CHECK(image_used(&img, 0x0100, IMAGE_BLOCK_SIZE));
+    CHECK(!image_used(&img, 0x0000, IMAGE_BLOCK_SIZE));
+    CHECK(!image_used(&img, 0x0200, IMAGE_BLOCK_SIZE));
+    image_free(&img);
+
+    // CR LF line breaks and a last line without a break
+    strcpy(text, "");
+    srec_add(text, 0x0000, bytes, 4);
+    text[strlen(text) - 1] = '\0';
+    CHECK(SREC_NO_ERROR == parse(text));
+    CHECK(0 == memcmp(code, bytes, 4));
+}
+
+static void test_srec_checksum(void)
+{
+    char text[1024];
+    sample(text);
+    // Last digit of the checksum of the second line
+    char *p = strchr(strchr(text, '\n') + 1, '\n') - 1;
+    *p = '0' == *p ? '1' : '0';
+    CHECK(SREC_CHECKSUM_ERROR == parse(text));
+    CHECK(test_logged("Checksum error in line 2"));
+}
+
+static void test_srec_truncated(void)
+{
+    char text[1024];
+    sample(text);
+    // The file ends in the middle of the data flash record
+    text[strstr(text, "S2") - text + 20] = '\0';
+    CHECK(SREC_FORMAT_ERROR == parse(text));
+    CHECK(test_logged("line 3"));
+    strcpy(text, "S1");
+    CHECK(SREC_FORMAT_ERROR == parse(text));
+    strcpy(text, "S113010000112233445566778899AABBCCDDEEFZ52\n");
+    CHECK(SREC_FORMAT_ERROR == parse(text));
+}
+
+static void test_srec_overlap(void)
+{
+    char text[1024] = "";
+    srec_add(text, 0x0100, bytes, 16);
+    srec_add(text, 0x0108, bytes + 8, 8);
+    CHECK(SREC_NO_ERROR == parse(text));
+    CHECK(0 == memcmp(code + 0x0100, bytes, 16));
+    strcpy(text, "");
+    srec_add(text, 0x0100, bytes, 16);
+    srec_add(text, 0x0200, bytes, 16);
+    srec_add(text, 0x0108, bytes, 8);
+    CHECK(SREC_OVERLAP_ERROR == parse(text));
+    CHECK(test_logged("lines 1 and 3 overlap"));
+}
+
+static void test_srec_range(void)
+{
+    char text[1024] = "";
+    srec_add(text, CODE_LEN - 8, bytes, 16);
+    CHECK(SREC_MEMORY_ERROR == parse(text));
+    strcpy(text, "");
+    srec_add(text, DATA_OFFSET + DATA_LEN, bytes, 1);
+    CHECK(SREC_MEMORY_ERROR == parse(text));
+}
+
+static void test_ihex(void)
+{
+    static const unsigned char flash_data[2] = { 0x00, 0x0F };
+    char text[1024] = "";
+    ihex_add(text, 0x00, 0x0100, bytes, 16);
+    ihex_add(text, 0x04, 0x0000, flash_data, 2);
+    ihex_add(text, 0x00, 0x1000, bytes, 8);
+    ihex_add(text, 0x01, 0x0000, NULL, 0);
+    CHECK(SREC_NO_ERROR == parse(text));
+    CHECK(0 == memcmp(code + 0x0100, bytes, 16));
+    CHECK(0 == memcmp(data, bytes, 8));
+
+    // Bad checksum of the data flash record
+    char *p = strchr(strchr(strchr(text, '\n') + 1, '\n') + 1, '\n') - 1;
+    *p = '0' == *p ? '1' : '0';
+    CHECK(SREC_CHECKSUM_ERROR == parse(text));
+    CHECK(test_logged("line 3"));
+
+    strcpy(text, ":1001000000112233");
+    CHECK(SREC_FORMAT_ERROR == parse(text));
+    strcpy(text, "");
+    ihex_add(text, 0x07, 0x0000, bytes, 1);
+    CHECK(SREC_FORMAT_ERROR == parse(text));
+}
+
+/* ELF file with two loadable segments and one without contents in the file */
+static size_t elf_make(unsigned char *elf, unsigned int machine)
+{
+    static const unsigned int phdr[3][8] =
+    {
+        // type, offset, vaddr, paddr, filesz, memsz, flags, align
+        { 1, 148, 0x0100, 0x0100, 16, 16, 5, 1 },
+        { 1, 164, 0xFE000, DATA_OFFSET, 8, 8, 6, 1 },
+        { 1, 0, 0xFEF00, 0xFEF00, 0, 64, 6, 1 },
+    };
+    memset(elf, 0, 172);
+    memcpy(elf, "\x7F" "ELF\x01\x01\x01", 7);
+    elf[16] = 2;                // Executable
+    elf[18] = machine;
+    elf[20] = 1;                // Version
+    elf[28] = 52;               // Program headers
+    elf[40] = 52;               // Header size
+    elf[42] = 32;
+    elf[44] = 3;
+    unsigned int i;
+    unsigned int j;
+    for (i = 0; i < 3; ++i)
+    {
+        for (j = 0; j < 8; ++j)
+        {
+            const unsigned int v = phdr[i][j];
+            unsigned char *p = elf + 52 + i * 32 + j * 4;
+            p[0] = v & 0xFF;
+            p[1] = (v >> 8) & 0xFF;
+            p[2] = (v >> 16) & 0xFF;
+            p[3] = v >> 24;
+        }
+    }
+    memcpy(elf + 148, bytes, 16);
+    memcpy(elf + 164, bytes, 8);
+    return 172;
+}
+
+static int parse_input(int format, unsigned int address, const void *file, size_t size)
+{
+    memset(code, 0xFF, sizeof code);
+    memset(data, 0xFF, sizeof data);
+    test_clear();
+    return input_parse(&test_log, format, address, file, size, code, CODE_LEN, data, DATA_LEN);
+}
+
+static void test_elf(void)
+{
+    unsigned char elf[172];
+    const size_t size = elf_make(elf, 197);
+    CHECK(INPUT_ELF == input_detect((const char*)elf, size));
+    CHECK(SREC_NO_ERROR == parse_input(INPUT_ELF, 0, elf, size));
+    CHECK(0 == memcmp(code + 0x0100, bytes, 16));
+    CHECK(0 == memcmp(data, bytes, 8));
+    CHECK(0xFF == data[8]);
+    // Contents of a segment past the end of the file
+    CHECK(SREC_FORMAT_ERROR == parse_input(INPUT_ELF, 0, elf, size - 1));
+    CHECK(test_logged("damaged"));
+    CHECK(SREC_FORMAT_ERROR == parse_input(INPUT_ELF, 0, elf, 40));
+    elf_make(elf, 40);
+    CHECK(SREC_FORMAT_ERROR == parse_input(INPUT_ELF, 0, elf, size));
+    CHECK(test_logged("not built for RL78"));
+}
+
+/* Set a field of a program header made by elf_make() */
+static void elf_phdr(unsigned char *elf, unsigned int segment, unsigned int field, unsigned int v)
+{
+    unsigned char *p = elf + 52 + segment * 32 + field * 4;
+    p[0] = v & 0xFF;
+    p[1] = (v >> 8) & 0xFF;
+    p[2] = (v >> 16) & 0xFF;
+    p[3] = v >> 24;
+}
+
+static void test_elf_overlap(void)
+{
+    // A segment inside another one is compared with it, not only with its neighbour
+    unsigned char elf[172];
+    const size_t size = elf_make(elf, 197);
+    elf_phdr(elf, 1, 1, 150);
+    elf_phdr(elf, 1, 3, 0x0102);
+    elf_phdr(elf, 1, 4, 2);
+    elf_phdr(elf, 2, 1, 156);
+    elf_phdr(elf, 2, 3, 0x0108);
+    elf_phdr(elf, 2, 4, 4);
+    CHECK(SREC_NO_ERROR == parse_input(INPUT_ELF, 0, elf, size));
+    CHECK(0 == memcmp(code + 0x0100, bytes, 16));
+    elf_phdr(elf, 2, 1, 148);
+    CHECK(SREC_OVERLAP_ERROR == parse_input(INPUT_ELF, 0, elf, size));
+    CHECK(test_logged("Segments at 000100 and 000108 overlap"));
+}
+
+static void test_binary(void)
+{
+    char name[] = "dump.bin@0x0F0FF0";
+    unsigned int address = 0;
+    CHECK(input_split_address(name, &address));
+    CHECK(0 == strcmp(name, "dump.bin") && 0x0F0FF0 == address);
+    char plain[] = "file.mot";
+    CHECK(!input_split_address(plain, &address));
+    int offset = 0;
+    char moved[] = "app.mot@-0x100";
+    CHECK(!input_split_address(moved, &address));
+    CHECK(input_split_offset(moved, &offset));
+    CHECK(0 == strcmp(moved, "app.mot") && -0x100 == offset);
+    char up[] = "app.elf@+4096";
+    CHECK(input_split_offset(up, &offset) && 4096 == offset);
+    CHECK(!input_split_offset(plain, &offset));
+    char raw[] = "dump.bin@0x100";
+    CHECK(!input_split_offset(raw, &offset));
+
+    // A dump running from code flash into data flash is split there
+    unsigned char dump[32];
+    memcpy(dump, bytes, 16);
+    memcpy(dump + 16, bytes, 16);
+    image_t img;
+    image_init(&img);
+    CHECK(SREC_NO_ERROR == input_parse_image(&test_log, INPUT_BINARY, DATA_OFFSET - 16, (const char*)dump, sizeof dump,
+                                             DATA_OFFSET - CODE_OFFSET, DATA_LEN, &img));
+    unsigned char buf[32];
+    CHECK(0 == memcmp(image_data(&img, DATA_OFFSET - 16, 32, buf), dump, 32));
+    image_free(&img);
+    image_init(&img);
+    CHECK(SREC_MEMORY_ERROR == parse_input(INPUT_BINARY, CODE_LEN - 16, dump, sizeof dump));
+    CHECK(SREC_NO_ERROR == input_parse_image(&test_log, INPUT_BINARY, 0x0200, (const char*)dump, sizeof dump,
+                                             CODE_LEN, DATA_LEN, &img));
+    CHECK(0 == memcmp(image_data(&img, 0x0200, 32, buf), dump, 32));
+    image_free(&img);
+}
+
+/* Files big enough to be parsed by several workers give the same result */
+static void test_parallel(void)
+{
+    const unsigned int passes = 4;
+    const unsigned int records = CODE_LEN / 16;
+    char *text = malloc(passes * records * 48 + 64);
+    CHECK(NULL != text);
+    if (NULL == text)
+    {
+        return;
+    }
+    text[0] = '\0';
+    size_t len = 0;
+    size_t last = 0;
+    unsigned int pass;
+    unsigned int i;
+    // The same data is written again by every pass, the records overlap across workers
+    for (pass = 0; pass < passes; ++pass)
+    {
+        for (i = 0; i < records; ++i)
+        {
+            unsigned char record[16];
+            unsigned int j;
+            for (j = 0; j < 16; ++j)
+            {
+                record[j] = (i * 16 + j) * 7 + (i >> 4);
+            }
+            last = len;
+            srec_add(text + len, 0x10000 + i * 16, record, 16);
+            len += strlen(text + len);
+        }
+    }
+    unsigned char *big = malloc(0x10000 + CODE_LEN);
+    CHECK(NULL != big);
+    if (NULL != big)
+    {
+        memset(big, 0xFF, 0x10000 + CODE_LEN);
+        CHECK(SREC_NO_ERROR == srec_parse(&test_log, text, len, big, 0x10000 + CODE_LEN, NULL, 0));
+        for (i = 0; i < CODE_LEN; ++i)
+        {
+            if (big[0x10000 + i] != (unsigned char)(i * 7 + (i >> 8)))
+            {
+                break;
+            }
+        }
+        CHECK(CODE_LEN == i);
+        // The last record of the file differs from the first pass
+        unsigned char record[16];
+        memset(record, 0x5A, sizeof record);
+        text[last] = '\0';
+        srec_add(text + last, 0x10000 + CODE_LEN - 16, record, 16);
+        test_clear();
+        CHECK(SREC_OVERLAP_ERROR == srec_parse(&test_log, text, len, big, 0x10000 + CODE_LEN, NULL, 0));
+        free(big);
+    }
+    free(text);
+}
+
+/* Records of workers write disjoint ranges of a large file */
+static void test_parallel_disjoint(void)
+{
+    const unsigned int size = 768U * 1024U;
+    const unsigned int records = size / 32;
+    char *text = malloc(records * 80 + 64);
+    unsigned char *big = malloc(size);
+    CHECK(NULL != text && NULL != big);
+    if (NULL != text && NULL != big)
+    {
+        size_t len = 0;
+        unsigned int i;
+        // Backwards, so the first chunks fill the end of the buffer
+        for (i = 0; i < records; ++i)
+        {
+            const unsigned int address = size - (i + 1) * 32;
+            unsigned char record[32];
+            unsigned int j;
+            for (j = 0; j < 32; ++j)
+            {
+                record[j] = (address + j) * 5 + (address >> 10);
+            }
+            text[len] = '\0';
+            srec_add(text + len, address, record, 32);
+            len += strlen(text + len);
+        }
+        memset(big, 0xFF, size);
+        CHECK(SREC_NO_ERROR == srec_parse(&test_log, text, len, big, size, NULL, 0));
+        for (i = 0; i < size; ++i)
+        {
+            if (big[i] != (unsigned char)(i * 5 + ((i & ~31U) >> 10)))
+            {
+                break;
+            }
+        }
+        CHECK(size == i);
+    }
+    free(big);
+    free(text);
+}
+
+int main(void)
+{
+    test_srec_good();
+    test_srec_checksum();
+    test_srec_truncated();
+    test_srec_overlap();
+    test_srec_range();
+    test_ihex();
+    test_elf();
+    test_elf_overlap();
+    test_binary();
+    test_parallel();
+    test_parallel_disjoint();
+    return test_result("test_input");
+}
@@ -0,0 +1,150 @@
+/*********************************************************************************************************************
+ * The MIT License (MIT)                                                                                             *
+ * Copyright (c) 2026 rl78flash contributors                                                                         *
+ *                                                                                                                   *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated      *
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation   *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and  *
+ * to permit persons to whom the Software is furnished to do so, subject to the following conditions:                *
+ *                                                                                                                   *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions     *
+ * of the Software.                                                                                                  *
+ *                                                                                                                   *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO  *
+ * THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF         *
+ * CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+ * IN THE SOFTWARE.                                                                                                  *
+ *********************************************************************************************************************/
+
+#include "test.h"
+#include "patch.h"
+#include <stdlib.h>
+
+static char dir[64];
+
+static void path_of(char *path, size_t size, const char *name)
+{
+    snprintf(path, size, "%s/%s", dir, name);
+}
+
+static void write_file(const char *path, const char *text)
+{
+    FILE *file = fopen(path, "w");
+    CHECK(NULL != file);
+    if (NULL != file)
+    {
+        fputs(text, file);
+        fclose(file);
+    }
+}
+
+static void test_parse(void)
+{
+    char spec[128];
+    patch_t p;
+    strcpy(spec, "0x100:4:hex:01-02:0a:FF");
+    CHECK(0 == patch_parse(spec, &p));
+    CHECK(0x100 == p.address && 4 == p.size && PATCH_HEX == p.source);
+    CHECK(0 == memcmp(p.value, "\x01\x02\x0A\xFF", 4));
+    strcpy(spec, "256:2:counter:serial.txt");
+    CHECK(0 == patch_parse(spec, &p));
+    CHECK(256 == p.address && PATCH_COUNTER == p.source && 0 == strcmp(p.file, "serial.txt"));
+    strcpy(spec, "0x200:6:csv:c:\\keys.csv:3");
+    CHECK(0 == patch_parse(spec, &p));
+    CHECK(PATCH_CSV == p.source && 3 == p.column && 0 == strcmp(p.file, "c:\\keys.csv"));
+    strcpy(spec, "0x300:16:stdin");
+    CHECK(0 == patch_parse(spec, &p));
+    CHECK(PATCH_STDIN == p.source && 16 == p.size);
+
+    static const char *const bad[] =
+    {
+        "", "0x100", "0x100:4", "0x100:0:hex:", "0x100:65:stdin", "0x100:2:hex:123", "0x100:2:hex:12345",
+        "0x100:2:hex:12xz", "0x100:9:counter:n", "0x100:2:counter:", "0x100:2:csv:keys.csv", "0x100:2:csv:f:0",
+        "0x100:2:csv::1", "0x100:2:file:x",
+    };
+    unsigned int i;
+    for (i = 0; i < sizeof bad / sizeof bad[0]; ++i)
+    {
+        strcpy(spec, bad[i]);
+        if (0 == patch_parse(spec, &p))
+        {
+            fprintf(stderr, "accepted \"%s\"\n", bad[i]);
+            CHECK(0);
+        }
+    }
+}
+
+static void test_counter(void)
+{
+    char counter[128];
+    char spec[256];
+    char text[64];
+    patch_t patch[2];
+    unsigned char a[3 * 2];
+    unsigned char b[3 * 4];
+    unsigned char *values[] = { a, b };
+    path_of(counter, sizeof counter, "counter");
+    snprintf(spec, sizeof spec, "0x100:2:counter:%s", counter);
+    CHECK(0 == patch_parse(spec, &patch[0]));
+    snprintf(spec, sizeof spec, "0x200:4:counter:%s", counter);
+    CHECK(0 == patch_parse(spec, &patch[1]));
+    write_file(counter, "0x1FF\n");
+    CHECK(0 == patch_values(&test_log, patch, 2, 3, values));
+    CHECK(0 == memcmp(a, "\xFF\x01\x00\x02\x01\x02", sizeof a));
+    CHECK(0 == memcmp(b, "\xFF\x01\x00\x00\x00\x02\x00\x00\x01\x02\x00\x00", sizeof b));
+    // Both patches name the same file, the number is moved on once
+    FILE *file = fopen(counter, "r");
+    CHECK(NULL != file && NULL != fgets(text, sizeof text, file));
+    CHECK(0 == strcmp(text, "514\n"));
+    if (NULL != file)
+    {
+        fclose(file);
+    }
+    // The last unit gets 0x10000, which does not fit into 2 bytes
+    write_file(counter, "65534\n");
+    test_clear();
+    CHECK(0 != patch_values(&test_log, patch, 1, 3, values));
+    CHECK(test_logged("Counter 65536"));
+}
+
+static void test_csv(void)
+{
+    char csv[128];
+    char next[160];
+    char spec[256];
+    patch_t p;
+    unsigned char a[2 * 3];
+    unsigned char *values[] = { a };
+    path_of(csv, sizeof csv, "keys.csv");
+    snprintf(next, sizeof next, "%s.next", csv);
+    write_file(csv, "1,00:11:22\n\n2,33-44-55\r\n3,zz\n");
+    snprintf(spec, sizeof spec, "0:3:csv:%s:2", csv);
+    CHECK(0 == patch_parse(spec, &p));
+    CHECK(0 == patch_values(&test_log, &p, 1, 2, values));
+    CHECK(0 == memcmp(a, "\x00\x11\x22\x33\x44\x55", sizeof a));
+    test_clear();
+    CHECK(0 != patch_values(&test_log, &p, 1, 1, values));
+    CHECK(test_logged("Column 2 of row 3"));
+    write_file(next, "4\n");
+    test_clear();
+    CHECK(0 != patch_values(&test_log, &p, 1, 1, values));
+    CHECK(test_logged("has no row 4"));
+}
+
+int main(void)
+{
+    strcpy(dir, "/tmp/test_patch.XXXXXX");
+    if (NULL == mkdtemp(dir))
+    {
+        perror("mkdtemp");
+        return 1;
+    }
+    test_parse();
+    test_counter();
+    test_csv();
+    char command[128];
+    snprintf(command, sizeof command, "rm -rf %s", dir);
+    (void)system(command);
+    return test_result("test_patch");
+}
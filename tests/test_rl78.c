@@ -0,0 +1,277 @@
+/*********************************************************************************************************************
+ * The MIT License (MIT)                                                                                             *
+ * Copyright (c) 2026 rl78flash contributors                                                                         *
+ *                                                                                                                   *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated      *
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation   *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and  *
+ * to permit persons to whom the Software is furnished to do so, subject to the following conditions:                *
+ *                                                                                                                   *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions     *
+ * of the Software.                                                                                                  *
+ *                                                                                                                   *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO  *
+ * THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF         *
+ * CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+ * IN THE SOFTWARE.                                                                                                  *
+ *********************************************************************************************************************/
+
+#include "test.h"
+#include "fake_rl78.h"
+#include "rl78.h"
+#include <stdlib.h>
+#include <unistd.h>
+
+#define BLOCKS      8U
+#define SIZE        (BLOCKS * FAKE_BLOCK_SIZE)
+
+static fake_rl78_t fake;
+static rl78_session_t session;
+static unsigned char contents[SIZE];
+
+/* Image of the first blocks of code flash */
+static void make_image(image_t *img, const unsigned char *data, unsigned int size)
+{
+    image_init(img);
+    image_reserve(img, 0, size);
+    image_alloc(img);
+    memcpy(image_ptr(img, 0, size), data, size);
+    image_seal(img);
+}
+
+/* The fake is set up by the caller after fake_rl78_init() */
+static int device_open(int flags)
+{
+    test_clear();
+    if (0 != fake_rl78_start(&fake)
+        || 0 != rl78_session_open(&session, fake.path, MODE_UART_2, &test_log))
+    {
+        fprintf(stderr, "Unable to start the fake device\n");
+        exit(1);
+    }
+    rl78_set_protocol(&session, PROTOCOL_VERSION_A);
+    session.code_block_size = FAKE_BLOCK_SIZE;
+    session.data_block_size = FAKE_BLOCK_SIZE;
+    session.flags = flags;
+    return 0;
+}
+
+static void device_close(void)
+{
+    rl78_session_close(&session);
+    fake_rl78_stop(&fake);
+}
+
+/* A block whose checksum mismatches while its data matches does not make the
+ * blocks after it suspects */
+static void test_verify_checksum_fault(void)
+{
+    image_t img;
+    make_image(&img, contents, SIZE);
+    fake_rl78_init(&fake);
+    memcpy(fake.code, contents, SIZE);
+    fake.checksum_fault = 0x0010;
+    device_open(RL78_FLAG_VERIFY_CHECKSUM | RL78_FLAG_VERIFY_DATA);
+    CHECK(0 == rl78_verify(&session, &img, 0, SIZE));
+    device_close();
+    CHECK(1 == fake_rl78_count(&fake, CMD_VERIFY, -1));
+    CHECK(1 == fake_rl78_count(&fake, CMD_VERIFY, 0x0000));
+    CHECK(test_logged("but data does (000000)"));
+    CHECK(!test_logged("(000400)"));
+
+    // A real mismatch after it is still found
+    fake_rl78_init(&fake);
+    memcpy(fake.code, contents, SIZE);
+    fake.code[0x0C10] ^= 0x80;
+    fake.checksum_fault = 0x0010;
+    device_open(RL78_FLAG_VERIFY_CHECKSUM | RL78_FLAG_VERIFY_DATA);
+    CHECK(1 == rl78_verify(&session, &img, 0, SIZE));
+    device_close();
+    CHECK(test_logged("Block content does not match (000C00)"));
+    CHECK(!test_logged("(000400)"));
+    image_free(&img);
+}
+
+/* Bisection stops at the first mismatching block */
+static void test_verify_checksum(void)
+{
+    image_t img;
+    make_image(&img, contents, SIZE);
+    fake_rl78_init(&fake);
+    memcpy(fake.code, contents, SIZE);
+    device_open(RL78_FLAG_VERIFY_CHECKSUM);
+    CHECK(0 == rl78_verify(&session, &img, 0, SIZE));
+    device_close();
+    CHECK(1 == fake_rl78_count(&fake, CMD_CHECKSUM, -1));
+
+    fake_rl78_init(&fake);
+    memcpy(fake.code, contents, SIZE);
+    fake.code[0x1400] ^= 0x80;
+    fake.code[0x1C00] ^= 0x80;
+    device_open(RL78_FLAG_VERIFY_CHECKSUM);
+    CHECK(1 == rl78_verify(&session, &img, 0, SIZE));
+    device_close();
+    CHECK(test_logged("Block content does not match (001400)"));
+    CHECK(0 == fake_rl78_count(&fake, CMD_VERIFY, -1));
+    image_free(&img);
+}
+
+/* Update mode writes the blocks whose checksums differ. With data verify it
+ * also finds the blocks which differ in spite of their checksums. */
+static void test_program_delta(void)
+{
+    unsigned char expect[SIZE];
+    image_t img;
+    // Image has no data in the last two blocks
+    memcpy(expect, contents, SIZE);
+    memset(expect + 6 * FAKE_BLOCK_SIZE, 0xFF, 2 * FAKE_BLOCK_SIZE);
+    make_image(&img, contents, 6 * FAKE_BLOCK_SIZE);
+    fake_rl78_init(&fake);
+    memcpy(fake.code, expect, SIZE);
+    fake.code[0x0400] ^= 0x80;
+    fake.code[0x0FFF] ^= 0x01;
+    // Swapped bytes keep the checksum
+    fake.code[0x1400] = contents[0x1401];
+    fake.code[0x1401] = contents[0x1400];
+    fake.code[0x1C00] = 0x00;
+    unsigned char before[SIZE];
+    memcpy(before, fake.code, SIZE);
+    device_open(RL78_FLAG_DELTA);
+    CHECK(0 == rl78_program(&session, &img, 0, SIZE));
+    device_close();
+    CHECK(0 == fake_rl78_count(&fake, CMD_VERIFY, -1));
+    CHECK(3 == fake_rl78_count(&fake, CMD_BLOCK_ERASE, -1));
+    CHECK(0 == fake_rl78_count(&fake, CMD_BLOCK_ERASE, 0x1400));
+    CHECK(0 == memcmp(fake.code + 0x1400, before + 0x1400, FAKE_BLOCK_SIZE));
+
+    fake_rl78_init(&fake);
+    memcpy(fake.code, before, SIZE);
+    device_open(RL78_FLAG_DELTA | RL78_FLAG_VERIFY_DATA);
+    CHECK(0 == rl78_program(&session, &img, 0, SIZE));
+    device_close();
+    CHECK(0 == memcmp(fake.code, expect, SIZE));
+    CHECK(4 == fake_rl78_count(&fake, CMD_BLOCK_ERASE, -1));
+    CHECK(1 == fake_rl78_count(&fake, CMD_BLOCK_ERASE, 0x0400));
+    CHECK(1 == fake_rl78_count(&fake, CMD_BLOCK_ERASE, 0x0C00));
+    CHECK(1 == fake_rl78_count(&fake, CMD_BLOCK_ERASE, 0x1400));
+    CHECK(1 == fake_rl78_count(&fake, CMD_BLOCK_ERASE, 0x1C00));
+    CHECK(3 == fake_rl78_count(&fake, CMD_PROGRAMMING, -1));
+
+    // Nothing to do on a device which is up to date
+    fake_rl78_init(&fake);
+    memcpy(fake.code, expect, SIZE);
+    device_open(RL78_FLAG_DELTA);
+    CHECK(0 == rl78_program(&session, &img, 0, SIZE));
+    device_close();
+    CHECK(0 == fake_rl78_count(&fake, CMD_BLOCK_ERASE, -1));
+    CHECK(0 == fake_rl78_count(&fake, CMD_PROGRAMMING, -1));
+    image_free(&img);
+}
+
+/* Blocks with data are programmed on blank flash */
+static void test_program(void)
+{
+    image_t img;
+    make_image(&img, contents, 3 * FAKE_BLOCK_SIZE);
+    fake_rl78_init(&fake);
+    device_open(RL78_FLAG_MERGE_BLOCKS);
+    CHECK(0 == rl78_program(&session, &img, 0, SIZE));
+    device_close();
+    CHECK(0 == memcmp(fake.code, contents, 3 * FAKE_BLOCK_SIZE));
+    CHECK(0xFF == fake.code[3 * FAKE_BLOCK_SIZE]);
+    CHECK(1 == fake_rl78_count(&fake, CMD_PROGRAMMING, -1));
+    image_free(&img);
+}
+
+/* Stream of the contents, every block is final */
+static void make_stream(image_stream_t *st)
+{
+    unsigned int address;
+    image_stream_init(st);
+    for (address = 0; address < SIZE; address += 256)
+    {
+        CHECK(0 == image_stream_write(st, address, contents + address, 256));
+    }
+}
+
+/* Writer which finds an error after the blocks have been taken */
+static THREAD_FUNC(stream_fail, arg)
+{
+    usleep(100000);
+    image_stream_finish((image_stream_t*)arg, -1);
+    return 0;
+}
+
+/* Blank blocks are written while streaming, others only once the file is valid */
+static void test_program_stream(void)
+{
+    image_stream_t st;
+    thread_t writer;
+    make_stream(&st);
+    image_stream_finish(&st, 0);
+    fake_rl78_init(&fake);
+    fake.code[0x0A00] = 0x00;
+    device_open(0);
+    CHECK(0 == rl78_program_stream(&session, &st, 0, SIZE));
+    device_close();
+    CHECK(0 == memcmp(fake.code, contents, SIZE));
+    CHECK(1 == fake_rl78_count(&fake, CMD_BLOCK_ERASE, -1));
+    CHECK(1 == fake_rl78_count(&fake, CMD_BLOCK_ERASE, 0x0800));
+    CHECK(BLOCKS == fake_rl78_count(&fake, CMD_PROGRAMMING, -1));
+    image_stream_destroy(&st);
+
+    // Blocks written from a file which turns out to be bad are erased again,
+    // the others are left alone
+    make_stream(&st);
+    fake_rl78_init(&fake);
+    fake.code[0x0A00] = 0x00;
+    device_open(0);
+    CHECK(0 == thread_create(&writer, stream_fail, &st));
+    CHECK(0 != rl78_program_stream(&session, &st, 0, SIZE));
+    thread_join(&writer);
+    device_close();
+    CHECK(BLOCKS - 1 == fake_rl78_count(&fake, CMD_PROGRAMMING, -1));
+    CHECK(BLOCKS - 1 == fake_rl78_count(&fake, CMD_BLOCK_ERASE, -1));
+    CHECK(0 == fake_rl78_count(&fake, CMD_BLOCK_ERASE, 0x0800));
+    CHECK(0x00 == fake.code[0x0A00]);
+    CHECK(0xFF == fake.code[0x0000] && 0xFF == fake.code[SIZE - 1]);
+    image_stream_destroy(&st);
+}
+
+/* Data outside of the flash of the device fails the stream */
+static void test_stream_limit(void)
+{
+    static const unsigned int range[2][2] = { { 0x0000, 0x2000 }, { 0x4000, 0x4400 } };
+    image_stream_t st;
+    image_stream_init(&st);
+    CHECK(0 == image_stream_write(&st, 0x3000, contents, 16));
+    CHECK(0 != image_stream_limit(&st, range, 2));
+    image_stream_destroy(&st);
+
+    image_stream_init(&st);
+    CHECK(0 == image_stream_write(&st, 0x1000, contents, 16));
+    CHECK(0 == image_stream_limit(&st, range, 2));
+    CHECK(0 == image_stream_write(&st, 0x1FF0, contents, 16));
+    CHECK(0 == image_stream_write(&st, 0x4000, contents, 16));
+    CHECK(IMAGE_STREAM_RANGE_ERROR == image_stream_write(&st, 0x1FF8, contents, 16));
+    CHECK(IMAGE_STREAM_RANGE_ERROR == image_stream_write(&st, 0x2000, contents, 16));
+    CHECK(IMAGE_STREAM_RANGE_ERROR == image_stream_write(&st, 0x43F8, contents, 16));
+    image_stream_destroy(&st);
+}
+
+int main(void)
+{
+    unsigned int i;
+    for (i = 0; i < SIZE; ++i)
+    {
+        contents[i] = i * 13 + (i >> 8);
+    }
+    test_verify_checksum();
+    test_verify_checksum_fault();
+    test_program();
+    test_program_delta();
+    test_program_stream();
+    test_stream_limit();
+    return test_result("test_rl78");
+}